@@ -0,0 +1,105 @@
+/**
+ * \file
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "adcsource.hh"
+#include "cpustats.hh"
+
+AdcSource *AdcSource::instance = nullptr;
+
+void AdcSource::handleInterrupt() {
+    if (!recorder || !(ADC->ADC_ISR & ADC_ISR_ENDRX))
+        return;
+
+    // The PDC has moved on to the next buffer, give it one to follow.
+    uint16_t *full = filling[0];
+    filling[0] = filling[1];
+    filling[1] = recorder->complete(full);
+
+    ADC->ADC_RNPR = (uint32_t)(uintptr_t)filling[1];
+    ADC->ADC_RNCR = Recorder::bufferSamples; // Clears ENDRX.
+}
+
+extern "C" void ADC_Handler(void) {
+    IsrTimer timer;
+
+    if (AdcSource::instance)
+        AdcSource::instance->handleInterrupt();
+}
+
+bool AdcSource::start(Recorder &recorder_, uint32_t rate) {
+    if (!rate || rate > maxRate || channel >= channelCount)
+        return false;
+
+    filling[0] = recorder_.acquire();
+    filling[1] = recorder_.acquire();
+    if (!filling[0] || !filling[1])
+        return false;
+
+    recorder = &recorder_;
+    instance = this;
+
+    pmc_enable_periph_clk(ID_ADC);
+    pmc_enable_periph_clk(ID_TC0);
+
+    // ADC clock: MCK / 4 = 21 MHz, just under the 22 MHz maximum.
+    ADC->ADC_CR   = ADC_CR_SWRST;
+    ADC->ADC_MR   = ADC_MR_TRGEN_EN | ADC_MR_TRGSEL_ADC_TRIG1 // TIOA0.
+                  | ADC_MR_PRESCAL(1) | ADC_MR_STARTUP_SUT64
+                  | ADC_MR_TRACKTIM(0) | ADC_MR_SETTLING_AST3 | ADC_MR_TRANSFER(1);
+    ADC->ADC_CHDR = 0xffff;
+    ADC->ADC_CHER = 1u << channel;
+
+    ADC->ADC_IDR  = 0xffffffff;
+    ADC->ADC_PTCR = ADC_PTCR_RXTDIS;
+    ADC->ADC_RPR  = (uint32_t)(uintptr_t)filling[0];
+    ADC->ADC_RCR  = Recorder::bufferSamples;
+    ADC->ADC_RNPR = (uint32_t)(uintptr_t)filling[1];
+    ADC->ADC_RNCR = Recorder::bufferSamples;
+    ADC->ADC_PTCR = ADC_PTCR_RXTEN;
+
+    ADC->ADC_IER = ADC_IER_ENDRX;
+    NVIC_EnableIRQ(ADC_IRQn);
+
+    // TIOA0 rises on an RC compare, starting a conversion, and falls
+    // halfway. TIMER_CLOCK1 is MCK / 2.
+    TcChannel &tc = TC0->TC_CHANNEL[0];
+    uint32_t   rc = SystemCoreClock / 2 / rate;
+
+    tc.TC_CCR = TC_CCR_CLKDIS;
+    tc.TC_CMR = TC_CMR_TCCLKS_TIMER_CLOCK1 | TC_CMR_WAVE | TC_CMR_WAVSEL_UP_RC
+              | TC_CMR_ACPA_CLEAR | TC_CMR_ACPC_SET;
+    tc.TC_RC  = rc;
+    tc.TC_RA  = rc / 2;
+    tc.TC_CCR = TC_CCR_CLKEN | TC_CCR_SWTRG;
+
+    return true;
+}
+
+void AdcSource::stop() {
+    TC0->TC_CHANNEL[0].TC_CCR = TC_CCR_CLKDIS;
+
+    NVIC_DisableIRQ(ADC_IRQn);
+    ADC->ADC_IDR  = 0xffffffff;
+    ADC->ADC_PTCR = ADC_PTCR_RXTDIS;
+    ADC->ADC_MR  &= ~ADC_MR_TRGEN_EN;
+
+    recorder = nullptr;
+    instance = nullptr;
+}
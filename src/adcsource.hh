@@ -0,0 +1,61 @@
+/**
+ * \file
+ * \brief     Timer-triggered ADC sampling into recorder buffers.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "recorder.hh"
+#include "sam.hh"
+
+/**
+ * \brief Samples one ADC channel at a fixed rate.
+ *
+ * Timer channel TC0:0 triggers the conversions, and the ADC's PDC moves
+ * the results into the recorder's buffers without CPU involvement. The PDC
+ * holds two buffers: when the first is full it continues with the second,
+ * and the interrupt handler hands the full one to the recorder and queues
+ * a fresh one behind the second. Samples are 12-bit values.
+ *
+ * On the Arduino Due, pin A0 is channel 7 and A7 is channel 0.
+ */
+class AdcSource : public SampleSource {
+
+public:
+    static const uint32_t maxRate      = 1000000;
+    static const unsigned channelCount = 16;
+
+private:
+    friend void ADC_Handler();
+
+    static AdcSource *instance;
+
+    Recorder *recorder = nullptr;
+    uint16_t *filling[2]; ///< The buffers owned by the PDC, current and next.
+    unsigned  channel;
+
+    void handleInterrupt();
+
+public:
+    bool start(Recorder &recorder_, uint32_t rate);
+    void stop();
+
+    AdcSource(unsigned channel_) : channel(channel_) { }
+    ~AdcSource() = default;
+};
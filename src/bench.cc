@@ -0,0 +1,311 @@
+/**
+ * \file
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "bench.hh"
+#include "fileops.hh"
+#include "filereader.hh"
+#include "cycles.hh"
+#include "scratch.hh"
+
+#include <cstring>
+
+using namespace MuStore;
+
+static auto &ioBuffer = scratch.bench.io;
+
+static const uint32_t ioSectors = sizeof(ioBuffer) / FatVolume::sectorSize; // 4K per operation.
+static const uint32_t fsFiles   = 8;
+
+namespace {
+
+/**
+ * \brief Collects per-operation latencies.
+ *
+ * Averages cover all operations, percentiles only the first maxSamples.
+ */
+class LatencyStats {
+
+    static const size_t maxSamples = sizeof(scratch.bench.samples) / sizeof(uint32_t);
+
+    // Shared by all instances, only one benchmark runs at a time.
+    static uint32_t (&samples)[maxSamples];
+
+    size_t   count = 0;
+    uint64_t total = 0;
+    uint32_t min   = 0xffffffff;
+
+public:
+    void add(uint32_t cycles) {
+        if (count < maxSamples)
+            samples[count] = cycles;
+        count++;
+        total += cycles;
+        if (cycles < min)
+            min = cycles;
+    }
+
+    void print(Console &con, const char *name, uint32_t bytesPerOp) {
+        if (!count) {
+            con.printf("%14s no samples\n", name);
+            return;
+        }
+
+        size_t n = count < maxSamples ? count : maxSamples;
+
+        // Insertion sort, n is small.
+        for (size_t i = 1; i < n; i++) {
+            uint32_t x = samples[i];
+            size_t   j = i;
+            for (; j && samples[j-1] > x; j--)
+                samples[j] = samples[j-1];
+            samples[j] = x;
+        }
+
+        uint32_t us     = (uint32_t)(total / (SystemCoreClock / 1000000));
+        uint32_t p99    = samples[(n * 99 + 99) / 100 - 1];
+        uint32_t iops   = us ? (uint32_t)((uint64_t)count * 1000000 / us) : 0;
+        uint32_t kbps   = us ? (uint32_t)((uint64_t)count * bytesPerOp * 1000000 / 1024 / us) : 0;
+
+        con.printf("%14s %6u IOPS %6u KB/s  lat us min %6u avg %6u p99 %6u\n",
+                   name, iops, kbps,
+                   cyclesToUs(min),
+                   cyclesToUs((uint32_t)(total / count)),
+                   cyclesToUs(p99));
+    }
+};
+
+uint32_t (&LatencyStats::samples)[LatencyStats::maxSamples] = scratch.bench.samples;
+
+}
+
+/// Xorshift PRNG, for choosing random offsets.
+static uint32_t nextRandom() {
+    static uint32_t state = 2463534242;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+void benchStore(Console &con, FatVolume &volume, uint32_t kib) {
+    const char *path = "/bench.tmp";
+
+    uint32_t ops = kib * 1024 / sizeof(ioBuffer);
+    if (!ops) {
+        con.printf("bench: scratch area too small\n");
+        return;
+    }
+
+    FatVolume::DirEntry area;
+    FatError err = createFile(volume, path, ops * (uint32_t)sizeof(ioBuffer), area);
+    if (err) {
+        con.printf("bench: could not create %s (%d)\n", path, err);
+        return;
+    }
+
+    // The tests address the store directly, so the file must be contiguous.
+    FatVolume::Cursor cursor { area.cluster, 0 };
+    uint32_t lba;
+    uint32_t count;
+    if ((err = volume.nextRun(cursor, ops * ioSectors, lba, count))
+        || count != ops * ioSectors) {
+        con.printf("bench: no contiguous free space of %u KB\n", kib);
+        removeFile(volume, path);
+        return;
+    }
+
+    BlockStore &store = volume.getStore();
+
+    for (size_t i = 0; i < sizeof(ioBuffer); i++)
+        ioBuffer[i] = (uint8_t)nextRandom();
+
+    con.printf("Store: %u KB scratch area at LBA %u\n", kib, lba);
+
+    struct {
+        const char *name;
+        bool     write;
+        bool     random;
+        uint32_t sectors;
+    } tests[] = {
+        { "seq write 4K",  true,  false, ioSectors },
+        { "seq read 4K",   false, false, ioSectors },
+        { "rand write 4K", true,  true,  ioSectors },
+        { "rand read 4K",  false, true,  ioSectors },
+        // Single blocks, mostly the SPI byte loops.
+        { "write 512",     true,  false, 1         },
+        { "read 512",      false, false, 1         },
+    };
+
+    for (auto &test : tests) {
+        LatencyStats stats;
+        bool failed = false;
+
+        for (uint32_t i = 0; i < ops; i++) {
+            uint32_t op    = test.random ? nextRandom() % ops : i;
+            uint32_t start = getCycles();
+
+            StoreError storeErr = store.seek(lba + op * ioSectors);
+            if (!storeErr)
+                storeErr = test.write ? store.writeBlocks(ioBuffer, test.sectors)
+                                      : store.readBlocks (ioBuffer, test.sectors);
+
+            stats.add(getCycles() - start);
+
+            if (storeErr) {
+                con.printf("%14s I/O error at LBA %u\n", test.name, lba + op * ioSectors);
+                failed = true;
+                break;
+            }
+        }
+        if (!failed)
+            stats.print(con, test.name, test.sectors * FatVolume::sectorSize);
+    }
+
+    removeFile(volume, path);
+}
+
+void benchFs(Console &con, Fs &fs, FatVolume &volume, uint32_t kib) {
+    const uint32_t chunk    = FatVolume::sectorSize;
+    const uint32_t fileSize = kib * 1024 / fsFiles / chunk * chunk;
+
+    if (!fileSize) {
+        con.printf("bench: file size too small\n");
+        return;
+    }
+
+    con.printf("Filesystem: %u files of %u bytes\n", fsFiles, fileSize);
+
+    char path[] = "/bench0.tmp";
+    char &digit = path[6];
+
+    LatencyStats createStats;
+    LatencyStats writeStats;
+    LatencyStats readStats;
+    LatencyStats removeStats;
+
+    uint32_t created = 0;
+
+    for (; created < fsFiles; created++) {
+        FatVolume::DirEntry entry;
+        digit = (char)('0' + created);
+
+        uint32_t start = getCycles();
+        FatError err   = createFile(volume, path, fileSize, entry);
+        createStats.add(getCycles() - start);
+
+        if (err) {
+            con.printf("bench: could not create %s (%d)\n", path, err);
+            break;
+        }
+    }
+
+    // The files were created through the volume, but are written and read
+    // through the Fs, which has its own view of the directories and the
+    // FAT. Hand over in both directions, as blkserve does.
+    volume.invalidate();
+
+    for (uint32_t i = 0; i < created; i++) {
+        digit = (char)('0' + i);
+
+        FsError err;
+        FsNode node = fs.get(path, err);
+        for (uint32_t done = 0; !err && done < fileSize; done += chunk) {
+            uint32_t start = getCycles();
+            node.write(ioBuffer, chunk, err);
+            writeStats.add(getCycles() - start);
+        }
+        if (err) {
+            con.printf("bench: write error in %s (%d)\n", path, err);
+            break;
+        }
+    }
+
+    for (uint32_t i = 0; i < created; i++) {
+        digit = (char)('0' + i);
+
+        FsError err;
+        FsNode node = fs.get(path, err);
+        for (uint32_t done = 0; !err && done < fileSize; done += chunk) {
+            uint32_t start = getCycles();
+            node.read(ioBuffer, chunk, err);
+            readStats.add(getCycles() - start);
+        }
+        if (err && err != FS_EOF) {
+            con.printf("bench: read error in %s (%d)\n", path, err);
+            break;
+        }
+    }
+
+    volume.forgetAll();
+
+    for (uint32_t i = 0; i < created; i++) {
+        digit = (char)('0' + i);
+
+        uint32_t start = getCycles();
+        removeFile(volume, path);
+        removeStats.add(getCycles() - start);
+    }
+
+    createStats.print(con, "create",     0);
+    writeStats .print(con, "write 512",  chunk);
+    readStats  .print(con, "read 512",   chunk);
+    removeStats.print(con, "remove",     0);
+}
+
+void benchRead(Console &con, FatVolume &volume, const char *path, Lz4Reader &reader) {
+    const uint32_t chunk = FatVolume::sectorSize;
+
+    FileReader file(reader);
+    FatError   err = file.open(volume, path);
+    if (err) {
+        con.printf("bench: could not open %s (%d)\n", path, err);
+        return;
+    }
+
+    LatencyStats stats;
+    uint32_t     bytes = 0;
+    uint32_t     start = getCycles();
+
+    while (true) {
+        uint32_t opStart = getCycles();
+        size_t   readBytes;
+        err = file.read(ioBuffer, chunk, readBytes);
+        if (err || !readBytes)
+            break;
+        stats.add(getCycles() - opStart);
+        bytes += (uint32_t)readBytes;
+    }
+
+    uint32_t us = cyclesToUs(getCycles() - start);
+
+    if (err) {
+        con.printf("bench: read error in %s (%d)\n", path, err);
+        return;
+    }
+
+    uint32_t stored = file.getStoredPosition();
+
+    con.printf("Read: %'u bytes stored, %'u bytes out in %'u us\n", stored, bytes, us);
+    if (us)
+        con.printf("%14s %6u KB/s stored %6u KB/s out\n", "sequential",
+                   (uint32_t)((uint64_t)stored * 1000000 / 1024 / us),
+                   (uint32_t)((uint64_t)bytes  * 1000000 / 1024 / us));
+    stats.print(con, "read 512", chunk);
+}
@@ -0,0 +1,55 @@
+/**
+ * \file
+ * \brief     Storage and filesystem benchmarks.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <mustore/fs.hh>
+#include "console.hh"
+#include "fatvol.hh"
+#include "lz4.hh"
+
+/**
+ * \brief Measure raw store performance.
+ *
+ * Sequential and random 4K reads and writes are done on the sectors of a
+ * freshly allocated scratch file, so no existing data is overwritten.
+ *
+ * \param kib size of the scratch area in KiB
+ */
+void benchStore(Console &con, FatVolume &volume, uint32_t kib);
+
+/**
+ * \brief Measure file creation, write and read performance through a Fs.
+ *
+ * Files are created and removed through `volume`, which drops its cached
+ * lookups and sectors around the writes and reads through `fs`.
+ *
+ * \param kib total size of the files written in KiB
+ */
+void benchFs(Console &con, MuStore::Fs &fs, FatVolume &volume, uint32_t kib);
+
+/**
+ * \brief Measure sequential read throughput of an existing file.
+ *
+ * Compressed files are decompressed with `reader`, and both the stored and the
+ * decompressed byte rates are reported.
+ */
+void benchRead(Console &con, FatVolume &volume, const char *path, Lz4Reader &reader);
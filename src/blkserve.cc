@@ -0,0 +1,136 @@
+/**
+ * \file
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "blkserve.hh"
+#include "crc.hh"
+
+using namespace MuStore;
+
+void BlkServer::reply(const uint8_t *request, uint32_t lba, uint16_t count,
+                      StoreError status, const void *payload, size_t length) {
+
+    uint8_t head[replyLength];
+    head[offOp]  = request[offOp];
+    head[offTag] = request[offTag];
+    putLe32(head + offLba,   lba);
+    putLe16(head + offCount, count);
+    head[offStatus] = (uint8_t)status;
+
+    link.send(head, sizeof(head), payload, length);
+}
+
+void BlkServer::read(const uint8_t *request, uint32_t lba, uint16_t count) {
+    StoreError err = store->seek(lba);
+
+    while (!err && count) {
+        uint16_t n = count < maxBlocks ? count : (uint16_t)maxBlocks;
+
+        if ((err = store->readBlocks(data, n)))
+            break;
+
+        reply(request, lba, n, STORE_ERR_OK, data, n * blockSize);
+        blocksRead += n;
+        lba        += n;
+        count       = (uint16_t)(count - n);
+    }
+    if (err)
+        reply(request, lba, 0, err);
+}
+
+void BlkServer::write(const uint8_t *request, uint32_t lba, uint16_t count, size_t length) {
+    if (count > maxBlocks || length != requestLength + count * blockSize) {
+        reply(request, lba, 0, STORE_ERR_IO);
+        return;
+    }
+
+    StoreError err = store->seek(lba);
+    if (!err)
+        err = store->writeBlocks(request + requestLength, count);
+    if (!err)
+        blocksWritten += count;
+
+    reply(request, lba, err ? 0 : count, err);
+}
+
+void BlkServer::crc(const uint8_t *request, uint32_t lba, uint16_t count) {
+    uint32_t   sum = 0;
+    uint16_t   n   = count;
+    StoreError err = store->seek(lba);
+
+    while (!err && n) {
+        uint16_t chunk = n < maxBlocks ? n : (uint16_t)maxBlocks;
+
+        if ((err = store->readBlocks(data, chunk)))
+            break;
+
+        sum = crc32(data, chunk * blockSize, sum);
+        n   = (uint16_t)(n - chunk);
+    }
+
+    uint8_t payload[4];
+    putLe32(payload, sum);
+
+    if (err)
+        reply(request, lba, 0, err);
+    else
+        reply(request, lba, count, STORE_ERR_OK, payload, sizeof(payload));
+}
+
+void BlkServer::run(Console &con, BlockStore &store_) {
+    store         = &store_;
+    blocksRead    = 0;
+    blocksWritten = 0;
+
+    link.attach(con);
+
+    while (true) {
+        size_t length = link.receive(idleTimeout);
+        if (!length)
+            return;
+        if (length < requestLength)
+            continue;
+
+        uint32_t lba   = getLe32(frame + offLba);
+        uint16_t count = getLe16(frame + offCount);
+
+        switch (frame[offOp]) {
+        case OP_INFO:
+            reply(frame, (uint32_t)store->getBlockCount(),
+                  (uint16_t)store->getBlockSize(), STORE_ERR_OK);
+            break;
+
+        case OP_READ:  read (frame, lba, count);         break;
+        case OP_WRITE: write(frame, lba, count, length); break;
+        case OP_CRC:   crc  (frame, lba, count);         break;
+
+        case OP_FLUSH:
+            reply(frame, 0, 0, store->flush());
+            break;
+
+        case OP_QUIT:
+            reply(frame, 0, 0, store->flush());
+            return;
+
+        default:
+            reply(frame, lba, 0, STORE_ERR_IO);
+            break;
+        }
+    }
+}
@@ -0,0 +1,106 @@
+/**
+ * \file
+ * \brief     Serial block device server.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "blockstore.hh"
+#include "framelink.hh"
+
+/**
+ * \brief Serves a block store to a host over a console.
+ *
+ * Requests and replies are FrameLink frames that start with a common
+ * header (see the offsets below):
+ *
+ *     op, tag, lba (4 bytes), count (2 bytes), status (replies only)
+ *
+ * The host picks the tag and replies repeat it, so the host can have
+ * several requests in flight. Requests are handled in order.
+ *
+ *     INFO            -> lba is the block count, count the block size
+ *     READ  lba count -> replies with up to maxBlocks blocks each
+ *     WRITE lba count, followed by up to maxBlocks blocks
+ *     CRC   lba count -> the CRC-32 of the blocks
+ *     FLUSH
+ *     QUIT            -> the server stops after replying
+ *
+ * A failed request gets a reply with an error status and no data.
+ * Damaged frames are dropped without a reply: the host repeats requests
+ * that are not answered in time, which is safe for every request.
+ *
+ * The store's block size must be blockSize.
+ */
+class BlkServer {
+
+public:
+    static const size_t   blockSize   = 512;
+    static const size_t   maxBlocks   = 4;     ///< Per frame.
+    static const uint32_t idleTimeout = 60000; ///< In ms, in case the host is gone.
+
+    enum Op : uint8_t {
+        OP_INFO  = 'I',
+        OP_READ  = 'R',
+        OP_WRITE = 'W',
+        OP_CRC   = 'C',
+        OP_FLUSH = 'F',
+        OP_QUIT  = 'Q',
+    };
+
+    // Header field offsets.
+    static const size_t offOp     = 0;
+    static const size_t offTag    = 1;
+    static const size_t offLba    = 2;
+    static const size_t offCount  = 6;
+    static const size_t offStatus = 8;
+
+    static const size_t requestLength = 8;
+    static const size_t replyLength   = 9;
+
+private:
+    uint8_t   frame[requestLength + maxBlocks * blockSize + 4];
+    uint8_t   data[maxBlocks * blockSize];
+    FrameLink link;
+
+    BlockStore *store = nullptr;
+
+    uint32_t blocksRead    = 0;
+    uint32_t blocksWritten = 0;
+
+    void reply(const uint8_t *request, uint32_t lba, uint16_t count,
+               MuStore::StoreError status,
+               const void *payload = nullptr, size_t length = 0);
+
+    void read (const uint8_t *request, uint32_t lba, uint16_t count);
+    void write(const uint8_t *request, uint32_t lba, uint16_t count, size_t length);
+    void crc  (const uint8_t *request, uint32_t lba, uint16_t count);
+
+public:
+    /// Serve requests until the host quits or goes quiet for idleTimeout.
+    void run(Console &con, BlockStore &store_);
+
+    uint32_t getBlocksRead()    const { return blocksRead; }
+    uint32_t getBlocksWritten() const { return blocksWritten; }
+
+    /// \param getTicks_ a millisecond clock
+    BlkServer(uint32_t (*getTicks_)())
+        : link(frame, sizeof(frame), getTicks_) { }
+    ~BlkServer() = default;
+};
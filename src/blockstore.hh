@@ -0,0 +1,79 @@
+/**
+ * \file
+ * \brief     Store with multi-block transfers.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <mustore/store.hh>
+
+/**
+ * \brief A Store that can transfer runs of consecutive blocks at once.
+ *
+ * The default implementations simply loop over single block transfers.
+ * Drivers that have a faster path for bulk transfers (such as the SD
+ * multiple block commands) override them.
+ */
+class BlockStore : public MuStore::Store {
+
+public:
+    /// Read `count` blocks starting at the current position.
+    virtual MuStore::StoreError readBlocks(void *buffer, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            MuStore::StoreError err = read((uint8_t*)buffer + i * blockSize);
+            if (err)
+                return err;
+        }
+        return MuStore::STORE_ERR_OK;
+    }
+
+    /// Write `count` blocks starting at the current position.
+    virtual MuStore::StoreError writeBlocks(const void *buffer, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            MuStore::StoreError err = write((const uint8_t*)buffer + i * blockSize);
+            if (err)
+                return err;
+        }
+        return MuStore::STORE_ERR_OK;
+    }
+
+    /**
+     * \brief Get a pointer to a block, for memory-mapped stores.
+     *
+     * Consecutive blocks are consecutive in memory, so a pointer to the
+     * first block of a run covers the whole run.
+     *
+     * \return nullptr if the store is not memory-mapped
+     */
+    virtual const uint8_t *getMapping(size_t lba) const {
+        (void)lba;
+        return nullptr;
+    }
+
+    /// Write back any buffered changes. Stores that do not buffer writes have nothing to do.
+    virtual MuStore::StoreError flush() {
+        return MuStore::STORE_ERR_OK;
+    }
+
+    using Store::read;
+    using Store::write;
+
+    BlockStore() = default;
+    virtual ~BlockStore() = default;
+};
@@ -250,16 +250,16 @@ int Console::printf(const char *format, ...) {
 						int32_t num;
 						num = (int32_t)va_arg(vaList, int);
 
-						length += printfDecimal(*this, num, true, &flags, width);
+						length += (int)printfDecimal(*this, num, true, &flags, width);
 
 					} else if (c == 'u' || c == 'x') {
 						uint32_t num;
 						num = (uint32_t)va_arg(vaList, unsigned int);
 
 						if (c == 'u')
-							length += printfDecimal(*this, num, false, &flags, width);
+							length += (int)printfDecimal(*this, num, false, &flags, width);
 						else if (c == 'x')
-							length += printfHex(*this, num, &flags, width);
+							length += (int)printfHex(*this, num, &flags, width);
 
 					} else if (c == 's') {
 						const char *str = (char*)va_arg(vaList, char*);
@@ -277,10 +277,10 @@ int Console::printf(const char *format, ...) {
 								for (size_t j=0; j<(width - slen); j++)
 									putch(' ');
 							}
-							length += width;
+							length += (int)width;
 						} else {
 							puts(str);
-							length += slen;
+							length += (int)slen;
 						}
 					} else if (c == 'c') {
 						char ch = (char)va_arg(vaList, int);
@@ -0,0 +1,71 @@
+/**
+ * \file
+ * \brief     Cycle accounting for idle time and interrupt handlers.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "cycles.hh"
+
+/**
+ * \brief Running totals of where the CPU's cycles go.
+ *
+ * Together with the wait counters in IoStats these divide the CPU's time:
+ * what is left is time spent running code. Like IoStats, the counters
+ * wrap around, take the difference of two snapshots.
+ */
+struct CpuStats {
+    uint32_t          idleCycles; ///< Spent sleeping while waiting for input.
+    volatile uint32_t isrCycles;  ///< Spent in interrupt handlers.
+};
+
+extern CpuStats cpuStats;
+
+/**
+ * \brief Measures the cycles spent in a section of code.
+ *
+ * Interrupt handlers that run meanwhile are left out, they count their
+ * own cycles through IsrTimer.
+ */
+class CycleTimer {
+    uint32_t start;
+    uint32_t isrStart;
+
+public:
+    uint32_t elapsed() const {
+        return getCycles() - start - (cpuStats.isrCycles - isrStart);
+    }
+
+    CycleTimer() : start(getCycles()), isrStart(cpuStats.isrCycles) { }
+    ~CycleTimer() = default;
+};
+
+/// Adds the cycles spent in the rest of an interrupt handler to CpuStats.
+class IsrTimer : public CycleTimer {
+public:
+    IsrTimer() = default;
+    ~IsrTimer() { cpuStats.isrCycles += elapsed(); }
+};
+
+/// Sleep, counting the time as idle.
+inline void idleSleep(uint32_t ms) {
+    CycleTimer timer;
+    Sleep(ms);
+    cpuStats.idleCycles += timer.elapsed();
+}
@@ -0,0 +1,33 @@
+/**
+ * \file
+ * \brief     CRC-32 checksums.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+
+/**
+ * \brief Compute the CRC-32 of a buffer (as used by zlib and Ethernet).
+ *
+ * Can be computed in parts by passing the result of the previous part as
+ * `crc`.
+ */
+uint32_t crc32(const void *data, size_t length, uint32_t crc = 0);
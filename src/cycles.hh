@@ -0,0 +1,45 @@
+/**
+ * \file
+ * \brief     DWT cycle counter access.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "sam.hh"
+
+/// Start the DWT cycle counter. Needs to be called once at startup.
+inline void enableCycleCounter() {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT       = 0;
+    DWT->CTRL        |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+/**
+ * \brief Get the current core cycle count.
+ *
+ * The counter wraps around after about 51 seconds at 84 MHz, differences
+ * between two readings are correct as long as they are shorter than that.
+ */
+inline uint32_t getCycles() {
+    return DWT->CYCCNT;
+}
+
+inline uint32_t cyclesToUs(uint32_t cycles) {
+    return cycles / (SystemCoreClock / 1000000);
+}
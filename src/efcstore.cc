@@ -0,0 +1,326 @@
+/**
+ * \file
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "efcstore.hh"
+
+#include <cstring>
+
+using namespace MuStore;
+
+static const uint8_t segmentMagic[4] = { 'P', 'C', 'L', 'G' };
+
+const uint8_t *EfcStore::record(size_t segment, size_t chunk) const {
+    return flash.getPage(segment * segmentPages + chunk * recordSize / pageSize)
+         + chunk * recordSize % pageSize;
+}
+
+bool EfcStore::program(size_t page, const void *data, bool erase) {
+    pagePrograms++;
+    return flash.programPage(page, data, erase);
+}
+
+uint16_t EfcStore::recordedSector(size_t segment, size_t slot) const {
+    // Chunk 0 is the segment's own record.
+    const uint8_t *p = record(segment, 1 + slot);
+
+    uint16_t sector = (uint16_t)(p[0] | p[1] << 8);
+    uint16_t check  = (uint16_t)(p[2] | p[3] << 8);
+
+    // Also rejects unprogrammed and partially programmed records.
+    return sector == (uint16_t)~check && sector < blockCount ? sector : none;
+}
+
+bool EfcStore::isValidSegment(size_t segment, uint32_t &sequence_) const {
+    const uint8_t *p = record(segment, 0);
+    if (memcmp(p, segmentMagic, sizeof(segmentMagic)))
+        return false;
+
+    sequence_      = p[4] | p[5] <<  8 | p[6]  << 16 | (uint32_t)p[7]  << 24;
+    uint32_t check = p[8] | p[9] <<  8 | p[10] << 16 | (uint32_t)p[11] << 24;
+
+    // Rejects a partially programmed header too.
+    return sequence_ == ~check;
+}
+
+bool EfcStore::isLive(size_t segment, size_t slot) const {
+    uint16_t sector = recordedSector(segment, slot);
+    return sector != none && map[sector] == segment * slotsPerSegment + slot;
+}
+
+StoreError EfcStore::programRecords() {
+    if (pendingFrom == headSlot)
+        return STORE_ERR_OK;
+
+    // The records may span both header pages.
+    for (size_t page = 0; page < headerPages; page++) {
+        uint8_t data[pageSize];
+        bool    any = false;
+
+        memset(data, 0xff, sizeof(data));
+
+        for (size_t slot = pendingFrom; slot < headSlot; slot++) {
+            size_t chunk = 1 + slot;
+            if (chunk * recordSize / pageSize != page)
+                continue;
+
+            uint8_t *p = data + chunk * recordSize % pageSize;
+            uint16_t check = (uint16_t)~pending[slot];
+            p[0] = (uint8_t)pending[slot];
+            p[1] = (uint8_t)(pending[slot] >> 8);
+            p[2] = (uint8_t)check;
+            p[3] = (uint8_t)(check >> 8);
+            any  = true;
+        }
+
+        if (any && !program(head * segmentPages + page, data, false))
+            return STORE_ERR_IO;
+    }
+    pendingFrom = headSlot;
+
+    return STORE_ERR_OK;
+}
+
+StoreError EfcStore::advance() {
+    StoreError err = programRecords();
+    if (err)
+        return err;
+
+    size_t next = (head + 1) % segmentCount;
+
+    // clean() normally freed this segment when the head entered the
+    // current one. This only fails when cleaning was cut short by a power
+    // failure and could not be completed on mount.
+    for (size_t slot = 0; slot < slotsPerSegment; slot++) {
+        if (isLive(next, slot))
+            return STORE_ERR_IO;
+    }
+
+    // Erase the second header page first: until the first page carries the
+    // new sequence number, its old records must not be replayed.
+    uint8_t data[pageSize];
+    memset(data, 0xff, sizeof(data));
+    if (!program(next * segmentPages + 1, data, true))
+        return STORE_ERR_IO;
+
+    uint32_t nextSequence = sequence + 1;
+    memcpy(data, segmentMagic, sizeof(segmentMagic));
+    for (size_t i = 0; i < 4; i++) {
+        data[4 + i] = (uint8_t)(nextSequence >> (i * 8));
+        data[8 + i] = (uint8_t)(~nextSequence >> (i * 8));
+    }
+    if (!program(next * segmentPages, data, true))
+        return STORE_ERR_IO;
+
+    sequence    = nextSequence;
+    head        = next;
+    headSlot    = 0;
+    pendingFrom = 0;
+
+    return clean((head + 1) % segmentCount);
+}
+
+StoreError EfcStore::clean(size_t segment) {
+    for (size_t slot = 0; slot < slotsPerSegment; slot++) {
+        if (!isLive(segment, slot))
+            continue;
+
+        const uint8_t *data[sectorPages];
+        for (size_t page = 0; page < sectorPages; page++)
+            data[page] = slotData((uint16_t)(segment * slotsPerSegment + slot), page);
+
+        StoreError err = append(recordedSector(segment, slot), data, true);
+        if (err)
+            return err;
+    }
+    return STORE_ERR_OK;
+}
+
+StoreError EfcStore::append(uint16_t sector, const uint8_t *const data[sectorPages], bool cleaning) {
+    // Other writes leave the last slot free, so a segment never holds more
+    // than slotsPerSegment - 1 live sectors. Cleaning then always finds
+    // room, even when a copy was lost to a power failure halfway.
+    size_t limit = cleaning ? slotsPerSegment : slotsPerSegment - 1;
+
+    while (headSlot >= limit) {
+        if (cleaning)
+            return STORE_ERR_IO;
+
+        StoreError err = advance();
+        if (err)
+            return err;
+    }
+
+    uint16_t slot = (uint16_t)(head * slotsPerSegment + headSlot);
+    size_t   page = head * segmentPages + headerPages + headSlot * sectorPages;
+
+    for (size_t i = 0; i < sectorPages; i++) {
+        if (!program(page + i, data[i], true))
+            return STORE_ERR_IO;
+    }
+
+    pending[headSlot++] = sector;
+    map[sector] = slot;
+
+    // Copies are recorded right away, the oldest segment can be reused
+    // only once they are.
+    return cleaning ? programRecords() : STORE_ERR_OK;
+}
+
+StoreError EfcStore::commitBuffer() {
+    if (!bufferDirty)
+        return STORE_ERR_OK;
+
+    const uint8_t *data[sectorPages];
+    for (size_t page = 0; page < sectorPages; page++)
+        data[page] = buffer + page * pageSize;
+
+    StoreError err = append((uint16_t)bufferLba, data, false);
+    if (!err)
+        bufferDirty = false;
+
+    return err;
+}
+
+StoreError EfcStore::mount() {
+    segmentCount = flash.getPageCount() / segmentPages;
+    bufferDirty  = false;
+    blockCount   = 0;
+
+    if (segmentCount <= reserveSegments)
+        return STORE_ERR_IO;
+
+    blockCount = (segmentCount - reserveSegments) * slotsPerSegment;
+    if (blockCount > maxSectors)
+        blockCount = maxSectors;
+
+    for (size_t i = 0; i < maxSectors; i++)
+        map[i] = none;
+
+    // Replay segments from oldest to newest, later copies win.
+    bool found = false;
+    while (true) {
+        size_t   next         = segmentCount;
+        uint32_t nextSequence = 0;
+
+        for (size_t segment = 0; segment < segmentCount; segment++) {
+            uint32_t s;
+            if (isValidSegment(segment, s) && (!found || s > sequence)
+                && (next == segmentCount || s < nextSequence)) {
+                next         = segment;
+                nextSequence = s;
+            }
+        }
+        if (next == segmentCount)
+            break;
+
+        for (size_t slot = 0; slot < slotsPerSegment; slot++) {
+            uint16_t sector = recordedSector(next, slot);
+            if (sector != none)
+                map[sector] = (uint16_t)(next * slotsPerSegment + slot);
+        }
+
+        head     = next;
+        sequence = nextSequence;
+        found    = true;
+    }
+
+    if (!found) {
+        // Empty flash, the first write opens segment 0.
+        head        = segmentCount - 1;
+        headSlot    = slotsPerSegment;
+        pendingFrom = headSlot;
+        sequence    = 0;
+        return STORE_ERR_OK;
+    }
+
+    // Continue after the last programmed record. Slots written without a
+    // record are garbage and may be overwritten, records cannot.
+    headSlot = 0;
+    for (size_t slot = 0; slot < slotsPerSegment; slot++) {
+        const uint8_t *p = record(head, 1 + slot);
+        if (p[0] != 0xff || p[1] != 0xff || p[2] != 0xff || p[3] != 0xff)
+            headSlot = slot + 1;
+    }
+    pendingFrom = headSlot;
+
+    // Finish cleaning the oldest segment, in case that was interrupted.
+    return clean((head + 1) % segmentCount);
+}
+
+StoreError EfcStore::seek(size_t lba) {
+    if (lba >= blockCount)
+        return STORE_ERR_OUT_OF_BOUNDS;
+    pos = lba;
+    return STORE_ERR_OK;
+}
+
+StoreError EfcStore::read(void *data) {
+    if (pos >= blockCount)
+        return STORE_ERR_OUT_OF_BOUNDS;
+
+    uint8_t *out = (uint8_t*)data;
+
+    if (bufferDirty && bufferLba == pos) {
+        memcpy(out, buffer, sectorSize);
+    } else if (map[pos] == none) {
+        memset(out, 0, sectorSize);
+    } else {
+        for (size_t page = 0; page < sectorPages; page++)
+            memcpy(out + page * pageSize, slotData(map[pos], page), pageSize);
+    }
+    pos++;
+
+    return STORE_ERR_OK;
+}
+
+StoreError EfcStore::write(const void *data) {
+    if (pos >= blockCount)
+        return STORE_ERR_OUT_OF_BOUNDS;
+
+    // Rewrites of the same sector, as for FAT and directory updates,
+    // only touch the buffer.
+    if (bufferDirty && bufferLba != pos) {
+        StoreError err = commitBuffer();
+        if (err)
+            return err;
+    }
+
+    memcpy(buffer, data, sectorSize);
+    bufferLba   = (uint32_t)pos;
+    bufferDirty = true;
+    sectorWrites++;
+    pos++;
+
+    return STORE_ERR_OK;
+}
+
+StoreError EfcStore::flush() {
+    StoreError err = commitBuffer();
+    if (!err)
+        err = programRecords();
+    return err;
+}
+
+EfcStore::EfcStore(FlashPages &flash_)
+    : flash(flash_) {
+
+    blockSize  = sectorSize;
+    blockCount = 0;
+}
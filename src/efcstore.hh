@@ -0,0 +1,180 @@
+/**
+ * \file
+ * \brief     Log-structured block store on internal flash pages.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "blockstore.hh"
+
+/**
+ * \brief Page-level access to a region of flash memory.
+ *
+ * Implemented by Efc for the SAM3X internal flash, and by an emulation in
+ * the efcsim host tool.
+ */
+class FlashPages {
+
+public:
+    static const size_t pageSize = 256;
+
+    virtual size_t getPageCount() const = 0;
+
+    /// Get the (memory-mapped) contents of a page.
+    virtual const uint8_t *getPage(size_t page) const = 0;
+
+    /**
+     * \brief Program a page.
+     *
+     * Without `erase`, programming can only clear bits, and each 16-byte
+     * aligned chunk may be programmed only once between erases. Chunks
+     * that are all 0xff in `data` are left alone.
+     *
+     * \return false on failure
+     */
+    virtual bool programPage(size_t page, const void *data, bool erase) = 0;
+
+protected:
+    ~FlashPages() = default;
+};
+
+/**
+ * \brief A writable block store on flash pages, with wear leveling.
+ *
+ * Flash is divided into segments of 64 pages: two header pages followed by
+ * 31 slots of two pages, each holding one 512-byte sector. Sectors are
+ * never rewritten in place. Every write goes to the next free slot of the
+ * head segment, and a map in RAM tracks where each sector's latest copy
+ * lives. Page erases are thereby spread evenly over the whole region, no
+ * matter which sectors are written.
+ *
+ * The header records the segment's sequence number and, per slot, which
+ * sector it holds. Slot records are 16 bytes apart so that they can be
+ * programmed one by one without erasing the header. On mount, the map is
+ * rebuilt by replaying the headers in sequence order.
+ *
+ * Segments are reused in circular order. When the head moves into a new
+ * segment, the live sectors of the segment after it (the oldest) are
+ * copied into the new head, so that the oldest segment is free by the time
+ * the head reaches it. Two segments are held in reserve for this, and the
+ * last slot of each segment is only used by these copies.
+ *
+ * To batch programming, the last written sector is held in RAM until a
+ * different sector is written, and slot records of the head segment are
+ * programmed together on flush(). Unflushed writes are lost on power
+ * failure, older copies of those sectors then remain in effect.
+ */
+class EfcStore : public BlockStore {
+
+public:
+    static const size_t pageSize        = FlashPages::pageSize;
+    static const size_t sectorSize      = 512;
+    static const size_t sectorPages     = sectorSize / pageSize;
+    static const size_t headerPages     = 2;
+    static const size_t slotsPerSegment = 31;
+    static const size_t segmentPages    = headerPages + slotsPerSegment * sectorPages;
+    static const size_t reserveSegments = 2;
+    static const size_t maxSectors      = 1024; ///< Size of the sector map.
+
+private:
+    static const uint16_t none = 0xffff;
+
+    /// Size of a separately programmable chunk of flash.
+    static const size_t recordSize = 16;
+
+    FlashPages &flash;
+
+    size_t   segmentCount = 0;
+    uint16_t map[maxSectors]; ///< Sector to slot number, none if never written.
+
+    uint32_t sequence = 0; ///< Of the head segment.
+    size_t   head     = 0;
+    size_t   headSlot = 0; ///< Next free slot in the head segment.
+
+    /// Sectors written to head slots whose records are not programmed yet.
+    uint16_t pending[slotsPerSegment];
+    size_t   pendingFrom = 0;
+
+    uint8_t  buffer[sectorSize];
+    uint32_t bufferLba   = 0;
+    bool     bufferDirty = false;
+
+    uint32_t sectorWrites  = 0;
+    uint32_t pagePrograms  = 0;
+
+    const uint8_t *slotData(uint16_t slot, size_t page) const {
+        return flash.getPage((slot / slotsPerSegment) * segmentPages
+                             + headerPages
+                             + (slot % slotsPerSegment) * sectorPages
+                             + page);
+    }
+
+    /// Get a 16-byte record in a segment's header.
+    const uint8_t *record(size_t segment, size_t chunk) const;
+
+    bool program(size_t page, const void *data, bool erase);
+
+    /// Get the sector a slot holds according to its header, or none.
+    uint16_t recordedSector(size_t segment, size_t slot) const;
+
+    bool     isValidSegment(size_t segment, uint32_t &sequence_) const;
+    bool     isLive(size_t segment, size_t slot) const;
+
+    MuStore::StoreError programRecords();
+
+    /// Move the head into the next segment.
+    MuStore::StoreError advance();
+
+    /// Copy the live sectors of a segment to the head.
+    MuStore::StoreError clean(size_t segment);
+
+    /**
+     * \brief Write a sector to the next free slot.
+     *
+     * \param data     the sector's pages
+     * \param cleaning whether this copies a live sector out of the oldest segment
+     */
+    MuStore::StoreError append(uint16_t sector, const uint8_t *const data[sectorPages], bool cleaning);
+    MuStore::StoreError commitBuffer();
+
+public:
+    /**
+     * \brief Rebuild the sector map from flash.
+     *
+     * A region without valid segments is treated as empty.
+     */
+    MuStore::StoreError mount();
+
+    /// Logical sectors written, and flash pages programmed for them.
+    uint32_t getSectorWrites() const { return sectorWrites; }
+    uint32_t getPagePrograms() const { return pagePrograms; }
+
+    MuStore::StoreError seek(size_t lba);
+
+    MuStore::StoreError read (void *data);
+    MuStore::StoreError write(const void *data);
+
+    MuStore::StoreError flush();
+
+    using Store::read;
+    using Store::write;
+
+    EfcStore(FlashPages &flash_);
+    ~EfcStore() = default;
+};
@@ -0,0 +1,191 @@
+/**
+ * \file
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "fatfile.hh"
+
+#include <cstring>
+
+void FatFile::rewindChain() {
+    extentCount = 0;
+    tail        = FatVolume::Cursor { entry.cluster, 0 };
+    tailSector  = 0;
+}
+
+FatError FatFile::map(uint32_t sector, uint32_t &lba, uint32_t &count) {
+    if (extentCount && sector < extents[0].sector)
+        rewindChain();
+
+    while (sector >= tailSector) {
+        uint32_t runLba;
+        uint32_t runCount;
+        FatError err = volume->nextRun(tail, 0xffffffff, runLba, runCount);
+        if (err)
+            return err;
+        if (!runCount)
+            return FAT_ERR_IO; // The chain is shorter than the file size says.
+
+        if (extentCount == maxExtents) {
+            // Slide the window forward.
+            extentCount = 0;
+        }
+
+        extents[extentCount++] = Extent { tailSector, runLba, runCount };
+        tailSector += runCount;
+    }
+
+    // Binary search for the last extent starting at or before the sector.
+    size_t low  = 0;
+    size_t high = extentCount;
+    while (high - low > 1) {
+        size_t mid = (low + high) / 2;
+        if (extents[mid].sector <= sector)
+            low = mid;
+        else
+            high = mid;
+    }
+
+    const Extent &extent = extents[low];
+    lba   = extent.lba   + (sector - extent.sector);
+    count = extent.count - (sector - extent.sector);
+
+    return FAT_ERR_OK;
+}
+
+FatError FatFile::open(FatVolume &volume_, const char *path) {
+    volume      = &volume_;
+    position    = 0;
+    bufferValid = false;
+    compressed  = false;
+
+    FatError err = volume->lookup(path, entry);
+    if (err)
+        return err;
+    if (entry.isDirectory())
+        return FAT_ERR_IS_DIR;
+
+    rewindChain();
+
+    // Files listed in a built-in image's manifest are contiguous.
+    uint32_t sectors;
+    if (entry.cluster && !volume->findExtent(entry.cluster, sectors, compressed)) {
+        extents[0]  = Extent { 0, volume->clusterToLba(entry.cluster), sectors };
+        extentCount = 1;
+        tail        = FatVolume::Cursor { 0, 0 };
+        tailSector  = sectors;
+    }
+
+    return FAT_ERR_OK;
+}
+
+FatError FatFile::seek(uint32_t offset) {
+    if (offset > entry.size)
+        return FAT_ERR_INVALID_ARG;
+
+    position = offset;
+
+    return FAT_ERR_OK;
+}
+
+FatError FatFile::read(void *data, size_t length, size_t &bytesRead) {
+    const uint32_t sectorSize = FatVolume::sectorSize;
+    BlockStore &store = volume->getStore();
+    uint8_t    *out   = (uint8_t*)data;
+
+    bytesRead = 0;
+
+    if (length > entry.size - position)
+        length = entry.size - position;
+
+    while (length) {
+        uint32_t lba;
+        uint32_t count;
+        FatError err = map(position / sectorSize, lba, count);
+        if (err)
+            return err;
+
+        uint32_t offset = position % sectorSize;
+        uint32_t chunk;
+
+        if (!offset && length >= sectorSize) {
+            // Whole sectors, read them directly.
+            if (count > length / sectorSize)
+                count = (uint32_t)(length / sectorSize);
+
+            if (store.seek(lba) || store.readBlocks(out, count))
+                return FAT_ERR_IO;
+
+            chunk = count * sectorSize;
+
+        } else {
+            if (!bufferValid || bufferLba != lba) {
+                bufferValid = false;
+                if (store.seek(lba) || store.read(buffer))
+                    return FAT_ERR_IO;
+                bufferLba   = lba;
+                bufferValid = true;
+            }
+
+            chunk = sectorSize - offset;
+            if (chunk > length)
+                chunk = (uint32_t)length;
+
+            memcpy(out, buffer + offset, chunk);
+        }
+
+        out       += chunk;
+        position  += chunk;
+        bytesRead += chunk;
+        length    -= chunk;
+    }
+
+    return FAT_ERR_OK;
+}
+
+FatError FatFile::readDirect(const uint8_t *&data, size_t maxLength, size_t &length) {
+    const uint32_t sectorSize = FatVolume::sectorSize;
+
+    length = 0;
+
+    if (maxLength > entry.size - position)
+        maxLength = entry.size - position;
+    if (!maxLength)
+        return FAT_ERR_OK;
+
+    uint32_t lba;
+    uint32_t count;
+    FatError err = map(position / sectorSize, lba, count);
+    if (err)
+        return err;
+
+    const uint8_t *mapping = volume->getStore().getMapping(lba);
+    if (!mapping)
+        return FAT_ERR_INVALID_ARG;
+
+    uint32_t offset = position % sectorSize;
+
+    data   = mapping + offset;
+    length = count * sectorSize - offset;
+    if (length > maxLength)
+        length = maxLength;
+
+    position += (uint32_t)length;
+
+    return FAT_ERR_OK;
+}
@@ -0,0 +1,109 @@
+/**
+ * \file
+ * \brief     Extent-mapped FAT file reader.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "fatvol.hh"
+
+/**
+ * \brief Reads a file through a run-length list of its sectors.
+ *
+ * The cluster chain is decoded into extents (runs of consecutive sectors)
+ * as the file is read, so a seek only needs a search through the list
+ * instead of a walk along the chain. Reads of whole sectors go straight
+ * into the caller's buffer using multi-block transfers.
+ *
+ * When a file has more than maxExtents fragments, the list holds a window
+ * of them: seeking forward continues decoding where the list ends, only
+ * seeking back before the window restarts at the beginning of the chain.
+ */
+class FatFile {
+
+public:
+    static const size_t maxExtents = 16;
+
+private:
+    struct Extent {
+        uint32_t sector; ///< File-relative sector at which this extent starts.
+        uint32_t lba;
+        uint32_t count;
+    };
+
+    FatVolume          *volume = nullptr;
+    FatVolume::DirEntry entry;
+
+    Extent   extents[maxExtents];
+    size_t   extentCount = 0;
+    FatVolume::Cursor tail;           ///< Chain position after the last extent.
+    uint32_t          tailSector = 0; ///< File-relative sector at `tail`.
+
+    uint32_t position   = 0;
+    bool     compressed = false;
+
+    uint8_t  buffer[FatVolume::sectorSize]; ///< For partial sector reads.
+    uint32_t bufferLba   = 0;
+    bool     bufferValid = false;
+
+    void rewindChain();
+
+    /**
+     * \brief Find the sectors backing a file-relative sector.
+     *
+     * \param lba   the sector's LBA
+     * \param count consecutive sectors available from there on
+     */
+    FatError map(uint32_t sector, uint32_t &lba, uint32_t &count);
+
+public:
+    FatError open(FatVolume &volume_, const char *path);
+
+    uint32_t getSize()     const { return entry.size; }
+    uint32_t getPosition() const { return position; }
+    size_t   getExtentCount() const { return extentCount; }
+
+    /// Check whether mkfatimg stored the file as an LZ4 frame, see FileReader.
+    bool isCompressed() const { return compressed; }
+
+    FatError seek(uint32_t offset);
+
+    /// Check whether the file's store is memory-mapped, see readDirect().
+    bool isMapped() const { return volume->getStore().getMapping(0) != nullptr; }
+
+    /**
+     * \brief Read from the current position.
+     *
+     * Reading at the end of the file is not an error, bytesRead is 0 then.
+     */
+    FatError read(void *data, size_t length, size_t &bytesRead);
+
+    /**
+     * \brief Read from the current position without copying.
+     *
+     * Points `data` straight into the store's memory, for as much of the
+     * file as is contiguous there (at most `maxLength` bytes).
+     *
+     * \return FAT_ERR_INVALID_ARG if the store is not memory-mapped
+     */
+    FatError readDirect(const uint8_t *&data, size_t maxLength, size_t &length);
+
+    FatFile() = default;
+    ~FatFile() = default;
+};
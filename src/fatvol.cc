@@ -0,0 +1,1025 @@
+/**
+ * \file
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "fatvol.hh"
+
+#include <cstring>
+
+using namespace MuStore;
+
+static const uint32_t dirEntrySize   = 32;
+static const uint8_t  attrLongName   = 0x0f;
+static const uint8_t  attrVolumeId   = 0x08;
+static const uint8_t  attrDirectory  = 0x10;
+static const uint8_t  entryFree      = 0xe5;
+
+static inline uint16_t get16(const uint8_t *p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+static inline uint32_t get32(const uint8_t *p) {
+    return (uint32_t)p[0]       | (uint32_t)p[1] <<  8
+         | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+static inline void put16(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v);
+    p[1] = (uint8_t)(v >> 8);
+}
+static inline void put32(uint8_t *p, uint32_t v) {
+    put16(p,     v);
+    put16(p + 2, v >> 16);
+}
+
+uint32_t FatVolume::DentryKey::hash() const {
+    // FNV-1a.
+    uint32_t h = 2166136261u ^ parent;
+    for (size_t i = 0; i < sizeof(name); i++)
+        h = (h ^ (uint8_t)name[i]) * 16777619u;
+    return h;
+}
+
+bool FatVolume::DentryKey::operator==(const DentryKey &other) const {
+    return parent == other.parent && !memcmp(name, other.name, sizeof(name));
+}
+
+void FatVolume::cacheEntry(const DirEntry &entry, bool exists) {
+    DentryKey key;
+    key.parent = entry.parent;
+    memcpy(key.name, entry.name, sizeof(key.name));
+
+    dentries.insert(key, CachedEntry { exists, entry });
+}
+
+void FatVolume::entryChanged(const DirEntry &entry, bool exists) {
+    cacheEntry(entry, exists);
+    if (observer)
+        observer->entryChanged(entry, exists);
+}
+
+FatError FatVolume::loadSector(uint32_t lba) {
+    if (sectorValid && sectorLba == lba)
+        return FAT_ERR_OK;
+
+    sectorValid = false;
+    if (store->seek(lba) || store->read(sector))
+        return FAT_ERR_IO;
+
+    sectorLba   = lba;
+    sectorValid = true;
+
+    return FAT_ERR_OK;
+}
+
+FatError FatVolume::storeSector() {
+    generation++;
+    if (store->seek(sectorLba) || store->write(sector)) {
+        sectorValid = false;
+        return FAT_ERR_IO;
+    }
+    return FAT_ERR_OK;
+}
+
+FatError FatVolume::loadFatSector(uint32_t index) {
+    if (fatSectorValid && fatSectorIndex == index)
+        return FAT_ERR_OK;
+
+    FatError err = flush();
+    if (err)
+        return err;
+
+    fatSectorValid = false;
+    if (store->seek(fatLba + index) || store->read(fatSector))
+        return FAT_ERR_IO;
+
+    fatSectorIndex = index;
+    fatSectorValid = true;
+
+    return FAT_ERR_OK;
+}
+
+FatError FatVolume::flush() {
+    if (fatSectorDirty) {
+        generation++;
+        for (uint32_t i = 0; i < fatCount; i++) {
+            if (store->seek(fatLba + i * fatSectors + fatSectorIndex)
+                || store->write(fatSector))
+                return FAT_ERR_IO;
+        }
+        fatSectorDirty = false;
+    }
+
+    if (fsInfoDirty) {
+        // Callers may be working on the directory sector buffer, use a
+        // separate one. The free count would take a FAT scan to keep
+        // exact, so it is marked unknown instead.
+        uint8_t info[sectorSize];
+        generation++;
+        if (store->seek(fsInfoLba) || store->read(info))
+            return FAT_ERR_IO;
+        put32(info + 488, 0xffffffff);
+        put32(info + 492, freeHint);
+        if (store->seek(fsInfoLba) || store->write(info))
+            return FAT_ERR_IO;
+        if (sectorLba == fsInfoLba)
+            sectorValid = false;
+        fsInfoDirty = false;
+    }
+
+    return FAT_ERR_OK;
+}
+
+void FatVolume::invalidate() {
+    // Every operation that modifies the FAT flushes it before returning,
+    // so there is nothing to lose here.
+    flush();
+
+    generation++;
+    sectorValid    = false;
+    fatSectorValid = false;
+}
+
+FatError FatVolume::getFatEntry(uint32_t cluster, uint32_t &value) {
+    if (cluster < 2 || cluster >= clusterCount + 2)
+        return FAT_ERR_INVALID_ARG;
+
+    FatError err;
+
+    if (type == Type::FAT12) {
+        // FAT12 entries are 1.5 bytes and may straddle a sector boundary.
+        uint32_t offset = cluster + cluster / 2;
+        uint8_t  bytes[2];
+
+        for (uint32_t i = 0; i < 2; i++) {
+            if ((err = loadFatSector((offset + i) / sectorSize)))
+                return err;
+            bytes[i] = fatSector[(offset + i) % sectorSize];
+        }
+
+        uint32_t word = get16(bytes);
+        value = cluster & 1 ? word >> 4 : word & 0xfff;
+
+    } else if (type == Type::FAT16) {
+        uint32_t offset = cluster * 2;
+        if ((err = loadFatSector(offset / sectorSize)))
+            return err;
+        value = get16(fatSector + offset % sectorSize);
+
+    } else {
+        uint32_t offset = cluster * 4;
+        if ((err = loadFatSector(offset / sectorSize)))
+            return err;
+        value = get32(fatSector + offset % sectorSize) & 0x0fffffff;
+    }
+
+    return FAT_ERR_OK;
+}
+
+FatError FatVolume::setFatEntry(uint32_t cluster, uint32_t value) {
+    if (cluster < 2 || cluster >= clusterCount + 2)
+        return FAT_ERR_INVALID_ARG;
+
+    // The manifest no longer describes the volume.
+    manifestCount = 0;
+
+    uint32_t offset;
+    uint8_t  bytes[4];
+    uint8_t  masks[4] = { 0xff, 0xff, 0xff, 0xff };
+    size_t   length;
+
+    if (type == Type::FAT12) {
+        offset = cluster + cluster / 2;
+        length = 2;
+        if (cluster & 1) {
+            bytes[0] = (uint8_t)(value << 4); masks[0] = 0xf0;
+            bytes[1] = (uint8_t)(value >> 4);
+        } else {
+            bytes[0] = (uint8_t)(value);
+            bytes[1] = (uint8_t)(value >> 8); masks[1] = 0x0f;
+        }
+    } else if (type == Type::FAT16) {
+        offset = cluster * 2;
+        length = 2;
+        put16(bytes, value);
+    } else {
+        // The upper four bits of FAT32 entries are reserved.
+        offset = cluster * 4;
+        length = 4;
+        put32(bytes, value);
+        masks[3] = 0x0f;
+    }
+
+    for (size_t i = 0; i < length; i++) {
+        FatError err = loadFatSector((uint32_t)((offset + i) / sectorSize));
+        if (err)
+            return err;
+
+        uint8_t &b = fatSector[(offset + i) % sectorSize];
+        b = (uint8_t)((b & ~masks[i]) | (bytes[i] & masks[i]));
+        fatSectorDirty = true;
+    }
+
+    return FAT_ERR_OK;
+}
+
+FatError FatVolume::allocate(uint32_t count, uint32_t &first) {
+    if (!count)
+        return FAT_ERR_INVALID_ARG;
+
+    FatError err;
+    uint32_t value;
+    uint32_t runStart  = 0;
+    uint32_t runLength = 0;
+
+    // Look for a contiguous run first, starting at the hint. Only a window
+    // of the FAT is searched, so that an allocation on a large card does
+    // not read every FAT sector.
+    uint32_t window = count + allocSearchWindow;
+    for (uint32_t i = 0; i < clusterCount && i < window; i++) {
+        uint32_t cluster = 2 + (freeHint - 2 + i) % clusterCount;
+        if (cluster == 2)
+            runLength = 0; // Runs do not wrap.
+
+        if ((err = getFatEntry(cluster, value)))
+            return err;
+
+        if (value) {
+            runLength = 0;
+            continue;
+        }
+
+        if (!runLength++)
+            runStart = cluster;
+        if (runLength == count)
+            break;
+    }
+
+    if (runLength == count) {
+        for (uint32_t i = 0; i < count; i++) {
+            err = setFatEntry(runStart + i, i + 1 == count
+                                            ? endOfChain()
+                                            : runStart + i + 1);
+            if (err)
+                return err;
+        }
+        first       = runStart;
+        freeHint    = runStart + count < clusterCount + 2 ? runStart + count : 2;
+        fsInfoDirty = fsInfoLba != 0;
+        return flush();
+    }
+
+    // Fragmented allocation: chain together the free clusters that
+    // follow the hint.
+    uint32_t prev = 0;
+    for (uint32_t i = 0; count && i < clusterCount; i++) {
+        uint32_t cluster = 2 + (freeHint - 2 + i) % clusterCount;
+        if ((err = getFatEntry(cluster, value)))
+            return err;
+        if (value)
+            continue;
+
+        if ((err = setFatEntry(cluster, endOfChain())))
+            return err;
+        if (prev) {
+            if ((err = setFatEntry(prev, cluster)))
+                return err;
+        } else {
+            first = cluster;
+        }
+        prev = cluster;
+        count--;
+    }
+
+    if (count) {
+        // The volume is full, give back what was taken.
+        if (prev && (err = freeChain(first)))
+            return err;
+        return FAT_ERR_NO_SPACE;
+    }
+
+    freeHint    = prev + 1 < clusterCount + 2 ? prev + 1 : 2;
+    fsInfoDirty = fsInfoLba != 0;
+
+    return flush();
+}
+
+FatError FatVolume::freeChain(uint32_t first) {
+    uint32_t cluster = first;
+    while (!isEndOfChain(cluster)) {
+        uint32_t next;
+        FatError err = getFatEntry(cluster, next);
+        if (err)
+            return err;
+        if ((err = setFatEntry(cluster, 0)))
+            return err;
+        if (cluster < freeHint)
+            freeHint = cluster;
+        cluster = next;
+    }
+    fsInfoDirty = fsInfoLba != 0;
+    return flush();
+}
+
+FatError FatVolume::findExtent(uint32_t cluster, uint32_t &sectors, bool &compressed) {
+    // Entries are 8 bytes, following an 8 byte header, so none straddle a sector.
+    uint32_t low  = 0;
+    uint32_t high = manifestCount;
+
+    while (low < high) {
+        uint32_t mid    = (low + high) / 2;
+        uint32_t offset = 8 + mid * 8;
+
+        FatError err = loadSector(manifestLba + offset / sectorSize);
+        if (err)
+            return err;
+
+        const uint8_t *p     = sector + offset % sectorSize;
+        uint32_t       first = get32(p);
+
+        if (first == cluster) {
+            uint32_t clusters = get32(p + 4);
+            sectors    = (clusters & ~extentLz4) * sectorsPerCluster;
+            compressed = (clusters & extentLz4) != 0;
+            return FAT_ERR_OK;
+        } else if (first < cluster) {
+            low  = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return FAT_ERR_NOT_FOUND;
+}
+
+FatError FatVolume::nextRun(Cursor &cursor,
+                            uint32_t maxSectors,
+                            uint32_t &lba,
+                            uint32_t &count) {
+    count = 0;
+    if (isEndOfChain(cursor.cluster))
+        return FAT_ERR_OK;
+
+    lba = clusterToLba(cursor.cluster) + cursor.sectorOffset;
+
+    while (count < maxSectors && !isEndOfChain(cursor.cluster)) {
+        uint32_t take = sectorsPerCluster - cursor.sectorOffset;
+        if (take > maxSectors - count)
+            take = maxSectors - count;
+
+        count               += take;
+        cursor.sectorOffset += take;
+
+        if (cursor.sectorOffset < sectorsPerCluster)
+            break;
+
+        uint32_t next;
+        FatError err = getFatEntry(cursor.cluster, next);
+        if (err)
+            return err;
+
+        bool contiguous = next == cursor.cluster + 1;
+
+        cursor.cluster      = isEndOfChain(next) ? 0 : next;
+        cursor.sectorOffset = 0;
+
+        if (!contiguous)
+            break;
+    }
+
+    return FAT_ERR_OK;
+}
+
+bool FatVolume::toShortName(const char *name, char shortName[11]) {
+    memset(shortName, ' ', 11);
+
+    if (!strcmp(name, ".") || !strcmp(name, "..")) {
+        memcpy(shortName, name, strlen(name));
+        return true;
+    }
+
+    size_t i      = 0;
+    size_t limit  = 8;
+    bool   inExt  = false;
+
+    for (const char *p = name; *p; p++) {
+        char c = *p;
+        if (c == '.') {
+            if (inExt || !i)
+                return false;
+            inExt = true;
+            i     = 8;
+            limit = 11;
+            continue;
+        }
+        if (i >= limit)
+            return false;
+        if ((uint8_t)c < 0x20 || strchr(" \"*+,/:;<=>?[\\]|", c))
+            return false;
+        if (c >= 'a' && c <= 'z')
+            c = (char)(c - 'a' + 'A');
+
+        shortName[i++] = c;
+    }
+
+    if (shortName[0] == (char)entryFree)
+        shortName[0] = 0x05; // Escaped 0xe5.
+
+    return i > 0 && shortName[0] != ' ';
+}
+
+void FatVolume::fromShortName(const char shortName[11], char name[13]) {
+    size_t j = 0;
+    for (size_t i = 0; i < 8 && shortName[i] != ' '; i++)
+        name[j++] = shortName[i];
+    if (shortName[8] != ' ') {
+        name[j++] = '.';
+        for (size_t i = 8; i < 11 && shortName[i] != ' '; i++)
+            name[j++] = shortName[i];
+    }
+    name[j] = '\0';
+
+    if (name[0] == 0x05)
+        name[0] = (char)entryFree;
+
+    for (size_t i = 0; i < j; i++) {
+        if (name[i] >= 'A' && name[i] <= 'Z')
+            name[i] = (char)(name[i] - 'A' + 'a');
+    }
+}
+
+FatError FatVolume::dirSector(uint32_t dirCluster, uint32_t n, uint32_t &lba) {
+    lba = 0;
+
+    if (!dirCluster && type != Type::FAT32) {
+        if (n < rootSectors)
+            lba = rootLba + n;
+        return FAT_ERR_OK;
+    }
+
+    uint32_t cluster = dirCluster ? dirCluster : rootCluster;
+    for (uint32_t i = 0; i < n / sectorsPerCluster; i++) {
+        FatError err = getFatEntry(cluster, cluster);
+        if (err)
+            return err;
+        if (isEndOfChain(cluster))
+            return FAT_ERR_OK;
+    }
+
+    lba = clusterToLba(cluster) + n % sectorsPerCluster;
+
+    return FAT_ERR_OK;
+}
+
+FatError FatVolume::readDir(uint32_t dirCluster, uint32_t &index, DirEntry &entry) {
+    const uint32_t perSector = sectorSize / dirEntrySize;
+
+    while (true) {
+        uint32_t lba;
+        FatError err = dirSector(dirCluster, index / perSector, lba);
+        if (err)
+            return err;
+        if (!lba)
+            return FAT_ERR_NOT_FOUND;
+        if ((err = loadSector(lba)))
+            return err;
+
+        uint16_t offset = (uint16_t)(index % perSector * dirEntrySize);
+        const uint8_t *p = sector + offset;
+
+        if (!p[0])
+            return FAT_ERR_NOT_FOUND; // End of directory marker.
+
+        index++;
+
+        if (p[0] == entryFree
+            || p[11] == attrLongName
+            || p[11] & attrVolumeId)
+            continue;
+
+        memcpy(entry.name, p, 11);
+        entry.attributes = p[11];
+        entry.cluster    = (uint32_t)get16(p + 20) << 16 | get16(p + 26);
+        entry.size       = get32(p + 28);
+        entry.lba        = lba;
+        entry.offset     = offset;
+        entry.parent     = dirCluster;
+
+        // Some formatters point '..' at the FAT32 root cluster, rather than 0.
+        if (type == Type::FAT32 && entry.cluster == rootCluster)
+            entry.cluster = 0;
+
+        return FAT_ERR_OK;
+    }
+}
+
+FatError FatVolume::findShort(uint32_t dirCluster,
+                              const char shortName[11],
+                              DirEntry &entry) {
+    DentryKey key;
+    key.parent = dirCluster;
+    memcpy(key.name, shortName, sizeof(key.name));
+
+    if (CachedEntry *cached = dentries.find(key)) {
+        if (!cached->exists)
+            return FAT_ERR_NOT_FOUND;
+        entry = cached->entry;
+        return FAT_ERR_OK;
+    }
+
+    uint32_t index = 0;
+    while (true) {
+        FatError err = readDir(dirCluster, index, entry);
+        if (err == FAT_ERR_NOT_FOUND) {
+            // Remember that the name does not exist.
+            entry.parent = dirCluster;
+            memcpy(entry.name, shortName, sizeof(entry.name));
+            cacheEntry(entry, false);
+        }
+        if (err)
+            return err;
+
+        if (!memcmp(entry.name, shortName, 11)) {
+            cacheEntry(entry, true);
+            return FAT_ERR_OK;
+        }
+    }
+}
+
+FatError FatVolume::keyOf(const char *path, DentryKey &key) {
+    const char *name;
+    FatError err = lookupParent(path, key.parent, name);
+    if (err)
+        return err;
+
+    return toShortName(name, key.name) ? FAT_ERR_OK : FAT_ERR_INVALID_NAME;
+}
+
+FatError FatVolume::findEntry(uint32_t dirCluster, const char *name, DirEntry &entry) {
+    char shortName[11];
+    if (!toShortName(name, shortName))
+        return FAT_ERR_INVALID_NAME;
+
+    return findShort(dirCluster, shortName, entry);
+}
+
+FatError FatVolume::walk(const char *path, size_t length, DirEntry &entry) {
+    // Start at the root directory.
+    memset(&entry, 0, sizeof(entry));
+    memset(entry.name, ' ', sizeof(entry.name));
+    entry.attributes = attrDirectory;
+
+    size_t i = 0;
+    while (i < length) {
+        while (i < length && path[i] == '/')
+            i++;
+
+        size_t start = i;
+        while (i < length && path[i] != '/')
+            i++;
+
+        size_t componentLength = i - start;
+        if (!componentLength)
+            break;
+        if (componentLength > 12)
+            return FAT_ERR_NOT_FOUND; // Cannot be a valid short name.
+
+        char component[13];
+        memcpy(component, path + start, componentLength);
+        component[componentLength] = '\0';
+
+        if (!strcmp(component, "."))
+            continue;
+
+        if (!entry.isDirectory())
+            return FAT_ERR_NOT_DIR;
+
+        if (!strcmp(component, "..") && !entry.cluster) {
+            continue; // The root is its own parent.
+        }
+
+        FatError err = findEntry(entry.cluster, component, entry);
+        if (err)
+            return err;
+
+        if (!strcmp(component, "..") && !entry.cluster) {
+            // Back at the root, forget where the '..' entry was found.
+            memset(&entry, 0, sizeof(entry));
+            memset(entry.name, ' ', sizeof(entry.name));
+            entry.attributes = attrDirectory;
+        }
+    }
+
+    return FAT_ERR_OK;
+}
+
+FatError FatVolume::lookup(const char *path, DirEntry &entry) {
+    return walk(path, strlen(path), entry);
+}
+
+FatError FatVolume::lookupParent(const char *path, uint32_t &dirCluster, const char *&name) {
+    const char *slash = strrchr(path, '/');
+    name = slash ? slash + 1 : path;
+
+    if (!*name)
+        return FAT_ERR_INVALID_NAME;
+
+    DirEntry dir;
+    FatError err = walk(path, slash ? (size_t)(slash - path) : 0, dir);
+    if (err)
+        return err;
+    if (!dir.isDirectory())
+        return FAT_ERR_NOT_DIR;
+
+    dirCluster = dir.cluster;
+
+    return FAT_ERR_OK;
+}
+
+FatError FatVolume::extendDir(uint32_t dirCluster, DirEntry &slot) {
+    // Find the last cluster of the directory.
+    uint32_t last = dirCluster ? dirCluster : rootCluster;
+    while (true) {
+        uint32_t next;
+        FatError err = getFatEntry(last, next);
+        if (err)
+            return err;
+        if (isEndOfChain(next))
+            break;
+        last = next;
+    }
+
+    uint32_t cluster;
+    FatError err = allocate(1, cluster);
+    if (err)
+        return err;
+
+    // Directory clusters must be zeroed, an empty first entry marks the end.
+    memset(sector, 0, sizeof(sector));
+    for (uint32_t i = 0; i < sectorsPerCluster; i++) {
+        sectorLba = clusterToLba(cluster) + i;
+        if ((err = storeSector()))
+            return err;
+    }
+    sectorValid = true;
+
+    if ((err = setFatEntry(last, cluster)) || (err = flush()))
+        return err;
+
+    slot.lba    = clusterToLba(cluster);
+    slot.offset = 0;
+
+    return FAT_ERR_OK;
+}
+
+FatError FatVolume::findFree(uint32_t dirCluster, DirEntry &slot) {
+    const uint32_t perSector = sectorSize / dirEntrySize;
+
+    for (uint32_t n = 0; ; n++) {
+        uint32_t lba;
+        FatError err = dirSector(dirCluster, n, lba);
+        if (err)
+            return err;
+
+        if (!lba) {
+            if (!dirCluster && type != Type::FAT32)
+                return FAT_ERR_DIR_FULL; // The FAT12/16 root cannot grow.
+            return extendDir(dirCluster, slot);
+        }
+
+        if ((err = loadSector(lba)))
+            return err;
+
+        for (uint32_t i = 0; i < perSector; i++) {
+            uint8_t first = sector[i * dirEntrySize];
+            if (!first || first == entryFree) {
+                slot.lba    = lba;
+                slot.offset = (uint16_t)(i * dirEntrySize);
+                return FAT_ERR_OK;
+            }
+        }
+    }
+}
+
+FatError FatVolume::createEntry(DirEntry &entry) {
+    DirEntry existing;
+    FatError err = findShort(entry.parent, entry.name, existing);
+    if (!err)
+        return FAT_ERR_EXISTS;
+    if (err != FAT_ERR_NOT_FOUND)
+        return err;
+
+    if ((err = findFree(entry.parent, entry)))
+        return err;
+
+    // Start from a clean slate, timestamps are left zeroed.
+    if ((err = loadSector(entry.lba)))
+        return err;
+    memset(sector + entry.offset, 0, dirEntrySize);
+
+    return updateEntry(entry);
+}
+
+FatError FatVolume::updateEntry(const DirEntry &entry) {
+    FatError err = loadSector(entry.lba);
+    if (err)
+        return err;
+
+    uint8_t *p = sector + entry.offset;
+    memcpy(p, entry.name, 11);
+    p[11] = entry.attributes;
+    put16(p + 20, entry.cluster >> 16);
+    put16(p + 26, entry.cluster);
+    put32(p + 28, entry.isDirectory() ? 0 : entry.size);
+
+    entryChanged(entry, true);
+
+    return storeSector();
+}
+
+FatError FatVolume::removeLongName(const DirEntry &entry) {
+    // Long name entries directly precede their short entry. We only clean
+    // up those in the same sector, any others are orphaned and will fail
+    // their checksum, so they are ignored by other FAT implementations.
+    FatError err = loadSector(entry.lba);
+    if (err)
+        return err;
+
+    bool changed = false;
+    for (int offset = entry.offset - (int)dirEntrySize; offset >= 0; offset -= (int)dirEntrySize) {
+        uint8_t *p = sector + offset;
+        if (p[11] != attrLongName || p[0] == entryFree)
+            break;
+        p[0]    = entryFree;
+        changed = true;
+    }
+
+    return changed ? storeSector() : FAT_ERR_OK;
+}
+
+FatError FatVolume::deleteEntry(const DirEntry &entry) {
+    FatError err = removeLongName(entry);
+    if (err)
+        return err;
+    if ((err = loadSector(entry.lba)))
+        return err;
+
+    sector[entry.offset] = entryFree;
+
+    entryChanged(entry, false);
+
+    return storeSector();
+}
+
+FatError FatVolume::move(const char *from, const char *to) {
+    DirEntry source;
+    FatError err = lookup(from, source);
+    if (err)
+        return err;
+    if (!source.lba)
+        return FAT_ERR_INVALID_ARG; // Cannot move the root directory.
+
+    uint32_t targetDir;
+    char     targetName[11];
+    DirEntry target;
+
+    if (!(err = lookup(to, target))) {
+        if (!target.isDirectory())
+            return FAT_ERR_EXISTS;
+        // Move into the given directory, keeping the name.
+        targetDir = target.cluster;
+        memcpy(targetName, source.name, sizeof(targetName));
+
+    } else if (err == FAT_ERR_NOT_FOUND) {
+        const char *name;
+        if ((err = lookupParent(to, targetDir, name)))
+            return err;
+        if (!toShortName(name, targetName))
+            return FAT_ERR_INVALID_NAME;
+    } else {
+        return err;
+    }
+
+    if (source.isDirectory()) {
+        // Refuse to move a directory into itself or one of its children.
+        for (uint32_t dir = targetDir; dir; ) {
+            if (dir == source.cluster)
+                return FAT_ERR_INVALID_ARG;
+            DirEntry parent;
+            if ((err = findShort(dir, "..         ", parent)))
+                return err;
+            dir = parent.cluster;
+        }
+    }
+
+    if (targetDir == source.parent) {
+        // A plain rename, update the entry in place.
+        if ((err = findShort(targetDir, targetName, target)) != FAT_ERR_NOT_FOUND)
+            return err ? err : FAT_ERR_EXISTS;
+        if ((err = removeLongName(source)))
+            return err;
+
+        entryChanged(source, false);
+
+        memcpy(source.name, targetName, sizeof(targetName));
+        return updateEntry(source);
+    }
+
+    target = source;
+    target.parent = targetDir;
+    memcpy(target.name, targetName, sizeof(targetName));
+
+    if ((err = createEntry(target)))
+        return err;
+    if ((err = deleteEntry(source)))
+        return err;
+
+    if (source.isDirectory()) {
+        // Point the '..' entry at the new parent directory.
+        DirEntry dotdot;
+        if ((err = findShort(source.cluster, "..         ", dotdot)))
+            return err;
+        dotdot.cluster = targetDir;
+        return updateEntry(dotdot);
+    }
+
+    return FAT_ERR_OK;
+}
+
+FatError FatVolume::format(BlockStore &store, const char *label) {
+    const uint32_t reserved    = 1;
+    const uint32_t fats        = 2;
+    const uint32_t rootEntries = 64;
+    const uint32_t rootSecs    = rootEntries * dirEntrySize / sectorSize;
+
+    uint32_t total = (uint32_t)store.getBlockCount();
+    if (store.getBlockSize() != sectorSize || total > 0xffff)
+        return FAT_ERR_INVALID_ARG;
+
+    // Use the smallest cluster size that keeps the cluster count within FAT12 limits.
+    uint32_t perCluster = 1;
+    uint32_t fatSecs;
+    uint32_t clusters;
+    while (true) {
+        fatSecs = 1;
+        // Each FAT sector holds 341 entries, two of which are reserved.
+        while (true) {
+            uint32_t overhead = reserved + fats * fatSecs + rootSecs;
+            if (overhead >= total)
+                return FAT_ERR_NO_SPACE;
+            clusters = (total - overhead) / perCluster;
+            if ((clusters + 2) * 3 / 2 <= fatSecs * sectorSize)
+                break;
+            fatSecs++;
+        }
+        if (clusters < 4085)
+            break;
+        if ((perCluster *= 2) > 128)
+            return FAT_ERR_INVALID_ARG;
+    }
+
+    uint8_t buffer[sectorSize];
+
+    // Boot sector.
+    memset(buffer, 0, sizeof(buffer));
+    memcpy(buffer, "\xeb\x3c\x90PICUS   ", 11);
+    put16(buffer + 11, sectorSize);
+    buffer[13] = (uint8_t)perCluster;
+    put16(buffer + 14, reserved);
+    buffer[16] = (uint8_t)fats;
+    put16(buffer + 17, rootEntries);
+    put16(buffer + 19, total);
+    buffer[21] = 0xf8; // Fixed disk.
+    put16(buffer + 22, fatSecs);
+    put16(buffer + 24, 1); // Sectors per track.
+    put16(buffer + 26, 1); // Heads.
+    buffer[36] = 0x80;
+    buffer[38] = 0x29; // Extended boot signature.
+    put32(buffer + 39, 0x50494355);
+    memset(buffer + 43, ' ', 11);
+    for (size_t i = 0; i < 11 && label[i]; i++)
+        buffer[43 + i] = (uint8_t)label[i];
+    memcpy(buffer + 54, "FAT12   ", 8);
+    put16(buffer + 510, 0xaa55);
+
+    if (store.seek(0) || store.write(buffer))
+        return FAT_ERR_IO;
+
+    // FATs, with the two reserved entries in the first sector.
+    for (uint32_t i = 0; i < fats; i++) {
+        for (uint32_t j = 0; j < fatSecs; j++) {
+            memset(buffer, 0, sizeof(buffer));
+            if (!j) {
+                buffer[0] = 0xf8;
+                buffer[1] = 0xff;
+                buffer[2] = 0xff;
+            }
+            if (store.write(buffer))
+                return FAT_ERR_IO;
+        }
+    }
+
+    // Root directory, holding only the volume label.
+    for (uint32_t i = 0; i < rootSecs; i++) {
+        memset(buffer, 0, sizeof(buffer));
+        if (!i) {
+            memset(buffer, ' ', 11);
+            for (size_t j = 0; j < 11 && label[j]; j++)
+                buffer[j] = (uint8_t)label[j];
+            buffer[11] = attrVolumeId;
+        }
+        if (store.write(buffer))
+            return FAT_ERR_IO;
+    }
+
+    return FAT_ERR_OK;
+}
+
+FatVolume::FatVolume(BlockStore *store_)
+    : store(store_) {
+
+    if (loadSector(0))
+        return;
+
+    // Accept either an unpartitioned volume, or use the first partition.
+    if (get16(sector + 11) != sectorSize && get16(sector + 510) == 0xaa55) {
+        volumeLba = get32(sector + 446 + 8);
+        if (!volumeLba || loadSector(volumeLba))
+            return;
+    }
+
+    if (get16(sector + 11) != sectorSize || get16(sector + 510) != 0xaa55)
+        return;
+
+    sectorsPerCluster = sector[13];
+    if (!sectorsPerCluster || sectorsPerCluster & (sectorsPerCluster - 1))
+        return;
+
+    uint32_t reservedSectors = get16(sector + 14);
+    uint32_t rootEntries     = get16(sector + 17);
+    uint32_t totalSectors    = get16(sector + 19);
+
+    fatCount    = sector[16];
+    fatSectors  = get16(sector + 22);
+    if (!totalSectors)
+        totalSectors = get32(sector + 32);
+    if (!fatSectors)
+        fatSectors = get32(sector + 36);
+
+    fatLba      = volumeLba + reservedSectors;
+    rootLba     = fatLba + fatCount * fatSectors;
+    rootSectors = (rootEntries * (uint32_t)dirEntrySize + sectorSize - 1) / sectorSize;
+    dataLba     = rootLba + rootSectors;
+
+    if (!fatCount || !fatSectors || dataLba - volumeLba >= totalSectors)
+        return;
+
+    clusterCount = (totalSectors - (dataLba - volumeLba)) / sectorsPerCluster;
+
+    if (clusterCount < 4085) {
+        type = Type::FAT12;
+    } else if (clusterCount < 65525) {
+        type = Type::FAT16;
+    } else {
+        type        = Type::FAT32;
+        rootCluster = get32(sector + 44);
+
+        // Start looking for free clusters where the FSInfo sector says
+        // the last allocation ended, instead of at the start of the FAT.
+        uint32_t fsInfoSector = get16(sector + 48);
+        if (fsInfoSector && fsInfoSector < reservedSectors
+            && !loadSector(volumeLba + fsInfoSector)
+            && get32(sector) == 0x41615252 && get32(sector + 484) == 0x61417272) {
+
+            fsInfoLba = volumeLba + fsInfoSector;
+
+            uint32_t nextFree = get32(sector + 492);
+            if (nextFree >= 2 && nextFree < clusterCount + 2)
+                freeHint = nextFree;
+        }
+    }
+
+    // mkfatimg puts an extent manifest right after the boot sector.
+    if (reservedSectors > 1 && type != Type::FAT32
+        && !loadSector(volumeLba + 1) && !memcmp(sector, "PCXT", 4)) {
+
+        manifestLba   = volumeLba + 1;
+        manifestCount = get32(sector + 4);
+        if (8 + manifestCount * 8 > (reservedSectors - 1) * sectorSize)
+            manifestCount = 0;
+    }
+}
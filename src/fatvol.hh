@@ -0,0 +1,354 @@
+/**
+ * \file
+ * \brief     Low-level FAT volume access.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "blockstore.hh"
+#include "lrucache.hh"
+
+enum FatError {
+    FAT_ERR_OK = 0,
+    FAT_ERR_IO,
+    FAT_ERR_NOT_FOUND,
+    FAT_ERR_EXISTS,
+    FAT_ERR_NOT_DIR,
+    FAT_ERR_IS_DIR,
+    FAT_ERR_INVALID_NAME,
+    FAT_ERR_NO_SPACE,
+    FAT_ERR_DIR_FULL,
+    FAT_ERR_INVALID_ARG,
+};
+
+/**
+ * \brief Metadata-level access to a FAT12/16/32 volume.
+ *
+ * MuStore's FatFs takes care of regular file I/O. This class covers what
+ * it does not expose: cluster chains, allocation and raw directory
+ * entries. Only short (8.3) names are handled, stale long name entries
+ * are removed when an entry is renamed or deleted.
+ *
+ * All operations except setFatEntry() write their changes through to the
+ * store before returning, so FsNodes obtained from FatFs see them on their
+ * next access.
+ */
+class FatVolume {
+
+public:
+    enum class Type { NONE, FAT12, FAT16, FAT32 };
+
+    static const uint32_t sectorSize = 512;
+
+    /// Location and contents of a directory entry.
+    struct DirEntry {
+        char     name[11];   ///< Space-padded 8.3 name, without the dot.
+        uint8_t  attributes;
+        uint32_t cluster;    ///< First cluster, 0 for empty files.
+        uint32_t size;
+        uint32_t lba;        ///< Sector holding this entry.
+        uint16_t offset;     ///< Byte offset of the entry in its sector.
+        uint32_t parent;     ///< First cluster of the parent directory, 0 for the root.
+
+        bool isDirectory() const { return attributes & 0x10; }
+    };
+
+    /// Identifies a directory entry by its parent directory and short name.
+    struct DentryKey {
+        uint32_t parent;
+        char     name[11];
+
+        uint32_t hash() const;
+        bool operator==(const DentryKey &other) const;
+    };
+
+    /**
+     * \brief Iterates over the sectors of a cluster chain.
+     *
+     * Consecutive clusters are merged, so that bulk transfers can span
+     * cluster boundaries.
+     */
+    struct Cursor {
+        uint32_t cluster;       ///< Current cluster, 0 at the end of the chain.
+        uint32_t sectorOffset;  ///< Sector offset within the current cluster.
+    };
+
+    /// Gets notified of every directory entry that is created, changed or deleted.
+    class Observer {
+    public:
+        virtual void entryChanged(const DirEntry &entry, bool exists) = 0;
+
+    protected:
+        ~Observer() = default;
+    };
+
+private:
+    BlockStore *store;
+    Type        type = Type::NONE;
+
+    uint32_t volumeLba         = 0; ///< Start of the volume (non-zero when partitioned).
+    uint32_t sectorsPerCluster = 0;
+    uint32_t fatLba            = 0;
+    uint32_t fatSectors        = 0;
+    uint32_t fatCount          = 0;
+    uint32_t rootLba           = 0; ///< FAT12/16 fixed root directory.
+    uint32_t rootSectors       = 0;
+    uint32_t rootCluster       = 0; ///< FAT32 root directory cluster.
+    uint32_t dataLba           = 0;
+    uint32_t clusterCount      = 0;
+    uint32_t freeHint          = 2; ///< Where to start looking for free clusters.
+    uint32_t fsInfoLba         = 0; ///< FAT32 FSInfo sector, if valid.
+    bool     fsInfoDirty       = false;
+    uint32_t generation        = 0; ///< See getGeneration().
+
+    /// Clusters beyond the requested count searched for a contiguous run.
+    static const uint32_t allocSearchWindow = 4096;
+
+    uint32_t manifestLba   = 0; ///< Extent manifest written by mkfatimg, if any.
+    uint32_t manifestCount = 0;
+
+    /// Set in a manifest entry's cluster count for LZ4-compressed files.
+    static const uint32_t extentLz4 = 0x80000000;
+
+    uint8_t  sector[sectorSize]; ///< Directory sector buffer.
+    uint32_t sectorLba   = 0;
+    bool     sectorValid = false;
+
+    uint8_t  fatSector[sectorSize]; ///< FAT sector buffer, relative to the first FAT.
+    uint32_t fatSectorIndex = 0;
+    bool     fatSectorValid = false;
+    bool     fatSectorDirty = false;
+
+    /// A cached name lookup, which may be negative.
+    struct CachedEntry {
+        bool     exists;
+        DirEntry entry;
+    };
+
+    static const size_t dentryCacheSize = 32;
+
+    /// Name lookups by (parent cluster, name), so that repeated lookups cost no I/O.
+    LruCache<DentryKey, CachedEntry, dentryCacheSize> dentries;
+
+    Observer *observer = nullptr;
+
+    void cacheEntry(const DirEntry &entry, bool exists);
+
+    /// Cache a modified entry and pass it on to the observer.
+    void entryChanged(const DirEntry &entry, bool exists);
+
+    FatError loadSector(uint32_t lba);
+    FatError storeSector();
+
+    FatError loadFatSector(uint32_t index);
+
+    /// Get the LBA of the n-th sector of a directory. Returns 0 past its end.
+    FatError dirSector(uint32_t dirCluster, uint32_t n, uint32_t &lba);
+
+    FatError walk(const char *path, size_t length, DirEntry &entry);
+    FatError findFree(uint32_t dirCluster, DirEntry &slot);
+    FatError extendDir(uint32_t dirCluster, DirEntry &slot);
+    FatError removeLongName(const DirEntry &entry);
+
+public:
+    Type     getType()        const { return type; }
+    uint32_t getClusterSize() const { return sectorsPerCluster * sectorSize; }
+    uint32_t getSectorsPerCluster() const { return sectorsPerCluster; }
+    uint32_t getClusterCount()      const { return clusterCount; }
+    uint32_t getRootCluster()       const { return type == Type::FAT32 ? rootCluster : 0; }
+    uint32_t getFatLba()            const { return fatLba;     }
+    uint32_t getFatSectors()        const { return fatSectors; }
+    uint32_t getFatCount()          const { return fatCount;   }
+
+    /// Get the first sector of the root directory.
+    uint32_t getRootDirLba() const {
+        return type == Type::FAT32 ? clusterToLba(rootCluster) : rootLba;
+    }
+    /// Get the length of the root directory (FAT32: its first cluster) in sectors.
+    uint32_t getRootDirSectors() const {
+        return type == Type::FAT32 ? sectorsPerCluster : rootSectors;
+    }
+    BlockStore &getStore() { return *store; }
+
+    /**
+     * \brief Get a count of changes to the volume.
+     *
+     * It changes whenever a directory or FAT sector is written through
+     * this object, and when cached state is dropped because the store
+     * was changed by someone else. Caches of lookups done by other means,
+     * such as FatFs nodes, compare it to find out they are outdated.
+     */
+    uint32_t getGeneration() const { return generation; }
+
+    /// Set an observer for directory changes, or nullptr for none.
+    void setObserver(Observer *observer_) { observer = observer_; }
+
+    uint32_t clusterToLba(uint32_t cluster) const {
+        return dataLba + (cluster - 2) * sectorsPerCluster;
+    }
+
+    /// Check whether a FAT entry value marks the end of a chain (or is invalid).
+    bool isEndOfChain(uint32_t value) const {
+        return value < 2 || value >= clusterCount + 2;
+    }
+
+    FatError getFatEntry(uint32_t cluster, uint32_t &value);
+
+    /**
+     * \brief Set a FAT entry.
+     *
+     * Changes are buffered, call flush() to write them to every copy of the FAT.
+     */
+    FatError setFatEntry(uint32_t cluster, uint32_t value);
+
+    /**
+     * \brief Write modified FAT sectors to all FATs.
+     *
+     * After clusters were allocated or freed on FAT32, this also updates
+     * the FSInfo sector: its free count becomes unknown and its next free
+     * cluster is set to the free hint.
+     */
+    FatError flush();
+
+    /// Value to use for the last cluster in a chain.
+    uint32_t endOfChain() const {
+        return type == Type::FAT12 ? 0xfff
+             : type == Type::FAT16 ? 0xffff
+             :                       0x0fffffff;
+    }
+
+    /**
+     * \brief Allocate a chain of clusters.
+     *
+     * A contiguous run within allocSearchWindow clusters of the free hint
+     * is preferred, otherwise the chain is assembled from the free
+     * clusters following the hint. On FAT32 the hint starts out at the
+     * FSInfo sector's next free cluster.
+     */
+    FatError allocate(uint32_t count, uint32_t &first);
+    FatError freeChain(uint32_t first);
+
+    /**
+     * \brief Get the next run of consecutive sectors in a chain.
+     *
+     * \param cursor     chain position, advanced past the returned run
+     * \param maxSectors maximum run length
+     * \param lba        first sector of the run
+     * \param count      run length, 0 at the end of the chain
+     */
+    FatError nextRun(Cursor &cursor, uint32_t maxSectors, uint32_t &lba, uint32_t &count);
+
+    /**
+     * \brief Look up a file in the volume's extent manifest.
+     *
+     * Images built by mkfatimg list every file's cluster run in their
+     * reserved sectors, so that their chains need not be walked. The
+     * manifest is ignored once the FAT has been modified.
+     *
+     * \param cluster    the file's first cluster
+     * \param sectors    the length of its (contiguous) run
+     * \param compressed whether mkfatimg stored the file as an LZ4 frame
+     *
+     * \return FAT_ERR_NOT_FOUND if the file is not listed
+     */
+    FatError findExtent(uint32_t cluster, uint32_t &sectors, bool &compressed);
+
+    /// Convert a file name to its space-padded 8.3 form.
+    static bool toShortName(const char *name, char shortName[11]);
+
+    /// Convert a space-padded 8.3 name to a lowercase "name.ext" string.
+    static void fromShortName(const char shortName[11], char name[13]);
+
+    /**
+     * \brief Read the n-th entry of a directory.
+     *
+     * Free slots, long name entries and volume labels are skipped: `index`
+     * is advanced to the entry after the one returned.
+     *
+     * \return FAT_ERR_NOT_FOUND at the end of the directory
+     */
+    FatError readDir(uint32_t dirCluster, uint32_t &index, DirEntry &entry);
+
+    FatError findEntry(uint32_t dirCluster, const char *name, DirEntry &entry);
+
+    /// Find an entry by its space-padded 8.3 name.
+    FatError findShort(uint32_t dirCluster, const char shortName[11], DirEntry &entry);
+
+    /// Get the cache key for a path. Fails for the root directory.
+    FatError keyOf(const char *path, DentryKey &key);
+
+    /**
+     * \brief Drop a cached lookup.
+     *
+     * Needs to be called when an entry is changed behind our back, for
+     * example when FatFs extends a file.
+     */
+    void forget(const DentryKey &key) {
+        dentries.remove(key);
+        invalidate();
+    }
+
+    /// Drop buffered directory and FAT sectors, after the store was written by someone else.
+    void invalidate();
+
+    /// Drop all cached lookups as well, after any part of the volume may have changed.
+    void forgetAll() {
+        dentries.clear();
+        invalidate();
+    }
+
+    /**
+     * \brief Look up an absolute path.
+     *
+     * The root directory itself is returned as a directory entry with no
+     * location (lba 0).
+     */
+    FatError lookup(const char *path, DirEntry &entry);
+
+    /// Look up the parent directory of a path, and return the final component.
+    FatError lookupParent(const char *path, uint32_t &dirCluster, const char *&name);
+
+    /// Create a directory entry. The entry's name and parent are taken from `entry`.
+    FatError createEntry(DirEntry &entry);
+
+    /// Write back the name, cluster, size and attributes of an entry.
+    FatError updateEntry(const DirEntry &entry);
+
+    /// Mark an entry as deleted. Its cluster chain is left alone.
+    FatError deleteEntry(const DirEntry &entry);
+
+    /**
+     * \brief Rename or move a file or directory.
+     *
+     * Only directory entries are touched, no file data is copied. If `to`
+     * is an existing directory, the entry is moved into it.
+     */
+    FatError move(const char *from, const char *to);
+
+    /**
+     * \brief Create an empty FAT12 filesystem spanning a whole store.
+     *
+     * Meant for small stores such as the RAM disk, fails on stores too
+     * large for FAT12.
+     */
+    static FatError format(BlockStore &store, const char *label);
+
+    FatVolume(BlockStore *store_);
+    ~FatVolume() = default;
+};
@@ -0,0 +1,287 @@
+/**
+ * \file
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "fileops.hh"
+#include "filereader.hh"
+#include "scratch.hh"
+
+#include <cstring>
+
+using namespace MuStore;
+
+static auto &transferBuffer = scratch.copy;
+
+static const uint32_t transferSectors = sizeof(transferBuffer) / FatVolume::sectorSize;
+
+FatError copyFile(FatVolume  &fromVolume,
+                  const char *from,
+                  FatVolume  &toVolume,
+                  const char *to,
+                  uint32_t   &bytes,
+                  Lz4Reader  *lz4) {
+    bytes = 0;
+
+    FatVolume::DirEntry source;
+    FatError err = fromVolume.lookup(from, source);
+    if (err)
+        return err;
+    if (source.isDirectory())
+        return FAT_ERR_IS_DIR;
+
+    // A compressed source is read through the decompressor instead of
+    // straight from its sectors.
+    uint32_t size = source.size;
+    bool     decompress = false;
+    if (lz4) {
+        FileReader reader(*lz4);
+        if ((err = reader.open(fromVolume, from)))
+            return err;
+        decompress = reader.isCompressed() && reader.getSize();
+        if (decompress)
+            size = reader.getSize();
+    }
+
+    FatVolume::DirEntry target;
+
+    if (!(err = toVolume.lookup(to, target))) {
+        if (target.isDirectory()) {
+            // Copy into the given directory, keeping the name.
+            uint32_t dir = target.cluster;
+            err = toVolume.findShort(dir, source.name, target);
+            if (err == FAT_ERR_NOT_FOUND) {
+                memset(&target, 0, sizeof(target));
+                memcpy(target.name, source.name, sizeof(target.name));
+                target.parent = dir;
+            } else if (err) {
+                return err;
+            } else if (target.isDirectory()) {
+                return FAT_ERR_IS_DIR;
+            }
+        }
+    } else if (err == FAT_ERR_NOT_FOUND) {
+        const char *name;
+        memset(&target, 0, sizeof(target));
+        if ((err = toVolume.lookupParent(to, target.parent, name)))
+            return err;
+        if (!FatVolume::toShortName(name, target.name))
+            return FAT_ERR_INVALID_NAME;
+    } else {
+        return err;
+    }
+
+    if (&fromVolume == &toVolume
+        && target.lba == source.lba && target.offset == source.offset)
+        return FAT_ERR_INVALID_ARG; // Copying a file onto itself.
+
+    // An existing target keeps its contents until the copy is complete, so
+    // a failed copy leaves it as it was. This needs room for both.
+    uint32_t oldCluster = target.lba ? target.cluster : 0;
+
+    uint32_t clusterSize = toVolume.getClusterSize();
+    uint32_t clusters    = (size + clusterSize - 1) / clusterSize;
+    uint32_t first       = 0;
+
+    if (clusters && (err = toVolume.allocate(clusters, first)))
+        return err;
+
+    if (!target.lba) {
+        target.attributes = 0x20; // Archive.
+        if ((err = toVolume.createEntry(target))) {
+            if (first)
+                toVolume.freeChain(first);
+            return err;
+        }
+    }
+
+    BlockStore &fromStore = fromVolume.getStore();
+    BlockStore &toStore   = toVolume.getStore();
+
+    FatVolume::Cursor sourceCursor { source.cluster, 0 };
+    FatVolume::Cursor targetCursor { first,          0 };
+
+    uint32_t remaining = (size + FatVolume::sectorSize - 1) / FatVolume::sectorSize;
+
+    if (decompress && (err = lz4->open(fromVolume, from)))
+        remaining = 0;
+
+    while (remaining) {
+        uint32_t want = remaining < transferSectors ? remaining : transferSectors;
+        uint32_t count;
+
+        const uint8_t *data;
+        if (decompress) {
+            size_t readBytes;
+            if ((err = lz4->read(transferBuffer, want * FatVolume::sectorSize, readBytes)))
+                break;
+            if (!readBytes) {
+                err = FAT_ERR_IO; // Shorter than the frame says.
+                break;
+            }
+            // Pad the last sector.
+            count = (uint32_t)(readBytes + FatVolume::sectorSize - 1) / FatVolume::sectorSize;
+            memset(transferBuffer + readBytes, 0, count * FatVolume::sectorSize - readBytes);
+            data = transferBuffer;
+
+        } else {
+            uint32_t lba;
+            if ((err = fromVolume.nextRun(sourceCursor, want, lba, count)))
+                break;
+            if (!count) {
+                err = FAT_ERR_IO; // The chain is shorter than the file size.
+                break;
+            }
+
+            // Memory-mapped sources are written out directly.
+            data = fromStore.getMapping(lba);
+            if (!data) {
+                if (fromStore.seek(lba) || fromStore.readBlocks(transferBuffer, count)) {
+                    err = FAT_ERR_IO;
+                    break;
+                }
+                data = transferBuffer;
+            }
+        }
+
+        // The target chain may be fragmented, so a run may need several writes.
+        for (uint32_t done = 0; done < count; ) {
+            uint32_t targetLba;
+            uint32_t targetCount;
+            if ((err = toVolume.nextRun(targetCursor, count - done, targetLba, targetCount)))
+                break;
+            if (!targetCount) {
+                err = FAT_ERR_IO;
+                break;
+            }
+            if (toStore.seek(targetLba)
+                || toStore.writeBlocks(data + done * FatVolume::sectorSize, targetCount)) {
+                err = FAT_ERR_IO;
+                break;
+            }
+            done += targetCount;
+        }
+        if (err)
+            break;
+
+        remaining -= count;
+    }
+
+    if (err) {
+        // Leave the old file, or an empty new one, rather than a partial one.
+        if (first)
+            toVolume.freeChain(first);
+        return err;
+    }
+
+    target.cluster = first;
+    target.size    = size;
+
+    if ((err = toVolume.updateEntry(target))) {
+        if (first)
+            toVolume.freeChain(first);
+        return err;
+    }
+
+    bytes = size;
+
+    if (oldCluster && (err = toVolume.freeChain(oldCluster)))
+        return err;
+
+    return FAT_ERR_OK;
+}
+
+FatError createFile(FatVolume &volume,
+                    const char *path,
+                    uint32_t size,
+                    FatVolume::DirEntry &entry) {
+
+    memset(&entry, 0, sizeof(entry));
+
+    const char *name;
+    FatError err = volume.lookupParent(path, entry.parent, name);
+    if (err)
+        return err;
+    if (!FatVolume::toShortName(name, entry.name))
+        return FAT_ERR_INVALID_NAME;
+
+    uint32_t clusterSize = volume.getClusterSize();
+    uint32_t clusters    = (size + clusterSize - 1) / clusterSize;
+
+    if (clusters && (err = volume.allocate(clusters, entry.cluster)))
+        return err;
+
+    entry.attributes = 0x20; // Archive.
+    entry.size       = size;
+
+    if ((err = volume.createEntry(entry))) {
+        if (entry.cluster)
+            volume.freeChain(entry.cluster);
+        return err;
+    }
+
+    return FAT_ERR_OK;
+}
+
+FatError truncateFile(FatVolume &volume, FatVolume::DirEntry &entry, uint32_t size) {
+    if (size > entry.size)
+        return FAT_ERR_INVALID_ARG;
+
+    uint32_t clusterSize = volume.getClusterSize();
+    uint32_t keep        = (size + clusterSize - 1) / clusterSize;
+    uint32_t rest        = entry.cluster; // The part of the chain to release.
+    FatError err;
+
+    if (keep && entry.cluster) {
+        uint32_t last = entry.cluster;
+        for (uint32_t i = 1; i < keep; i++) {
+            if ((err = volume.getFatEntry(last, last)))
+                return err;
+            if (volume.isEndOfChain(last))
+                return FAT_ERR_IO; // The chain is shorter than the file size says.
+        }
+        if ((err = volume.getFatEntry(last, rest)))
+            return err;
+        if (volume.isEndOfChain(rest))
+            rest = 0;
+        else if ((err = volume.setFatEntry(last, volume.endOfChain())))
+            return err;
+    } else {
+        entry.cluster = 0;
+    }
+
+    entry.size = size;
+    if ((err = volume.updateEntry(entry)))
+        return err;
+
+    return rest ? volume.freeChain(rest) : FAT_ERR_OK;
+}
+
+FatError removeFile(FatVolume &volume, const char *path) {
+    FatVolume::DirEntry entry;
+    FatError err = volume.lookup(path, entry);
+    if (err)
+        return err;
+    if (entry.isDirectory())
+        return FAT_ERR_IS_DIR;
+
+    if ((err = volume.deleteEntry(entry)))
+        return err;
+
+    return entry.cluster ? volume.freeChain(entry.cluster) : FAT_ERR_OK;
+}
@@ -0,0 +1,79 @@
+/**
+ * \file
+ * \brief     Bulk file operations.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "fatvol.hh"
+
+class Lz4Reader;
+
+/**
+ * \brief Copy a file.
+ *
+ * The destination's cluster chain is allocated up front, preferably as a
+ * single contiguous run. Data is then moved in runs of up to several
+ * clusters using the store's multi-block transfers.
+ *
+ * If `to` is an existing directory, the file is copied into it. An existing
+ * destination file is replaced once the copy is complete, so it is kept if
+ * the copy fails, and the volume must have room for both.
+ *
+ * The source and destination may be on different volumes.
+ *
+ * Given an Lz4Reader, compressed sources (see FileReader) are written out
+ * decompressed. Frames that do not state their size, and all compressed
+ * files without a reader, are copied as stored.
+ *
+ * \param bytes the amount of bytes copied
+ */
+FatError copyFile(FatVolume  &fromVolume,
+                  const char *from,
+                  FatVolume  &toVolume,
+                  const char *to,
+                  uint32_t   &bytes,
+                  Lz4Reader  *lz4 = nullptr);
+
+/// Copy a file within a volume.
+inline FatError copyFile(FatVolume &volume, const char *from, const char *to, uint32_t &bytes,
+                         Lz4Reader *lz4 = nullptr) {
+    return copyFile(volume, from, volume, to, bytes, lz4);
+}
+
+/**
+ * \brief Create a file of a given size.
+ *
+ * Space for the file is allocated up front, as one contiguous run if
+ * possible. Its contents are undefined.
+ */
+FatError createFile(FatVolume &volume,
+                    const char *path,
+                    uint32_t size,
+                    FatVolume::DirEntry &entry);
+
+/**
+ * \brief Shrink a file to `size` bytes.
+ *
+ * Clusters past the new end are released. `entry` is updated.
+ */
+FatError truncateFile(FatVolume &volume, FatVolume::DirEntry &entry, uint32_t size);
+
+/// Delete a file and release its clusters.
+FatError removeFile(FatVolume &volume, const char *path);
@@ -0,0 +1,62 @@
+/**
+ * \file
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "filereader.hh"
+
+FatError FileReader::open(FatVolume &volume, const char *path) {
+    compressed = false;
+
+    FatError err = file.open(volume, path);
+    if (err)
+        return err;
+
+    if (!file.isCompressed() && !Lz4Reader::isLz4Path(path))
+        return FAT_ERR_OK;
+
+    compressed = true;
+    return lz4.open(volume, path);
+}
+
+FatError FileReader::seek(uint32_t offset) {
+    if (!compressed)
+        return file.seek(offset);
+
+    FatError err;
+    if (offset < lz4.getPosition() && (err = lz4.rewind()))
+        return err;
+
+    uint8_t buffer[64];
+    while (lz4.getPosition() < offset) {
+        size_t length = offset - lz4.getPosition();
+        size_t readBytes;
+        if ((err = lz4.read(buffer, length < sizeof(buffer) ? length : sizeof(buffer), readBytes)))
+            return err;
+        if (!readBytes)
+            return FAT_ERR_INVALID_ARG; // Past the end.
+    }
+
+    return FAT_ERR_OK;
+}
+
+FatError FileReader::read(void *data, size_t length, size_t &bytesRead) {
+    return compressed ? lz4.read(data, length, bytesRead)
+                      : file.read(data, length, bytesRead);
+}
@@ -0,0 +1,85 @@
+/**
+ * \file
+ * \brief     Reads files as they were before mkfatimg compressed them.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "fatfile.hh"
+#include "lz4.hh"
+
+/**
+ * \brief Reads the contents of a file, decompressing it if it is stored
+ *        as an LZ4 frame.
+ *
+ * Files are decompressed if mkfatimg marked them as compressed in its
+ * manifest, or if their name ends in .lz4. Commands read files through
+ * this, so that they all see the same bytes as the files on the host.
+ *
+ * Decompression uses a shared Lz4Reader, which is large: only one
+ * compressed file can be open at a time.
+ */
+class FileReader {
+
+    FatFile    file;
+    Lz4Reader &lz4;
+    bool       compressed = false;
+
+public:
+    FatError open(FatVolume &volume, const char *path);
+
+    bool isCompressed() const { return compressed; }
+
+    /// Get the size of the contents, after decompression.
+    uint32_t getSize() const { return compressed ? lz4.getSize() : file.getSize(); }
+
+    uint32_t getPosition() const { return compressed ? lz4.getPosition() : file.getPosition(); }
+
+    /// Get the amount of bytes read from the store so far.
+    uint32_t getStoredPosition() const {
+        return compressed ? lz4.getCompressedPosition() : file.getPosition();
+    }
+
+    /**
+     * \brief Go to an offset in the contents.
+     *
+     * In a compressed file, seeking back decompresses again from the
+     * start, and seeking forward decompresses up to the offset.
+     */
+    FatError seek(uint32_t offset);
+
+    /**
+     * \brief Read from the current position.
+     *
+     * Reading at the end of the file is not an error, bytesRead is 0 then.
+     */
+    FatError read(void *data, size_t length, size_t &bytesRead);
+
+    /// Check whether readDirect() can be used, see FatFile::isMapped().
+    bool isMapped() const { return !compressed && file.isMapped(); }
+
+    /// See FatFile::readDirect(), for uncompressed files only.
+    FatError readDirect(const uint8_t *&data, size_t maxLength, size_t &length) {
+        return compressed ? FAT_ERR_INVALID_ARG : file.readDirect(data, maxLength, length);
+    }
+
+    FileReader(Lz4Reader &lz4_) : lz4(lz4_) { }
+    ~FileReader() = default;
+};
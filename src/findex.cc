@@ -0,0 +1,277 @@
+/**
+ * \file
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "findex.hh"
+
+#include <cstring>
+
+static inline char toLower(char c) {
+    return c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : c;
+}
+
+static bool hasWildcards(const char *pattern) {
+    return strpbrk(pattern, "*?") != nullptr;
+}
+
+/// Match a string against a glob pattern, case-insensitively.
+static bool globMatch(const char *pattern, const char *str) {
+    // Backtrack to the last star only, which is enough for glob patterns.
+    const char *star     = nullptr;
+    const char *starStr  = nullptr;
+
+    while (*str) {
+        if (*pattern == '*') {
+            star    = pattern++;
+            starStr = str;
+        } else if (*pattern == '?' || (*pattern && toLower(*pattern) == toLower(*str))) {
+            pattern++;
+            str++;
+        } else if (star) {
+            pattern = star + 1;
+            str     = ++starStr;
+        } else {
+            return false;
+        }
+    }
+    while (*pattern == '*')
+        pattern++;
+
+    return !*pattern;
+}
+
+uint16_t FileIndex::bucketOf(const char name[11]) {
+    // FNV-1a.
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < 11; i++)
+        h = (h ^ (uint8_t)name[i]) * 16777619u;
+    return (uint16_t)(h % bucketCount);
+}
+
+uint16_t FileIndex::dirOf(uint32_t cluster) const {
+    for (uint16_t d = 0; d < dirCount; d++) {
+        if (dirs[d].cluster == cluster)
+            return d;
+    }
+    return none;
+}
+
+uint16_t FileIndex::lookup(uint16_t dir, const char name[11]) const {
+    for (uint16_t i = buckets[bucketOf(name)]; i != none; i = entries[i].next) {
+        if (entries[i].dir == dir && !memcmp(entries[i].name, name, 11))
+            return i;
+    }
+    return none;
+}
+
+void FileIndex::add(const FatVolume::DirEntry &entry) {
+    // Entries in directories we have not reached yet are picked up by the scan.
+    uint16_t dir = dirOf(entry.parent);
+    if (dir == none)
+        return;
+
+    uint16_t i = lookup(dir, entry.name);
+    if (i == none) {
+        if (freeList != none) {
+            i        = freeList;
+            freeList = entries[i].next;
+        } else if (entryCount < maxEntries) {
+            i = entryCount++;
+        } else {
+            overflow = true;
+            return;
+        }
+
+        Entry &e = entries[i];
+        memcpy(e.name, entry.name, sizeof(e.name));
+        e.dir  = dir;
+
+        uint16_t &bucket = buckets[bucketOf(e.name)];
+        e.next = bucket;
+        bucket = i;
+    }
+
+    Entry &e = entries[i];
+    e.flags  = flagUsed | (entry.isDirectory() ? flagDirectory : 0);
+
+    if (entry.isDirectory()) {
+        uint16_t d = dirOf(entry.cluster);
+        if (d != none) {
+            // A moved directory, its contents stay where they are.
+            dirs[d].entry = i;
+        } else if (dirCount < maxDirs) {
+            // New directories are appended, so the scan will get to them.
+            dirs[dirCount].cluster = entry.cluster;
+            dirs[dirCount].entry   = i;
+            dirCount++;
+        } else {
+            overflow = true;
+        }
+    }
+}
+
+void FileIndex::remove(const FatVolume::DirEntry &entry) {
+    uint16_t dir = dirOf(entry.parent);
+    if (dir == none)
+        return;
+
+    uint16_t i = lookup(dir, entry.name);
+    if (i == none)
+        return;
+
+    for (uint16_t *p = &buckets[bucketOf(entry.name)]; *p != none; p = &entries[*p].next) {
+        if (*p == i) {
+            *p = entries[i].next;
+            break;
+        }
+    }
+
+    if (entries[i].flags & flagDirectory) {
+        uint16_t d = dirOf(entry.cluster);
+        if (d != none && dirs[d].entry == i)
+            dirs[d].entry = none; // Hides the directory's contents from queries.
+    }
+
+    entries[i].flags = 0;
+    entries[i].next  = freeList;
+    freeList = i;
+}
+
+void FileIndex::attach(FatVolume &volume_) {
+    volume = &volume_;
+    volume->setObserver(this);
+
+    for (size_t i = 0; i < bucketCount; i++)
+        buckets[i] = none;
+
+    dirs[0].cluster = 0;
+    dirs[0].entry   = none;
+    dirCount   = 1;
+    entryCount = 0;
+    freeList   = none;
+    scanDir    = 0;
+    scanIndex  = 0;
+    overflow   = false;
+    failed     = false;
+}
+
+bool FileIndex::step(size_t count) {
+    if (!volume || failed)
+        return false;
+
+    while (count-- && scanDir < dirCount) {
+        FatVolume::DirEntry entry;
+        FatError err = volume->readDir(dirs[scanDir].cluster, scanIndex, entry);
+
+        if (err == FAT_ERR_NOT_FOUND) {
+            scanDir++;
+            scanIndex = 0;
+        } else if (err) {
+            failed = true;
+            return false;
+        } else if (entry.name[0] != '.') {
+            add(entry);
+        }
+    }
+
+    return scanDir < dirCount;
+}
+
+size_t FileIndex::getEntryCount() const {
+    size_t count = 0;
+    for (size_t i = 0; i < entryCount; i++) {
+        if (entries[i].flags & flagUsed)
+            count++;
+    }
+    return count;
+}
+
+void FileIndex::entryChanged(const FatVolume::DirEntry &entry, bool exists) {
+    if (!volume || entry.name[0] == '.')
+        return;
+
+    if (exists)
+        add(entry);
+    else
+        remove(entry);
+}
+
+bool FileIndex::matches(uint16_t i, const char *pattern) const {
+    if (!(entries[i].flags & flagUsed))
+        return false;
+
+    char name[13];
+    FatVolume::fromShortName(entries[i].name, name);
+
+    return globMatch(pattern, name);
+}
+
+uint16_t FileIndex::findNext(const char *pattern, uint16_t after) const {
+    if (hasWildcards(pattern)) {
+        for (uint16_t i = (uint16_t)(after == none ? 0 : after + 1); i < entryCount; i++) {
+            if (matches(i, pattern))
+                return i;
+        }
+        return none;
+    }
+
+    char shortName[11];
+    if (!FatVolume::toShortName(pattern, shortName))
+        return none;
+
+    uint16_t i = after == none ? buckets[bucketOf(shortName)] : entries[after].next;
+    for (; i != none; i = entries[i].next) {
+        if (!memcmp(entries[i].name, shortName, sizeof(shortName)))
+            return i;
+    }
+    return none;
+}
+
+bool FileIndex::getPath(uint16_t i, char *buffer, size_t size) const {
+    // Build the path backwards from the end of the buffer.
+    if (!size)
+        return false;
+
+    size_t pos = size - 1;
+    buffer[pos] = '\0';
+
+    while (true) {
+        char name[13];
+        FatVolume::fromShortName(entries[i].name, name);
+        size_t length = strlen(name);
+
+        if (pos < length + 1)
+            return false;
+        pos -= length;
+        memcpy(buffer + pos, name, length);
+        buffer[--pos] = '/';
+
+        uint16_t dir = entries[i].dir;
+        if (!dir)
+            break;
+
+        i = dirs[dir].entry;
+        if (i == none)
+            return false; // The parent directory was deleted.
+    }
+
+    memmove(buffer, buffer + pos, size - pos);
+
+    return true;
+}
@@ -0,0 +1,139 @@
+/**
+ * \file
+ * \brief     In-memory index of all file names on a volume.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "fatvol.hh"
+
+// Index capacity, set by the Makefile.
+#ifndef FINDEX_ENTRIES
+#define FINDEX_ENTRIES 256
+#endif
+
+/**
+ * \brief Indexes the short names of all files and directories on a volume.
+ *
+ * The index is built a few entries at a time by calling step() while the
+ * system is idle, directories are scanned breadth-first. Afterwards it is
+ * kept up to date through FatVolume's observer interface, so that name
+ * queries never need to touch the store.
+ *
+ * Each entry takes 16 bytes, plus 8 per directory and 2 per hash bucket;
+ * the default of 256 entries takes 4.5 KB. Once the index is full,
+ * further names are dropped and isComplete() stays false.
+ */
+class FileIndex : public FatVolume::Observer {
+
+public:
+    static const size_t   maxEntries = FINDEX_ENTRIES;
+    static const size_t   maxDirs    = maxEntries / 8;
+    static const uint16_t none       = 0xffff;
+
+private:
+    static const size_t bucketCount = maxEntries / 4;
+
+    static const uint8_t flagUsed      = 0x01;
+    static const uint8_t flagDirectory = 0x02;
+
+    struct Entry {
+        char     name[11]; ///< Space-padded 8.3 name.
+        uint8_t  flags;
+        uint16_t dir;      ///< Index of the parent directory in `dirs`.
+        uint16_t next;     ///< Next entry in the same bucket, or in the free list.
+    };
+
+    /// An indexed directory. dirs[0] is the root directory.
+    struct Dir {
+        uint32_t cluster;
+        uint16_t entry;    ///< The directory's own entry, none for the root or a deleted directory.
+    };
+
+    FatVolume *volume = nullptr;
+
+    Entry    entries[maxEntries];
+    Dir      dirs[maxDirs];
+    uint16_t buckets[bucketCount];
+    uint16_t entryCount = 0; ///< Entries in use, including freed ones.
+    uint16_t dirCount   = 0;
+    uint16_t freeList   = none;
+
+    uint16_t scanDir   = 0; ///< Directory currently being scanned.
+    uint32_t scanIndex = 0; ///< readDir() position within that directory.
+    bool     overflow  = false;
+    bool     failed    = false;
+
+    static uint16_t bucketOf(const char name[11]);
+
+    uint16_t dirOf(uint32_t cluster) const;
+    uint16_t lookup(uint16_t dir, const char name[11]) const;
+
+    void add(const FatVolume::DirEntry &entry);
+    void remove(const FatVolume::DirEntry &entry);
+
+    bool matches(uint16_t i, const char *pattern) const;
+
+public:
+    /// Drop the index and start indexing a volume.
+    void attach(FatVolume &volume_);
+
+    /**
+     * \brief Index a number of directory entries.
+     *
+     * \return true if there is work left
+     */
+    bool step(size_t count);
+
+    /// Check whether all names on the volume are indexed.
+    bool isComplete() const { return !overflow && !failed && scanDir >= dirCount; }
+
+    size_t getEntryCount() const;
+    size_t getDirCount()   const { return dirCount; }
+    bool   isFull()        const { return overflow; }
+
+    void entryChanged(const FatVolume::DirEntry &entry, bool exists) override;
+
+    /**
+     * \brief Find the next entry matching a name or a glob pattern.
+     *
+     * Patterns may contain `*` and `?`, and are matched case-insensitively
+     * against "name.ext". Names without wildcards are looked up by hash.
+     *
+     * \param after the previous match, or none to start a new query
+     *
+     * \return the matching entry, or none
+     */
+    uint16_t findNext(const char *pattern, uint16_t after = none) const;
+
+    /**
+     * \brief Get the absolute path of an entry.
+     *
+     * \return false if the path does not fit
+     */
+    bool getPath(uint16_t i, char *buffer, size_t size) const;
+
+    bool isDirectory(uint16_t i) const { return entries[i].flags & flagDirectory; }
+
+    FileIndex() = default;
+    ~FileIndex() = default;
+
+    FileIndex(const FileIndex&) = delete;
+    void operator=(const FileIndex&) = delete;
+};
@@ -0,0 +1,113 @@
+/**
+ * \file
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "framelink.hh"
+#include "crc.hh"
+
+static const uint8_t frameEnd    = 0xc0;
+static const uint8_t frameEsc    = 0xdb;
+static const uint8_t frameEscEnd = 0xdc;
+static const uint8_t frameEscEsc = 0xdd;
+static const uint8_t frameEscLf  = 0xde;
+static const uint8_t frameEscCr  = 0xdf;
+
+void FrameLink::attach(Console &con_) {
+    con      = &con_;
+    length   = 0;
+    escaped  = false;
+    overflow = false;
+}
+
+void FrameLink::sendByte(uint8_t byte) {
+    switch (byte) {
+    case frameEnd: con->putch((char)frameEsc); byte = frameEscEnd; break;
+    case frameEsc: con->putch((char)frameEsc); byte = frameEscEsc; break;
+    case '\n':     con->putch((char)frameEsc); byte = frameEscLf;  break;
+    case '\r':     con->putch((char)frameEsc); byte = frameEscCr;  break;
+    }
+    con->putch((char)byte);
+}
+
+void FrameLink::send(const void *head, size_t headLength, const void *data, size_t dataLength) {
+    uint32_t crc = crc32(data, dataLength, crc32(head, headLength));
+
+    uint8_t trailer[4];
+    putLe32(trailer, crc);
+
+    con->putch((char)frameEnd);
+    for (size_t i = 0; i < headLength; i++)
+        sendByte(((const uint8_t*)head)[i]);
+    for (size_t i = 0; i < dataLength; i++)
+        sendByte(((const uint8_t*)data)[i]);
+    for (size_t i = 0; i < sizeof(trailer); i++)
+        sendByte(trailer[i]);
+    con->putch((char)frameEnd);
+}
+
+size_t FrameLink::receive(uint32_t ms) {
+    uint32_t start = getTicks();
+
+    while (true) {
+        int c = con->getch(false);
+        if (c < 0) {
+            if (getTicks() - start >= ms)
+                return 0;
+            continue;
+        }
+
+        uint8_t byte = (uint8_t)c;
+
+        if (byte == frameEnd) {
+            // Empty frames are the start of the next one, anything
+            // damaged (or not a frame at all) is dropped.
+            size_t frameLength = 0;
+            if (!overflow && !escaped && length > 4
+                && crc32(buffer, length - 4) == getLe32(buffer + length - 4))
+                frameLength = length - 4;
+
+            length   = 0;
+            escaped  = false;
+            overflow = false;
+
+            if (frameLength)
+                return frameLength;
+            continue;
+        }
+
+        if (escaped) {
+            escaped = false;
+            switch (byte) {
+            case frameEscEnd: byte = frameEnd; break;
+            case frameEscEsc: byte = frameEsc; break;
+            case frameEscLf:  byte = '\n';     break;
+            case frameEscCr:  byte = '\r';     break;
+            default:          overflow = true; break;
+            }
+        } else if (byte == frameEsc) {
+            escaped = true;
+            continue;
+        }
+
+        if (length < bufferSize)
+            buffer[length++] = byte;
+        else
+            overflow = true;
+    }
+}
@@ -0,0 +1,102 @@
+/**
+ * \file
+ * \brief     Checksummed frames over a console.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "console.hh"
+
+#include <cstdint>
+#include <cstdlib>
+
+/**
+ * \brief Sends and receives checksummed frames over a console.
+ *
+ * Frames are delimited and escaped like SLIP, additionally escaping CR and
+ * LF so that line ending conversion cannot touch them, and end in a CRC-32.
+ * Anything outside frames, such as a shell prompt, is ignored, and so are
+ * frames that arrive damaged.
+ *
+ * The code has no dependencies on the target, so that host tools can use
+ * it as well.
+ */
+class FrameLink {
+
+    Console   *con = nullptr;
+    uint32_t (*getTicks)();
+
+    uint8_t *buffer;
+    size_t   bufferSize;
+    size_t   length   = 0;
+    bool     escaped  = false;
+    bool     overflow = false;
+
+    void sendByte(uint8_t byte);
+
+public:
+    /// Use a console from now on.
+    void attach(Console &con_);
+
+    /// Send a frame made of a header and data.
+    void send(const void *head,     size_t headLength,
+              const void *data = nullptr, size_t dataLength = 0);
+
+    /**
+     * \brief Wait for a frame.
+     *
+     * \param ms time to wait, 0 to only look at input that is available
+     *
+     * \return the length of the frame without its CRC, 0 if no valid frame was received
+     */
+    size_t receive(uint32_t ms);
+
+    /// The last frame received, valid until the next call to receive().
+    const uint8_t *getFrame() const { return buffer; }
+
+    /**
+     * \param buffer_   holds a frame while it is received, including its CRC
+     * \param getTicks_ a millisecond clock
+     */
+    FrameLink(uint8_t *buffer_, size_t bufferSize_, uint32_t (*getTicks_)())
+        : getTicks(getTicks_), buffer(buffer_), bufferSize(bufferSize_) { }
+    ~FrameLink() = default;
+};
+
+// Multi-byte fields in frames are little-endian.
+
+inline uint16_t getLe16(const uint8_t *p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+inline uint32_t getLe32(const uint8_t *p) {
+    return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+inline void putLe16(uint8_t *p, uint16_t value) {
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+}
+
+inline void putLe32(uint8_t *p, uint32_t value) {
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >>  8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+}
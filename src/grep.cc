@@ -0,0 +1,199 @@
+/**
+ * \file
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "grep.hh"
+#include "scratch.hh"
+
+#include <cstring>
+
+static const size_t sectorSize = 512;
+
+/// Holds one sector of unfinished line plus one newly read sector.
+static auto &buffer = scratch.grep;
+static_assert(sizeof(buffer) == sectorSize * 2, "grep needs two sectors of scratch memory");
+
+namespace {
+
+struct GrepState {
+    Console           &con;
+    const Bmh         &pattern;
+    const GrepOptions &options;
+    size_t lineNo;
+    size_t matches;
+
+    bool   inLongLine;  ///< The current line did not fit in the buffer.
+    bool   longMatched; ///< The current long line was already counted.
+    size_t kept;        ///< Bytes of the long line carried over to the next piece.
+
+    void printPrefix() {
+        if (options.prefix)
+            con.printf("%s:", options.prefix);
+        if (options.lineNumbers)
+            con.printf("%u:", lineNo);
+    }
+
+    void printText(const char *begin, const char *end) {
+        for (const char *p = begin; p < end; p++)
+            con.putch(*p);
+    }
+
+    void printLine(const char *begin, const char *end) {
+        printPrefix();
+        printText(begin, end);
+        con.putch('\n');
+    }
+
+    /**
+     * \brief Search a piece of a line too long for the buffer.
+     *
+     * The first `kept` bytes of the piece are the end of the previous
+     * piece, so that matches spanning two pieces are found. A long line
+     * is counted once. Once it matches, the rest of it is printed as it
+     * comes in; earlier pieces are gone by then and are shown as "...".
+     *
+     * \param last whether the piece ends the line
+     */
+    void scanLong(const char *begin, const char *end, bool last) {
+        if (!longMatched) {
+            if (pattern.find(begin, (size_t)(end - begin))) {
+                longMatched = true;
+                matches++;
+                if (!options.countOnly) {
+                    printPrefix();
+                    if (inLongLine)
+                        con.puts("...");
+                    printText(begin, end);
+                }
+            }
+        } else if (!options.countOnly) {
+            printText(begin + kept, end);
+        }
+
+        if (last) {
+            if (longMatched && !options.countOnly)
+                con.putch('\n');
+            lineNo++;
+            inLongLine  = false;
+            longMatched = false;
+            kept        = 0;
+        } else {
+            size_t overlap = pattern.getLength() - 1;
+            inLongLine = true;
+            kept       = (size_t)(end - begin) < overlap ? (size_t)(end - begin) : overlap;
+        }
+    }
+
+    /**
+     * \brief Search a region of complete lines.
+     *
+     * Rather than splitting the region into lines first, we search the
+     * whole region at once and only look for line boundaries around a match.
+     */
+    void scan(const char *begin, const char *end) {
+        const char *p = begin;
+
+        while (p < end) {
+            const char *match = pattern.find(p, (size_t)(end - p));
+            if (!match) {
+                if (options.lineNumbers)
+                    lineNo += countChar(p, (size_t)(end - p), '\n');
+                break;
+            }
+
+            const char *lineEnd = findChar(match, (size_t)(end - match), '\n');
+            if (!lineEnd)
+                lineEnd = end;
+
+            const char *lineBegin = findLastChar(p, (size_t)(match - p), '\n');
+            lineBegin = lineBegin ? lineBegin + 1 : p;
+
+            if (options.lineNumbers)
+                lineNo += countChar(p, (size_t)(lineBegin - p), '\n');
+
+            matches++;
+            if (!options.countOnly)
+                printLine(lineBegin, lineEnd);
+
+            if (lineEnd < end)
+                lineNo++;
+
+            p = lineEnd + 1;
+        }
+    }
+};
+
+}
+
+size_t grep(Console &con,
+            FileReader &file,
+            const Bmh &pattern,
+            const GrepOptions &options,
+            FatError &err) {
+
+    GrepState state { con, pattern, options, 1, 0, false, false, 0 };
+    size_t    fill = 0;
+
+    while (true) {
+        size_t readBytes;
+        if ((err = file.read(buffer + fill, sectorSize, readBytes)))
+            return state.matches;
+
+        fill += readBytes;
+
+        bool        eof   = readBytes < sectorSize;
+        const char *begin = buffer;
+        const char *end   = buffer + fill;
+
+        if (state.inLongLine) {
+            const char *lineEnd = findChar(begin, fill, '\n');
+            if (lineEnd || eof) {
+                state.scanLong(begin, lineEnd ? lineEnd : end, true);
+                begin = lineEnd ? lineEnd + 1 : end;
+            }
+        }
+
+        if (eof) {
+            // The last line need not be terminated.
+            state.scan(begin, end);
+            return state.matches;
+        }
+
+        const char *rest = begin;
+        if (!state.inLongLine) {
+            const char *lastNewline = findLastChar(begin, (size_t)(end - begin), '\n');
+            if (lastNewline)
+                rest = lastNewline + 1;
+            state.scan(begin, rest);
+        }
+
+        size_t restLength = (size_t)(end - rest);
+        if (restLength > sectorSize) {
+            // This line does not fit in our buffer, search what we have so
+            // far and keep only enough of it to find a match that
+            // continues in the next sector.
+            state.scanLong(rest, end, false);
+            rest       = end - state.kept;
+            restLength = state.kept;
+        }
+
+        memmove(buffer, rest, restLength);
+        fill = restLength;
+    }
+}
@@ -0,0 +1,48 @@
+/**
+ * \file
+ * \brief     Streaming file search.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "console.hh"
+#include "search.hh"
+#include "filereader.hh"
+
+struct GrepOptions {
+    bool lineNumbers = false; ///< Prefix matching lines with their line number.
+    bool countOnly   = false; ///< Print only the amount of matching lines.
+    const char *prefix = nullptr; ///< Printed before every line, if set.
+};
+
+/**
+ * \brief Print all lines in a file that contain a pattern.
+ *
+ * The file is read in whole sectors and searched in place, only matching
+ * lines are written to the console. Lines longer than the internal buffer
+ * are searched in overlapping pieces and still count as one line, but
+ * only the part from the piece with the first match on is printed.
+ *
+ * \return the amount of matching lines
+ */
+size_t grep(Console &con,
+            FileReader &file,
+            const Bmh &pattern,
+            const GrepOptions &options,
+            FatError &err);
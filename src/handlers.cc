@@ -20,6 +20,8 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "sam.hh"
+#include "profiler.hh"
+#include "cpustats.hh"
 
 extern "C" {
     void hang() {
@@ -40,8 +42,27 @@ extern "C" {
     void DebugMon_Handler()   __attribute__((weak, alias("dummyHandler")));
     void PendSV_Handler()     __attribute__((weak, alias("dummyHandler")));
 
-    void SysTick_Handler(void) {
+    /// Called by SysTick_Handler() with the interrupted code's stack frame.
+    __attribute__((used)) static void sysTickHandler(const uint32_t *frame) {
+        IsrTimer timer;
+
         TimeTick_Increment();
+
+        // The frame holds r0-r3, r12, lr, pc and xpsr.
+        if (profiler.isRunning())
+            profiler.sample(frame[6], frame[5]);
+    }
+
+    /**
+     * Passes the stack pointer that was in use when the interrupt hit,
+     * bit 2 of the exception return value in lr tells which one it is.
+     */
+    __attribute__((naked)) void SysTick_Handler(void) {
+        asm volatile("tst   lr, #4        \n"
+                     "ite   eq            \n"
+                     "mrseq r0, msp       \n"
+                     "mrsne r0, psp       \n"
+                     "b     sysTickHandler\n");
     }
 
     // Handlers for peripheral interrupts.
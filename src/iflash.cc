@@ -0,0 +1,79 @@
+/**
+ * \file
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "sam.hh"
+#include "iflash.hh"
+
+#include <cstring>
+
+static const uint32_t commandWritePage      = 0x01;
+static const uint32_t commandEraseWritePage = 0x03;
+
+static const uint32_t commandKey = 0x5a;
+
+/**
+ * Run a flash command. Lives in RAM, as the bank being programmed can not
+ * be read meanwhile.
+ *
+ * The firmware, vector table and handlers are in bank 0, so interrupts are
+ * masked only for commands on bank 0. The caller's interrupt mask is kept.
+ */
+__attribute__((section(".ramfunc"), noinline))
+static uint32_t runCommand(Efc *efc, uint32_t command, uint32_t argument) {
+    uint32_t primask = __get_PRIMASK();
+    if (efc == EFC0)
+        __disable_irq();
+
+    efc->EEFC_FCR = EEFC_FCR_FKEY(commandKey)
+                  | EEFC_FCR_FARG(argument)
+                  | EEFC_FCR_FCMD(command);
+
+    uint32_t status;
+    while (!((status = efc->EEFC_FSR) & EEFC_FSR_FRDY));
+
+    __set_PRIMASK(primask);
+
+    return status;
+}
+
+bool InternalFlash::programPage(size_t page, const void *data, bool erase) {
+    if (page >= pageCount)
+        return false;
+
+    uint32_t pageAddress = address + (uint32_t)(page * pageSize);
+
+    bool     bank1 = pageAddress >= IFLASH1_ADDR;
+    Efc     *efc   = bank1 ? EFC1 : EFC0;
+    uint32_t index = (pageAddress - (bank1 ? IFLASH1_ADDR : IFLASH0_ADDR)) / pageSize;
+
+    // The page's latch buffer is filled by writing words to the page's
+    // own addresses. Copy through a word, `data` may be unaligned.
+    volatile uint32_t *latch = (volatile uint32_t*)pageAddress;
+    const uint8_t     *in    = (const uint8_t*)data;
+    for (size_t i = 0; i < pageSize / 4; i++) {
+        uint32_t word;
+        memcpy(&word, in + i * 4, 4);
+        latch[i] = word;
+    }
+
+    uint32_t status = runCommand(efc, erase ? commandEraseWritePage : commandWritePage, index);
+
+    return !(status & (EEFC_FSR_FCMDE | EEFC_FSR_FLOCKE));
+}
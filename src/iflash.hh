@@ -0,0 +1,58 @@
+/**
+ * \file
+ * \brief     SAM3X internal flash programming.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "efcstore.hh"
+
+/**
+ * \brief A region of the SAM3X internal flash, programmed through the EEFC.
+ *
+ * Pages are programmed with the Write Page or Erase and Write Page
+ * commands of the flash controller of the bank they are in. The command is
+ * issued and waited for from RAM.
+ *
+ * The region may lie in bank 0, which the firmware runs from, but then
+ * interrupts are masked for the whole erase and write of each page:
+ * several milliseconds in which SysTick ticks and received UART bytes are
+ * lost. In bank 1, like the default /data region, interrupts keep running.
+ */
+class InternalFlash : public FlashPages {
+
+    uint32_t address;
+    size_t   pageCount;
+
+public:
+    size_t getPageCount() const { return pageCount; }
+
+    const uint8_t *getPage(size_t page) const {
+        return (const uint8_t*)(address + page * pageSize);
+    }
+
+    bool programPage(size_t page, const void *data, bool erase);
+
+    /// A page-aligned region of `size` bytes at `address_`.
+    InternalFlash(uint32_t address_, size_t size)
+        : address(address_),
+          pageCount(size / pageSize) { }
+
+    ~InternalFlash() = default;
+};
@@ -0,0 +1,45 @@
+/**
+ * \file
+ * \brief     Driver I/O counters.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstdint>
+
+/**
+ * \brief Running totals kept by the storage and console drivers.
+ *
+ * The counters only ever increase (and wrap around), take the difference
+ * of two snapshots to measure an operation.
+ */
+struct IoStats {
+    uint32_t storeBytesRead;
+    uint32_t storeBytesWritten;
+    uint32_t storeWaitCycles;   ///< Spent waiting for the SD card to become ready.
+
+    uint32_t consoleBytes;
+    uint32_t consoleWaitCycles; ///< Spent waiting for the UART transmitter.
+
+    uint32_t consoleRxInterrupts;
+    uint32_t consoleRxCycles;    ///< Spent in receive interrupt handlers.
+    uint32_t consoleRxMaxCycles; ///< Longest receive interrupt, not a running total.
+};
+
+extern IoStats ioStats;
@@ -0,0 +1,177 @@
+/**
+ * \file
+ * \brief     Fixed-size hashed LRU cache type.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+/**
+ * \brief Maps keys to values, evicting the least recently used entry when full.
+ *
+ * K must provide `uint32_t hash() const` and `operator==`. V need not be
+ * default-constructible, values are constructed in place on insertion.
+ * At most 254 entries are supported.
+ */
+template<typename K, typename V, size_t size, size_t bucketCount = size>
+class LruCache {
+
+    static_assert(size > 0 && size < 255, "LruCache size must be within 1..254");
+
+    static const uint8_t none = 0xff;
+
+    struct Slot {
+        K       key;
+        uint8_t bucketNext; ///< Next slot in the same hash bucket.
+        uint8_t prev;       ///< More recently used slot.
+        uint8_t next;       ///< Less recently used slot.
+        bool    used;
+
+        alignas(V) uint8_t storage[sizeof(V)];
+
+        V &value() { return *reinterpret_cast<V*>(storage); }
+    };
+
+    Slot    slots[size];
+    uint8_t buckets[bucketCount];
+    uint8_t mru;  ///< Most recently used slot.
+    uint8_t lru;  ///< Least recently used slot.
+    uint8_t free; ///< First unused slot, chained through `next`.
+
+    uint8_t &bucketOf(const K &key) {
+        return buckets[key.hash() % bucketCount];
+    }
+
+    void unlink(uint8_t i) {
+        Slot &s = slots[i];
+        if (s.prev != none) slots[s.prev].next = s.next; else mru = s.next;
+        if (s.next != none) slots[s.next].prev = s.prev; else lru = s.prev;
+    }
+
+    void linkFront(uint8_t i) {
+        Slot &s = slots[i];
+        s.prev = none;
+        s.next = mru;
+        if (mru != none)
+            slots[mru].prev = i;
+        mru = i;
+        if (lru == none)
+            lru = i;
+    }
+
+    void release(uint8_t i) {
+        Slot &s = slots[i];
+
+        for (uint8_t *p = &bucketOf(s.key); *p != none; p = &slots[*p].bucketNext) {
+            if (*p == i) {
+                *p = s.bucketNext;
+                break;
+            }
+        }
+
+        unlink(i);
+        s.value().~V();
+        s.used = false;
+        s.next = free;
+        free   = i;
+    }
+
+    uint8_t lookup(const K &key) {
+        for (uint8_t i = bucketOf(key); i != none; i = slots[i].bucketNext) {
+            if (slots[i].key == key)
+                return i;
+        }
+        return none;
+    }
+
+public:
+    /// Find a value, and mark it as most recently used.
+    V *find(const K &key) {
+        uint8_t i = lookup(key);
+        if (i == none)
+            return nullptr;
+
+        unlink(i);
+        linkFront(i);
+
+        return &slots[i].value();
+    }
+
+    /// Insert or replace a value.
+    void insert(const K &key, const V &value) {
+        uint8_t i = lookup(key);
+        if (i != none)
+            release(i);
+
+        if (free == none)
+            release(lru);
+
+        i    = free;
+        free = slots[i].next;
+
+        Slot &s = slots[i];
+        s.key   = key;
+        s.used  = true;
+        new (s.storage) V(value);
+
+        uint8_t &bucket = bucketOf(key);
+        s.bucketNext = bucket;
+        bucket       = i;
+
+        linkFront(i);
+    }
+
+    void remove(const K &key) {
+        uint8_t i = lookup(key);
+        if (i != none)
+            release(i);
+    }
+
+    /// Remove all entries for which a predicate holds.
+    template<typename F>
+    void removeIf(F predicate) {
+        for (size_t i = 0; i < size; i++) {
+            if (slots[i].used && predicate(slots[i].key, slots[i].value()))
+                release((uint8_t)i);
+        }
+    }
+
+    void clear() {
+        removeIf([](const K&, const V&) { return true; });
+    }
+
+    LruCache() {
+        for (size_t i = 0; i < bucketCount; i++)
+            buckets[i] = none;
+        for (size_t i = 0; i < size; i++) {
+            slots[i].used = false;
+            slots[i].next = (uint8_t)(i + 1 < size ? i + 1 : none);
+        }
+        mru  = lru = none;
+        free = 0;
+    }
+
+    ~LruCache() { clear(); }
+
+    LruCache(const LruCache&) = delete;
+    void operator=(const LruCache&) = delete;
+};
@@ -0,0 +1,235 @@
+/**
+ * \file
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "lz4.hh"
+
+#include <cstring>
+
+static const uint32_t frameMagic = 0x184d2204;
+
+static const uint8_t flagVersionMask   = 0xc0;
+static const uint8_t flagVersion       = 0x40;
+static const uint8_t flagBlockChecksum = 0x10;
+static const uint8_t flagContentSize   = 0x08;
+static const uint8_t flagChecksum      = 0x04;
+static const uint8_t flagDictionary    = 0x01;
+
+bool Lz4Reader::refill() {
+    if (error)
+        return false;
+
+    size_t   readBytes;
+    FatError err = file.read(input, inputSize, readBytes);
+    if (err || !readBytes) {
+        error = err ? err : FAT_ERR_IO; // Truncated frame.
+        return false;
+    }
+    inputPos    = 0;
+    inputLength = readBytes;
+
+    return true;
+}
+
+uint8_t Lz4Reader::nextByte() {
+    if (inputPos == inputLength && !refill())
+        return 0;
+    return input[inputPos++];
+}
+
+uint8_t Lz4Reader::blockByte() {
+    if (!blockLeft) {
+        error = FAT_ERR_INVALID_ARG; // A sequence runs past the end of its block.
+        return 0;
+    }
+    blockLeft--;
+    return nextByte();
+}
+
+uint32_t Lz4Reader::nextLength(uint32_t nibble) {
+    uint32_t length = nibble;
+    if (nibble == 15) {
+        uint8_t byte;
+        do {
+            byte    = blockByte();
+            length += byte;
+        } while (byte == 255 && !error);
+    }
+    return length;
+}
+
+void Lz4Reader::skip(size_t count) {
+    while (count--)
+        nextByte();
+}
+
+FatError Lz4Reader::open(FatVolume &volume, const char *path) {
+    error = file.open(volume, path);
+    return start();
+}
+
+FatError Lz4Reader::rewind() {
+    error = file.seek(0);
+    return start();
+}
+
+FatError Lz4Reader::start() {
+    position     = 0;
+    inputPos     = 0;
+    inputLength  = 0;
+    contentSize  = 0;
+    frameDone    = false;
+    blockLeft    = 0;
+    blockRaw     = false;
+    blockOpen    = false;
+    literalsLeft = 0;
+    matchLeft    = 0;
+    matchPending = false;
+
+    uint32_t magic = 0;
+    for (size_t i = 0; i < 4; i++)
+        magic |= (uint32_t)nextByte() << (i * 8);
+
+    flags = nextByte();
+    nextByte(); // Block size, irrelevant as we stream.
+
+    if (error)
+        return error;
+    if (magic != frameMagic
+        || (flags & flagVersionMask) != flagVersion
+        || (flags & flagDictionary))
+        return error = FAT_ERR_INVALID_ARG;
+
+    if (flags & flagContentSize) {
+        uint32_t high = 0;
+        for (size_t i = 0; i < 4; i++)
+            contentSize |= (uint32_t)nextByte() << (i * 8);
+        for (size_t i = 0; i < 4; i++)
+            high |= nextByte();
+        if (high)
+            return error = FAT_ERR_INVALID_ARG;
+    }
+
+    nextByte(); // Header checksum.
+
+    return error;
+}
+
+FatError Lz4Reader::read(void *data, size_t length, size_t &bytesRead) {
+    uint8_t *out = (uint8_t*)data;
+
+    bytesRead = 0;
+
+    while (bytesRead < length && !error) {
+        if (literalsLeft) {
+            // Copy as many literals as the input buffer holds at once.
+            if (inputPos == inputLength && !refill())
+                break;
+
+            size_t count = inputLength - inputPos;
+            if (count > literalsLeft)         count = literalsLeft;
+            if (count > length - bytesRead)   count = length - bytesRead;
+            if (count > blockLeft)            count = blockLeft;
+            if (!count) {
+                error = FAT_ERR_INVALID_ARG;
+                break;
+            }
+
+            for (size_t i = 0; i < count; i++)
+                emit(out++, input[inputPos++]);
+
+            literalsLeft -= (uint32_t)count;
+            blockLeft    -= (uint32_t)count;
+            bytesRead    += count;
+
+        } else if (matchLeft) {
+            // Matches may overlap their own output, so copy bytewise.
+            size_t count = matchLeft;
+            if (count > length - bytesRead)
+                count = length - bytesRead;
+
+            for (size_t i = 0; i < count; i++)
+                emit(out++, window[(position - matchOffset) % windowSize]);
+
+            matchLeft -= (uint32_t)count;
+            bytesRead += count;
+
+        } else if (matchPending) {
+            matchPending = false;
+            if (!blockLeft)
+                continue; // The last sequence of a block has no match.
+
+            matchOffset  = blockByte();
+            matchOffset |= (uint32_t)blockByte() << 8;
+            if (!matchOffset || matchOffset > windowSize || matchOffset > position) {
+                error = FAT_ERR_INVALID_ARG;
+                break;
+            }
+            matchLeft = nextLength(matchNibble) + 4;
+
+        } else if (blockLeft) {
+            if (blockRaw) {
+                literalsLeft = blockLeft;
+            } else {
+                uint8_t token = blockByte();
+                literalsLeft  = nextLength(token >> 4);
+                matchNibble   = token & 0x0f;
+                matchPending  = true;
+            }
+
+        } else if (blockOpen) {
+            blockOpen = false;
+            if (flags & flagBlockChecksum)
+                skip(4);
+
+        } else {
+            if (frameDone)
+                break;
+
+            uint32_t size = 0;
+            for (size_t i = 0; i < 4; i++)
+                size |= (uint32_t)nextByte() << (i * 8);
+
+            if (!size) {
+                if (flags & flagChecksum)
+                    skip(4);
+                frameDone = true;
+                break;
+            }
+
+            blockRaw  = size & 0x80000000;
+            blockLeft = size & 0x7fffffff;
+            blockOpen = true;
+        }
+    }
+
+    return error;
+}
+
+bool Lz4Reader::isLz4Path(const char *path) {
+    size_t length = strlen(path);
+    if (length < 4)
+        return false;
+
+    const char *ext = path + length - 4;
+    return ext[0] == '.'
+        && (ext[1] | 0x20) == 'l'
+        && (ext[2] | 0x20) == 'z'
+        && ext[3] == '4';
+}
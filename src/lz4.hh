@@ -0,0 +1,112 @@
+/**
+ * \file
+ * \brief     Streaming LZ4 frame decompression.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "fatfile.hh"
+
+/**
+ * \brief Reads the decompressed contents of an LZ4 frame file.
+ *
+ * Decompression streams through a fixed window of the most recent output,
+ * so memory use does not depend on the frame's block size. Matches must
+ * not reach further back than windowSize bytes: mkfatimg compresses files
+ * accordingly, frames from other compressors are rejected with
+ * FAT_ERR_INVALID_ARG when they do.
+ *
+ * Checksums are skipped, not verified.
+ */
+class Lz4Reader {
+
+public:
+    static const size_t windowSize = 4096;
+
+private:
+    static const size_t inputSize = 128;
+
+    FatFile file;
+
+    uint8_t  window[windowSize];
+    uint32_t position = 0; ///< Decompressed bytes produced so far.
+
+    uint8_t  input[inputSize];
+    size_t   inputPos    = 0;
+    size_t   inputLength = 0;
+
+    uint8_t  flags       = 0; ///< The frame descriptor's FLG byte.
+    uint32_t contentSize = 0;
+    bool     frameDone   = false;
+
+    uint32_t blockLeft    = 0; ///< Compressed bytes left in the current block.
+    bool     blockRaw     = false;
+    bool     blockOpen    = false; ///< A block checksum may still follow.
+    uint32_t literalsLeft = 0;
+    uint32_t matchLeft    = 0;
+    uint32_t matchOffset  = 0;
+    uint8_t  matchNibble  = 0;
+    bool     matchPending = false; ///< A match follows the current literals.
+
+    FatError error = FAT_ERR_OK;
+
+    bool     refill();
+    uint8_t  nextByte();
+    uint8_t  blockByte();
+    uint32_t nextLength(uint32_t nibble);
+    void     skip(size_t count);
+
+    /// Start decoding the frame at the file's current position.
+    FatError start();
+
+    void emit(uint8_t *out, uint8_t byte) {
+        window[position++ % windowSize] = byte;
+        *out = byte;
+    }
+
+public:
+    FatError open(FatVolume &volume, const char *path);
+
+    /// Start over at the beginning of the frame.
+    FatError rewind();
+
+    /// Get the amount of decompressed bytes read so far.
+    uint32_t getPosition() const { return position; }
+
+    /// Get the decompressed size, or 0 if the frame does not state it.
+    uint32_t getSize() const { return contentSize; }
+
+    /// Get the amount of compressed bytes read so far.
+    uint32_t getCompressedPosition() const {
+        return file.getPosition() - (uint32_t)(inputLength - inputPos);
+    }
+
+    /**
+     * \brief Read decompressed data.
+     *
+     * Reading at the end of the frame is not an error, bytesRead is 0 then.
+     */
+    FatError read(void *data, size_t length, size_t &bytesRead);
+
+    /// Check whether a path has the .lz4 extension.
+    static bool isLz4Path(const char *path);
+
+    Lz4Reader() = default;
+    ~Lz4Reader() = default;
+};
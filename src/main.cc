@@ -21,15 +21,53 @@
 #include "sam.hh"
 
 #include "uartcon.hh"
-#include <mustore/memstore.hh>
 #include <mustore/fatfs.hh>
 #include "sdspi.hh"
+#include "metacache.hh"
+#include "memorystore.hh"
+#include "iflash.hh"
 #include "shell.hh"
+#include "cycles.hh"
+#include "memusage.hh"
 
 #include <cstring>
 
 Console *con;
 
+// The size of the RAM disk mounted at /ram, set by the Makefile. 0 disables it.
+#ifndef RAMDISK_SIZE
+#define RAMDISK_SIZE 0
+#endif
+
+#if RAMDISK_SIZE
+/// Backing memory for the RAM disk mounted at /ram.
+static uint8_t ramDisk[RAMDISK_SIZE];
+#endif
+
+// The location of the filesystem image built by mkfatimg, set by the Makefile.
+#ifndef FLASH_IMAGE_OFFSET
+#define FLASH_IMAGE_OFFSET 0x20000
+#endif
+#ifndef FLASH_IMAGE_SIZE
+#define FLASH_IMAGE_SIZE 0x20000
+#endif
+
+// The writable flash region, at the end of the second bank by default.
+#ifndef FLASH_STORE_OFFSET
+#define FLASH_STORE_OFFSET 0x60000
+#endif
+#ifndef FLASH_STORE_SIZE
+#define FLASH_STORE_SIZE 0x20000
+#endif
+
+/// Where the filesystem image starts, relative to the start of flash.
+static const uint32_t flashImageOffset = FLASH_IMAGE_OFFSET;
+static const uint32_t flashImageSize   = FLASH_IMAGE_SIZE;
+
+/// Where the writable flash store starts, relative to the start of flash.
+static const uint32_t flashStoreOffset = FLASH_STORE_OFFSET;
+static const uint32_t flashStoreSize   = FLASH_STORE_SIZE;
+
 using namespace MuStore;
 
 static void dumpTree(FsNode &node, int level) {
@@ -64,7 +102,9 @@ static void dumpTree(FsNode &node, int level) {
 }
 
 extern "C" void __libc_init_array();
-extern "C" int main() {
+
+/// Everything after the switch to the thread stack.
+static void run() {
 
     // CMSIS initialization.
     SystemInit();
@@ -73,6 +113,9 @@ extern "C" int main() {
     if (SysTick_Config(SystemCoreClock / 1000))
         hang();
 
+    // Start the cycle counter, used for timing measurements.
+    enableCycleCounter();
+
     // Disable the watchdog.
     WDT_Disable(WDT);
 
@@ -116,12 +159,13 @@ extern "C" int main() {
         "This is free software with ABSOLUTELY NO WARRANTY.\n\n"
     );
 
-    // Try to parse a FAT somewhere in flash storage.
-    // MemStore store((const void*)(0x80000 + 0x8000), 128*1024);
-    // FatFs fs(&store);
+    SdSpi     sd;
+    MetaCache cache(&sd);
+    FatFs     fs(&cache);
+    FatVolume volume(&cache);
 
-    SdSpi sd;
-    FatFs fs(&sd);
+    // Keep the FAT and root directory in RAM from here on.
+    cache.pin(volume);
 
     bool gotFat = fs.getFsSubType() != FatFs::SubType::NONE;
     if (gotFat) {
@@ -156,7 +200,51 @@ extern "C" int main() {
         }
     }
 
-    runShell(*con, fs);
+    MountTable mounts;
+    mounts.add("/", fs, volume);
+
+#if RAMDISK_SIZE
+    // A scratch filesystem in RAM, for fast temporary files.
+    MemoryStore ramStore(ramDisk, sizeof(ramDisk));
+    FatVolume::format(ramStore, "RAMDISK");
+    FatFs     ramFs(&ramStore);
+    FatVolume ramVolume(&ramStore);
+    if (ramFs.getFsSubType() != FatFs::SubType::NONE)
+        mounts.add("/ram", ramFs, ramVolume);
+#endif
+
+    // A read-only filesystem image appended to the firmware, if there is one.
+    MemoryStore flashStore((const void*)(IFLASH0_ADDR + flashImageOffset), flashImageSize);
+    FatFs       flashFs(&flashStore);
+    FatVolume   flashVolume(&flashStore);
+    if (flashFs.getFsSubType() != FatFs::SubType::NONE)
+        mounts.add("/flash", flashFs, flashVolume);
+
+    // A writable filesystem in internal flash, which survives resets (but
+    // not uploads, which erase all flash).
+    InternalFlash dataFlash(IFLASH0_ADDR + flashStoreOffset, flashStoreSize);
+    EfcStore      dataStore(dataFlash);
+    bool gotData = !dataStore.mount();
+    if (gotData && FatVolume(&dataStore).getType() == FatVolume::Type::NONE)
+        gotData = !FatVolume::format(dataStore, "DATA") && !dataStore.flush();
+    FatFs     dataFs(&dataStore);
+    FatVolume dataVolume(&dataStore);
+    if (gotData && dataFs.getFsSubType() != FatFs::SubType::NONE)
+        mounts.add("/data", dataFs, dataVolume);
+
+    // Extra sessions on the Due's Serial1 to Serial3 ports.
+    Console *consoles[] = {
+        con,
+        &SamUartConsole::getInstance(SamUartConsole::Port::Usart0),
+        &SamUartConsole::getInstance(SamUartConsole::Port::Usart1),
+        &SamUartConsole::getInstance(SamUartConsole::Port::Usart3),
+    };
+
+    runShell(consoles, sizeof(consoles) / sizeof(*consoles), mounts);
+}
 
-    return 0;
+extern "C" int main() {
+    // Before anything uses the stack space to be measured.
+    paintStacks();
+    runOnThreadStack(run);
 }
@@ -0,0 +1,78 @@
+/**
+ * \file
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "memorystore.hh"
+
+#include <cstring>
+
+using namespace MuStore;
+
+StoreError MemoryStore::seek(size_t lba) {
+    if (lba >= blockCount)
+        return STORE_ERR_OUT_OF_BOUNDS;
+    pos = lba;
+    return STORE_ERR_OK;
+}
+
+StoreError MemoryStore::read(void *buffer) {
+    return readBlocks(buffer, 1);
+}
+
+StoreError MemoryStore::write(const void *buffer) {
+    return writeBlocks(buffer, 1);
+}
+
+StoreError MemoryStore::readBlocks(void *buffer, size_t count) {
+    if (pos + count > blockCount)
+        return STORE_ERR_OUT_OF_BOUNDS;
+
+    memcpy(buffer, readData + pos * blockSize, count * blockSize);
+    pos += count;
+
+    return STORE_ERR_OK;
+}
+
+StoreError MemoryStore::writeBlocks(const void *buffer, size_t count) {
+    if (!data)
+        return STORE_ERR_IO;
+    if (pos + count > blockCount)
+        return STORE_ERR_OUT_OF_BOUNDS;
+
+    memcpy(data + pos * blockSize, buffer, count * blockSize);
+    pos += count;
+
+    return STORE_ERR_OK;
+}
+
+MemoryStore::MemoryStore(void *data_, size_t size)
+    : data((uint8_t*)data_),
+      readData((const uint8_t*)data_) {
+
+    blockSize  = 512;
+    blockCount = size / blockSize;
+}
+
+MemoryStore::MemoryStore(const void *data_, size_t size)
+    : data(nullptr),
+      readData((const uint8_t*)data_) {
+
+    blockSize  = 512;
+    blockCount = size / blockSize;
+}
@@ -0,0 +1,63 @@
+/**
+ * \file
+ * \brief     Block store backed by memory.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "blockstore.hh"
+
+/**
+ * \brief A block store on a region of RAM, or a read-only one in flash.
+ *
+ * Used for the RAM disk, and for filesystem images linked into flash.
+ * Unlike MuStore::MemStore this supports the BlockStore interface, so
+ * FatVolume and the bulk file operations can be used on it.
+ */
+class MemoryStore : public BlockStore {
+
+    uint8_t       *data;     ///< nullptr for read-only stores.
+    const uint8_t *readData;
+
+public:
+    MuStore::StoreError seek(size_t lba);
+
+    MuStore::StoreError read (void *buffer);
+    MuStore::StoreError write(const void *buffer);
+
+    MuStore::StoreError readBlocks (void *buffer,       size_t count);
+    MuStore::StoreError writeBlocks(const void *buffer, size_t count);
+
+    bool isWritable() const { return data != nullptr; }
+
+    const uint8_t *getMapping(size_t lba) const {
+        return lba < blockCount ? readData + lba * blockSize : nullptr;
+    }
+
+    using Store::read;
+    using Store::write;
+
+    /// A writable store.
+    MemoryStore(void *data_, size_t size);
+
+    /// A read-only store.
+    MemoryStore(const void *data_, size_t size);
+
+    ~MemoryStore() = default;
+};
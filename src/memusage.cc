@@ -0,0 +1,97 @@
+/**
+ * \file
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "memusage.hh"
+#include "sam.hh"
+
+// Defined by flash.ld.
+extern "C" {
+    extern uint32_t _sfixed;
+    extern uint32_t _etext;
+    extern uint32_t _srelocate;
+    extern uint32_t _erelocate;
+    extern uint32_t _sramfunc;
+    extern uint32_t _eramfunc;
+    extern uint32_t _sbss;
+    extern uint32_t _ebss;
+    extern uint32_t _end;
+    extern uint32_t _estack;
+}
+
+static const uint32_t stackPaint = 0x5a5a5a5a;
+
+static uint32_t address(const uint32_t *p) {
+    return (uint32_t)(uintptr_t)p;
+}
+
+static uint32_t *isrStackBottom() {
+    return &_estack - isrStackSize / sizeof(uint32_t);
+}
+
+/// Count the bytes above the highest painted word in a region.
+static uint32_t peakUse(const uint32_t *bottom, const uint32_t *top) {
+    const uint32_t *p = bottom;
+    while (p < top && *p == stackPaint)
+        p++;
+    return address(top) - address(p);
+}
+
+void paintStacks() {
+    // Interrupts are still off, so nothing but this function (and maybe a
+    // memset() the loop is turned into) uses the stack. Stay clear of that.
+    uint32_t *end = (uint32_t*)(uintptr_t)__get_MSP() - 64;
+    for (uint32_t *p = &_end; p < end; p++)
+        *p = stackPaint;
+}
+
+/// Called with the function to run in r0 and the top of its stack in r1.
+__attribute__((naked, noreturn)) static void switchStack(void (*)(), uint32_t *) {
+    asm volatile("msr  psp, r1    \n"
+                 "movs r2, #2     \n" // CONTROL.SPSEL: thread mode uses PSP.
+                 "msr  control, r2\n"
+                 "isb             \n"
+                 "blx  r0         \n"
+                 "b    hang       \n");
+}
+
+void runOnThreadStack(void (*entry)()) {
+    switchStack(entry, isrStackBottom());
+}
+
+MemoryUsage getMemoryUsage() {
+    MemoryUsage usage;
+
+    usage.ramStart = address(&_srelocate);
+    usage.ramSize  = address(&_estack)    - address(&_srelocate);
+    usage.dataSize = address(&_erelocate) - address(&_srelocate);
+    usage.bssSize  = address(&_ebss)      - address(&_sbss);
+
+    usage.ramfuncSize = address(&_eramfunc) - address(&_sramfunc);
+
+    usage.threadStackSize = address(isrStackBottom()) - address(&_end);
+    usage.threadStackPeak = peakUse(&_end, isrStackBottom());
+    usage.threadStackNow  = address(isrStackBottom()) - __get_PSP();
+    usage.isrStackSize    = isrStackSize;
+    usage.isrStackPeak    = peakUse(isrStackBottom(), &_estack);
+
+    usage.flashSize = address(&_etext) - address(&_sfixed) + usage.dataSize;
+
+    return usage;
+}
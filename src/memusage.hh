@@ -0,0 +1,71 @@
+/**
+ * \file
+ * \brief     Stack painting and RAM usage.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Set by the Makefile, which also passes it to the linker.
+#ifndef ISR_STACK_SIZE
+#define ISR_STACK_SIZE 2048
+#endif
+
+/**
+ * \name Stacks
+ *
+ * The program runs on the process stack (PSP), from the end of .bss up to
+ * isrStackSize bytes below the top of RAM. Interrupt handlers keep using
+ * the main stack (MSP) above that, so a deep call chain in a command
+ * cannot eat into the room the handlers need, and the two can be measured
+ * separately.
+ *
+ * Free stack space is painted with a pattern at startup. The lowest
+ * address where the pattern was overwritten gives a stack's peak use.
+ */
+///@{
+static const size_t isrStackSize = ISR_STACK_SIZE;
+
+/// Paint all RAM below the current stack pointer. Call first thing in main().
+void paintStacks();
+
+/// Switch thread mode to the process stack and run a function on it.
+void runOnThreadStack(void (*entry)()) __attribute__((noreturn));
+///@}
+
+/// Sizes of the RAM regions laid out by flash.ld, in bytes.
+struct MemoryUsage {
+    uint32_t ramStart;
+    uint32_t ramSize;
+    uint32_t dataSize;        ///< .data and RAM functions, copied from flash at reset.
+    uint32_t ramfuncSize;     ///< RAM functions alone.
+    uint32_t bssSize;
+
+    uint32_t threadStackSize;
+    uint32_t threadStackPeak;
+    uint32_t threadStackNow;
+    uint32_t isrStackSize;
+    uint32_t isrStackPeak;
+
+    uint32_t flashSize;       ///< Code, constants and .data initializers.
+};
+
+MemoryUsage getMemoryUsage();
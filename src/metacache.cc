@@ -0,0 +1,231 @@
+/**
+ * \file
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "metacache.hh"
+
+#include <cstring>
+
+using namespace MuStore;
+
+MetaCache::Slot *MetaCache::slotOf(uint32_t lba, uint32_t &index) {
+    if (lba >= fatLba && lba < fatLba + fatSectors * fatCount) {
+        // Every FAT copy maps to the same sectors.
+        index = (lba - fatLba) % fatSectors;
+        return &fatSlots[index % fatSlotCount];
+    }
+    if (lba >= dirLba && lba < dirLba + dirSectors) {
+        index = lba - dirLba;
+        return &dirSlots[index];
+    }
+
+    return nullptr;
+}
+
+bool MetaCache::overlaps(uint32_t lba, size_t count) const {
+    return (fatCount   && lba < fatLba + fatSectors * fatCount && lba + count > fatLba)
+        || (dirSectors && lba < dirLba + dirSectors            && lba + count > dirLba);
+}
+
+StoreError MetaCache::writeBack(Slot &slot) {
+    // Only FAT slots are ever dirty, directory writes go through.
+    if (!slot.valid || !slot.dirty)
+        return STORE_ERR_OK;
+
+    for (uint32_t i = 0; i < fatCount; i++) {
+        StoreError err = store->seek(fatLba + i * fatSectors + slot.index);
+        if (!err)
+            err = store->write(slot.data);
+        if (err)
+            return err;
+    }
+    slot.dirty = false;
+
+    return STORE_ERR_OK;
+}
+
+StoreError MetaCache::writeBackFat() {
+    for (auto &slot : fatSlots) {
+        StoreError err = writeBack(slot);
+        if (err)
+            return err;
+    }
+    return STORE_ERR_OK;
+}
+
+StoreError MetaCache::pin(const FatVolume &volume) {
+    StoreError err = flush();
+    if (err)
+        return err;
+
+    for (auto &slot : fatSlots) slot.valid = false;
+    for (auto &slot : dirSlots) slot.valid = false;
+
+    fatLba     = volume.getFatLba();
+    fatSectors = volume.getFatSectors();
+    fatCount   = fatSectors ? volume.getFatCount() : 0;
+
+    dirLba     = volume.getRootDirLba();
+    dirSectors = volume.getRootDirSectors();
+    if (dirSectors > dirSlotCount)
+        dirSectors = dirSlotCount;
+
+    return STORE_ERR_OK;
+}
+
+StoreError MetaCache::seek(size_t lba) {
+    if (lba >= blockCount)
+        return STORE_ERR_OUT_OF_BOUNDS;
+    pos = lba;
+    return STORE_ERR_OK;
+}
+
+StoreError MetaCache::read(void *buffer) {
+    if (pos >= blockCount)
+        return STORE_ERR_OUT_OF_BOUNDS;
+
+    uint32_t lba  = (uint32_t)pos;
+    uint32_t index;
+    Slot    *slot = slotOf(lba, index);
+    if (!slot) {
+        StoreError err = store->seek(lba);
+        if (!err)
+            err = store->read(buffer);
+        if (!err)
+            pos++;
+        return err;
+    }
+
+    if (slot->valid && slot->index == index) {
+        hits++;
+    } else {
+        misses++;
+        StoreError err = writeBack(*slot);
+        if (!err)
+            err = store->seek(lba);
+        if (!err)
+            err = store->read(slot->data);
+        if (err) {
+            slot->valid = false;
+            return err;
+        }
+        slot->index = index;
+        slot->valid = true;
+        slot->dirty = false;
+    }
+
+    memcpy(buffer, slot->data, sizeof(slot->data));
+    pos++;
+
+    return STORE_ERR_OK;
+}
+
+StoreError MetaCache::write(const void *buffer) {
+    if (pos >= blockCount)
+        return STORE_ERR_OUT_OF_BOUNDS;
+
+    uint32_t lba  = (uint32_t)pos;
+    uint32_t index;
+    Slot    *slot = slotOf(lba, index);
+    if (!slot) {
+        StoreError err = writeBackFat();
+        if (!err)
+            err = store->seek(lba);
+        if (!err)
+            err = store->write(buffer);
+        if (!err)
+            pos++;
+        return err;
+    }
+
+    bool isFat = slot < dirSlots || slot >= dirSlots + dirSlotCount;
+
+    // The FAT first, so that the entry written here cannot refer to
+    // clusters that are still free on the store.
+    StoreError err = isFat ? STORE_ERR_OK : writeBackFat();
+    if (!err && (!slot->valid || slot->index != index))
+        err = writeBack(*slot);
+    if (err)
+        return err;
+
+    memcpy(slot->data, buffer, sizeof(slot->data));
+    slot->index = index;
+    slot->valid = true;
+    slot->dirty = isFat;
+
+    if (!isFat) {
+        err = store->seek(lba);
+        if (!err)
+            err = store->write(buffer);
+        if (err) {
+            slot->valid = false;
+            return err;
+        }
+    }
+    pos++;
+
+    return STORE_ERR_OK;
+}
+
+StoreError MetaCache::readBlocks(void *buffer, size_t count) {
+    if (pos + count > blockCount)
+        return STORE_ERR_OUT_OF_BOUNDS;
+    if (overlaps((uint32_t)pos, count))
+        return BlockStore::readBlocks(buffer, count);
+
+    StoreError err = store->seek(pos);
+    if (!err)
+        err = store->readBlocks(buffer, count);
+    if (!err)
+        pos += count;
+    return err;
+}
+
+StoreError MetaCache::writeBlocks(const void *buffer, size_t count) {
+    if (pos + count > blockCount)
+        return STORE_ERR_OUT_OF_BOUNDS;
+    if (overlaps((uint32_t)pos, count))
+        return BlockStore::writeBlocks(buffer, count);
+
+    StoreError err = writeBackFat();
+    if (!err)
+        err = store->seek(pos);
+    if (!err)
+        err = store->writeBlocks(buffer, count);
+    if (!err)
+        pos += count;
+    return err;
+}
+
+StoreError MetaCache::flush() {
+    StoreError err = writeBackFat();
+    if (err)
+        return err;
+    return store->flush();
+}
+
+MetaCache::MetaCache(BlockStore *store_)
+    : store(store_) {
+
+    blockSize  = store->getBlockSize();
+    blockCount = store->getBlockCount();
+
+    for (auto &slot : fatSlots) slot.valid = false;
+    for (auto &slot : dirSlots) slot.valid = false;
+}
@@ -0,0 +1,110 @@
+/**
+ * \file
+ * \brief     Block cache for FAT metadata.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "blockstore.hh"
+#include "fatvol.hh"
+
+/**
+ * \brief Keeps the FAT and the start of the root directory in RAM.
+ *
+ * Sits between a store and the filesystem code, so that both FatFs and
+ * FatVolume benefit. Walking a cluster chain then no longer reads the same
+ * FAT sectors from the card over and over.
+ *
+ * FAT sectors are held in a small direct-mapped window, which covers the
+ * whole FAT on small volumes. All FAT copies map to the same slot: writes
+ * to any copy are buffered, and each modified sector is written to every
+ * copy once. Root directory writes go through immediately.
+ *
+ * Modified FAT sectors are written back by flush(), and before any write
+ * outside the FAT. A directory entry or file data therefore never reaches
+ * the store before the clusters it uses are marked as allocated there.
+ *
+ * Everything else is passed on to the underlying store unchanged.
+ */
+class MetaCache : public BlockStore {
+
+public:
+    static const size_t fatSlotCount = 8;
+    static const size_t dirSlotCount = 4;
+
+private:
+    struct Slot {
+        uint32_t index; ///< Sector offset within the cached region.
+        bool     valid;
+        bool     dirty;
+        uint8_t  data[FatVolume::sectorSize];
+    };
+
+    BlockStore *store;
+
+    uint32_t fatLba     = 0;
+    uint32_t fatSectors = 0; ///< Per FAT copy.
+    uint32_t fatCount   = 0;
+    uint32_t dirLba     = 0;
+    uint32_t dirSectors = 0; ///< Pinned root directory sectors.
+
+    Slot fatSlots[fatSlotCount];
+    Slot dirSlots[dirSlotCount];
+
+    uint32_t hits   = 0;
+    uint32_t misses = 0;
+
+    /// Get the slot caching a sector, or nullptr if it is not cacheable.
+    Slot *slotOf(uint32_t lba, uint32_t &index);
+
+    /// Check whether a range of sectors overlaps a cached region.
+    bool overlaps(uint32_t lba, size_t count) const;
+
+    MuStore::StoreError writeBack(Slot &slot);
+
+    /// Write back all modified FAT sectors.
+    MuStore::StoreError writeBackFat();
+
+public:
+    /**
+     * \brief Start caching the metadata of a FAT volume on this store.
+     *
+     * Any buffered changes are flushed first.
+     */
+    MuStore::StoreError pin(const FatVolume &volume);
+
+    uint32_t getHits()   const { return hits; }
+    uint32_t getMisses() const { return misses; }
+
+    MuStore::StoreError seek(size_t lba);
+
+    MuStore::StoreError read (void *buffer);
+    MuStore::StoreError write(const void *buffer);
+
+    MuStore::StoreError readBlocks (void *buffer,       size_t count);
+    MuStore::StoreError writeBlocks(const void *buffer, size_t count);
+
+    MuStore::StoreError flush();
+
+    using Store::read;
+    using Store::write;
+
+    MetaCache(BlockStore *store_);
+    ~MetaCache() = default;
+};
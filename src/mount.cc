@@ -0,0 +1,63 @@
+/**
+ * \file
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mount.hh"
+
+#include <cstring>
+
+bool MountTable::add(const char *path, MuStore::Fs &fs, FatVolume &volume) {
+    if (count == maxMounts || path[0] != '/')
+        return false;
+
+    mounts[count++] = Mount { path, &fs, &volume };
+
+    return true;
+}
+
+const Mount *MountTable::resolve(const char *path, const char *&rest) const {
+    const Mount *best       = nullptr;
+    size_t       bestLength = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        const char *mountPath = mounts[i].path;
+        size_t      length    = strlen(mountPath);
+
+        if (!strcmp(mountPath, "/")) {
+            // The root filesystem matches anything, but any other mount wins.
+            if (!best) {
+                best       = &mounts[i];
+                bestLength = 0;
+            }
+        } else if (!strncmp(path, mountPath, length)
+                   && (path[length] == '/' || !path[length])
+                   && length > bestLength) {
+            best       = &mounts[i];
+            bestLength = length;
+        }
+    }
+
+    if (best) {
+        rest = path + bestLength;
+        if (!*rest)
+            rest = "/";
+    }
+
+    return best;
+}
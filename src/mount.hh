@@ -0,0 +1,68 @@
+/**
+ * \file
+ * \brief     Mount table.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <mustore/fs.hh>
+#include "fatvol.hh"
+
+/// A filesystem mounted at a path.
+struct Mount {
+    const char  *path;   ///< Mount point, "/" for the root filesystem.
+    MuStore::Fs *fs;
+    FatVolume   *volume;
+};
+
+/**
+ * \brief Routes absolute paths to the filesystem they are on.
+ *
+ * The filesystem mounted at "/" holds everything that is not below one of
+ * the other mount points. Mount points are single path components, and
+ * shadow any directory of the same name on the root filesystem.
+ */
+class MountTable {
+
+public:
+    static const size_t maxMounts = 4;
+
+private:
+    Mount  mounts[maxMounts];
+    size_t count = 0;
+
+public:
+    /// Add a filesystem. The mount point string must outlive the table.
+    bool add(const char *path, MuStore::Fs &fs, FatVolume &volume);
+
+    /**
+     * \brief Find the filesystem an absolute path is on.
+     *
+     * \param rest set to the path relative to the mount's root, starting with a '/'
+     *
+     * \return the mount, or nullptr if nothing is mounted at "/"
+     */
+    const Mount *resolve(const char *path, const char *&rest) const;
+
+    size_t getCount() const { return count; }
+    const Mount &operator[](size_t i) const { return mounts[i]; }
+
+    MountTable() = default;
+    ~MountTable() = default;
+};
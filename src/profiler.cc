@@ -0,0 +1,154 @@
+/**
+ * \file
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "profiler.hh"
+#include "sam.hh"
+
+Profiler profiler;
+
+static_assert(!(Profiler::pcSlots & (Profiler::pcSlots - 1)), "pcSlots must be a power of two");
+static_assert(!(Profiler::lrSlots & (Profiler::lrSlots - 1)), "lrSlots must be a power of two");
+
+bool Profiler::count(Hit *hits, size_t slots, uint32_t address) {
+    // Thumb instructions are halfword aligned.
+    size_t i = (size_t)(((address >> 1) * 2654435761u) >> 16) & (slots - 1);
+
+    for (size_t probe = 0; probe < maxProbes; probe++) {
+        Hit &hit = hits[(i + probe) & (slots - 1)];
+        if (hit.address == address && hit.count) {
+            hit.count++;
+            return true;
+        } else if (!hit.count) {
+            hit.address = address;
+            hit.count   = 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+void Profiler::sample(uint32_t pc, uint32_t lr) {
+    sampleCount++;
+    if (!count(pcHits, pcSlots, pc))
+        lostCount++;
+    // Clear the Thumb bit, return addresses then point into the caller.
+    count(lrHits, lrSlots, lr & ~1u);
+}
+
+void Profiler::start() {
+    stop();
+
+    for (Hit &hit : pcHits)
+        hit = Hit { 0, 0 };
+    for (Hit &hit : lrHits)
+        hit = Hit { 0, 0 };
+
+    pcCount     = 0;
+    lrCount     = 0;
+    sampleCount = 0;
+    lostCount   = 0;
+    summarized  = false;
+    startTicks  = GetTickCount();
+
+    NVIC_SetPriority(SysTick_IRQn, 0);
+    running = true;
+}
+
+void Profiler::stop() {
+    if (!running)
+        return;
+
+    running = false;
+    ms      = GetTickCount() - startTicks;
+    NVIC_SetPriority(SysTick_IRQn, (1 << __NVIC_PRIO_BITS) - 1);
+}
+
+uint32_t Profiler::getDuration() const {
+    return running ? GetTickCount() - startTicks : ms;
+}
+
+const ProfSymbol *Profiler::findSymbol(uint32_t address) {
+    // Binary search for the last function starting at or before the address.
+    size_t low  = 0;
+    size_t high = profSymbolCount;
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if (profSymbols[mid].start <= address)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    if (!low)
+        return nullptr;
+
+    const ProfSymbol &symbol = profSymbols[low - 1];
+    return address - symbol.start < symbol.size ? &symbol : nullptr;
+}
+
+size_t Profiler::fold(Hit *hits, size_t slots) {
+    // Replace addresses by the start of their function, and drop empty slots.
+    size_t count = 0;
+    for (size_t i = 0; i < slots; i++) {
+        if (!hits[i].count)
+            continue;
+        const ProfSymbol *symbol = findSymbol(hits[i].address);
+        hits[count++] = Hit { symbol ? symbol->start : hits[i].address, hits[i].count };
+    }
+
+    // Sort by address to bring the hits of a function together.
+    for (size_t i = 1; i < count; i++) {
+        Hit    hit = hits[i];
+        size_t j   = i;
+        for (; j && hits[j - 1].address > hit.address; j--)
+            hits[j] = hits[j - 1];
+        hits[j] = hit;
+    }
+
+    size_t merged = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (merged && hits[merged - 1].address == hits[i].address)
+            hits[merged - 1].count += hits[i].count;
+        else
+            hits[merged++] = hits[i];
+    }
+
+    // Most frequent first.
+    for (size_t i = 1; i < merged; i++) {
+        Hit    hit = hits[i];
+        size_t j   = i;
+        for (; j && hits[j - 1].count < hit.count; j--)
+            hits[j] = hits[j - 1];
+        hits[j] = hit;
+    }
+
+    return merged;
+}
+
+void Profiler::summarize() {
+    stop();
+
+    // The tables are no longer hash tables after folding.
+    if (summarized)
+        return;
+
+    pcCount    = fold(pcHits, pcSlots);
+    lrCount    = fold(lrHits, lrSlots);
+    summarized = true;
+}
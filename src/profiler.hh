@@ -0,0 +1,123 @@
+/**
+ * \file
+ * \brief     Statistical profiler sampling the program counter from SysTick.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/// A function in the firmware, see the symbol table below.
+struct ProfSymbol {
+    uint32_t    start;
+    uint32_t    size;
+    const char *name;
+};
+
+/**
+ * \name Symbol table
+ *
+ * Generated from the linked firmware by mksymtab, sorted by address.
+ * Code is placed before read-only data, so linking the table in does not
+ * move the functions it describes.
+ */
+///@{
+extern const ProfSymbol profSymbols[];
+extern const size_t     profSymbolCount;
+///@}
+
+/**
+ * \brief Counts where the CPU is found at each SysTick interrupt.
+ *
+ * The SysTick handler passes the program counter and link register of the
+ * interrupted code, as saved on the exception stack frame. Both go into
+ * small open-addressing hash tables keyed by address. The link register
+ * tells which function called a hot leaf function, such as a byte loop.
+ * Samples whose address does not fit in the table are counted as lost.
+ *
+ * While profiling SysTick gets the highest interrupt priority, so that the
+ * other interrupt handlers are sampled too.
+ */
+class Profiler {
+
+public:
+    struct Hit {
+        uint32_t address;
+        uint32_t count;
+    };
+
+    static const size_t pcSlots   = 256;
+    static const size_t lrSlots   = 128;
+    static const size_t maxProbes = 8;
+
+private:
+    Hit pcHits[pcSlots];
+    Hit lrHits[lrSlots];
+
+    size_t pcCount = 0; ///< Hits left after summarize().
+    size_t lrCount = 0;
+
+    volatile bool running = false;
+    bool          summarized = false;
+
+    uint32_t sampleCount = 0;
+    uint32_t lostCount   = 0;
+    uint32_t startTicks  = 0;
+    uint32_t ms          = 0;
+
+    static bool   count(Hit *hits, size_t slots, uint32_t address);
+    static size_t fold(Hit *hits, size_t slots);
+
+public:
+    /// Clear the counts and start sampling.
+    void start();
+    void stop();
+
+    bool isRunning() const { return running; }
+
+    /// Count one sample, called from the SysTick handler.
+    void sample(uint32_t pc, uint32_t lr);
+
+    /**
+     * \brief Merge the counts per function, most frequent first.
+     *
+     * Stops the profiler. Addresses outside any known function are kept
+     * as they are.
+     */
+    void summarize();
+
+    /// Functions that were interrupted, valid after summarize().
+    const Hit *getFunctions(size_t &count_) const { count_ = pcCount; return pcHits; }
+
+    /// Functions that interrupted code would return to, valid after summarize().
+    const Hit *getCallers(size_t &count_) const { count_ = lrCount; return lrHits; }
+
+    uint32_t getSampleCount() const { return sampleCount; }
+    uint32_t getLostCount()   const { return lostCount; }
+    uint32_t getDuration()    const; ///< In milliseconds.
+
+    /// Find the function containing an address, nullptr if there is none.
+    static const ProfSymbol *findSymbol(uint32_t address);
+
+    Profiler() = default;
+    ~Profiler() = default;
+};
+
+extern Profiler profiler;
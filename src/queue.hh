@@ -66,6 +66,7 @@ public:
     }
 
     size_t getLength() { return length; }
+    bool   isFull()    { return length == size; }
 
     Queue &operator+=(T elem) { push(elem); return *this; }
     T      operator--()       { return pop(); };
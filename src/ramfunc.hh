@@ -0,0 +1,44 @@
+/**
+ * \file
+ * \brief     Placement of hot functions in RAM.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+/**
+ * \brief Run a function from SRAM instead of flash.
+ *
+ * At 84 MHz every flash access costs wait states, which the prefetch
+ * buffer only partly hides in tight loops with branches. Functions marked
+ * RAMFUNC go into the .ramfunc section, which flash.ld places with .data,
+ * so the startup code copies them to RAM.
+ *
+ * Calls between flash and RAM go through linker veneers. Keep the inner
+ * loop inside the RAM function, calls out to flash in it defeat the purpose.
+ *
+ * Build with RAMFUNCS=0 (after a make clean) to leave these functions in
+ * flash, for comparing.
+ * Code that must not run from flash at all, like flash programming, uses
+ * the section attribute directly.
+ */
+#if defined(RAMFUNCS) && !RAMFUNCS
+#define RAMFUNC
+#else
+#define RAMFUNC __attribute__((section(".ramfunc"), noinline))
+#endif
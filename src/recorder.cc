@@ -0,0 +1,126 @@
+/**
+ * \file
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "recorder.hh"
+
+using namespace MuStore;
+
+uint16_t *Recorder::acquire() {
+    if (freeBuffers.isEmpty())
+        return nullptr;
+    return buffers[freeBuffers.pop()];
+}
+
+uint16_t *Recorder::complete(uint16_t *buffer) {
+    if (blocksQueued >= blockTarget)
+        return buffer;
+
+    if (freeBuffers.isEmpty()) {
+        // The writer is behind, lose these samples rather than older ones.
+        dropped = dropped + 1;
+        return buffer;
+    }
+    fullBuffers.push(indexOf(buffer));
+    blocksQueued += bufferBlocks;
+    return buffers[freeBuffers.pop()];
+}
+
+StoreError Recorder::record(SampleSource &source,
+                            uint32_t      rate,
+                            BlockStore   &store,
+                            uint32_t      lba,
+                            uint32_t      blockCount,
+                            bool        (*stop)()) {
+
+    freeBuffers.head = freeBuffers.tail = 0;
+    fullBuffers.head = fullBuffers.tail = 0;
+    for (uint8_t i = 0; i < bufferCount; i++)
+        freeBuffers.push(i);
+
+    dropped       = 0;
+    blocksQueued  = 0;
+    blockTarget   = blockCount;
+    blocksWritten = 0;
+    elapsed       = 0;
+
+    uint32_t start = getTicks();
+
+    if (!source.start(*this, rate))
+        return STORE_ERR_IO;
+
+    StoreError err = STORE_ERR_OK;
+
+    while (blocksWritten < blockCount) {
+        if (stop && stop())
+            break;
+
+        source.poll();
+        if (fullBuffers.isEmpty())
+            continue;
+
+        uint8_t  i = fullBuffers.pop();
+        uint32_t n = blockCount - blocksWritten;
+        if (n > bufferBlocks)
+            n = bufferBlocks;
+
+        if ((err = store.seek(lba + blocksWritten))
+         || (err = store.writeBlocks(buffers[i], n)))
+            break;
+
+        blocksWritten += n;
+        freeBuffers.push(i);
+    }
+
+    source.stop();
+    elapsed = getTicks() - start;
+
+    return err;
+}
+
+bool SyntheticSource::start(Recorder &recorder_, uint32_t rate_) {
+    recorder   = &recorder_;
+    rate       = rate_;
+    buffer     = recorder->acquire();
+    filled     = 0;
+    produced   = 0;
+    startTicks = getTicks();
+
+    return rate && buffer;
+}
+
+void SyntheticSource::stop() {
+    recorder = nullptr;
+}
+
+void SyntheticSource::poll() {
+    if (!recorder)
+        return;
+
+    uint64_t due = (uint64_t)rate * (getTicks() - startTicks) / 1000;
+
+    while (produced < due) {
+        buffer[filled++] = (uint16_t)produced++;
+
+        if (filled == Recorder::bufferSamples) {
+            buffer = recorder->complete(buffer);
+            filled = 0;
+        }
+    }
+}
@@ -0,0 +1,187 @@
+/**
+ * \file
+ * \brief     Streams samples from a source to consecutive blocks of a store.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "blockstore.hh"
+
+#include <cstdint>
+#include <cstdlib>
+
+class Recorder;
+
+/**
+ * \brief Produces samples into buffers handed out by a Recorder.
+ *
+ * Sources fill a buffer, pass it to Recorder::complete() and continue with
+ * the buffer they get back. They may do so from an interrupt handler.
+ */
+class SampleSource {
+public:
+    /// Start producing samples at `rate` per second. \return false if the rate is not supported
+    virtual bool start(Recorder &recorder, uint32_t rate) = 0;
+    virtual void stop() = 0;
+
+    /// Called continuously while recording, for sources that are not interrupt-driven.
+    virtual void poll() { }
+
+protected:
+    ~SampleSource() = default;
+};
+
+/**
+ * \brief Writes full sample buffers to a range of blocks.
+ *
+ * A source fills buffers while the recorder writes earlier ones to the
+ * store, bufferBlocks at a time, using multi-block writes. This absorbs
+ * write latency of up to (bufferCount - 2) buffers' worth of samples: the
+ * source always holds two buffers, the one being filled and the next.
+ *
+ * When no free buffer is left the source overwrites the buffer it just
+ * filled, and the recorder counts it as dropped.
+ *
+ * The buffer queues are single-producer, single-consumer rings, safe to
+ * use from an interrupt handler on one side.
+ */
+class Recorder {
+
+public:
+    static const size_t blockSize     = 512;
+    static const size_t bufferBlocks  = 4;
+    static const size_t bufferCount   = 3; ///< 6 KB of buffers in all.
+    static const size_t bufferSamples = bufferBlocks * blockSize / sizeof(uint16_t);
+
+    static_assert(bufferCount >= 3, "the source holds two buffers, the writer needs one");
+
+private:
+    uint32_t (*getTicks)();
+
+    uint16_t buffers[bufferCount][bufferSamples];
+
+    /**
+     * \brief Buffer indices, passed from one side to the other.
+     *
+     * One slot more than there are buffers, so a ring holding all of them
+     * is not mistaken for an empty one.
+     */
+    struct Ring {
+        static const size_t slotCount = bufferCount + 1;
+
+        volatile uint8_t  slots[slotCount];
+        volatile uint32_t head = 0; ///< Written by the consumer.
+        volatile uint32_t tail = 0; ///< Written by the producer.
+
+        bool isEmpty() const { return head == tail; }
+
+        void push(uint8_t i) {
+            slots[tail] = i;
+            tail = (tail + 1) % slotCount;
+        }
+        uint8_t pop() {
+            uint8_t i = slots[head];
+            head = (head + 1) % slotCount;
+            return i;
+        }
+    };
+
+    Ring freeBuffers; ///< Recorder to source.
+    Ring fullBuffers; ///< Source to recorder.
+
+    volatile uint32_t dropped = 0;
+
+    uint32_t blocksQueued  = 0; ///< Source side: blocks handed to the writer.
+    uint32_t blockTarget   = 0;
+
+    uint32_t blocksWritten = 0;
+    uint32_t elapsed       = 0;
+
+    uint8_t indexOf(const uint16_t *buffer) const {
+        return (uint8_t)((buffer - buffers[0]) / bufferSamples);
+    }
+
+public:
+    /// Get a buffer to fill, for a source that is starting. \return nullptr if none are free
+    uint16_t *acquire();
+
+    /**
+     * \brief Hand in a full buffer.
+     *
+     * Buffers past the end of the recording are ignored.
+     *
+     * \return the buffer to fill next, the same buffer if it was dropped
+     */
+    uint16_t *complete(uint16_t *buffer);
+
+    /**
+     * \brief Record samples into consecutive blocks.
+     *
+     * Stops when blockCount blocks have been written, on a write error, or
+     * when `stop` returns true.
+     *
+     * \param stop polled while recording, may be nullptr
+     *
+     * \return STORE_ERR_IO if the source could not be started
+     */
+    MuStore::StoreError record(SampleSource &source,
+                               uint32_t     rate,
+                               BlockStore  &store,
+                               uint32_t     lba,
+                               uint32_t     blockCount,
+                               bool       (*stop)() = nullptr);
+
+    uint32_t getBlocksWritten()  const { return blocksWritten; }
+    uint32_t getSamplesWritten() const { return blocksWritten * (blockSize / sizeof(uint16_t)); }
+    uint32_t getDropped()        const { return dropped; }
+    uint32_t getElapsed()        const { return elapsed; } ///< In ms.
+
+    /// \param getTicks_ a millisecond clock
+    Recorder(uint32_t (*getTicks_)()) : getTicks(getTicks_) { }
+    ~Recorder() = default;
+};
+
+/**
+ * \brief Produces a 16-bit counter at a given rate, without hardware.
+ *
+ * Samples are produced when polled, as many as are due according to the
+ * clock. The counter keeps counting through dropped buffers, so gaps in a
+ * recording show where data was lost.
+ */
+class SyntheticSource : public SampleSource {
+
+    uint32_t (*getTicks)();
+
+    Recorder *recorder = nullptr;
+    uint16_t *buffer   = nullptr;
+    size_t    filled   = 0;
+
+    uint32_t rate       = 0;
+    uint32_t startTicks = 0;
+    uint64_t produced   = 0;
+
+public:
+    bool start(Recorder &recorder_, uint32_t rate_);
+    void stop();
+    void poll();
+
+    /// \param getTicks_ a millisecond clock
+    SyntheticSource(uint32_t (*getTicks_)()) : getTicks(getTicks_) { }
+    ~SyntheticSource() = default;
+};
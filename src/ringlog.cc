@@ -0,0 +1,267 @@
+/**
+ * \file
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "ringlog.hh"
+#include "fileops.hh"
+#include "crc.hh"
+
+#include <cstring>
+
+static const size_t headerLength = 24;
+static const size_t offCrc       = 20;
+
+static inline uint16_t get16(const uint8_t *p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+static inline uint32_t get32(const uint8_t *p) {
+    return (uint32_t)p[0]       | (uint32_t)p[1] <<  8
+         | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+static inline void put32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v);
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+FatError RingLog::locate(FatVolume &volume, const char *path, uint32_t &lba_, uint32_t &sectors) {
+    FatVolume::DirEntry entry;
+    FatError err = volume.lookup(path, entry);
+    if (err)
+        return err;
+    if (entry.isDirectory())
+        return FAT_ERR_IS_DIR;
+
+    sectors = entry.size / sectorSize;
+    if (sectors < 2)
+        return FAT_ERR_INVALID_ARG;
+
+    uint32_t          count;
+    FatVolume::Cursor cursor { entry.cluster, 0 };
+    if ((err = volume.nextRun(cursor, sectors, lba_, count)))
+        return err;
+
+    return count < sectors ? FAT_ERR_INVALID_ARG : FAT_ERR_OK;
+}
+
+FatError RingLog::create(FatVolume &volume, const char *path, uint32_t size) {
+    size -= size % (uint32_t)sectorSize;
+    if (size < 2 * sectorSize)
+        return FAT_ERR_INVALID_ARG;
+
+    FatVolume::DirEntry entry;
+    FatError err = removeFile(volume, path);
+    if (!err || err == FAT_ERR_NOT_FOUND)
+        err = createFile(volume, path, size, entry);
+    if (err)
+        return err;
+
+    RingLog  log;
+    uint32_t sectors;
+    if ((err = locate(volume, path, log.lba, sectors))) {
+        removeFile(volume, path);
+        return err == FAT_ERR_INVALID_ARG ? FAT_ERR_NO_SPACE : err;
+    }
+
+    log.store    = &volume.getStore();
+    log.capacity = (sectors - 1) * sectorSize;
+
+    return log.writeHeader();
+}
+
+FatError RingLog::open(FatVolume &volume, const char *path) {
+    store       = nullptr;
+    sectorIndex = noSector;
+
+    uint32_t sectors;
+    FatError err = locate(volume, path, lba, sectors);
+    if (err)
+        return err;
+
+    BlockStore &store_ = volume.getStore();
+    if (store_.seek(lba) || store_.read(header))
+        return FAT_ERR_IO;
+
+    if (memcmp(header, "RLOG", 4) || get32(header + offCrc) != crc32(header, offCrc))
+        return FAT_ERR_INVALID_ARG;
+
+    capacity = get32(header + 4);
+    head     = get32(header + 8);
+    used     = get32(header + 12);
+    count    = get32(header + 16);
+
+    if (capacity != (sectors - 1) * sectorSize || head >= capacity || used > capacity)
+        return FAT_ERR_INVALID_ARG;
+
+    store = &store_;
+
+    return FAT_ERR_OK;
+}
+
+FatError RingLog::writeHeader() {
+    memset(header, 0, sizeof(header));
+    memcpy(header, "RLOG", 4);
+    put32(header + 4,  capacity);
+    put32(header + 8,  head);
+    put32(header + 12, used);
+    put32(header + 16, count);
+    put32(header + offCrc, crc32(header, offCrc));
+
+    if (store->seek(lba) || store->write(header))
+        return FAT_ERR_IO;
+
+    return FAT_ERR_OK;
+}
+
+FatError RingLog::loadSector(uint32_t index) {
+    if (index == sectorIndex)
+        return FAT_ERR_OK;
+
+    sectorIndex = noSector;
+    if (store->seek(lba + 1 + index) || store->read(sector))
+        return FAT_ERR_IO;
+    sectorIndex = index;
+
+    return FAT_ERR_OK;
+}
+
+FatError RingLog::readBytes(uint32_t offset, void *data, uint32_t length) {
+    uint8_t *out = (uint8_t*)data;
+
+    while (length) {
+        FatError err = loadSector(offset / sectorSize);
+        if (err)
+            return err;
+
+        uint32_t at = offset % sectorSize;
+        uint32_t n  = (uint32_t)sectorSize - at;
+        if (n > length)
+            n = length;
+
+        memcpy(out, sector + at, n);
+        out    += n;
+        length -= n;
+        offset  = (offset + n) % capacity;
+    }
+
+    return FAT_ERR_OK;
+}
+
+FatError RingLog::writeRecord(uint32_t offset, const void *data, uint16_t length) {
+    const uint8_t *in   = (const uint8_t*)data;
+    uint32_t       size = 2 + (uint32_t)length;
+    uint32_t       i    = 0;
+
+    while (i < size) {
+        uint32_t index = offset / sectorSize;
+        uint32_t at    = offset % sectorSize;
+        uint32_t start = i;
+
+        // Unless the record covers the whole sector, other records may
+        // share it: before the tail, or after it once the ring wraps.
+        bool whole = !at && size - i >= sectorSize;
+        if (!whole && index != sectorIndex) {
+            FatError err = loadSector(index);
+            if (err)
+                return err;
+        }
+        sectorIndex = index;
+
+        for (; i < size && at < sectorSize; i++)
+            sector[at++] = i < 2 ? (uint8_t)(length >> (8 * i)) : in[i - 2];
+
+        if (store->seek(lba + 1 + index) || store->write(sector)) {
+            sectorIndex = noSector;
+            return FAT_ERR_IO;
+        }
+
+        offset = (offset + i - start) % capacity;
+    }
+
+    return FAT_ERR_OK;
+}
+
+FatError RingLog::append(const void *data, uint16_t length) {
+    if (!store)
+        return FAT_ERR_INVALID_ARG;
+
+    uint32_t size = 2 + (uint32_t)length;
+    if (length > maxRecordLength || size > capacity)
+        return FAT_ERR_INVALID_ARG;
+
+    FatError err;
+    bool     dropped = false;
+
+    // Drop the oldest records until the new one fits.
+    while (capacity - used < size) {
+        uint8_t lengthBytes[2];
+        if ((err = readBytes(head, lengthBytes, 2)))
+            return err;
+
+        uint32_t oldSize = 2 + (uint32_t)get16(lengthBytes);
+        if (oldSize > used)
+            return FAT_ERR_IO; // Corrupt.
+
+        head  = (head + oldSize) % capacity;
+        used -= oldSize;
+        count--;
+        dropped = true;
+    }
+
+    // The record overwrites the dropped ones, which the header on the
+    // store must no longer include.
+    if (dropped && (err = writeHeader()))
+        return err;
+
+    if ((err = writeRecord((head + used) % capacity, data, length)))
+        return err;
+
+    used += size;
+    count++;
+
+    return writeHeader();
+}
+
+FatError RingLog::next(Cursor &cursor, void *data, size_t size, size_t &length) {
+    length = 0;
+
+    if (!store)
+        return FAT_ERR_INVALID_ARG;
+    if (cursor.remaining < 2)
+        return FAT_ERR_NOT_FOUND;
+
+    uint8_t  lengthBytes[2];
+    FatError err = readBytes(cursor.offset, lengthBytes, 2);
+    if (err)
+        return err;
+
+    uint32_t recordLength = get16(lengthBytes);
+    if (2 + recordLength > cursor.remaining)
+        return FAT_ERR_IO; // Corrupt.
+
+    length = recordLength < size ? recordLength : size;
+    if ((err = readBytes((cursor.offset + 2) % capacity, data, (uint32_t)length)))
+        return err;
+
+    cursor.offset     = (cursor.offset + 2 + recordLength) % capacity;
+    cursor.remaining -= 2 + recordLength;
+
+    return FAT_ERR_OK;
+}
@@ -0,0 +1,113 @@
+/**
+ * \file
+ * \brief     Fixed-size circular log in a contiguous file.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "fatvol.hh"
+
+/**
+ * \brief A log of records that overwrites its oldest records when full.
+ *
+ * The file is allocated once, contiguously, so that its sectors can be
+ * addressed directly instead of through the cluster chain. Its first
+ * sector is a header:
+ *
+ *     "RLOG", capacity, head, used, count, CRC-32 of the preceding bytes
+ *
+ * (32-bit little-endian values). The remaining sectors are a ring of
+ * `capacity` bytes, holding records from `head` on for `used` bytes. Each
+ * record is a 16-bit length followed by that many bytes, and may wrap
+ * around the end of the ring.
+ *
+ * An append writes the sectors the record lands in and then the header,
+ * usually just two sector writes: the tail sector stays cached between
+ * appends. The oldest records are dropped to make room, which only reads
+ * their lengths; the header is then written first, so that it no longer
+ * covers the space the record is written to. An interrupted append thus
+ * leaves the log as it was, less any records dropped to make room.
+ */
+class RingLog {
+
+public:
+    static const size_t   sectorSize      = FatVolume::sectorSize;
+    static const uint16_t maxRecordLength = 1024;
+
+    /// Position of a record, for reading the log oldest-first.
+    struct Cursor {
+        uint32_t offset;
+        uint32_t remaining; ///< Bytes of records left.
+    };
+
+private:
+    static const uint32_t noSector = 0xffffffff;
+
+    BlockStore *store = nullptr;
+    uint32_t    lba   = 0; ///< The header sector.
+
+    uint32_t capacity = 0;
+    uint32_t head     = 0;
+    uint32_t used     = 0;
+    uint32_t count    = 0;
+
+    uint8_t  sector[sectorSize]; ///< Caches one ring sector, usually the tail.
+    uint32_t sectorIndex = noSector;
+    uint8_t  header[sectorSize];
+
+    FatError loadSector(uint32_t index);
+    FatError readBytes(uint32_t offset, void *data, uint32_t length);
+    FatError writeRecord(uint32_t offset, const void *data, uint16_t length);
+    FatError writeHeader();
+
+    /// Find a file's first sector, and check that the file is contiguous.
+    static FatError locate(FatVolume &volume, const char *path, uint32_t &lba, uint32_t &sectors);
+
+public:
+    /**
+     * \brief Create an empty log of `size` bytes, replacing any existing file.
+     *
+     * \return FAT_ERR_NO_SPACE if no contiguous space was found
+     */
+    static FatError create(FatVolume &volume, const char *path, uint32_t size);
+
+    /// \return FAT_ERR_INVALID_ARG if the file is not a ring log
+    FatError open(FatVolume &volume, const char *path);
+
+    /// Append a record, dropping the oldest ones if there is no room.
+    FatError append(const void *data, uint16_t length);
+
+    Cursor begin() const { return Cursor { head, used }; }
+
+    /**
+     * \brief Read the record at a cursor, and advance the cursor.
+     *
+     * Records longer than `size` are cut short.
+     *
+     * \return FAT_ERR_NOT_FOUND after the newest record
+     */
+    FatError next(Cursor &cursor, void *data, size_t size, size_t &length);
+
+    uint32_t getCapacity() const { return capacity; }
+    uint32_t getUsed()     const { return used; }
+    uint32_t getCount()    const { return count; }
+
+    RingLog() = default;
+    ~RingLog() = default;
+};
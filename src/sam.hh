@@ -4,11 +4,18 @@
  */
 #pragma once
 
+#ifdef HOST_BUILD
+// The host build (see `make host`) gets stand-ins instead.
+#include "hostsam.hh"
+#else
 #define __SAM3X8E__
 
 extern "C" {
 #include "sam/libsam/chip.h"
 #include "sam/CMSIS/Device/ATMEL/sam.h"
+}
+#endif
 
+extern "C" {
     void hang() __attribute__((noreturn));
 }
@@ -0,0 +1,51 @@
+/**
+ * \file
+ * \brief     Memory shared by shell commands.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstdint>
+
+/**
+ * \brief Buffers that shell commands only need while they run.
+ *
+ * The shell runs one command at a time, to completion, so these share
+ * memory instead of each being a static buffer of its own. Each member is
+ * the layout of one user. Interrupt handlers, the recorder and the file
+ * indexer run outside commands, and must not use it.
+ */
+union Scratch {
+    /// copyFile, for cp and mv.
+    uint8_t copy[8 * 512];
+
+    /// crc32 and sha256sum.
+    uint8_t checksum[4 * 512];
+
+    /// grep: one sector of unfinished line plus one newly read sector.
+    char grep[2 * 512];
+
+    /// bench: the data of one operation, and latency samples.
+    struct {
+        uint8_t  io[8 * 512];
+        uint32_t samples[256];
+    } bench;
+};
+
+extern Scratch scratch;
@@ -20,6 +20,10 @@
  */
 #include "sam.hh"
 #include "sdspi.hh"
+#include "cpustats.hh"
+#include "iostats.hh"
+#include "trace.hh"
+#include "ramfunc.hh"
 
 #include <cstdlib>
 #include <cstring>
@@ -81,30 +85,36 @@ struct SdCsd {
     uint8_t  _endBit          :  1;
 } __attribute__((packed));
 
-uint8_t SdSpi::wait() {
+template<typename Bus, typename Cs, typename Clock>
+RAMFUNC uint8_t SdSpiT<Bus, Cs, Clock>::wait() {
     // Wait for the card to become ready for accepting new commands.
     uint8_t  x = 0;
     uint32_t i = 0;
+    CycleTimer timer;
     do {
         if (i++ > cmdTimeoutClocks)
-            return x;
-        SPI_Write(SPI0, 0, 0xff);
-        x = (uint8_t)SPI_Read(SPI0);
+            break;
+        x = transfer(0xff);
     } while (x != 0xff);
 
+    ioStats.storeWaitCycles += timer.elapsed();
+
     return x;
 }
 
-uint8_t SdSpi::recv() {
-    return send(0xff);
+template<typename Bus, typename Cs, typename Clock>
+RAMFUNC uint8_t SdSpiT<Bus, Cs, Clock>::recv() {
+    return transfer(0xff);
 }
 
-void SdSpi::recv(uint8_t *buffer, size_t length) {
+template<typename Bus, typename Cs, typename Clock>
+RAMFUNC void SdSpiT<Bus, Cs, Clock>::recv(uint8_t *buffer, size_t length) {
     for (size_t i = 0; i < length; i++)
-        buffer[i] = recv();
+        buffer[i] = transfer(0xff);
 }
 
-StoreError SdSpi::recvBlock(uint8_t *buffer, size_t length) {
+template<typename Bus, typename Cs, typename Clock>
+RAMFUNC StoreError SdSpiT<Bus, Cs, Clock>::recvBlock(uint8_t *buffer, size_t length) {
     size_t i = 0;
     uint8_t ch;
 
@@ -112,23 +122,23 @@ StoreError SdSpi::recvBlock(uint8_t *buffer, size_t length) {
         if (i++ > cmdTimeoutClocks)
             return STORE_ERR_IO;
         // Wait for start block token (0xfe).
-    } while ((ch = recv()) != 0xfe);
+    } while ((ch = transfer(0xff)) != 0xfe);
 
     for (i = 0; i < length; i++)
-        buffer[i] = recv();
+        buffer[i] = transfer(0xff);
 
     return STORE_ERR_OK;
 }
 
-uint8_t SdSpi::recvR1() {
+template<typename Bus, typename Cs, typename Clock>
+RAMFUNC uint8_t SdSpiT<Bus, Cs, Clock>::recvR1() {
     // Receive R1 response byte.
     uint8_t  x = 0;
     uint32_t i = 0;
     do {
         if (i++ > cmdTimeoutClocks)
             return 0xff; // Invalid.
-        SPI_Write(SPI0, 0, 0xff);
-        x = (uint8_t)SPI_Read(SPI0);
+        x = transfer(0xff);
 
         // First bit of R1 must be zero.
     } while (x & 0x80);
@@ -136,54 +146,85 @@ uint8_t SdSpi::recvR1() {
     return x;
 }
 
-uint8_t SdSpi::send(uint8_t byte) {
-    SPI_Write(SPI0, 0, byte);
-    return (uint8_t)SPI_Read(SPI0);
+template<typename Bus, typename Cs, typename Clock>
+RAMFUNC uint8_t SdSpiT<Bus, Cs, Clock>::send(uint8_t byte) {
+    return transfer(byte);
 }
 
-uint8_t SdSpi::send(uint8_t *buffer, size_t length) {
+template<typename Bus, typename Cs, typename Clock>
+RAMFUNC uint8_t SdSpiT<Bus, Cs, Clock>::send(uint8_t *buffer, size_t length) {
     uint8_t ret = 0;
     for (size_t i = 0; i < length; i++)
-        ret = send(buffer[i]);
+        ret = transfer(buffer[i]);
     return ret;
 }
 
-uint8_t SdSpi::send(SdCommand cmd) {
-    uint8_t str[6];
-    str[0] = (uint8_t)(0x40 | (cmd.cmd & 0x3f));
-    str[1] = (uint8_t)(cmd.arg >> 24);
-    str[2] = (uint8_t)(cmd.arg >> 16);
-    str[3] = (uint8_t)(cmd.arg >>  8);
-    str[4] = (uint8_t)(cmd.arg      );
+/// Encode a command frame.
+static void packCommand(uint8_t cmd, uint32_t arg, uint8_t *str) {
+    str[0] = (uint8_t)(0x40 | (cmd & 0x3f));
+    str[1] = (uint8_t)(arg >> 24);
+    str[2] = (uint8_t)(arg >> 16);
+    str[3] = (uint8_t)(arg >>  8);
+    str[4] = (uint8_t)(arg      );
 
-    if (cmd.cmd == 0) {
+    if (cmd == 0) {
         str[5] = 0x95; // CRC7 for CMD0, includes terminating end bit.
-    } else if (cmd.cmd == 8) {
+    } else if (cmd == 8) {
         str[5] = 0x69; // CRC7 for CMD8 with 0x1a5 as params.
     } else {
         str[5] = 0xff; // ¯\_(ツ)_/¯
     }
+}
+
+template<typename Bus, typename Cs, typename Clock>
+uint8_t SdSpiT<Bus, Cs, Clock>::send(SdCommand cmd) {
+    uint8_t str[6];
+    packCommand(cmd.cmd, cmd.arg, str);
+
+    tracer.log(TRACE_SD_CMD, cmd.cmd, 0, cmd.arg);
 
     wait();
     send(str, sizeof(str));
 
-    return recvR1();
+    uint8_t result = recvR1();
+    tracer.log(TRACE_SD_RESP, cmd.cmd, result);
+
+    return result;
 }
 
-StoreError SdSpi::sendBlock(const uint8_t *buffer, size_t length) {
+template<typename Bus, typename Cs, typename Clock>
+uint8_t SdSpiT<Bus, Cs, Clock>::stopTransmission() {
+    // The card is still streaming data, so we cannot wait for it to
+    // become idle before sending the command as send(SdCommand) does.
+    uint8_t str[6];
+    packCommand(12, 0, str);
+    tracer.log(TRACE_SD_CMD, 12);
+    send(str, sizeof(str));
+
+    recv(); // Skip the stuff byte.
+    uint8_t result = recvR1();
+    tracer.log(TRACE_SD_RESP, 12, result);
+
+    wait();
+
+    return result;
+}
+
+template<typename Bus, typename Cs, typename Clock>
+RAMFUNC StoreError SdSpiT<Bus, Cs, Clock>::sendBlock(const uint8_t *buffer, size_t length, uint8_t token) {
     if (wait() != 0xff)
         return STORE_ERR_IO;
 
-    send(0xfe); // Data start token.
+    transfer(token); // Data start token.
 
     for (size_t i = 0; i < length; i++)
-        send(buffer[i]);
+        transfer(buffer[i]);
 
     // CRC, unused.
-    send(0xff);
-    send(0xff);
+    transfer(0xff);
+    transfer(0xff);
 
-    uint8_t respToken = recv();
+    uint8_t respToken = transfer(0xff);
     if ((respToken & 0x1f) == 0x05) {
         // 'Data accepted'.
         if (wait() != 0xff)
@@ -195,7 +236,8 @@ StoreError SdSpi::sendBlock(const uint8_t *buffer, size_t length) {
     }
 }
 
-StoreError SdSpi::seek(size_t lba) {
+template<typename Bus, typename Cs, typename Clock>
+StoreError SdSpiT<Bus, Cs, Clock>::seek(size_t lba) {
     if (!cardPresent || !inited)
         return STORE_ERR_IO;
     if (lba >= blockCount)
@@ -206,7 +248,8 @@ StoreError SdSpi::seek(size_t lba) {
     return STORE_ERR_OK;
 }
 
-StoreError SdSpi::read(void *buffer) {
+template<typename Bus, typename Cs, typename Clock>
+StoreError SdSpiT<Bus, Cs, Clock>::read(void *buffer) {
     if (!cardPresent || !inited)
         return STORE_ERR_IO;
     if (pos >= blockCount)
@@ -222,6 +265,7 @@ StoreError SdSpi::read(void *buffer) {
     recvBlock((uint8_t*)buffer, blockSize);
 
     pos++;
+    ioStats.storeBytesRead += blockSize;
 
     // Receive and discard 16-bit CRC.
     recv();
@@ -233,7 +277,8 @@ StoreError SdSpi::read(void *buffer) {
     return STORE_ERR_OK;
 }
 
-StoreError SdSpi::write(const void *buffer) {
+template<typename Bus, typename Cs, typename Clock>
+StoreError SdSpiT<Bus, Cs, Clock>::write(const void *buffer) {
     if (!cardPresent || !inited)
         return STORE_ERR_IO;
     if (pos >= blockCount)
@@ -248,39 +293,138 @@ StoreError SdSpi::write(const void *buffer) {
     }
 
     pos++;
+    ioStats.storeBytesWritten += blockSize;
 
     return sendBlock((uint8_t*)buffer, 512);
 }
 
-SdSpi::SdSpi() {
-    // con->puts("Initing SD SPI on NPCS0\n");
+template<typename Bus, typename Cs, typename Clock>
+StoreError SdSpiT<Bus, Cs, Clock>::readBlocks(void *buffer, size_t count) {
+    if (!cardPresent || !inited)
+        return STORE_ERR_IO;
+    if (pos + count > blockCount)
+        return STORE_ERR_OUT_OF_BOUNDS;
+    if (count == 1)
+        return read(buffer);
+    if (!count)
+        return STORE_ERR_OK;
+
+    wait();
+
+    uint8_t result = send(SdCommand{18, (uint32_t)pos});
+    if (result != 0)
+        return STORE_ERR_IO;
+
+    StoreError err = STORE_ERR_OK;
+
+    for (size_t i = 0; i < count; i++) {
+        err = recvBlock((uint8_t*)buffer + i * blockSize, blockSize);
+        if (err)
+            break;
+
+        // Receive and discard 16-bit CRC.
+        recv();
+        recv();
+
+        pos++;
+        ioStats.storeBytesRead += blockSize;
+    }
+
+    if (stopTransmission() != 0)
+        return STORE_ERR_IO;
+
+    return err;
+}
+
+template<typename Bus, typename Cs, typename Clock>
+StoreError SdSpiT<Bus, Cs, Clock>::writeBlocks(const void *buffer, size_t count) {
+    if (!cardPresent || !inited)
+        return STORE_ERR_IO;
+    if (pos + count > blockCount)
+        return STORE_ERR_OUT_OF_BOUNDS;
+    if (count == 1)
+        return write(buffer);
+    if (!count)
+        return STORE_ERR_OK;
+
+    if (wait() != 0xff)
+        return STORE_ERR_IO;
+
+    uint8_t result = send(SdCommand{25, (uint32_t)pos});
+    if (result != 0)
+        return STORE_ERR_IO;
+
+    StoreError err = STORE_ERR_OK;
+
+    for (size_t i = 0; i < count; i++) {
+        // Each block uses the 'multiple block write' start token.
+        err = sendBlock((const uint8_t*)buffer + i * blockSize, blockSize, 0xfc);
+        if (err)
+            break;
+
+        pos++;
+        ioStats.storeBytesWritten += blockSize;
+    }
+
+    // Stop tran token, the card signals busy until everything is written.
+    wait();
+    send(0xfd);
+    recv();
+
+    if (wait() != 0xff)
+        return STORE_ERR_IO;
+
+    return err;
+}
+
+bool Spi0Bus::started = false;
+
+void Spi0Bus::begin() {
+    if (started)
+        return;
+    started = true;
 
     SPI_Disable(SPI0);
 
     // Setup SPI pins.
-    // Note: CS0 is pin 10 on the due.
-    PIO_Configure(PIOA, PIO_PERIPH_A, PIO_PA28A_SPI0_NPCS0, PIO_DEFAULT);
     PIO_Configure(PIOA, PIO_PERIPH_A, PIO_PA25A_SPI0_MISO,  PIO_DEFAULT);
     PIO_Configure(PIOA, PIO_PERIPH_A, PIO_PA26A_SPI0_MOSI,  PIO_DEFAULT);
     PIO_Configure(PIOA, PIO_PERIPH_A, PIO_PA27A_SPI0_SPCK,  PIO_DEFAULT);
 
     // Set SPI configuration parameters.
     SPI_Configure(SPI0, ID_SPI0,
-                  0x21         // WDRBT enabled, PS Fixed, Master.
-                  | SPI_PCS(0) // Select first peripheral (NPCS0 - CS on Due pin 10).
-                 );
-
-    // Configure SPI peripheral 0 (CS0).
-    SPI_ConfigureNPCS(SPI0, 0,
-                      // XXX: These clock values are just a guess but they seem to work for SD.
-                      // TODO: Tune this for performance?
-                        (uint32_t)32 << 24
-                      | (uint32_t)32 << 16
-                      | (uint32_t)16 << 8 // baud rate divisor thingy.
-                      | 0x2);            // CPOL = 0, NCHPA = 1
-
-	// con->puts("Enable SPI\n");
+                  0x23); // WDRBT enabled, PS variable, Master.
+
     SPI_Enable(SPI0);
+}
+
+// Note: CS0 is pin 10 on the due.
+template<>
+void SpiChipSelect<0>::configurePin() {
+    PIO_Configure(PIOA, PIO_PERIPH_A, PIO_PA28A_SPI0_NPCS0, PIO_DEFAULT);
+}
+
+// Pin 4 on the due.
+template<>
+void SpiChipSelect<1>::configurePin() {
+    PIO_Configure(PIOA, PIO_PERIPH_A, PIO_PA29A_SPI0_NPCS1, PIO_DEFAULT);
+}
+
+/// Chip select register value for an SD card at MCK / divisor.
+static uint32_t sdCsr(uint8_t divisor) {
+    // XXX: These delays are just a guess but they seem to work for SD.
+    return (uint32_t)32 << 24
+         | (uint32_t)32 << 16
+         | (uint32_t)divisor << 8 // Baud rate divisor.
+         | 0x2;                   // CPOL = 0, NCHPA = 1
+}
+
+template<typename Bus, typename Cs, typename Clock>
+SdSpiT<Bus, Cs, Clock>::SdSpiT() {
+    Bus::begin();
+    Cs::configurePin();
+
+    Bus::regs()->SPI_CSR[Cs::index] = sdCsr(Clock::init);
 
     // Wait for the SD card to become ready.
     if (wait() != 0xff)
@@ -349,5 +493,10 @@ SdSpi::SdSpi() {
     // result = send(SdCommand{16, 512}); // Set block length.
     // con->printf("result16: <%02xh>\n", result);
 
+    Bus::regs()->SPI_CSR[Cs::index] = sdCsr(Clock::run);
+
     inited = true;
 }
+
+// The cards in use. Another card is another line here.
+template class SdSpiT<Spi0Bus, SpiChipSelect<0>, SdClock<210, 16>>;
@@ -21,9 +21,63 @@
  */
 #pragma once
 
-#include <mustore/store.hh>
+#include "blockstore.hh"
+#include "sam.hh"
 
-class SdSpi : public MuStore::Store {
+/// SPI0, the SAM3X8E's only SPI controller.
+struct Spi0Bus {
+    static Spi *regs() { return SPI0; }
+
+    /**
+     * \brief Reset the controller and set up its data pins, once.
+     *
+     * Uses variable peripheral select, every transfer names its chip select.
+     */
+    static void begin();
+
+private:
+    static bool started;
+};
+
+/**
+ * \brief A chip select line of an SPI controller.
+ *
+ * Only NPCS0 (Due pin 10) and NPCS1 (Due pin 4) have configurePin()
+ * defined, the other lines share pins with peripherals used elsewhere.
+ */
+template<unsigned npcs>
+struct SpiChipSelect {
+    static_assert(npcs < 4, "There are four chip selects");
+
+    static const unsigned index = npcs;
+
+    /// The TDR PCS field that selects this line, without a decoder.
+    static const uint32_t pcs = (~(1u << npcs) & 0xfu) << 16;
+
+    static void configurePin();
+};
+
+/**
+ * \brief SPI clock divisors for an SD card, MCK / divisor.
+ *
+ * Cards must be initialized at 400 kHz at most, some tolerate more.
+ */
+template<uint8_t initDivisor, uint8_t divisor>
+struct SdClock {
+    static const uint8_t init = initDivisor;
+    static const uint8_t run  = divisor;
+};
+
+/**
+ * \brief An SD card on an SPI chip select.
+ *
+ * The bus, chip select and clock are template parameters, so register
+ * addresses and PCS fields are constants and the byte loops compile to
+ * plain register accesses. Cards on other chip selects are separate
+ * instantiations, listed at the end of sdspi.cc.
+ */
+template<typename Bus, typename Cs, typename Clock>
+class SdSpiT : public BlockStore {
 
     struct SdCommand {
         uint8_t  cmd;
@@ -35,12 +89,24 @@ class SdSpi : public MuStore::Store {
     bool cardPresent = false;
     bool inited      = false;
 
+    /// Exchange a byte with the card.
+    __attribute__((always_inline))
+    static uint8_t transfer(uint8_t byte) {
+        Spi *spi = Bus::regs();
+        while (!(spi->SPI_SR & SPI_SR_TXEMPTY));
+        spi->SPI_TDR = byte | Cs::pcs;
+        while (!(spi->SPI_SR & SPI_SR_RDRF));
+        return (uint8_t)spi->SPI_RDR;
+    }
+
     uint8_t wait();
 
     uint8_t send(uint8_t byte);
     uint8_t send(uint8_t *buffer, size_t length);
     uint8_t send(SdCommand cmd);
-    MuStore::StoreError sendBlock(const uint8_t *buffer, size_t length);
+    MuStore::StoreError sendBlock(const uint8_t *buffer,
+                                  size_t length,
+                                  uint8_t token = 0xfe);
 
     uint8_t recv();
     void    recv(uint8_t *buffer, size_t length);
@@ -48,15 +114,24 @@ class SdSpi : public MuStore::Store {
 
     uint8_t recvR1();
 
+    /// Terminate a multiple block read.
+    uint8_t stopTransmission();
+
 public:
     MuStore::StoreError seek(size_t lba);
 
     MuStore::StoreError read (void *buffer);
     MuStore::StoreError write(const void *buffer);
 
+    MuStore::StoreError readBlocks (void *buffer,       size_t count);
+    MuStore::StoreError writeBlocks(const void *buffer, size_t count);
+
     using Store::read;
     using Store::write;
 
-    SdSpi();
-    ~SdSpi() = default;
+    SdSpiT();
+    ~SdSpiT() = default;
 };
+
+/// The card on the Due's pin 10, initialized at MCK / 210 = 400 kHz, then run at MCK / 16 = 5.25 MHz.
+using SdSpi = SdSpiT<Spi0Bus, SpiChipSelect<0>, SdClock<210, 16>>;
@@ -0,0 +1,132 @@
+/**
+ * \file
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "search.hh"
+
+#include <cstring>
+
+// The word-at-a-time routines below use the classic "has zero byte" trick:
+// XORing a word with the needle repeated four times turns matching bytes
+// into zero bytes, which can then be detected without a per-byte branch.
+
+static const uint32_t ones  = 0x01010101;
+static const uint32_t highs = 0x80808080;
+
+/// Load a word. The Cortex-M3 handles unaligned loads, this compiles to a single LDR.
+static inline uint32_t loadWord(const char *p) {
+    uint32_t w;
+    memcpy(&w, p, sizeof(w));
+    return w;
+}
+
+/// Get a mask with the high bit set in every zero byte of a word.
+static inline uint32_t zeroBytes(uint32_t w) {
+    // This variant has no false positives, so the result can be counted.
+    return ~(((w & ~highs) + ~highs) | w) & highs;
+}
+
+const char *findChar(const char *buffer, size_t length, char ch) {
+    const char *p   = buffer;
+    const char *end = buffer + length;
+
+    while (p < end && ((uintptr_t)p & 3)) {
+        if (*p == ch)
+            return p;
+        p++;
+    }
+
+    uint32_t mask = ones * (uint8_t)ch;
+
+    for (; end - p >= 4; p += 4) {
+        uint32_t w = loadWord(p) ^ mask;
+        if ((w - ones) & ~w & highs)
+            break; // The matching byte is in this word.
+    }
+
+    for (; p < end; p++) {
+        if (*p == ch)
+            return p;
+    }
+
+    return nullptr;
+}
+
+const char *findLastChar(const char *buffer, size_t length, char ch) {
+    for (const char *p = buffer + length; p > buffer; p--) {
+        if (p[-1] == ch)
+            return p - 1;
+    }
+    return nullptr;
+}
+
+size_t countChar(const char *buffer, size_t length, char ch) {
+    const char *p   = buffer;
+    const char *end = buffer + length;
+    size_t count = 0;
+
+    while (p < end && ((uintptr_t)p & 3)) {
+        if (*p++ == ch)
+            count++;
+    }
+
+    uint32_t mask = ones * (uint8_t)ch;
+
+    for (; end - p >= 4; p += 4) {
+        uint32_t z = zeroBytes(loadWord(p) ^ mask);
+        // Sum the marker bits without a popcount instruction.
+        count += ((z >> 7) * ones) >> 24;
+    }
+
+    for (; p < end; p++) {
+        if (*p == ch)
+            count++;
+    }
+
+    return count;
+}
+
+const char *Bmh::find(const char *buffer, size_t bufferLength) const {
+    if (!length || bufferLength < length)
+        return length ? nullptr : buffer;
+
+    const size_t last = length - 1;
+    const char  *end  = buffer + bufferLength - length;
+    const char   tail = pattern[last];
+
+    for (const char *p = buffer; p <= end; p += skip[(uint8_t)p[last]]) {
+        if (p[last] == tail && !memcmp(p, pattern, last))
+            return p;
+    }
+
+    return nullptr;
+}
+
+Bmh::Bmh(const char *pattern_)
+    : pattern(pattern_) {
+
+    length = strlen(pattern);
+    if (length > maxLength)
+        length = maxLength;
+
+    memset(skip, (int)(length ? length : 1), sizeof(skip));
+
+    for (size_t i = 0; i + 1 < length; i++)
+        skip[(uint8_t)pattern[i]] = (uint8_t)(length - 1 - i);
+}
@@ -0,0 +1,75 @@
+/**
+ * \file
+ * \brief     Fast byte and substring search routines.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+
+/**
+ * \brief Find the first occurrence of a byte.
+ *
+ * Scans a 32-bit word at a time once the pointer is aligned.
+ *
+ * \return a pointer to the byte, or nullptr if it does not occur in the buffer
+ */
+const char *findChar(const char *buffer, size_t length, char ch);
+
+/**
+ * \brief Find the last occurrence of a byte.
+ *
+ * \return a pointer to the byte, or nullptr if it does not occur in the buffer
+ */
+const char *findLastChar(const char *buffer, size_t length, char ch);
+
+/**
+ * \brief Count the occurrences of a byte, a 32-bit word at a time.
+ */
+size_t countChar(const char *buffer, size_t length, char ch);
+
+/**
+ * \brief Boyer-Moore-Horspool literal string searcher.
+ *
+ * The pattern is not copied and must outlive the searcher.
+ */
+class Bmh {
+
+    const char *pattern;
+    size_t      length;
+
+    /// Bad character shift table, patterns are limited to 255 bytes.
+    uint8_t skip[256];
+
+public:
+    static const size_t maxLength = 255;
+
+    size_t getLength() const { return length; }
+
+    /**
+     * \brief Find the first occurrence of the pattern.
+     *
+     * \return a pointer to the match, or nullptr if there is none
+     */
+    const char *find(const char *buffer, size_t bufferLength) const;
+
+    Bmh(const char *pattern_);
+    ~Bmh() = default;
+};
@@ -0,0 +1,176 @@
+/**
+ * \file
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "sha256.hh"
+
+#include <cstring>
+
+static const uint32_t k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static inline uint32_t rotr(uint32_t x, unsigned n) { return x >> n | x << (32 - n); }
+
+static inline uint32_t getBe32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline void putBe32(uint8_t *p, uint32_t value) {
+    p[0] = (uint8_t)(value >> 24);
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >>  8);
+    p[3] = (uint8_t)value;
+}
+
+// Rather than shuffling the eight working variables after every round,
+// the rounds are unrolled by eight with the variables' roles rotated.
+// The message schedule is kept in a 16-word ring; with rounds unrolled
+// by sixteen its indices are constants, so it stays in registers as far
+// as the register file allows.
+
+#define SIGMA0(x) (rotr(x,  2) ^ rotr(x, 13) ^ rotr(x, 22))
+#define SIGMA1(x) (rotr(x,  6) ^ rotr(x, 11) ^ rotr(x, 25))
+#define GAMMA0(x) (rotr(x,  7) ^ rotr(x, 18) ^ ((x) >>  3))
+#define GAMMA1(x) (rotr(x, 17) ^ rotr(x, 19) ^ ((x) >> 10))
+
+#define CH(x, y, z)  ((z) ^ ((x) & ((y) ^ (z))))
+#define MAJ(x, y, z) (((x) & (y)) | ((z) & ((x) | (y))))
+
+#define SCHEDULE(j) \
+    (w[(j) & 15] += GAMMA1(w[((j) - 2) & 15]) + w[((j) - 7) & 15] + GAMMA0(w[((j) - 15) & 15]))
+
+#define ROUND(a, b, c, d, e, f, g, h, i, wi)                  \
+    do {                                                      \
+        h += SIGMA1(e) + CH(e, f, g) + k[i] + (wi);           \
+        d += h;                                               \
+        h += SIGMA0(a) + MAJ(a, b, c);                        \
+    } while (0)
+
+#define ROUNDS8(i, W)                                         \
+    do {                                                      \
+        ROUND(a, b, c, d, e, f, g, h, (i) + 0, W((i) + 0));   \
+        ROUND(h, a, b, c, d, e, f, g, (i) + 1, W((i) + 1));   \
+        ROUND(g, h, a, b, c, d, e, f, (i) + 2, W((i) + 2));   \
+        ROUND(f, g, h, a, b, c, d, e, (i) + 3, W((i) + 3));   \
+        ROUND(e, f, g, h, a, b, c, d, (i) + 4, W((i) + 4));   \
+        ROUND(d, e, f, g, h, a, b, c, (i) + 5, W((i) + 5));   \
+        ROUND(c, d, e, f, g, h, a, b, (i) + 6, W((i) + 6));   \
+        ROUND(b, c, d, e, f, g, h, a, (i) + 7, W((i) + 7));   \
+    } while (0)
+
+#define LOAD(j) (w[j] = getBe32(data + 4 * (j)))
+
+void Sha256::compress(uint32_t *state, const uint8_t *data, size_t blocks) {
+    uint32_t w[16];
+
+    for (; blocks; blocks--, data += blockSize) {
+        uint32_t a = state[0];
+        uint32_t b = state[1];
+        uint32_t c = state[2];
+        uint32_t d = state[3];
+        uint32_t e = state[4];
+        uint32_t f = state[5];
+        uint32_t g = state[6];
+        uint32_t h = state[7];
+
+        ROUNDS8(0, LOAD);
+        ROUNDS8(8, LOAD);
+
+        for (unsigned i = 16; i < 64; i += 16) {
+            ROUNDS8(i,     SCHEDULE);
+            ROUNDS8(i + 8, SCHEDULE);
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+void Sha256::reset() {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(state, initial, sizeof(state));
+    bufferLength = 0;
+    length       = 0;
+}
+
+void Sha256::update(const void *data, size_t size) {
+    const uint8_t *p = (const uint8_t*)data;
+
+    length += size;
+
+    if (bufferLength) {
+        size_t n = blockSize - bufferLength;
+        if (n > size)
+            n = size;
+        memcpy(buffer + bufferLength, p, n);
+        bufferLength += n;
+        p            += n;
+        size         -= n;
+
+        if (bufferLength < blockSize)
+            return;
+        compress(state, buffer, 1);
+        bufferLength = 0;
+    }
+
+    if (size >= blockSize) {
+        compress(state, p, size / blockSize);
+        p    += size / blockSize * blockSize;
+        size %= blockSize;
+    }
+
+    memcpy(buffer, p, size);
+    bufferLength = size;
+}
+
+void Sha256::finish(uint8_t digest[digestSize]) {
+    uint64_t bits = length * 8;
+
+    // Pad with a one bit and zeroes up to the length field.
+    buffer[bufferLength++] = 0x80;
+    if (bufferLength > blockSize - 8) {
+        memset(buffer + bufferLength, 0, blockSize - bufferLength);
+        compress(state, buffer, 1);
+        bufferLength = 0;
+    }
+    memset(buffer + bufferLength, 0, blockSize - 8 - bufferLength);
+    putBe32(buffer + blockSize - 8, (uint32_t)(bits >> 32));
+    putBe32(buffer + blockSize - 4, (uint32_t)bits);
+    compress(state, buffer, 1);
+
+    for (size_t i = 0; i < 8; i++)
+        putBe32(digest + 4 * i, state[i]);
+}
@@ -0,0 +1,56 @@
+/**
+ * \file
+ * \brief     SHA-256 message digest.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+
+/**
+ * \brief Computes a SHA-256 digest of data passed in parts.
+ *
+ * Whole 64-byte blocks are compressed straight from the caller's buffer,
+ * only partial blocks are copied.
+ */
+class Sha256 {
+
+public:
+    static const size_t blockSize  = 64;
+    static const size_t digestSize = 32;
+
+private:
+    uint32_t state[8];
+    uint8_t  buffer[blockSize];
+    size_t   bufferLength;
+    uint64_t length;
+
+    static void compress(uint32_t *state, const uint8_t *data, size_t blocks);
+
+public:
+    void reset();
+    void update(const void *data, size_t size);
+
+    /// Get the digest. Call reset() to start a new one.
+    void finish(uint8_t digest[digestSize]);
+
+    Sha256() { reset(); }
+    ~Sha256() = default;
+};
@@ -20,9 +20,34 @@
  */
 #include "shell.hh"
 #include "sam.hh"
+#include "grep.hh"
+#include "fileops.hh"
+#include "bench.hh"
+#include "cycles.hh"
+#include "iostats.hh"
+#include "cpustats.hh"
+#include "lrucache.hh"
+#include "findex.hh"
+#include "fatfile.hh"
+#include "filereader.hh"
+#include "mount.hh"
+#include "lz4.hh"
+#include "xfer.hh"
+#include "xferfile.hh"
+#include "blkserve.hh"
+#include "recorder.hh"
+#include "crc.hh"
+#include "sha256.hh"
+#include "ringlog.hh"
+#include "scratch.hh"
+#include "adcsource.hh"
+#include "profiler.hh"
+#include "trace.hh"
+#include "memusage.hh"
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <new>
 
 using namespace MuStore;
 
@@ -38,54 +63,388 @@ struct Command {
 #define CMD(name) \
     { #name, CMD_NAME(name) }
 
-static Fs      *fs;
-static FsNode  *pwd;
-static char     pwdPath[257] = { };
+static MountTable  *mounts;
+static const Mount *rootMount;
+
+/**
+ * \brief The state of one shell, every console gets its own.
+ *
+ * Commands run to completion before another session gets its turn, so
+ * sessions can share the filesystem and the caches below without locking.
+ */
+struct Session {
+    Console *con;
+    FsNode   pwd;
+    char     pwdPath[257];
+    char     cmdInput[256];
+    int      cmdInputI;
+
+    Session(Console &con_, const FsNode &root)
+        : con(&con_), pwd(root), pwdPath { }, cmdInput { }, cmdInputI(0) { }
+};
+
+/// The maximum amount of concurrent sessions.
+static const size_t maxSessions = 5;
+
+// The context of the session that is currently running, see enterSession().
 static Console *con;
+static FsNode  *pwd;
+static char    *pwdPath;
+
+/// Make a session current, commands then use its console and working directory.
+static void enterSession(Session &session) {
+    con     = session.con;
+    pwd     = &session.pwd;
+    pwdPath = session.pwdPath;
+}
+
+/// Prefix a relative path with the working directory.
+static const char *absolutePath(const char *path, char *buffer, size_t size) {
+    if (path[0] == '/')
+        return path;
+
+    strncpy(buffer, pwdPath, size - 1);
+    buffer[size - 1] = '\0';
+    if (strcmp(buffer, "/"))
+        strncat(buffer, "/", size - 1 - strlen(buffer));
+    strncat(buffer, path, size - 1 - strlen(buffer));
+
+    return buffer;
+}
+
+/**
+ * \brief Find the filesystem a path is on.
+ *
+ * \param rest set to the absolute path within that filesystem
+ */
+static const Mount &resolvePath(const char *path, char *buffer, size_t size, const char *&rest) {
+    // Something is always mounted at "/".
+    return *mounts->resolve(absolutePath(path, buffer, size), rest);
+}
+
+/// Identifies a path lookup by its filesystem, parent directory and name.
+struct NodeKey {
+    const Mount         *mount;
+    FatVolume::DentryKey dentry;
+
+    uint32_t hash() const {
+        return dentry.hash() * 31 + (uint32_t)(uintptr_t)mount;
+    }
+    bool operator==(const NodeKey &other) const {
+        return mount == other.mount && dentry == other.dentry;
+    }
+};
+
+/// The result of a path lookup through FatFs, which may be negative.
+struct CachedNode {
+    FsNode   node;
+    FsError  err;
+    uint32_t generation; ///< The volume's generation at the time of the lookup.
+};
+
+/**
+ * \brief Recent path lookups, keyed by parent directory cluster and name.
+ *
+ * Entries for nodes written to must be refreshed with nodeWritten().
+ * Operations that go through FatVolume can rename, create or remove
+ * entries, they change the volume's generation, which outdates every
+ * entry for that volume.
+ */
+static LruCache<NodeKey, CachedNode, 16> nodeCache;
+
+/// Names of all files on the volume, built while the shell is idle.
+static FileIndex fileIndex;
+
+/// Decompresses compressed files for every FileReader, too large for the stack.
+static Lz4Reader lz4Reader;
+
+/// File transfers with the host, shared by the sessions for the same reason.
+static Xfer xfer(GetTickCount);
+
+/// Serves a mount's store to the host, see tools/blkclient.cc.
+static BlkServer blkServer(GetTickCount);
+
+/// Sample buffers for record, far too large for the stack.
+static Recorder recorder(GetTickCount);
+
+/// The logfile or histfile, opened for each use (one sector read).
+static RingLog ringLog;
+
+/**
+ * \brief Look up a path from the root if it is absolute, or from the working directory otherwise.
+ *
+ * Results are cached, repeated lookups of the same path cost no I/O.
+ */
+static FsNode getNode(const char *path, FsError &err) {
+    char buffer[257];
+    const Mount &mount = resolvePath(path, buffer, sizeof(buffer), path);
+
+    // Finding the parent directory's cluster goes through FatVolume's own
+    // name cache, so this is free for recently used directories.
+    NodeKey key;
+    key.mount = &mount;
+    if (mount.volume->keyOf(path, key.dentry))
+        return mount.fs->get(path, err); // The root, or not a valid 8.3 name.
+
+    CachedNode *cached = nodeCache.find(key);
+    if (cached && cached->generation == mount.volume->getGeneration()) {
+        err = cached->err;
+        return cached->node;
+    }
+
+    FsNode node = mount.fs->get(path, err);
+
+    // Only cache failures if the name really does not exist, and not
+    // because of an I/O error.
+    FatVolume::DirEntry entry;
+    if (!err || mount.volume->findShort(key.dentry.parent, key.dentry.name, entry) == FAT_ERR_NOT_FOUND)
+        nodeCache.insert(key, CachedNode { node, err, mount.volume->getGeneration() });
+
+    return node;
+}
+
+/// Refresh cached lookups after a file was extended through FatFs.
+static void nodeWritten(const char *path, FsNode &node) {
+    char buffer[257];
+    const Mount &mount = resolvePath(path, buffer, sizeof(buffer), path);
+
+    NodeKey key;
+    key.mount = &mount;
+    if (mount.volume->keyOf(path, key.dentry))
+        return;
+
+    // FatVolume's copy of the directory entry is outdated now.
+    mount.volume->forget(key.dentry);
+
+    node.seek(0);
+    nodeCache.insert(key, CachedNode { node, FS_ERR_OK, mount.volume->getGeneration() });
+}
+
+/// Print the transfer rate of a finished operation.
+static void printRate(uint32_t bytes, uint32_t ms) {
+    if (!ms)
+        ms = 1;
+    con->printf("%'u bytes in %'u ms (%'u bytes/s)\n",
+                bytes, ms, (uint32_t)((uint64_t)bytes * 1000 / ms));
+}
+
+static const char *fatErrorString(FatError err) {
+    switch (err) {
+    case FAT_ERR_OK:           return "ok";
+    case FAT_ERR_IO:           return "I/O error";
+    case FAT_ERR_NOT_FOUND:    return "no such file or directory";
+    case FAT_ERR_EXISTS:       return "file exists";
+    case FAT_ERR_NOT_DIR:      return "not a directory";
+    case FAT_ERR_IS_DIR:       return "is a directory";
+    case FAT_ERR_INVALID_NAME: return "invalid 8.3 file name";
+    case FAT_ERR_NO_SPACE:     return "no space left on volume";
+    case FAT_ERR_DIR_FULL:     return "directory full";
+    case FAT_ERR_INVALID_ARG:  return "invalid argument";
+    }
+    return "unknown error";
+}
+
+static const char *xferErrorString(XferError err) {
+    switch (err) {
+    case XFER_ERR_OK:        return "ok";
+    case XFER_ERR_IO:        return "I/O error";
+    case XFER_ERR_TIMEOUT:   return "timed out";
+    case XFER_ERR_CANCELLED: return "cancelled by peer";
+    case XFER_ERR_PROTOCOL:  return "protocol error";
+    }
+    return "unknown error";
+}
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-parameter"
 
+CMD_DECL(help);
+CMD_DECL(time);
+
+CMD_DECL(bench) {
+    bool     doStore = true;
+    bool     doFs    = true;
+    uint32_t kib     = 512;
+
+    if (argc == 3 && !strcmp(argv[1], "read")) {
+        char        pathBuffer[257];
+        const char *path;
+        const Mount &mount = resolvePath(argv[2], pathBuffer, sizeof(pathBuffer), path);
+        benchRead(*con, *mount.volume, path, lz4Reader);
+        return;
+    }
+
+    if (argc == 2 && !strcmp(argv[1], "uart")) {
+        con->printf("Type a line to time the receive interrupt.\n");
+
+        IoStats before = ioStats;
+        ioStats.consoleRxMaxCycles = 0;
+
+        int c;
+        while ((c = con->getch()) != '\r' && c != '\n');
+
+        uint32_t count  = ioStats.consoleRxInterrupts - before.consoleRxInterrupts;
+        uint32_t cycles = ioStats.consoleRxCycles     - before.consoleRxCycles;
+        con->printf("%u interrupts, %u cycles on average, %u at most\n",
+                    count, count ? cycles / count : 0, ioStats.consoleRxMaxCycles);
+        return;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "store")) {
+            doFs = false;
+        } else if (!strcmp(argv[i], "fs")) {
+            doStore = false;
+        } else if (argv[i][0] >= '1' && argv[i][0] <= '9') {
+            kib = (uint32_t)strtoul(argv[i], nullptr, 10);
+        } else {
+            con->printf("usage: bench [store|fs] [KB]\n"
+                        "       bench read FILE\n"
+                        "       bench uart\n");
+            return;
+        }
+    }
+
+    if (doStore)
+        benchStore(*con, *rootMount->volume, kib);
+    if (doFs)
+        benchFs(*con, *rootMount->fs, *rootMount->volume, kib);
+}
+
+CMD_DECL(blkserve) {
+    if (argc > 2) {
+        con->printf("usage: blkserve [MOUNT]\n");
+        return;
+    }
+
+    char         pathBuffer[257];
+    const char  *rest;
+    const Mount &mount = resolvePath(argc > 1 ? argv[1] : "/",
+                                     pathBuffer, sizeof(pathBuffer), rest);
+
+    // This is the store FatVolume uses, so its metadata cache stays
+    // coherent with whatever the host reads and writes.
+    BlockStore &store = mount.volume->getStore();
+    if (store.getBlockSize() != BlkServer::blockSize) {
+        con->printf("blkserve: unsupported block size\n");
+        return;
+    }
+    mount.volume->flush();
+    store.flush();
+
+    con->printf("blkserve: serving %s, %u blocks\n",
+                mount.path, (unsigned)store.getBlockCount());
+
+    blkServer.run(*con, store);
+
+    if (blkServer.getBlocksWritten()) {
+        // Anything cached about the filesystem may be outdated.
+        mount.volume->forgetAll();
+        if (&mount == rootMount)
+            fileIndex.attach(*rootMount->volume);
+    }
+
+    con->printf("blkserve: %u blocks read, %u blocks written\n",
+                blkServer.getBlocksRead(), blkServer.getBlocksWritten());
+    if (blkServer.getBlocksWritten())
+        con->printf("blkserve: reset the board if the host changed the filesystem's layout\n");
+}
+
 CMD_DECL(cat) {
-    FsError err;
-    if (argc > 1) {
-        for (int i = 1; i < argc; i++) {
-            FsNode node(fs);
-            if (argv[i][0] == '/') {
-                node = fs->get(argv[i], err);
-            } else {
-                node = pwd->get(argv[i], err);
+    if (argc < 2) {
+        con->printf("usage: cat FILE...\n");
+        return;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        char        pathBuffer[257];
+        const char *path;
+        FileReader  file(lz4Reader);
+
+        const Mount &mount = resolvePath(argv[i], pathBuffer, sizeof(pathBuffer), path);
+        FatError     err   = file.open(*mount.volume, path);
+        if (err == FAT_ERR_IS_DIR) {
+            con->printf("cat: '%s' is a directory\n", argv[i]);
+            continue;
+        } else if (err) {
+            con->printf("cat: %s: %s\n", argv[i], fatErrorString(err));
+            continue;
+        }
+
+        if (file.isMapped()) {
+            // Stream straight from flash or RAM.
+            const uint8_t *data;
+            size_t         length;
+            while (!(err = file.readDirect(data, 0xffffffff, length)) && length) {
+                for (size_t j = 0; j < length; j++)
+                    con->putch((char)data[j]);
             }
-            if (err) {
-                con->printf("err: %d\n", err);
-            } else if (node.isDirectory()){
-                con->printf("cat: '%s' is a directory\n", argv[i]);
-            } else {
-                char buffer[32] = { };
-                while (true) {
-                    size_t readBytes = node.read(buffer, 32, err);
-                    if (err && err != FS_EOF) {
-                        con->printf("err: %d\n", err);
-                        break;
-                    } else {
-                        for (size_t j = 0; j < readBytes; j++)
-                            con->putch(buffer[j]);
-                        if (err == FS_EOF)
-                            break;
-                    }
-                }
+        } else {
+            char   buffer[32];
+            size_t readBytes;
+            while (!(err = file.read(buffer, sizeof(buffer), readBytes)) && readBytes) {
+                for (size_t j = 0; j < readBytes; j++)
+                    con->putch(buffer[j]);
             }
         }
+        if (err)
+            con->printf("cat: %s: %s\n", argv[i], fatErrorString(err));
+    }
+}
+
+/// File data for crc32 and sha256sum. Whole sectors are read straight into it.
+static auto &checksumBuffer = scratch.checksum;
+
+/**
+ * \brief Pass the contents of a file to a checksum, in large pieces.
+ *
+ * \return false if the file could not be read, after printing why
+ */
+template<typename F>
+static bool checksumFile(const char *cmd, const char *arg, F update, uint32_t &bytes) {
+    char         pathBuffer[257];
+    const char  *path;
+    FileReader   file(lz4Reader);
+    const Mount &mount = resolvePath(arg, pathBuffer, sizeof(pathBuffer), path);
+
+    FatError err = file.open(*mount.volume, path);
+    if (err) {
+        con->printf("%s: %s: %s\n", cmd, arg, fatErrorString(err));
+        return false;
+    }
+
+    const uint8_t *data;
+    size_t         length;
+
+    if (file.isMapped()) {
+        while (!(err = file.readDirect(data, 0xffffffff, length)) && length)
+            update(data, length);
     } else {
-        con->printf("usage: cat FILE...\n");
+        while (!(err = file.read(checksumBuffer, sizeof(checksumBuffer), length)) && length)
+            update(checksumBuffer, length);
+    }
+    if (err) {
+        con->printf("%s: %s: %s\n", cmd, arg, fatErrorString(err));
+        return false;
     }
+
+    bytes += file.getSize();
+    return true;
+}
+
+static void printChecksumRate(const char *cmd, uint32_t bytes, uint32_t ms) {
+    if (!ms)
+        ms = 1;
+    uint32_t centiMbps = (uint32_t)((uint64_t)bytes / 10 / ms); // 1 MB/s = 1000 bytes/ms.
+    con->printf("%s: %'u bytes in %'u ms (%u.%02u MB/s)\n",
+                cmd, bytes, ms, centiMbps / 100, centiMbps % 100);
 }
 
 CMD_DECL(cd) {
     FsError err;
     if (argc == 2) {
         if (argv[1][0] == '/') {
-            auto node = fs->get(argv[1], err);
+            auto node = getNode(argv[1], err);
             if (!err && node.isDirectory()) {
                 *pwd = node;
                 strncpy(pwdPath, argv[1], 255);
@@ -93,7 +452,7 @@ CMD_DECL(cd) {
                 con->printf("Path '%s' is not a directory\n", argv[1]);
             }
         } else {
-            auto node = pwd->get(argv[1], err);
+            auto node = getNode(argv[1], err);
             if (!err && node.isDirectory()) {
                 *pwd = node;
                 if (strcmp(pwdPath, "/"))
@@ -104,7 +463,7 @@ CMD_DECL(cd) {
             }
         }
     } else {
-        *pwd = fs->getRoot(err);
+        *pwd = rootMount->fs->getRoot(err);
         strcpy(pwdPath, "/");
     }
 }
@@ -113,6 +472,52 @@ CMD_DECL(cls) {
     con->clear();
 }
 
+CMD_DECL(cp) {
+    if (argc != 3) {
+        con->printf("usage: cp SOURCE DEST\n");
+        return;
+    }
+
+    char fromBuffer[257];
+    char toBuffer[257];
+    const char  *from;
+    const char  *to;
+    const Mount &fromMount = resolvePath(argv[1], fromBuffer, sizeof(fromBuffer), from);
+    const Mount &toMount   = resolvePath(argv[2], toBuffer,   sizeof(toBuffer),   to);
+
+    uint32_t bytes;
+    uint32_t start = GetTickCount();
+    FatError err   = copyFile(*fromMount.volume, from, *toMount.volume, to, bytes, &lz4Reader);
+    uint32_t ms    = GetTickCount() - start;
+
+    if (err == FAT_ERR_NO_SPACE)
+        con->printf("cp: %s (an existing target is kept until the copy completes)\n", fatErrorString(err));
+    else if (err)
+        con->printf("cp: %s\n", fatErrorString(err));
+    else
+        printRate(bytes, ms);
+}
+
+CMD_DECL(crc32) {
+    if (argc < 2) {
+        con->printf("usage: crc32 FILE...\n");
+        return;
+    }
+
+    uint32_t bytes = 0;
+    uint32_t start = GetTickCount();
+
+    for (int i = 1; i < argc; i++) {
+        uint32_t crc = 0;
+        if (checksumFile("crc32", argv[i],
+                         [&](const uint8_t *data, size_t length) { crc = crc32(data, length, crc); },
+                         bytes))
+            con->printf("%08x  %s\n", crc, argv[i]);
+    }
+
+    printChecksumRate("crc32", bytes, GetTickCount() - start);
+}
+
 CMD_DECL(dir) {
     con->printf("%s\n", pwdPath);
     size_t totalSize  = 0;
@@ -121,12 +526,14 @@ CMD_DECL(dir) {
 
     FsNode node = *pwd;
     FsError err;
-    if (argc == 2) {
-        if (argv[1][0] == '/')
-            node = fs->get(argv[1], err);
-        else
-            node = pwd->get(argv[1], err);
-    }
+    if (argc == 2)
+        node = getNode(argv[1], err);
+
+    char pathBuffer[257];
+    bool isRoot = !strcmp(argc == 2 ? absolutePath(argv[1], pathBuffer, sizeof(pathBuffer))
+                                    : pwdPath,
+                          "/");
+
     if (node.isDirectory()) {
         node.rewind();
         while (true) {
@@ -148,6 +555,16 @@ CMD_DECL(dir) {
                 totalSize += child.getSize();
             }
         }
+        if (isRoot) {
+            for (size_t i = 0; i < mounts->getCount(); i++) {
+                const Mount &mount = (*mounts)[i];
+                if (&mount == rootMount)
+                    continue;
+                con->printf("%13s", mount.path + 1);
+                con->puts(  "  <MNT>\r\n");
+                totalDirs++;
+            }
+        }
         con->printf("%5'u File(s)        %8'u Bytes\n", totalFiles, totalSize);
         con->printf("%5'u Dir(s)\n", totalDirs);
     } else if (argc > 1){
@@ -164,58 +581,283 @@ CMD_DECL(echo) {
     con->putch('\n');
 }
 
+CMD_DECL(find) {
+    if (argc != 2) {
+        con->printf("usage: find PATTERN\n");
+        return;
+    }
+
+    size_t matches = 0;
+    for (uint16_t i = fileIndex.findNext(argv[1]);
+         i != FileIndex::none;
+         i = fileIndex.findNext(argv[1], i)) {
+
+        char path[257];
+        if (!fileIndex.getPath(i, path, sizeof(path)))
+            continue;
+
+        con->printf("%s%s\n", path, fileIndex.isDirectory(i) ? "/" : "");
+        matches++;
+    }
+
+    if (!fileIndex.isComplete()) {
+        con->printf("find: %s, results may be incomplete (%u entries indexed)\n",
+                    fileIndex.isFull() ? "index is full" : "indexing in progress",
+                    fileIndex.getEntryCount());
+    } else if (!matches) {
+        con->printf("find: no matches\n");
+    }
+}
+
+CMD_DECL(grep) {
+    GrepOptions options;
+
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        for (const char *flag = argv[i] + 1; *flag; flag++) {
+            if (*flag == 'n') {
+                options.lineNumbers = true;
+            } else if (*flag == 'c') {
+                options.countOnly = true;
+            } else {
+                con->printf("grep: unknown option '%c'\n", *flag);
+                return;
+            }
+        }
+    }
+
+    if (argc - i < 2) {
+        con->printf("usage: grep [-n] [-c] PATTERN FILE...\n");
+        return;
+    }
+
+    Bmh pattern(argv[i++]);
+    bool multiple = argc - i > 1;
+
+    for (; i < argc; i++) {
+        char         pathBuffer[257];
+        const char  *path;
+        FileReader   file(lz4Reader);
+        const Mount &mount = resolvePath(argv[i], pathBuffer, sizeof(pathBuffer), path);
+
+        FatError err = file.open(*mount.volume, path);
+        if (err == FAT_ERR_IS_DIR) {
+            con->printf("grep: '%s' is a directory\n", argv[i]);
+            continue;
+        } else if (err) {
+            con->printf("grep: %s: %s\n", argv[i], fatErrorString(err));
+            continue;
+        }
+
+        options.prefix = multiple ? argv[i] : nullptr;
+
+        size_t matches = grep(*con, file, pattern, options, err);
+        if (err)
+            con->printf("grep: %s: %s\n", argv[i], fatErrorString(err));
+
+        if (options.countOnly) {
+            if (multiple)
+                con->printf("%s:", argv[i]);
+            con->printf("%u\n", matches);
+        }
+    }
+}
+
 CMD_DECL(hello) {
     con->puts("Hello, world!\n");
 }
 
-CMD_DECL(help) {
-    con->printf("%8s %8s %8s %8s %8s\n"
-                "%8s %8s %8s %8s\n",
-                "cat",
-                "cd",
-                "cls",
-                "dir",
-                "echo",
-                "hello",
-                "help",
-                "log",
-                "pwd"
-               );
+/// Size of the ring logs created by mklog by default, and on first use.
+static const uint32_t defaultLogKib = 16;
+
+/**
+ * \brief Open a ring log, printing why if that fails.
+ *
+ * A plain file left by older firmware is kept as FILE.old, and replaced
+ * by a ring log.
+ *
+ * \param create whether to create the log if it does not exist
+ */
+static bool openLog(const char *cmd, const char *path, bool create) {
+    char         pathBuffer[257];
+    const char  *rest;
+    const Mount &mount = resolvePath(path, pathBuffer, sizeof(pathBuffer), rest);
+
+    FatError err = ringLog.open(*mount.volume, rest);
+    if (err == FAT_ERR_INVALID_ARG) {
+        char   oldPath[257 + 4];
+        size_t length = strlen(rest);
+        memcpy(oldPath, rest, length);
+        memcpy(oldPath + length, ".old", 5);
+        if (!(err = mount.volume->move(rest, oldPath))) {
+            con->printf("%s: %s is not a ring log, kept it as %s.old\n", cmd, path, path);
+            err    = FAT_ERR_NOT_FOUND;
+            create = true;
+        }
+    }
+    if (err == FAT_ERR_NOT_FOUND && create) {
+        err = RingLog::create(*mount.volume, rest, defaultLogKib * 1024);
+        if (!err)
+            err = ringLog.open(*mount.volume, rest);
+    }
+
+    if (err && !(err == FAT_ERR_NOT_FOUND && !create))
+        con->printf("%s: %s: %s\n", cmd, path, fatErrorString(err));
+
+    return !err;
 }
 
 CMD_DECL(log) {
-    FsError err;
-    auto logFile = fs->get("/logFile", err);
-    if (!logFile.doesExist()) {
-        con->puts("Sorry, logfile does not exist.\n");
+    if (!openLog("log", "/logfile", true))
         return;
-    }
+
     if (argc == 1) {
-        const char *catArgs[] = {
-            "cat", "/logfile"
-        };
-        // Delegate.
-        CMD_NAME(cat)(2, catArgs);
+        // Oldest first.
+        char             record[RingLog::maxRecordLength + 1];
+        size_t           length;
+        RingLog::Cursor  cursor = ringLog.begin();
+        FatError         err;
+
+        while (!(err = ringLog.next(cursor, record, sizeof(record) - 1, length))) {
+            record[length] = '\0';
+            con->printf("%s\n", record);
+        }
+        if (err != FAT_ERR_NOT_FOUND)
+            con->printf("log: %s\n", fatErrorString(err));
 
     } else {
         // Add item to log.
-        logFile.seek(logFile.getSize());
-        logFile.write("log entry: ", 11, err);
-        if (err) {
-            con->printf("An error occured (1:%d)\n", err);
-            return;
-        }
-        for (int i = 1; i < argc; i++) {
-            // Since our Store doesn't buffer writes, this can get
-            // very inefficient. Not the shell's problem though.
-            logFile.write(argv[i], strlen(argv[i]), err);
-            logFile.write(" ", 1, err);
-            if (err) {
-                con->printf("An error occured (2:%d)\n", err);
-                return;
-            }
+        char   entry[RingLog::maxRecordLength];
+        size_t length = strlen("log entry:");
+
+        memcpy(entry, "log entry:", length);
+        for (int i = 1; i < argc && length < sizeof(entry); i++) {
+            entry[length++] = ' ';
+            for (const char *p = argv[i]; *p && length < sizeof(entry); p++)
+                entry[length++] = *p;
         }
-        logFile.write("\n", 1, err);
+
+        FatError err = ringLog.append(entry, (uint16_t)length);
+        if (err)
+            con->printf("log: %s\n", fatErrorString(err));
+    }
+}
+
+CMD_DECL(mem) {
+    MemoryUsage usage = getMemoryUsage();
+
+    con->printf("ram        %'u bytes at 0x%08x\n", usage.ramSize, usage.ramStart);
+    con->printf("  data     %'u bytes, including %'u of RAM functions\n", usage.dataSize, usage.ramfuncSize);
+    con->printf("  bss      %'u bytes\n", usage.bssSize);
+    con->printf("  stack    %'u bytes, peak %'u, now %'u, %'u never used\n",
+                usage.threadStackSize,
+                usage.threadStackPeak,
+                usage.threadStackNow,
+                usage.threadStackSize - usage.threadStackPeak);
+    con->printf("  isr      %'u bytes, peak %'u\n", usage.isrStackSize, usage.isrStackPeak);
+    con->printf("flash      %'u bytes of code, constants and data\n", usage.flashSize);
+}
+
+CMD_DECL(mklog) {
+    if (argc < 2 || argc > 3) {
+        con->printf("usage: mklog FILE [KB]\n");
+        return;
+    }
+
+    uint32_t kib = argc > 2 ? (uint32_t)strtoul(argv[2], nullptr, 10) : defaultLogKib;
+    if (!kib || kib > 1024) {
+        con->printf("mklog: invalid size\n");
+        return;
+    }
+
+    char         pathBuffer[257];
+    const char  *path;
+    const Mount &mount = resolvePath(argv[1], pathBuffer, sizeof(pathBuffer), path);
+
+    // Any existing file is replaced.
+    FatError err = RingLog::create(*mount.volume, path, kib * 1024);
+
+    if (err)
+        con->printf("mklog: %s: %s\n", argv[1], fatErrorString(err));
+}
+
+CMD_DECL(mv) {
+    if (argc != 3) {
+        con->printf("usage: mv SOURCE DEST\n");
+        return;
+    }
+
+    char fromBuffer[257];
+    char toBuffer[257];
+    const char  *from;
+    const char  *to;
+    const Mount &fromMount = resolvePath(argv[1], fromBuffer, sizeof(fromBuffer), from);
+    const Mount &toMount   = resolvePath(argv[2], toBuffer,   sizeof(toBuffer),   to);
+
+    FatError err;
+    if (&fromMount == &toMount) {
+        err = fromMount.volume->move(from, to);
+    } else {
+        // Moving between filesystems means copying the data.
+        uint32_t bytes;
+        err = copyFile(*fromMount.volume, from, *toMount.volume, to, bytes, &lz4Reader);
+        if (!err)
+            err = removeFile(*fromMount.volume, from);
+    }
+    if (err)
+        con->printf("mv: %s\n", fatErrorString(err));
+}
+
+/// Print the most frequent hits of a profile, by function.
+static void printHits(const char *title, const Profiler::Hit *hits, size_t count, size_t max) {
+    uint32_t samples = profiler.getSampleCount();
+
+    con->printf("\n%-10s  %-5s  %s\n", "samples", "%", title);
+    for (size_t i = 0; i < count && i < max; i++) {
+        uint32_t permille = (uint32_t)((uint64_t)hits[i].count * 1000 / samples);
+
+        con->printf("%10u  %3u.%u  ", hits[i].count, permille / 10, permille % 10);
+
+        const ProfSymbol *symbol = Profiler::findSymbol(hits[i].address);
+        if (symbol)
+            con->printf("%s\n", symbol->name);
+        else
+            con->printf("0x%08x\n", hits[i].address);
+    }
+}
+
+CMD_DECL(prof) {
+    const char *action = argc > 1 ? argv[1] : "";
+
+    if (!strcmp(action, "start") && argc == 2) {
+        profiler.start();
+
+    } else if (!strcmp(action, "stop") && argc == 2) {
+        profiler.stop();
+
+    } else if (!strcmp(action, "dump") && argc <= 3) {
+        size_t max = argc > 2 ? (size_t)strtoul(argv[2], nullptr, 10) : 20;
+
+        profiler.summarize();
+
+        con->printf("%'u samples in %'u ms, %'u lost\n",
+                    profiler.getSampleCount(),
+                    profiler.getDuration(),
+                    profiler.getLostCount());
+        if (!profiler.getSampleCount())
+            return;
+
+        size_t count;
+        const Profiler::Hit *hits = profiler.getFunctions(count);
+        printHits("function", hits, count, max);
+        hits = profiler.getCallers(count);
+        printHits("returning to", hits, count, max);
+
+    } else {
+        con->printf("usage: prof start|stop|dump [COUNT]\n");
+        con->printf("profiler %s, %'u samples\n",
+                    profiler.isRunning() ? "running" : "stopped",
+                    profiler.getSampleCount());
     }
 }
 
@@ -223,117 +865,530 @@ CMD_DECL(pwd) {
     con->printf("%s\n", pwdPath);
 }
 
+/// Stops a recording when a key is pressed.
+static bool keyPressed() {
+    return con->getch(false) >= 0;
+}
+
+CMD_DECL(record) {
+    if (argc < 4 || argc > 5) {
+        con->printf("usage: record FILE RATE SECONDS [CHANNEL|test]\n");
+        return;
+    }
+
+    uint32_t rate    = (uint32_t)strtoul(argv[2], nullptr, 10);
+    uint32_t seconds = (uint32_t)strtoul(argv[3], nullptr, 10);
+    unsigned channel = 7; // A0 on the Due.
+    bool     test    = false;
+
+    if (argc > 4) {
+        if (!strcmp(argv[4], "test"))
+            test = true;
+        else
+            channel = (unsigned)strtoul(argv[4], nullptr, 10);
+    }
+
+    // Whole buffers are written, so the file is rounded up to one.
+    const uint32_t bufferSize = Recorder::bufferBlocks * Recorder::blockSize;
+    uint64_t       size       = (uint64_t)rate * seconds * sizeof(uint16_t);
+    size = (size + bufferSize - 1) / bufferSize * bufferSize;
+
+    if (!rate || rate > AdcSource::maxRate || channel >= AdcSource::channelCount
+        || !size || size > 0xffffffff - bufferSize) {
+        con->printf("record: invalid rate, duration or channel\n");
+        return;
+    }
+
+    char         pathBuffer[257];
+    const char  *path;
+    const Mount &mount = resolvePath(argv[1], pathBuffer, sizeof(pathBuffer), path);
+
+    // Samples go straight to the file's sectors, so it has to be contiguous.
+    FatVolume::DirEntry entry;
+    FatError err = removeFile(*mount.volume, path);
+    if (!err || err == FAT_ERR_NOT_FOUND)
+        err = createFile(*mount.volume, path, (uint32_t)size, entry);
+
+    if (err) {
+        con->printf("record: %s: %s\n", argv[1], fatErrorString(err));
+        return;
+    }
+
+    uint32_t          blocks = (uint32_t)(size / Recorder::blockSize);
+    uint32_t          lba;
+    uint32_t          count;
+    FatVolume::Cursor cursor { entry.cluster, 0 };
+
+    err = mount.volume->nextRun(cursor, blocks, lba, count);
+    if (!err && count < blocks) {
+        removeFile(*mount.volume, path);
+        con->printf("record: %s: no contiguous free space\n", argv[1]);
+        return;
+    }
+
+    // Get the directory entry and FAT on the card before the data.
+    BlockStore &store = mount.volume->getStore();
+    if (!err)
+        err = mount.volume->flush();
+    if (err || store.flush()) {
+        con->printf("record: %s: %s\n", argv[1], fatErrorString(err ? err : FAT_ERR_IO));
+        return;
+    }
+
+    con->printf("record: %'u samples/s for %u s from %s, press a key to stop\n",
+                rate, seconds, test ? "a test counter" : "the ADC");
+
+    MuStore::StoreError storeErr;
+    if (test) {
+        SyntheticSource source(GetTickCount);
+        storeErr = recorder.record(source, rate, store, lba, blocks, keyPressed);
+    } else {
+        AdcSource source(channel);
+        storeErr = recorder.record(source, rate, store, lba, blocks, keyPressed);
+    }
+    store.flush();
+
+    uint32_t written = recorder.getBlocksWritten();
+    if (written < blocks) {
+        // Stopped early, or a write failed: keep what was recorded.
+        err = truncateFile(*mount.volume, entry, written * Recorder::blockSize);
+        if (err)
+            con->printf("record: %s: %s\n", argv[1], fatErrorString(err));
+    }
+    if (storeErr)
+        con->printf("record: write error\n");
+
+    uint32_t ms = recorder.getElapsed() ? recorder.getElapsed() : 1;
+    con->printf("record: %'u samples in %'u ms (%'u samples/s), %u buffers dropped\n",
+                recorder.getSamplesWritten(), ms,
+                (uint32_t)((uint64_t)recorder.getSamplesWritten() * 1000 / ms),
+                recorder.getDropped());
+}
+
+CMD_DECL(rz) {
+    if (argc > 2) {
+        con->printf("usage: rz [FILE]\n");
+        return;
+    }
+
+    xfer.attach(*con);
+
+    char      name[Xfer::maxNameLength + 1];
+    uint32_t  size;
+    XferError err = xfer.receiveHeader(name, sizeof(name), size);
+    if (err) {
+        con->printf("rz: %s\n", xferErrorString(err));
+        return;
+    }
+
+    // Without an argument, the sender's name is used.
+    const char  *dest = argc > 1 ? argv[1] : name;
+    char         pathBuffer[257];
+    const char  *path;
+    const Mount &mount = resolvePath(dest, pathBuffer, sizeof(pathBuffer), path);
+
+    // Existing files are replaced. The new file is allocated in one go,
+    // so that it is contiguous if possible.
+    FatVolume::DirEntry entry;
+    FatError fatErr = removeFile(*mount.volume, path);
+    if (!fatErr || fatErr == FAT_ERR_NOT_FOUND)
+        fatErr = createFile(*mount.volume, path, size, entry);
+
+    if (fatErr) {
+        xfer.cancel();
+        con->printf("rz: %s: %s\n", dest, fatErrorString(fatErr));
+        return;
+    }
+
+    FsError fsErr;
+    FsNode  node = getNode(dest, fsErr);
+    if (fsErr || !node.doesExist()) {
+        xfer.cancel();
+        con->printf("rz: %s: could not open file\n", dest);
+        return;
+    }
+
+    NodeSink sink(node);
+    uint32_t start = GetTickCount();
+    err            = xfer.receiveData(sink, size);
+    uint32_t ms    = GetTickCount() - start;
+
+    nodeWritten(dest, node);
+
+    if (err) {
+        // Do not leave a partial file around.
+        removeFile(*mount.volume, path);
+        con->printf("rz: %s\n", xferErrorString(err));
+    } else {
+        printRate(size, ms);
+        xfer.linger(size);
+    }
+}
+
+CMD_DECL(sha256sum) {
+    if (argc < 2) {
+        con->printf("usage: sha256sum FILE...\n");
+        return;
+    }
+
+    uint32_t bytes = 0;
+    uint32_t start = GetTickCount();
+
+    for (int i = 1; i < argc; i++) {
+        Sha256 sha;
+        if (!checksumFile("sha256sum", argv[i],
+                          [&](const uint8_t *data, size_t length) { sha.update(data, length); },
+                          bytes))
+            continue;
+
+        uint8_t digest[Sha256::digestSize];
+        sha.finish(digest);
+        for (size_t j = 0; j < sizeof(digest); j++)
+            con->printf("%02x", digest[j]);
+        con->printf("  %s\n", argv[i]);
+    }
+
+    printChecksumRate("sha256sum", bytes, GetTickCount() - start);
+}
+
+CMD_DECL(sz) {
+    if (argc != 2) {
+        con->printf("usage: sz FILE\n");
+        return;
+    }
+
+    xfer.attach(*con);
+
+    char         pathBuffer[257];
+    const char  *path;
+    FileReader   file(lz4Reader);
+    const Mount &mount = resolvePath(argv[1], pathBuffer, sizeof(pathBuffer), path);
+
+    FatError fatErr = file.open(*mount.volume, path);
+    if (fatErr) {
+        // Let a waiting receiver know right away.
+        xfer.cancel();
+        con->printf("sz: %s: %s\n", argv[1], fatErrorString(fatErr));
+        return;
+    }
+
+    const char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+
+    FileSource source(file);
+    uint32_t  start = GetTickCount();
+    XferError err   = xfer.send(source, file.getSize(), name);
+    uint32_t  ms    = GetTickCount() - start;
+
+    if (err)
+        con->printf("sz: %s\n", xferErrorString(err));
+    else
+        printRate(file.getSize(), ms);
+}
+
+/// Print a utilization line, overwriting the previous one.
+static void printLoad(const char *name, uint32_t cycles, uint32_t total) {
+    const uint32_t width    = 40;
+    uint32_t       permille = (uint32_t)((uint64_t)cycles * 1000 / total);
+    uint32_t       filled   = (permille * width + 500) / 1000;
+    char           bar[width + 1];
+
+    for (uint32_t i = 0; i < width; i++)
+        bar[i] = i < filled ? '#' : ' ';
+    bar[width] = '\0';
+
+    con->printf("%10s %3u.%u%% [%s]\x1b[K\n", name, permille / 10, permille % 10, bar);
+}
+
+CMD_DECL(top) {
+    const unsigned lines = 5;
+
+    con->printf("cpu utilization per second, press a key to stop\n");
+
+    bool first = true;
+    while (true) {
+        IoStats  ioBefore  = ioStats;
+        CpuStats cpuBefore = cpuStats;
+        uint32_t start     = getCycles();
+
+        // Sleeping here counts as idle time.
+        for (uint32_t ms = GetTickCount(); GetTickCount() - ms < 1000; ) {
+            if (keyPressed())
+                return;
+            idleSleep(10);
+        }
+
+        uint32_t total = getCycles() - start;
+        uint32_t idle  = cpuStats.idleCycles        - cpuBefore.idleCycles;
+        uint32_t isr   = cpuStats.isrCycles         - cpuBefore.isrCycles;
+        uint32_t sd    = ioStats.storeWaitCycles    - ioBefore.storeWaitCycles;
+        uint32_t uart  = ioStats.consoleWaitCycles  - ioBefore.consoleWaitCycles;
+        uint32_t other = idle + isr + sd + uart;
+        uint32_t busy  = total > other ? total - other : 0;
+
+        // Move back up over the previous report.
+        if (!first)
+            con->printf("\x1b[%uA", lines);
+        first = false;
+
+        printLoad("busy",      busy, total);
+        printLoad("idle",      idle, total);
+        printLoad("isr",       isr,  total);
+        printLoad("sd wait",   sd,   total);
+        printLoad("uart wait", uart, total);
+    }
+}
+
+CMD_DECL(trace) {
+    const char *action = argc == 2 ? argv[1] : "";
+
+    if (argc == 1) {
+        con->printf("trace %s, %'u of %'u records used\n",
+                    tracer.isEnabled() ? "running" : "stopped",
+                    tracer.getCount(),
+                    Tracer::recordCount);
+    } else if (!strcmp(action, "start")) {
+        tracer.start();
+    } else if (!strcmp(action, "stop")) {
+        tracer.stop();
+    } else if (!strcmp(action, "clear")) {
+        tracer.clear();
+    } else if (!strcmp(action, "dump")) {
+        tracer.dump(*con);
+    } else {
+        con->printf("usage: trace [start|stop|clear|dump]\n");
+    }
+}
+
 #pragma GCC diagnostic pop
 
 static Command cmds[] = {
+    CMD(bench),
+    CMD(blkserve),
     CMD(cat),
     CMD(cd),
     CMD(cls),
+    CMD(cp),
+    CMD(crc32),
     CMD(dir),
     CMD(echo),
+    CMD(find),
+    CMD(grep),
     CMD(hello),
     CMD(help),
     CMD(log),
+    CMD(mem),
+    CMD(mklog),
+    CMD(mv),
+    CMD(prof),
     CMD(pwd),
+    CMD(record),
+    CMD(rz),
+    CMD(sha256sum),
+    CMD(sz),
+    CMD(time),
+    CMD(top),
+    CMD(trace),
 };
 
 #define CMD_COUNT (sizeof(cmds) / sizeof(*cmds))
 
-/// Save a command string in the histfile if it exists.
-static void saveCommand(const char *cmd) {
-    FsError err;
-    auto histfile = fs->get("/histfile", err);
-    if (histfile.doesExist()) {
-        histfile.seek(histfile.getSize());
-        histfile.write(cmd, strlen(cmd), err);
-        histfile.write("\n", 1, err); // Inefficient, but w/e.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+/// Find and run a command.
+static void runCommand(int argc, const char **argv) {
+    for (size_t i = 0; i < CMD_COUNT; i++) {
+        if (!strcmp(cmds[i].name, argv[0])) {
+            uint32_t name = (uint32_t)(uintptr_t)cmds[i].name;
+            tracer.log(TRACE_CMD_START, 0, 0, name);
+            cmds[i].func(argc, argv);
+            tracer.log(TRACE_CMD_END, 0, 0, name);
+            return;
+        }
     }
+    con->printf("No such command `%s'\n", argv[0]);
 }
 
+CMD_DECL(help) {
+    for (size_t i = 0; i < CMD_COUNT; i++)
+        con->printf(i % 5 == 4 || i == CMD_COUNT - 1 ? "%8s\n" : "%8s ", cmds[i].name);
+}
 
-void runShell(Console &con_, MuStore::Fs &fs_) {
-    con = &con_;
-    fs  = &fs_;
+CMD_DECL(time) {
+    if (argc < 2) {
+        con->printf("usage: time COMMAND [ARG...]\n");
+        return;
+    }
 
-    FsError fsErr;
-    FsNode  root = fs->getRoot(fsErr);
-    pwd = &root;
+    IoStats  before      = ioStats;
+    uint32_t startTicks  = GetTickCount();
+    uint32_t startCycles = getCycles();
 
-    if (fsErr || !root.doesExist()) {
-        con->printf("Could not get root directory, aborting.\n");
-        return;
+    runCommand(argc - 1, argv + 1);
+
+    uint32_t cycles = getCycles() - startCycles;
+    uint32_t ms     = GetTickCount() - startTicks;
+    IoStats  after  = ioStats;
+
+    uint32_t storeWait   = after.storeWaitCycles   - before.storeWaitCycles;
+    uint32_t consoleWait = after.consoleWaitCycles - before.consoleWaitCycles;
+
+    con->printf("\n");
+    con->printf("real    %'u ms\n", ms);
+    if (ms < 50000) {
+        // The cycle counter wraps after ~51 seconds.
+        con->printf("cpu     %'u cycles (%'u us excluding waits)\n",
+                    cycles,
+                    cyclesToUs(cycles - storeWait - consoleWait));
     }
+    con->printf("store   %'u bytes read, %'u bytes written, %'u us waiting\n",
+                after.storeBytesRead    - before.storeBytesRead,
+                after.storeBytesWritten - before.storeBytesWritten,
+                cyclesToUs(storeWait));
+    // Note: This excludes the report itself, which has not been printed yet.
+    con->printf("console %'u bytes written, %'u us waiting\n",
+                after.consoleBytes - before.consoleBytes,
+                cyclesToUs(consoleWait));
+}
 
-    strncpy(pwdPath, pwd->getName(), sizeof(pwdPath)-1);
+#pragma GCC diagnostic pop
 
-    char cmdInput[256] = { };
-    int  cmdInputI     = 0;
-    int   argc         = 0;
-    char *argv[16]     = { };
-    uint32_t frame     = 0;
+/// Save a command string in the histfile if it exists.
+static void saveCommand(const char *cmd) {
+    size_t length = strlen(cmd);
+    if (openLog("history", "/histfile", false))
+        ringLog.append(cmd, (uint16_t)(length < RingLog::maxRecordLength ? length : RingLog::maxRecordLength));
+}
 
-    auto printPrompt = []() {
-        con->printf("%s:%s> ", fs->getVolumeLabel(), pwdPath);
-    };
 
-    printPrompt();
+static void printPrompt() {
+    const char *path;
+    con->printf("%s:%s> ", mounts->resolve(pwdPath, path)->fs->getVolumeLabel(), pwdPath);
+}
 
-    while (true) {
-        int c;
+/**
+ * \brief Handle input of the current session.
+ *
+ * Reads characters until a line is complete or no more input is
+ * available, at most one command is run per call.
+ *
+ * \return whether any input was handled
+ */
+static bool pollSession(Session &session) {
+    char *cmdInput  = session.cmdInput;
+    int  &cmdInputI = session.cmdInputI;
+    bool  busy      = false;
+    int   c;
+
+    while ((c = con->getch(false)) >= 0) {
+        busy = true;
+
+        if (c == '\r' || c == '\n') {
+            cmdInput[cmdInputI] = '\0';
+            if (cmdInputI)
+                saveCommand(cmdInput);
+
+            int   argc     = 0;
+            char *argv[16] = { };
 
-        if ((c = con->getch(false)) >= 0) {
-            if (c == '\r' || c == '\n') {
-                cmdInput[cmdInputI] = '\0';
-                if (cmdInputI)
-                    saveCommand(cmdInput);
-                argc = 0;
-                // Split command line into arguments.
-                bool inPart = false;
-                for (int i = 0; i < cmdInputI; i++) {
-                    if (inPart) {
-                        if (cmdInput[i] == ' ') {
-                            cmdInput[i] = '\0';
-                            inPart = false;
-                            if (argc >= 15)
-                                break;
-                        }
-                    } else {
-                        if (cmdInput[i] != ' ') {
-                            inPart = true;
-                            argv[argc++] = cmdInput + i;
-                        }
+            // Split command line into arguments.
+            bool inPart = false;
+            for (int i = 0; i < cmdInputI; i++) {
+                if (inPart) {
+                    if (cmdInput[i] == ' ') {
+                        cmdInput[i] = '\0';
+                        inPart = false;
+                        if (argc >= 15)
+                            break;
                     }
-                }
-                cmdInputI = 0;
-                // Find a matching command.
-                if (argc && strlen(argv[0])) {
-                    bool cmdFound = false;
-                    for (size_t i = 0; i < CMD_COUNT; i++) {
-                        if (!strcmp(cmds[i].name, argv[0])) {
-                            cmdFound = true;
-                            cmds[i].func(argc, (const char**)argv);
-                        }
+                } else {
+                    if (cmdInput[i] != ' ') {
+                        inPart = true;
+                        argv[argc++] = cmdInput + i;
                     }
-                    if (!cmdFound)
-                        con->printf("No such command `%s'\n", argv[0]);
                 }
+            }
+            cmdInputI = 0;
+            // Find a matching command.
+            if (argc && strlen(argv[0]))
+                runCommand(argc, (const char**)argv);
 
-                printPrompt();
+            // Write back buffered FAT sectors.
+            for (size_t i = 0; i < mounts->getCount(); i++)
+                (*mounts)[i].volume->getStore().flush();
 
-            } else if (c == '\b') {
-                // Backspace.
-                if (cmdInputI) {
-                    cmdInputI--;
-                    con->putch(' ');
-                    con->putch((char)c);
-                } else {
-                    con->putch(' ');
-                }
+            printPrompt();
+
+            // Give the other sessions a turn.
+            break;
+
+        } else if (c == '\b') {
+            // Backspace.
+            if (cmdInputI) {
+                cmdInputI--;
+                con->putch(' ');
+                con->putch((char)c);
             } else {
-                if (cmdInputI < 255)
-                    cmdInput[cmdInputI++] = (char)c;
+                con->putch(' ');
             }
         } else {
+            if (cmdInputI < 255)
+                cmdInput[cmdInputI++] = (char)c;
+        }
+    }
+
+    return busy;
+}
+
+void runShell(Console *const *consoles, size_t count, MountTable &mounts_) {
+    mounts = &mounts_;
+    con    = consoles[0];
+
+    if (count > maxSessions)
+        count = maxSessions;
+
+    const char *rest;
+    rootMount = mounts->resolve("/", rest);
+    if (!rootMount) {
+        con->printf("Nothing mounted at /, aborting.\n");
+        return;
+    }
+
+    FsError fsErr;
+    FsNode  root = rootMount->fs->getRoot(fsErr);
+
+    if (fsErr || !root.doesExist()) {
+        con->printf("Could not get root directory, aborting.\n");
+        return;
+    }
+
+    // Only the root filesystem is indexed, the others are in RAM or flash.
+    fileIndex.attach(*rootMount->volume);
+
+    alignas(Session) static uint8_t storage[maxSessions][sizeof(Session)];
+    Session *sessions = reinterpret_cast<Session*>(storage);
+
+    for (size_t i = 0; i < count; i++) {
+        new (&sessions[i]) Session(*consoles[i], root);
+        enterSession(sessions[i]);
+        strncpy(pwdPath, pwd->getName(), sizeof(sessions[i].pwdPath)-1);
+        printPrompt();
+    }
+
+    uint32_t frame = 0;
+
+    while (true) {
+        // Visit every session in turn, so that a busy console cannot
+        // starve the others.
+        bool busy = false;
+        for (size_t i = 0; i < count; i++) {
+            enterSession(sessions[i]);
+            if (pollSession(sessions[i]))
+                busy = true;
+        }
+
+        if (!busy) {
             if (frame % 10 == 0) {
                 // Blink LED at pin 13.
                 if (frame % 20 == 0)
@@ -343,8 +1398,10 @@ void runShell(Console &con_, MuStore::Fs &fs_) {
             }
 
             frame++;
-            Sleep(10);
+
+            // Index a few sectors worth of directory entries while idle.
+            if (!fileIndex.step(32))
+                idleSleep(10);
         }
     }
-    
 }
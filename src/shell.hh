@@ -19,7 +19,13 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
-#include <mustore/fs.hh>
 #include "console.hh"
+#include "mount.hh"
 
-void runShell(Console &con, MuStore::Fs &fs);
+/**
+ * \brief Run a shell session on each of the given consoles.
+ *
+ * The first console is used for fatal errors. Does not return unless
+ * the root filesystem is unavailable.
+ */
+void runShell(Console *const *consoles, size_t count, MountTable &mounts);
@@ -0,0 +1,128 @@
+/**
+ * \file
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "trace.hh"
+#include "sam.hh"
+#include "cycles.hh"
+#include "ramfunc.hh"
+
+Tracer tracer;
+
+RAMFUNC void Tracer::append(TraceEvent event, uint8_t a, uint16_t b, uint32_t arg) {
+    uint32_t index;
+    uint32_t cycles;
+    do {
+        index  = __LDREXW(&head);
+        cycles = getCycles();
+    } while (__STREXW(index + 1, &head));
+
+    TraceRecord &record = records[index % recordCount];
+    record.cycles = cycles;
+    record.event  = event;
+    record.a      = a;
+    record.b      = b;
+    record.arg    = arg;
+}
+
+namespace {
+
+/// Writes bytes as lines of hex digits.
+class HexWriter {
+    Console &con;
+    size_t   column = 0;
+
+public:
+    void put(const void *data, size_t length) {
+        for (size_t i = 0; i < length; i++) {
+            con.printf("%02x", ((const uint8_t*)data)[i]);
+            if (++column == 32) {
+                con.putch('\n');
+                column = 0;
+            }
+        }
+    }
+
+    void put32(uint32_t value) {
+        uint8_t bytes[4] = { (uint8_t)value,         (uint8_t)(value >> 8),
+                             (uint8_t)(value >> 16), (uint8_t)(value >> 24) };
+        put(bytes, sizeof(bytes));
+    }
+
+    void end() {
+        if (column)
+            con.putch('\n');
+        column = 0;
+    }
+
+    HexWriter(Console &con_) : con(con_) { }
+};
+
+}
+
+void Tracer::dump(Console &con) {
+    bool wasEnabled = enabled;
+    enabled = false;
+
+    size_t   count = getCount();
+    uint32_t first = head - (uint32_t)count;
+
+    // Collect the command names.
+    uint32_t strings[maxStrings];
+    size_t   stringCount = 0;
+    for (size_t i = 0; i < count; i++) {
+        const TraceRecord &record = records[(first + i) % recordCount];
+        if (record.event != TRACE_CMD_START && record.event != TRACE_CMD_END)
+            continue;
+
+        size_t j = 0;
+        while (j < stringCount && strings[j] != record.arg)
+            j++;
+        if (j == stringCount && stringCount < maxStrings)
+            strings[stringCount++] = record.arg;
+    }
+
+    HexWriter out(con);
+
+    con.printf("trace: begin\n");
+    out.put("PTRC", 4);
+    out.put32(SystemCoreClock);
+    out.put32((uint32_t)count);
+    out.put32((uint32_t)stringCount);
+
+    // Records are laid out in memory as in the dump, on this little-endian CPU.
+    for (size_t i = 0; i < count; i++)
+        out.put(&records[(first + i) % recordCount], sizeof(TraceRecord));
+
+    for (size_t i = 0; i < stringCount; i++) {
+        const char *string = (const char*)(uintptr_t)strings[i];
+        size_t      length = 0;
+        while (length < 255 && string[length])
+            length++;
+
+        out.put32(strings[i]);
+        uint8_t length8 = (uint8_t)length;
+        out.put(&length8, 1);
+        out.put(string, length);
+    }
+    out.end();
+    con.printf("trace: end\n");
+
+    enabled = wasEnabled;
+}
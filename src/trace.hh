@@ -0,0 +1,106 @@
+/**
+ * \file
+ * \brief     Timestamped event trace for drivers and the shell.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "console.hh"
+
+#include <cstddef>
+#include <cstdint>
+
+enum TraceEvent : uint8_t {
+    TRACE_NONE = 0,
+    TRACE_CMD_START,     ///< arg: address of the command name.
+    TRACE_CMD_END,       ///< arg: address of the command name.
+    TRACE_SD_CMD,        ///< a: command index, arg: argument. Logged before waiting for the card.
+    TRACE_SD_RESP,       ///< a: command index, b: R1 response, 0xff on a timeout.
+    TRACE_UART_RX,       ///< a: port, b: character, arg: 1 if it was dropped for a full buffer.
+    TRACE_UART_TX_STALL, ///< a: port, arg: cycles spent waiting for the transmitter.
+};
+
+/// One event, stored little-endian as is in a dump.
+struct TraceRecord {
+    uint32_t cycles; ///< DWT cycle count.
+    uint8_t  event;
+    uint8_t  a;
+    uint16_t b;
+    uint32_t arg;
+};
+
+static_assert(sizeof(TraceRecord) == 12, "TraceRecord must not be padded");
+
+/**
+ * \brief A ring of the most recent events, for looking back at a stall.
+ *
+ * Records are claimed with an exclusive load/store pair on the head
+ * index, so interrupt handlers and thread code can log without disabling
+ * interrupts. The timestamp is taken inside the claim: an interrupt that
+ * logs in between makes the store fail and the claim is retried, so the
+ * records are in timestamp order.
+ *
+ * Tracing is on from startup. Timestamps wrap around every 51 seconds at
+ * 84 MHz, a decoder can only unwrap them if no such gap occurs between
+ * two records.
+ *
+ * dump() writes the ring as hex text between "trace: begin" and
+ * "trace: end" lines. The data is a header:
+ *
+ *   "PTRC", uint32 core clock in Hz, uint32 record count, uint32 string count
+ *
+ * followed by the records oldest first, and then the strings referred to
+ * by command records, each as uint32 address, uint8 length and the
+ * characters. All fields are little-endian.
+ */
+class Tracer {
+
+public:
+    static const size_t recordCount = 512;
+    static const size_t maxStrings  = 32;
+
+private:
+    TraceRecord records[recordCount];
+
+    volatile uint32_t head    = 0; ///< Total records claimed.
+    volatile bool     enabled = true;
+
+    void append(TraceEvent event, uint8_t a, uint16_t b, uint32_t arg);
+
+public:
+    void log(TraceEvent event, uint8_t a = 0, uint16_t b = 0, uint32_t arg = 0) {
+        if (enabled)
+            append(event, a, b, arg);
+    }
+
+    void start() { enabled = true;  }
+    void stop()  { enabled = false; }
+    void clear() { head = 0; }
+
+    bool   isEnabled() const { return enabled; }
+    size_t getCount()  const { return head < recordCount ? head : recordCount; }
+
+    /// Write the ring to a console, pausing the trace meanwhile.
+    void dump(Console &con);
+
+    Tracer() = default;
+    ~Tracer() = default;
+};
+
+extern Tracer tracer;
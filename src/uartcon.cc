@@ -19,30 +19,66 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "uartcon.hh"
-#include "queue.hh"
+#include "cpustats.hh"
+#include "iostats.hh"
+#include "trace.hh"
+#include "ramfunc.hh"
 
 #include <cstdlib>
 #include <cstring>
 
-Queue<uint8_t, 64> rxbuf;
+namespace {
+
+/// Registers, interrupt and pins of a port.
+struct PortInfo {
+    Uart    *uart;
+    uint32_t id;
+    bool     usart;
+    Pio     *pio;
+    int      pinType;
+    uint32_t rxPin;
+    uint32_t txPin;
+};
 
-SamUartConsole &SamUartConsole::getInstance() {
-    static SamUartConsole console(UART);
-    return console;
+}
+
+static const PortInfo ports[SamUartConsole::portCount] = {
+    { UART,           ID_UART,   false, PIOA, PIO_PERIPH_A, PIO_PA8A_URXD,  PIO_PA9A_UTXD  },
+    { (Uart*)USART0,  ID_USART0, true,  PIOA, PIO_PERIPH_A, PIO_PA10A_RXD0, PIO_PA11A_TXD0 },
+    { (Uart*)USART1,  ID_USART1, true,  PIOA, PIO_PERIPH_A, PIO_PA12A_RXD1, PIO_PA13A_TXD1 },
+    { (Uart*)USART2,  ID_USART2, true,  PIOB, PIO_PERIPH_A, PIO_PB21A_RXD2, PIO_PB20A_TXD2 },
+    { (Uart*)USART3,  ID_USART3, true,  PIOD, PIO_PERIPH_B, PIO_PD5B_RXD3,  PIO_PD4B_TXD3  },
+};
+
+SamUartConsole *SamUartConsole::instances[SamUartConsole::portCount] = { };
+
+SamUartConsole &SamUartConsole::getInstance(Port port) {
+    // Constructed on first use, so unused ports stay untouched.
+    switch (port) {
+    case Port::Usart0: { static SamUartConsole console(Port::Usart0); return console; }
+    case Port::Usart1: { static SamUartConsole console(Port::Usart1); return console; }
+    case Port::Usart2: { static SamUartConsole console(Port::Usart2); return console; }
+    case Port::Usart3: { static SamUartConsole console(Port::Usart3); return console; }
+    default:           { static SamUartConsole console(Port::Main);   return console; }
+    }
 }
 
 void SamUartConsole::doPutch(uint8_t ch) {
     // Wait for the transmitter to become ready.
-    while (!(uart->UART_SR & UART_SR_TXRDY));
+    if (!(uart->UART_SR & UART_SR_TXRDY)) {
+        CycleTimer timer;
+        while (!(uart->UART_SR & UART_SR_TXRDY));
+        uint32_t cycles = timer.elapsed();
+        ioStats.consoleWaitCycles += cycles;
+        tracer.log(TRACE_UART_TX_STALL, (uint8_t)port, 0, cycles);
+    }
 
     // Set the transmit holding register.
     uart->UART_THR = ch;
+    ioStats.consoleBytes++;
 }
 
 void SamUartConsole::putch(char ch) {
-
-    static char lastChar = '\0';
-
     // Convert LF -> CRLF.
     if (lastChar != '\r' && ch == '\n')
         doPutch('\r');
@@ -51,34 +87,20 @@ void SamUartConsole::putch(char ch) {
     lastChar = ch;
 }
 
-int SamUartConsole::doGetch(bool block) {
-    if (block) {
-        // Wait for the receiver to become ready.
-        while (!(uart->UART_SR & UART_SR_RXRDY)) {
-            // XXX: Blink LED for debugging.
-            PIOB->PIO_CODR = PIO_PB27;
-            Sleep(10);
-            PIOB->PIO_SODR = PIO_PB27;
-        }
-    } else {
-        if (!(uart->UART_SR & UART_SR_RXRDY))
-            return -1;
-    }
-
-    // Read from receive holding register.
-    return (uint8_t)uart->UART_RHR;
-}
-
 int SamUartConsole::getch(bool block) {
     if (block) {
         while (!rxbuf.getLength())
-            Sleep(1);
+            idleSleep(1);
     }
-    if (rxbuf.getLength()) {
-        return (uint8_t) --rxbuf;
-    } else {
+    if (!rxbuf.getLength())
         return -1;
-    }
+
+    // The interrupt handler modifies the buffer too.
+    uart->UART_IDR = UART_IDR_RXRDY;
+    uint8_t c = --rxbuf;
+    uart->UART_IER = UART_IER_RXRDY;
+
+    return c;
 }
 
 void SamUartConsole::clear() {
@@ -87,39 +109,63 @@ void SamUartConsole::clear() {
     // erase dpy ^        ^ move cursor to origin.
 }
 
-extern "C" void UART_Handler(void) {
-    int c;
-    SamUartConsole &con = SamUartConsole::getInstance();
+RAMFUNC void SamUartConsole::handleInterrupt(Port port) {
+    IsrTimer timer;
+    SamUartConsole *con = instances[(size_t)port];
+    if (!con)
+        return;
 
-    if (con.uart->UART_IMR & UART_IMR_RXRDY) {
+    Uart *uart = con->uart;
+    if ((uart->UART_IMR & UART_IMR_RXRDY) && (uart->UART_SR & UART_SR_RXRDY)) {
         // Append the received character to the receive buffer.
-        if ((c = con.doGetch(false)) >= 0) {
-            rxbuf += (uint8_t)c;
-        }
+        uint8_t c = (uint8_t)uart->UART_RHR;
+        tracer.log(TRACE_UART_RX, (uint8_t)port, c, con->rxbuf.isFull());
+        con->rxbuf += c;
+
+        uint32_t cycles = timer.elapsed();
+        ioStats.consoleRxInterrupts++;
+        ioStats.consoleRxCycles += cycles;
+        if (cycles > ioStats.consoleRxMaxCycles)
+            ioStats.consoleRxMaxCycles = cycles;
     }
 }
 
-SamUartConsole::SamUartConsole(Uart *uart_)
-    : uart(uart_) {
+extern "C" RAMFUNC void UART_Handler(void)   { SamUartConsole::handleInterrupt(SamUartConsole::Port::Main);   }
+extern "C" RAMFUNC void USART0_Handler(void) { SamUartConsole::handleInterrupt(SamUartConsole::Port::Usart0); }
+extern "C" RAMFUNC void USART1_Handler(void) { SamUartConsole::handleInterrupt(SamUartConsole::Port::Usart1); }
+extern "C" RAMFUNC void USART2_Handler(void) { SamUartConsole::handleInterrupt(SamUartConsole::Port::Usart2); }
+extern "C" RAMFUNC void USART3_Handler(void) { SamUartConsole::handleInterrupt(SamUartConsole::Port::Usart3); }
+
+SamUartConsole::SamUartConsole(Port port_) : port(port_) {
+    const PortInfo &info = ports[(size_t)port];
 
-    // Configure UART pins.
-    PIO_Configure(PIOA, PIO_PERIPH_A, PIO_PA8A_URXD, PIO_PULLUP);
-    PIO_Configure(PIOA, PIO_PERIPH_A, PIO_PA9A_UTXD, PIO_PULLUP);
+    uart = info.uart;
 
-    pmc_enable_periph_clk(ID_UART);
+    // Configure the port's pins.
+    PIO_Configure(info.pio, info.pinType, info.rxPin, PIO_PULLUP);
+    PIO_Configure(info.pio, info.pinType, info.txPin, PIO_PULLUP);
+
+    pmc_enable_periph_clk(info.id);
 
     // Reset and disable receiver and transmitter.
     uart->UART_CR = UART_CR_RSTRX | UART_CR_RSTTX | UART_CR_RXDIS | UART_CR_TXDIS;
 
-    // Set the baudrate to 115200.
+    // Set the baudrate to 115200. The USART divider works the same way.
     uart->UART_BRGR = 45; // MASTER_CLK_FREQ / (16 * 45) = 116666 (close enough).
     //uart->UART_BRGR = 546; // For ~9600 baud.
 
     // No parity, normal channel mode. (We could enable echo by setting CHMODE AUTOMATIC)
-    uart->UART_MR = UART_MR_PAR_NO;
+    // The USART needs a character length, stop bits and clock source as well.
+    if (info.usart)
+        uart->UART_MR = US_MR_USCLKS_MCK | US_MR_CHRL_8_BIT | US_MR_PAR_NO
+                      | US_MR_NBSTOP_1_BIT | US_MR_CHMODE_NORMAL;
+    else
+        uart->UART_MR = UART_MR_PAR_NO;
+
+    instances[(size_t)port] = this;
 
     uart->UART_IDR = 0xFFFFFFFF;        // Disable all interrupts.
-    NVIC_EnableIRQ((IRQn_Type)ID_UART); // Configure UART isr.
+    NVIC_EnableIRQ((IRQn_Type)info.id); // Configure the port's isr.
     uart->UART_IER = UART_IER_RXRDY;    // Enable receive-ready interrupt.
     //uart->UART_IER = UART_IER_RXRDY | UART_IER_TXRDY;
 
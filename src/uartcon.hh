@@ -1,6 +1,6 @@
 /**
  * \file
- * \brief     Due UART Console class.
+ * \brief     Due UART and USART console class.
  * \author    Chris Smeele
  * \copyright Copyright (c) 2016, Chris Smeele
  *
@@ -22,18 +22,46 @@
 #pragma once
 
 #include "console.hh"
+#include "queue.hh"
 #include "sam.hh"
 
+/**
+ * \brief A console on the UART or one of the USARTs.
+ *
+ * There is one instance per port, each with its own receive buffer, filled
+ * by the port's interrupt handler. The USARTs are used in asynchronous
+ * mode only, in which their registers are laid out like the UART's.
+ */
 class SamUartConsole : public Console {
 
+public:
+    /// Main is the UART, on the programming port.
+    enum class Port { Main, Usart0, Usart1, Usart2, Usart3 };
+
+    static const size_t portCount = 5;
+
+private:
     friend void UART_Handler();
+    friend void USART0_Handler();
+    friend void USART1_Handler();
+    friend void USART2_Handler();
+    friend void USART3_Handler();
+
+    static SamUartConsole *instances[portCount];
 
     Uart *uart;
+    Port  port;
+
+    Queue<uint8_t, 256> rxbuf; ///< Holds input while a command is busy, e.g. writing to a card.
+
+    char lastChar = '\0';
 
     void doPutch(uint8_t ch);
-    int  doGetch(bool block = true);
 
-    SamUartConsole(Uart *uart_);
+    /// Move received characters into the receive buffer.
+    static void handleInterrupt(Port port);
+
+    SamUartConsole(Port port_);
 
 public:
     void putch(char ch);
@@ -41,7 +69,8 @@ public:
 
     void clear();
 
-    static SamUartConsole &getInstance();
+    /// Get the console on a port, setting up the port on first use.
+    static SamUartConsole &getInstance(Port port = Port::Main);
 
     SamUartConsole(SamUartConsole const&) = delete;
     void operator=(SamUartConsole const&) = delete;
@@ -0,0 +1,267 @@
+/**
+ * \file
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "xfer.hh"
+
+#include <cstring>
+
+void Xfer::sendFrame(FrameType type, uint32_t value, const void *data, size_t length) {
+    uint8_t head[5] = { type };
+    putLe32(head + 1, value);
+
+    link.send(head, sizeof(head), data, length);
+}
+
+bool Xfer::receiveFrame(uint32_t ms) {
+    size_t length = link.receive(ms);
+    if (length < 5)
+        return false;
+
+    rxType    = (FrameType)frame[0];
+    rxValue   = getLe32(frame + 1);
+    rxPayload = frame + 5;
+    rxLength  = length - 5;
+
+    return true;
+}
+
+void Xfer::attach(Console &con_) {
+    link.attach(con_);
+}
+
+void Xfer::cancel() {
+    sendFrame(FRAME_CANCEL, 0);
+}
+
+XferError Xfer::send(XferFile &file, uint32_t size, const char *name) {
+    size_t nameLength = strlen(name);
+    if (nameLength > maxNameLength)
+        nameLength = maxNameLength;
+
+    // Wait for the receiver.
+    unsigned retries = 0;
+    while (true) {
+        if (receiveFrame(timeout)) {
+            if (rxType == FRAME_READY)
+                break;
+            if (rxType == FRAME_CANCEL)
+                return XFER_ERR_CANCELLED;
+        } else if (++retries > maxRetries) {
+            return XFER_ERR_TIMEOUT;
+        }
+    }
+
+    // Announce the file.
+    sendFrame(FRAME_HEADER, size, name, nameLength);
+    retries = 0;
+    while (true) {
+        if (receiveFrame(timeout)) {
+            if (rxType == FRAME_ACK && rxValue == 0)
+                break;
+            if (rxType == FRAME_CANCEL)
+                return XFER_ERR_CANCELLED;
+            if (rxType == FRAME_READY)
+                sendFrame(FRAME_HEADER, size, name, nameLength);
+        } else if (++retries > maxRetries) {
+            cancel();
+            return XFER_ERR_TIMEOUT;
+        } else {
+            sendFrame(FRAME_HEADER, size, name, nameLength);
+        }
+    }
+
+    // Stream the data.
+    uint32_t base         = 0; ///< The first byte not acknowledged.
+    uint32_t next         = 0; ///< The next byte to send.
+    uint16_t seq          = 0; ///< Number of the next data frame.
+    uint16_t rewindSeq    = 0; ///< The first frame sent after going back.
+    uint32_t lastProgress = getTicks();
+    retries = 0;
+
+    while (base < size) {
+        if (next < size && next - base < window * maxPayload) {
+            size_t length = size - next < maxPayload ? size - next : maxPayload;
+            if (file.read(next, payload + 2, length)) {
+                cancel();
+                return XFER_ERR_IO;
+            }
+            putLe16(payload, seq);
+            sendFrame(FRAME_DATA, next, payload, 2 + length);
+            next += (uint32_t)length;
+            seq++;
+        }
+
+        // Handle replies between frames, so that a retransmission request
+        // does not wait for the window to fill up.
+        if (receiveFrame(0)) {
+            if ((rxType == FRAME_ACK || rxType == FRAME_NAK)
+                && rxValue > base && rxValue <= size) {
+
+                base         = rxValue;
+                retries      = 0;
+                lastProgress = getTicks();
+                if (next < base)
+                    next = base;
+            }
+            if (rxType == FRAME_NAK && rxValue == base && rxLength == 2
+                && (int16_t)(getLe16(rxPayload) - rewindSeq) >= 0) {
+
+                // Requests caused by frames sent before we went back
+                // last time are already taken care of.
+                next         = base;
+                rewindSeq    = seq;
+                lastProgress = getTicks();
+
+            } else if (rxType == FRAME_CANCEL) {
+                return XFER_ERR_CANCELLED;
+            }
+        } else if (getTicks() - lastProgress >= timeout) {
+            if (++retries > maxRetries) {
+                cancel();
+                return XFER_ERR_TIMEOUT;
+            }
+            next         = base;
+            rewindSeq    = seq;
+            lastProgress = getTicks();
+        }
+    }
+
+    // Wait until the receiver has stored the file.
+    sendFrame(FRAME_END, size);
+    retries = 0;
+    while (true) {
+        if (receiveFrame(timeout)) {
+            if (rxType == FRAME_END && rxValue == size)
+                return XFER_ERR_OK;
+            if (rxType == FRAME_CANCEL)
+                return XFER_ERR_CANCELLED;
+        } else if (++retries > maxRetries) {
+            cancel();
+            return XFER_ERR_TIMEOUT;
+        } else {
+            sendFrame(FRAME_END, size);
+        }
+    }
+}
+
+XferError Xfer::receiveHeader(char *name, size_t nameSize, uint32_t &size) {
+    unsigned retries = 0;
+
+    sendFrame(FRAME_READY, 0);
+    while (true) {
+        if (receiveFrame(timeout)) {
+            if (rxType == FRAME_HEADER) {
+                size_t length = rxLength < nameSize - 1 ? rxLength : nameSize - 1;
+                memcpy(name, rxPayload, length);
+                name[length] = '\0';
+                size = rxValue;
+                return XFER_ERR_OK;
+            }
+            if (rxType == FRAME_CANCEL)
+                return XFER_ERR_CANCELLED;
+        } else if (++retries > maxRetries) {
+            return XFER_ERR_TIMEOUT;
+        } else {
+            sendFrame(FRAME_READY, 0);
+        }
+    }
+}
+
+XferError Xfer::receiveData(XferFile &file, uint32_t size) {
+    uint32_t expected = 0;
+    unsigned retries  = 0;
+
+    sendFrame(FRAME_ACK, 0);
+
+    while (true) {
+        if (!receiveFrame(timeout)) {
+            if (++retries > maxRetries) {
+                cancel();
+                return XFER_ERR_TIMEOUT;
+            }
+            sendFrame(FRAME_ACK, expected);
+            continue;
+        }
+
+        switch (rxType) {
+        case FRAME_HEADER:
+            // Our first reply got lost.
+            if (!expected)
+                sendFrame(FRAME_ACK, 0);
+            break;
+
+        case FRAME_DATA: {
+            if (rxLength < 2)
+                break;
+
+            // Skip the frame number.
+            const uint8_t *data   = rxPayload + 2;
+            size_t         length = rxLength  - 2;
+
+            if (rxValue == expected && length && length <= size - expected) {
+                if (file.write(data, length)) {
+                    cancel();
+                    return XFER_ERR_IO;
+                }
+                expected += (uint32_t)length;
+                retries   = 0;
+                sendFrame(FRAME_ACK, expected);
+
+            } else if (rxValue > expected) {
+                // Something got lost. Tell the sender which frame showed
+                // the gap, so it can ignore the requests for the rest of
+                // the window.
+                sendFrame(FRAME_NAK, expected, rxPayload, 2);
+            } else {
+                // A retransmission of data we already have.
+                sendFrame(FRAME_ACK, expected);
+            }
+            break;
+        }
+
+        case FRAME_END:
+            if (rxValue != size) {
+                cancel();
+                return XFER_ERR_PROTOCOL;
+            }
+            if (expected != size) {
+                sendFrame(FRAME_ACK, expected);
+                break;
+            }
+            if (file.finish()) {
+                cancel();
+                return XFER_ERR_IO;
+            }
+            sendFrame(FRAME_END, size);
+            return XFER_ERR_OK;
+
+        case FRAME_CANCEL:
+            return XFER_ERR_CANCELLED;
+
+        default:
+            break;
+        }
+    }
+}
+
+void Xfer::linger(uint32_t size) {
+    while (receiveFrame(timeout) && rxType == FRAME_END)
+        sendFrame(FRAME_END, size);
+}
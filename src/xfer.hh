@@ -0,0 +1,168 @@
+/**
+ * \file
+ * \brief     Windowed file transfer over a console.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "framelink.hh"
+
+#include <cstdint>
+#include <cstdlib>
+
+enum XferError {
+    XFER_ERR_OK = 0,
+    XFER_ERR_IO,        ///< The file could not be read or written.
+    XFER_ERR_TIMEOUT,   ///< The peer stopped responding.
+    XFER_ERR_CANCELLED, ///< The peer gave up.
+    XFER_ERR_PROTOCOL,  ///< The peer sent something unexpected.
+};
+
+/**
+ * \brief The data source of a sender, or the destination of a receiver.
+ */
+class XferFile {
+public:
+    /**
+     * \brief Read file data for sending.
+     *
+     * Offsets go back after a retransmission request, otherwise reads are
+     * sequential.
+     */
+    virtual XferError read(uint32_t offset, void *data, size_t length) = 0;
+
+    /// Write received data, always in order.
+    virtual XferError write(const void *data, size_t length) = 0;
+
+    /// Called when all data has been received.
+    virtual XferError finish() { return XFER_ERR_OK; }
+
+protected:
+    ~XferFile() = default;
+};
+
+/**
+ * \brief Sends and receives files over a console.
+ *
+ * The sender keeps up to `window` data frames in flight. The receiver
+ * acknowledges every frame with the offset it expects next, and asks for a
+ * retransmission (go-back-N) when it sees a gap. Data frames are numbered,
+ * so that the sender only goes back for gaps in frames sent after it last
+ * went back. A sender that hears nothing for a while resends from the last
+ * acknowledged offset. The receiver answers END only after the file has
+ * been stored.
+ *
+ * A transfer goes:
+ *
+ *     receiver            sender
+ *     READY       ->
+ *                 <-      HEADER (size, name)
+ *     ACK 0       ->
+ *                 <-      DATA (offset, bytes)...
+ *     ACK/NAK ... ->
+ *                 <-      END (size)
+ *     END size    ->
+ *
+ * Frames are sent through a FrameLink, so damaged ones are simply lost.
+ */
+class Xfer {
+
+public:
+    static const size_t   maxPayload = 1024;
+    static const size_t   window     = 4;    ///< Data frames in flight.
+    static const uint32_t timeout    = 1000; ///< In ms.
+    static const unsigned maxRetries = 10;
+
+    static const size_t maxNameLength = 255;
+
+private:
+    enum FrameType : uint8_t {
+        FRAME_READY  = 'R',
+        FRAME_HEADER = 'H',
+        FRAME_DATA   = 'D',
+        FRAME_END    = 'E',
+        FRAME_ACK    = 'A',
+        FRAME_NAK    = 'N',
+        FRAME_CANCEL = 'C',
+    };
+
+    /// Type, offset or size, frame number, payload and CRC.
+    static const size_t maxFrameLength = 1 + 4 + 2 + maxPayload + 4;
+
+    uint32_t (*getTicks)();
+
+    uint8_t   frame[maxFrameLength];
+    uint8_t   payload[2 + maxPayload]; ///< Data frame being sent.
+    FrameLink link;
+
+    // The last frame received.
+    FrameType      rxType;
+    uint32_t       rxValue;
+    const uint8_t *rxPayload;
+    size_t         rxLength;
+
+    void sendFrame(FrameType type, uint32_t value,
+                   const void *payload = nullptr, size_t length = 0);
+
+    /**
+     * \brief Wait for a frame.
+     *
+     * \param ms time to wait, 0 to only look at input that is available
+     *
+     * \return whether a valid frame was received
+     */
+    bool receiveFrame(uint32_t ms);
+
+public:
+    /// Use a console for the following transfers.
+    void attach(Console &con_);
+
+    /**
+     * \brief Send a file.
+     *
+     * Waits for the receiver to become ready first.
+     */
+    XferError send(XferFile &file, uint32_t size, const char *name);
+
+    /**
+     * \brief Wait for a sender and receive the name and size of its file.
+     *
+     * Continue with receiveData() to accept the file, or cancel().
+     */
+    XferError receiveHeader(char *name, size_t nameSize, uint32_t &size);
+
+    /// Receive the file announced by receiveHeader().
+    XferError receiveData(XferFile &file, uint32_t size);
+
+    /**
+     * \brief Keep answering the sender after a successful receiveData().
+     *
+     * The last reply may get lost, this waits until the sender has been
+     * quiet for a while.
+     */
+    void linger(uint32_t size);
+
+    /// Tell the peer to give up.
+    void cancel();
+
+    /// \param getTicks_ a millisecond clock
+    Xfer(uint32_t (*getTicks_)())
+        : getTicks(getTicks_), link(frame, sizeof(frame), getTicks_) { }
+    ~Xfer() = default;
+};
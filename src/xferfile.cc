@@ -0,0 +1,79 @@
+/**
+ * \file
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "xferfile.hh"
+
+#include <cstring>
+
+using namespace MuStore;
+
+XferError FileSource::read(uint32_t offset, void *data, size_t length) {
+    if (offset != file.getPosition() && file.seek(offset))
+        return XFER_ERR_IO;
+
+    size_t readBytes;
+    if (file.read(data, length, readBytes) || readBytes != length)
+        return XFER_ERR_IO;
+
+    return XFER_ERR_OK;
+}
+
+XferError FileSource::write(const void*, size_t) {
+    return XFER_ERR_IO;
+}
+
+XferError NodeSink::read(uint32_t, void*, size_t) {
+    return XFER_ERR_IO;
+}
+
+XferError NodeSink::write(const void *data, size_t length) {
+    const uint8_t *in = (const uint8_t*)data;
+
+    while (length) {
+        size_t chunk = sizeof(buffer) - bufferLength;
+        if (chunk > length)
+            chunk = length;
+
+        memcpy(buffer + bufferLength, in, chunk);
+        bufferLength += chunk;
+        in           += chunk;
+        length       -= chunk;
+
+        if (bufferLength == sizeof(buffer)) {
+            FsError err;
+            if (node.write(buffer, sizeof(buffer), err) != sizeof(buffer) || err)
+                return XFER_ERR_IO;
+            bufferLength = 0;
+        }
+    }
+
+    return XFER_ERR_OK;
+}
+
+XferError NodeSink::finish() {
+    if (bufferLength) {
+        FsError err;
+        if (node.write(buffer, bufferLength, err) != bufferLength || err)
+            return XFER_ERR_IO;
+        bufferLength = 0;
+    }
+
+    return XFER_ERR_OK;
+}
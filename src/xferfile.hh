@@ -0,0 +1,62 @@
+/**
+ * \file
+ * \brief     File sources and sinks for transfers.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "xfer.hh"
+#include "filereader.hh"
+
+#include <mustore/fs.hh>
+
+/// Sends a file, decompressed if it is stored compressed.
+class FileSource : public XferFile {
+
+    FileReader &file;
+
+public:
+    XferError read(uint32_t offset, void *data, size_t length);
+    XferError write(const void *data, size_t length);
+
+    FileSource(FileReader &file_) : file(file_) { }
+    ~FileSource() = default;
+};
+
+/**
+ * \brief Receives into a file node.
+ *
+ * Data is collected into whole sectors before it is written, so that the
+ * filesystem never has to read back a partial sector.
+ */
+class NodeSink : public XferFile {
+
+    MuStore::FsNode &node;
+
+    uint8_t buffer[FatVolume::sectorSize];
+    size_t  bufferLength = 0;
+
+public:
+    XferError read(uint32_t offset, void *data, size_t length);
+    XferError write(const void *data, size_t length);
+    XferError finish();
+
+    NodeSink(MuStore::FsNode &node_) : node(node_) { }
+    ~NodeSink() = default;
+};
@@ -0,0 +1,573 @@
+/**
+ * \file
+ * \brief     Host client for the blkserve shell command.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Images a device's store to a file (pull), writes an image back (push)
+ * or compares them (verify). Push and verify compare CRCs of chunks of
+ * blocks first, so only chunks that differ are transferred. A card can be
+ * pulled, checked or repaired on the host, and pushed back quickly.
+ *
+ * The client types the blkserve command into the shell itself. Several
+ * requests are kept in flight; requests that go unanswered are sent again.
+ *
+ * The selftest command serves a MemoryStore from a child process over a
+ * pseudo-terminal, and pushes, pulls and verifies an image, once over a
+ * clean link and once over one that drops and damages bytes.
+ */
+
+#include "blkserve.hh"
+#include "memorystore.hh"
+#include "crc.hh"
+#include "hostcon.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+using namespace MuStore;
+
+static const size_t blockSize = BlkServer::blockSize;
+
+struct Request {
+    BlkServer::Op        op;
+    uint32_t             lba;
+    uint16_t             count;
+    std::vector<uint8_t> data; ///< For writes.
+};
+
+/**
+ * \brief Keeps several requests in flight, and repeats them when needed.
+ *
+ * Replies are passed to a handler, which may queue more requests.
+ */
+class BlkClient {
+
+public:
+    static const size_t   window     = 4;
+    static const uint32_t timeout    = 2000;
+    static const unsigned maxRetries = 10;
+
+    /// Called with each successful reply and its payload.
+    typedef std::function<void(const Request &request, uint32_t lba, uint16_t count,
+                               const uint8_t *payload, size_t length)> Handler;
+
+private:
+    struct Pending {
+        Request  request;
+        uint8_t  tag;
+        uint32_t done;  ///< Blocks of a read received so far.
+        uint32_t order; ///< When it was last sent.
+    };
+
+    uint8_t   frame[BlkServer::replyLength + BlkServer::maxBlocks * blockSize + 4];
+    FrameLink link;
+
+    std::deque<Request> queue;
+    std::deque<Pending> pending;
+    uint8_t             nextTag   = 0;
+    uint32_t            nextOrder = 0;
+
+    void send(Pending &p) {
+        p.tag   = nextTag++;
+        p.order = nextOrder++;
+
+        uint8_t head[BlkServer::requestLength];
+        head[BlkServer::offOp]  = p.request.op;
+        head[BlkServer::offTag] = p.tag;
+        putLe32(head + BlkServer::offLba,   p.request.lba   + p.done);
+        putLe16(head + BlkServer::offCount, (uint16_t)(p.request.count - p.done));
+
+        link.send(head, sizeof(head), p.request.data.data(), p.request.data.size());
+    }
+
+public:
+    uint32_t resent = 0;
+
+    /// Send a request again, with a new tag so that late replies are ignored.
+    void resend(Pending &p) {
+        send(p);
+        resent++;
+    }
+
+    void queueRequest(const Request &request) { queue.push_back(request); }
+
+    /**
+     * \brief Run until all requests are answered.
+     *
+     * \return false if a request failed or the device stopped responding
+     */
+    bool run(const Handler &handler, unsigned retryLimit = maxRetries) {
+        uint32_t lastActivity = getTicks();
+        unsigned retries      = 0;
+
+        while (!queue.empty() || !pending.empty()) {
+            while (pending.size() < window && !queue.empty()) {
+                pending.push_back(Pending { queue.front(), 0, 0, 0 });
+                queue.pop_front();
+                send(pending.back());
+            }
+
+            size_t length = link.receive(10);
+            if (length < BlkServer::replyLength) {
+                if (getTicks() - lastActivity >= timeout) {
+                    if (++retries > retryLimit) {
+                        queue.clear();
+                        pending.clear();
+                        return false;
+                    }
+                    // Requests are answered in order, so all of them
+                    // need to be sent again.
+                    for (auto &p : pending)
+                        resend(p);
+                    lastActivity = getTicks();
+                }
+                continue;
+            }
+
+            uint8_t  tag    = frame[BlkServer::offTag];
+            uint32_t lba    = getLe32(frame + BlkServer::offLba);
+            uint16_t count  = getLe16(frame + BlkServer::offCount);
+            uint8_t  status = frame[BlkServer::offStatus];
+
+            auto it = pending.begin();
+            while (it != pending.end() && it->tag != tag)
+                it++;
+            if (it == pending.end())
+                continue; // A reply to a request that was sent again.
+
+            lastActivity = getTicks();
+            retries      = 0;
+
+            // Requests are answered in order, so those sent before this
+            // one that are still unanswered were lost.
+            for (auto &p : pending) {
+                if (p.order < it->order)
+                    resend(p);
+            }
+
+            if (status) {
+                fprintf(stderr, "blkclient: request '%c' at block %u failed (%u)\n",
+                        it->request.op, lba, status);
+                queue.clear();
+                pending.clear();
+                return false;
+            }
+
+            const uint8_t *payload = frame  + BlkServer::replyLength;
+            size_t         size    = length - BlkServer::replyLength;
+
+            if (it->request.op == BlkServer::OP_READ) {
+                // After a lost reply, ask for the rest of the blocks again.
+                if (lba != it->request.lba + it->done || size != count * blockSize) {
+                    resend(*it);
+                    continue;
+                }
+                it->done += count;
+                handler(it->request, lba, count, payload, size);
+                if (it->done < it->request.count)
+                    continue;
+            } else {
+                handler(it->request, lba, count, payload, size);
+            }
+
+            pending.erase(it);
+        }
+
+        return true;
+    }
+
+    void attach(Console &con) { link.attach(con); }
+
+    BlkClient() : link(frame, sizeof(frame), getTicks) { }
+};
+
+/// Blocks per CRC comparison in push and verify, and per read request in pull.
+static const uint16_t chunkBlocks = 64;
+
+static void printRate(const char *what, uint32_t blocks, uint32_t ms) {
+    if (!ms)
+        ms = 1;
+    printf("blkclient: %s %u blocks in %u ms (%llu bytes/s)\n",
+           what, blocks, ms, (unsigned long long)blocks * blockSize * 1000 / ms);
+}
+
+static bool info(BlkClient &client, uint32_t &blockCount) {
+    uint16_t size = 0;
+
+    client.queueRequest(Request { BlkServer::OP_INFO, 0, 0, { } });
+    bool ok = client.run([&](const Request&, uint32_t lba, uint16_t count,
+                             const uint8_t*, size_t) {
+        blockCount = lba;
+        size       = count;
+    });
+    if (!ok) {
+        fprintf(stderr, "blkclient: device not responding\n");
+        return false;
+    }
+    if (size != blockSize) {
+        fprintf(stderr, "blkclient: unsupported block size %u\n", size);
+        return false;
+    }
+    return true;
+}
+
+/// Stop the server. Its reply may be lost, so this does not try hard.
+static void quit(BlkClient &client) {
+    client.queueRequest(Request { BlkServer::OP_QUIT, 0, 0, { } });
+    client.run([](const Request&, uint32_t, uint16_t, const uint8_t*, size_t) { }, 2);
+}
+
+static bool pull(BlkClient &client, uint32_t blockCount, std::vector<uint8_t> &image) {
+    image.assign(blockCount * blockSize, 0);
+
+    for (uint32_t lba = 0; lba < blockCount; lba += chunkBlocks) {
+        uint32_t n = blockCount - lba;
+        client.queueRequest(Request { BlkServer::OP_READ, lba,
+                                      (uint16_t)(n < chunkBlocks ? n : chunkBlocks), { } });
+    }
+
+    uint32_t start = getTicks();
+    bool ok = client.run([&](const Request&, uint32_t lba, uint16_t,
+                             const uint8_t *payload, size_t length) {
+        memcpy(image.data() + lba * blockSize, payload, length);
+    });
+    if (!ok) {
+        fprintf(stderr, "blkclient: pull failed\n");
+        return false;
+    }
+    printRate("pulled", blockCount, getTicks() - start);
+
+    return true;
+}
+
+/**
+ * \brief Compare an image with the device, chunk by chunk.
+ *
+ * \param write     write chunks that differ to the device
+ * \param different chunks that differ
+ */
+static bool compare(BlkClient &client, const std::vector<uint8_t> &image,
+                    bool write, uint32_t &different) {
+
+    uint32_t blockCount = (uint32_t)(image.size() / blockSize);
+    uint32_t written    = 0;
+
+    different = 0;
+
+    for (uint32_t lba = 0; lba < blockCount; lba += chunkBlocks) {
+        uint32_t n = blockCount - lba;
+        client.queueRequest(Request { BlkServer::OP_CRC, lba,
+                                      (uint16_t)(n < chunkBlocks ? n : chunkBlocks), { } });
+    }
+
+    uint32_t start = getTicks();
+    bool ok = client.run([&](const Request &request, uint32_t lba, uint16_t count,
+                             const uint8_t *payload, size_t length) {
+        if (request.op != BlkServer::OP_CRC) {
+            written += count;
+            return;
+        }
+
+        const uint8_t *local = image.data() + lba * blockSize;
+        if (length == 4 && getLe32(payload) == crc32(local, count * blockSize))
+            return;
+
+        different++;
+        if (!write)
+            return;
+
+        for (uint32_t i = 0; i < count; i += BlkServer::maxBlocks) {
+            uint16_t n = (uint16_t)(count - i < BlkServer::maxBlocks
+                                    ? count - i : BlkServer::maxBlocks);
+            const uint8_t *data = local + i * blockSize;
+            client.queueRequest(Request { BlkServer::OP_WRITE, lba + i, n,
+                                          { data, data + n * blockSize } });
+        }
+    });
+
+    if (ok && write) {
+        client.queueRequest(Request { BlkServer::OP_FLUSH, 0, 0, { } });
+        ok = client.run([](const Request&, uint32_t, uint16_t, const uint8_t*, size_t) { });
+    }
+    if (!ok) {
+        fprintf(stderr, "blkclient: %s failed\n", write ? "push" : "verify");
+        return false;
+    }
+
+    if (write) {
+        printRate("pushed", written, getTicks() - start);
+        printf("blkclient: %u of %u chunks differed\n",
+               different, (blockCount + chunkBlocks - 1) / chunkBlocks);
+    } else {
+        printf("blkclient: %u of %u chunks differ\n",
+               different, (blockCount + chunkBlocks - 1) / chunkBlocks);
+    }
+
+    return true;
+}
+
+static bool loadImage(const char *path, std::vector<uint8_t> &image) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    uint8_t buffer[4096];
+    size_t  n;
+    while ((n = fread(buffer, 1, sizeof(buffer), f)))
+        image.insert(image.end(), buffer, buffer + n);
+    fclose(f);
+
+    if (image.size() % blockSize) {
+        fprintf(stderr, "blkclient: %s: size is not a multiple of %zu\n", path, blockSize);
+        return false;
+    }
+    return true;
+}
+
+static bool saveImage(const char *path, const std::vector<uint8_t> &image) {
+    FILE *f = fopen(path, "wb");
+    if (!f || fwrite(image.data(), 1, image.size(), f) != image.size() || fclose(f)) {
+        perror(path);
+        return false;
+    }
+    return true;
+}
+
+static int run(const std::string &command, int fd, const char *mount, const char *path) {
+    FdConsole con(fd);
+    con.puts("\rblkserve ");
+    con.puts(mount);
+    con.putch('\r');
+
+    BlkClient client;
+    client.attach(con);
+
+    uint32_t blockCount;
+    if (!info(client, blockCount))
+        return 1;
+
+    std::vector<uint8_t> image;
+    uint32_t             different = 0;
+    bool                 ok        = true;
+
+    if (command == "info") {
+        printf("blkclient: %u blocks of %zu bytes (%llu KiB)\n", blockCount, blockSize,
+               (unsigned long long)blockCount * blockSize / 1024);
+
+    } else if (command == "pull") {
+        ok = pull(client, blockCount, image) && saveImage(path, image);
+
+    } else {
+        ok = loadImage(path, image);
+        if (ok && image.size() / blockSize > blockCount) {
+            fprintf(stderr, "blkclient: %s is larger than the device\n", path);
+            ok = false;
+        }
+        if (ok)
+            ok = compare(client, image, command == "push", different);
+        if (ok && command == "verify")
+            ok = !different;
+    }
+
+    quit(client);
+
+    return ok ? 0 : 1;
+}
+
+/// The device end of the self test: serve a store in memory.
+static int servePeer(int fd, std::vector<uint8_t> &data) {
+    FdConsole   con(fd);
+    MemoryStore store(data.data(), data.size());
+    BlkServer   server(getTicks);
+
+    server.run(con, store);
+
+    return 0;
+}
+
+static bool selftestPass(uint32_t kib, uint32_t errorRate) {
+    // The device starts with a copy of the image that differs in some chunks.
+    std::vector<uint8_t> image(kib * 1024);
+    for (auto &byte : image)
+        byte = (uint8_t)rand();
+    for (size_t i = 0; i < image.size(); i += 97)
+        image[i] = (uint8_t)"\xc0\xdb\r\n"[i % 4];
+
+    std::vector<uint8_t> device = image;
+    uint32_t             changed = 0;
+    for (size_t i = 0; i < device.size(); i += 3 * chunkBlocks * blockSize) {
+        size_t span = std::min(chunkBlocks * blockSize, device.size() - i);
+        device[i + (size_t)rand() % span] ^= 1;
+        changed++;
+    }
+
+    int master;
+    int slave;
+    openPty(master, slave);
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("blkclient: fork");
+        exit(1);
+    }
+    if (!pid) {
+        close(master);
+        exit(servePeer(slave, device));
+    }
+    close(slave);
+
+    printf("blkclient: selftest, %u KiB, %u damaged bytes per million\n", kib, errorRate);
+
+    bool ok = true;
+    {
+        FdConsole con(master);
+        con.errorRate = errorRate;
+
+        BlkClient client;
+        client.attach(con);
+
+        uint32_t             blockCount = 0;
+        uint32_t             different  = 0;
+        std::vector<uint8_t> pulled;
+
+        ok = info(client, blockCount);
+        if (ok && blockCount != image.size() / blockSize) {
+            printf("blkclient: selftest: wrong block count %u\n", blockCount);
+            ok = false;
+        }
+        if (ok)
+            ok = compare(client, image, true, different);
+        if (ok && different != changed) {
+            printf("blkclient: selftest: %u chunks differed, expected %u\n",
+                   different, changed);
+            ok = false;
+        }
+        if (ok)
+            ok = pull(client, blockCount, pulled);
+        if (ok && pulled != image) {
+            printf("blkclient: selftest: data mismatch\n");
+            ok = false;
+        }
+        if (ok)
+            ok = compare(client, image, false, different);
+        if (ok && different) {
+            printf("blkclient: selftest: image differs after push\n");
+            ok = false;
+        }
+
+        quit(client);
+
+        printf("blkclient: %u bytes damaged, %u requests sent again\n",
+               con.errors, client.resent);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    close(master);
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status))
+        ok = false;
+
+    return ok;
+}
+
+static void usage() {
+    fprintf(stderr,
+            "usage: blkclient [-b BAUD] [-m MOUNT] info DEVICE\n"
+            "       blkclient [-b BAUD] [-m MOUNT] pull DEVICE IMAGE\n"
+            "       blkclient [-b BAUD] [-m MOUNT] push IMAGE DEVICE\n"
+            "       blkclient [-b BAUD] [-m MOUNT] verify IMAGE DEVICE\n"
+            "       blkclient [-s KIB] [-e RATE] [-r SEED] selftest\n"
+            "\n"
+            "  -b BAUD   baud rate of the serial device (default 115200)\n"
+            "  -m MOUNT  mount point whose store is served (default /)\n"
+            "  -s KIB    size of the test image (default 512)\n"
+            "  -e RATE   damaged bytes per million in the lossy test (default 100)\n"
+            "  -r SEED   random seed\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    unsigned long baud      = 115200;
+    const char   *mount     = "/";
+    uint32_t      kib       = 512;
+    uint32_t      errorRate = 100;
+    unsigned      seed      = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "b:m:s:e:r:")) != -1) {
+        switch (opt) {
+        case 'b': baud      = strtoul(optarg, nullptr, 0); break;
+        case 'm': mount     = optarg; break;
+        case 's': kib       = (uint32_t)strtoul(optarg, nullptr, 0); break;
+        case 'e': errorRate = (uint32_t)strtoul(optarg, nullptr, 0); break;
+        case 'r': seed      = (unsigned)strtoul(optarg, nullptr, 0); break;
+        default:  usage();
+        }
+    }
+    srand(seed);
+
+    if (optind >= argc)
+        usage();
+
+    std::string command = argv[optind++];
+    int         args    = argc - optind;
+
+    if (command == "selftest" && !args) {
+        bool ok = selftestPass(kib, 0) && selftestPass(kib, errorRate);
+        printf("blkclient: selftest %s\n", ok ? "passed" : "FAILED");
+        return ok ? 0 : 1;
+    }
+
+    const char *device = nullptr;
+    const char *image  = nullptr;
+
+    if (command == "info" && args == 1) {
+        device = argv[optind];
+    } else if (command == "pull" && args == 2) {
+        device = argv[optind];
+        image  = argv[optind + 1];
+    } else if ((command == "push" || command == "verify") && args == 2) {
+        image  = argv[optind];
+        device = argv[optind + 1];
+    } else {
+        usage();
+    }
+
+    int fd  = openTty(device, baudToSpeed(baud));
+    int ret = run(command, fd, mount, image);
+    close(fd);
+
+    return ret;
+}
@@ -0,0 +1,275 @@
+/**
+ * \file
+ * \brief     Exercise EfcStore against emulated SAM3X flash.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The emulation follows the EEFC's rules: programming without erase can
+ * only clear bits, and a 16-byte chunk may be programmed once between
+ * erases. Breaking a rule is counted as a violation.
+ *
+ * A random workload (most writes going to a few hot sectors, like FAT and
+ * directory sectors) is verified against a copy in RAM, with the store
+ * remounted now and then. Afterwards, power failures are simulated by
+ * cutting off a page program halfway: after remounting, every sector must
+ * hold its last flushed contents or a later write.
+ */
+
+#include "efcstore.hh"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#include <unistd.h>
+
+using namespace MuStore;
+
+class SimFlash : public FlashPages {
+
+    std::vector<uint8_t>  memory;
+    std::vector<uint32_t> erases;
+
+public:
+    uint32_t programs   = 0;
+    uint32_t violations = 0;
+    long     budget     = -1; ///< Programs until power fails, -1 for never.
+
+    size_t getPageCount() const { return erases.size(); }
+
+    const uint8_t *getPage(size_t page) const { return &memory[page * pageSize]; }
+
+    uint32_t getErases(size_t page) const { return erases[page]; }
+
+    bool programPage(size_t page, const void *data, bool erase) {
+        if (page >= erases.size() || !budget)
+            return false;
+
+        uint8_t       *p  = &memory[page * pageSize];
+        const uint8_t *in = (const uint8_t*)data;
+        bool       cutOff = budget > 0 && !--budget;
+
+        programs++;
+
+        if (erase) {
+            memset(p, 0xff, pageSize);
+            erases[page]++;
+        }
+
+        for (size_t chunk = 0; chunk < pageSize; chunk += 16) {
+            bool blank   = true;
+            bool written = false;
+            for (size_t i = 0; i < 16; i++) {
+                blank   &= in[chunk + i] == 0xff;
+                written |= p [chunk + i] != 0xff;
+            }
+            if (!blank && written)
+                violations++;
+        }
+
+        for (size_t i = 0; i < pageSize; i++) {
+            // A cut-off program leaves some bytes unprogrammed.
+            if (!cutOff || rand() % 2)
+                p[i] &= in[i];
+        }
+
+        return !cutOff;
+    }
+
+    /// Power comes back.
+    void restore() { budget = -1; }
+
+    SimFlash(size_t size)
+        : memory(size, 0xff),
+          erases(size / pageSize, 0) { }
+};
+
+static uint64_t hashSector(const uint8_t *data) {
+    // FNV-1a.
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < EfcStore::sectorSize; i++)
+        h = (h ^ data[i]) * 1099511628211ull;
+    return h;
+}
+
+static void fill(uint8_t *data, uint32_t lba, uint32_t version) {
+    for (size_t i = 0; i < EfcStore::sectorSize; i += 4) {
+        uint32_t word = lba * 2654435761u ^ version * 40503u ^ (uint32_t)i;
+        memcpy(data + i, &word, 4);
+    }
+}
+
+/// Pick a sector, with 80% of writes going to the first 5% of sectors.
+static uint32_t pickSector(uint32_t count) {
+    uint32_t hot = std::max(count / 20, 1u);
+    return rand() % 5 ? rand() % hot : rand() % count;
+}
+
+static bool verify(EfcStore &store, const std::vector<std::vector<uint64_t>> &allowed) {
+    uint8_t data[EfcStore::sectorSize];
+    for (uint32_t lba = 0; lba < store.getBlockCount(); lba++) {
+        if (store.read(data, lba)) {
+            printf("efcsim: read error at sector %u\n", lba);
+            return false;
+        }
+        uint64_t h = hashSector(data);
+        if (std::find(allowed[lba].begin(), allowed[lba].end(), h) == allowed[lba].end()) {
+            printf("efcsim: sector %u has unexpected contents\n", lba);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void usage() {
+    fprintf(stderr,
+            "usage: efcsim [-s KIB] [-n WRITES] [-c CRASHES] [-r SEED]\n"
+            "\n"
+            "  -s KIB      size of the emulated flash region (default 128)\n"
+            "  -n WRITES   sector writes in the wear test (default 200000)\n"
+            "  -c CRASHES  simulated power failures (default 200)\n"
+            "  -r SEED     random seed\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    uint32_t kib     = 128;
+    uint32_t writes  = 200000;
+    uint32_t crashes = 200;
+    unsigned seed    = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:n:c:r:")) != -1) {
+        switch (opt) {
+        case 's': kib     = (uint32_t)strtoul(optarg, nullptr, 0); break;
+        case 'n': writes  = (uint32_t)strtoul(optarg, nullptr, 0); break;
+        case 'c': crashes = (uint32_t)strtoul(optarg, nullptr, 0); break;
+        case 'r': seed    = (unsigned)strtoul(optarg, nullptr, 0); break;
+        default:  usage();
+        }
+    }
+    srand(seed);
+
+    SimFlash flash(kib * 1024);
+    EfcStore store(flash);
+
+    if (store.mount()) {
+        printf("efcsim: mount failed, region too small?\n");
+        return 1;
+    }
+
+    uint32_t sectors = (uint32_t)store.getBlockCount();
+    printf("efcsim: %u KiB flash, %u sectors (%u KiB) usable\n",
+           kib, sectors, sectors * (uint32_t)EfcStore::sectorSize / 1024);
+
+    // Unwritten sectors read as zeroes.
+    uint8_t data[EfcStore::sectorSize] = { };
+    std::vector<std::vector<uint64_t>> allowed(sectors, std::vector<uint64_t>(1, hashSector(data)));
+    std::vector<uint32_t> versions(sectors, 0);
+    std::vector<uint32_t> sectorWrites(sectors, 0);
+
+    // Wear test.
+    for (uint32_t i = 0; i < writes; i++) {
+        uint32_t lba = pickSector(sectors);
+        fill(data, lba, ++versions[lba]);
+        sectorWrites[lba]++;
+
+        if (store.write(data, lba)) {
+            printf("efcsim: write error at sector %u\n", lba);
+            return 1;
+        }
+        allowed[lba].assign(1, hashSector(data));
+
+        if (i % 8 == 7 && store.flush()) {
+            printf("efcsim: flush error\n");
+            return 1;
+        }
+        if (i % 10000 == 9999) {
+            store.flush();
+            if (store.mount() || !verify(store, allowed))
+                return 1;
+        }
+    }
+    store.flush();
+    if (!verify(store, allowed))
+        return 1;
+
+    uint32_t minErases = 0xffffffff;
+    uint32_t maxErases = 0;
+    uint64_t sumErases = 0;
+    for (size_t page = 0; page < flash.getPageCount(); page++) {
+        minErases  = std::min(minErases, flash.getErases(page));
+        maxErases  = std::max(maxErases, flash.getErases(page));
+        sumErases += flash.getErases(page);
+    }
+
+    printf("efcsim: %u sector writes, %u page programs (%u.%02u per sector)\n",
+           store.getSectorWrites(), store.getPagePrograms(),
+           store.getPagePrograms() / std::max(store.getSectorWrites(), 1u),
+           store.getPagePrograms() * 100 / std::max(store.getSectorWrites(), 1u) % 100);
+    printf("efcsim: page erases min %u avg %u max %u, in place the hottest sector needs %u\n",
+           minErases, (uint32_t)(sumErases / flash.getPageCount()), maxErases,
+           *std::max_element(sectorWrites.begin(), sectorWrites.end()));
+
+    // Power failure test.
+    uint32_t survived = 0;
+    for (uint32_t c = 0; c < crashes; c++) {
+        flash.budget = 1 + rand() % 500;
+
+        while (flash.budget) {
+            uint32_t lba = pickSector(sectors);
+            fill(data, lba, ++versions[lba]);
+
+            // Whether the write makes it or not, both versions are fine.
+            allowed[lba].push_back(hashSector(data));
+            if (store.write(data, lba))
+                break;
+
+            if (rand() % 8 == 0 && !store.flush()) {
+                for (auto &a : allowed)
+                    a.erase(a.begin(), a.end() - 1);
+            }
+        }
+
+        flash.restore();
+        if (store.mount()) {
+            printf("efcsim: mount failed after power failure %u\n", c);
+            continue;
+        }
+        if (!verify(store, allowed))
+            return 1;
+
+        // Settle on what is there now.
+        for (uint32_t lba = 0; lba < sectors; lba++) {
+            store.read(data, lba);
+            allowed[lba].assign(1, hashSector(data));
+        }
+        survived++;
+    }
+    if (crashes)
+        printf("efcsim: %u of %u power failures recovered\n", survived, crashes);
+
+    printf("efcsim: %u flash rule violations\n", flash.violations);
+
+    return flash.violations || survived != crashes;
+}
@@ -0,0 +1,174 @@
+/**
+ * \file
+ * \brief     Check the CRC-32 and SHA-256 code against known vectors.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Besides the published test vectors, random data is hashed in random
+ * pieces at random alignments, and compared with the same data hashed in
+ * one go and with a bytewise reference CRC. Throughput is printed as
+ * well, for comparison with the numbers the shell reports on the board.
+ */
+
+#include "crc.hh"
+#include "sha256.hh"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <time.h>
+
+static uint64_t getMicros() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static uint32_t referenceCrc32(const uint8_t *data, size_t length) {
+    uint32_t crc = 0xffffffff;
+    while (length--) {
+        crc ^= *data++;
+        for (int i = 0; i < 8; i++)
+            crc = crc >> 1 ^ (crc & 1 ? 0xedb88320 : 0);
+    }
+    return ~crc;
+}
+
+static std::string sha256Hex(const void *data, size_t length) {
+    Sha256  sha;
+    uint8_t digest[Sha256::digestSize];
+    char    hex[2 * Sha256::digestSize + 1];
+
+    sha.update(data, length);
+    sha.finish(digest);
+    for (size_t i = 0; i < sizeof(digest); i++)
+        sprintf(hex + 2 * i, "%02x", digest[i]);
+
+    return hex;
+}
+
+static bool check(bool ok, const char *what) {
+    if (!ok)
+        printf("hashtest: %s FAILED\n", what);
+    return ok;
+}
+
+static bool testVectors() {
+    bool ok = true;
+
+    ok &= check(crc32("", 0) == 0, "crc32 of nothing");
+    ok &= check(crc32("123456789", 9) == 0xcbf43926, "crc32 of 123456789");
+    ok &= check(crc32("The quick brown fox jumps over the lazy dog", 43) == 0x414fa339,
+                "crc32 of the quick brown fox");
+
+    ok &= check(sha256Hex("", 0)
+                == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+                "sha256 of nothing");
+    ok &= check(sha256Hex("abc", 3)
+                == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+                "sha256 of abc");
+
+    const char *two = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    ok &= check(sha256Hex(two, strlen(two))
+                == "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+                "sha256 of two blocks");
+
+    std::vector<uint8_t> million(1000000, 'a');
+    ok &= check(sha256Hex(million.data(), million.size())
+                == "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
+                "sha256 of a million a's");
+
+    return ok;
+}
+
+static bool testPieces() {
+    std::vector<uint8_t> data(70000);
+    for (auto &byte : data)
+        byte = (uint8_t)rand();
+
+    for (int round = 0; round < 200; round++) {
+        size_t start  = (size_t)rand() % 8;
+        size_t length = (size_t)rand() % (data.size() - start);
+        const uint8_t *p = data.data() + start;
+
+        uint32_t crc = 0;
+        Sha256   sha;
+        size_t   done = 0;
+        while (done < length) {
+            size_t n = (size_t)rand() % 300;
+            if (n > length - done)
+                n = length - done;
+            crc = crc32(p + done, n, crc);
+            sha.update(p + done, n);
+            done += n;
+        }
+
+        uint8_t digest[Sha256::digestSize];
+        char    hex[2 * Sha256::digestSize + 1];
+        sha.finish(digest);
+        for (size_t i = 0; i < sizeof(digest); i++)
+            sprintf(hex + 2 * i, "%02x", digest[i]);
+
+        if (!check(crc == referenceCrc32(p, length), "crc32 in pieces")
+         || !check(sha256Hex(p, length) == hex, "sha256 in pieces"))
+            return false;
+    }
+    return true;
+}
+
+static void benchmark() {
+    std::vector<uint8_t> data(1 << 20);
+    for (auto &byte : data)
+        byte = (uint8_t)rand();
+
+    const int rounds = 64;
+    uint32_t  crc    = 0;
+
+    uint64_t start = getMicros();
+    for (int i = 0; i < rounds; i++)
+        crc = crc32(data.data(), data.size(), crc);
+    uint64_t crcUs = getMicros() - start;
+
+    Sha256  sha;
+    uint8_t digest[Sha256::digestSize];
+    start = getMicros();
+    for (int i = 0; i < rounds; i++)
+        sha.update(data.data(), data.size());
+    sha.finish(digest);
+    uint64_t shaUs = getMicros() - start;
+
+    printf("hashtest: crc32 %llu MB/s, sha256 %llu MB/s (%08x %02x)\n",
+           (unsigned long long)(rounds * data.size() / (crcUs ? crcUs : 1)),
+           (unsigned long long)(rounds * data.size() / (shaUs ? shaUs : 1)),
+           crc, digest[0]);
+}
+
+int main() {
+    bool ok = testVectors() && testPieces();
+    if (ok)
+        benchmark();
+
+    printf("hashtest: %s\n", ok ? "passed" : "FAILED");
+    return ok ? 0 : 1;
+}
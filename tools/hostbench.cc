@@ -0,0 +1,543 @@
+/**
+ * \file
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmarks of the shell's building blocks, built for the host so
+ * that they can be run under perf or valgrind: console formatting, the
+ * UART receive queue, command dispatch, file reads through FatFile
+ * and MuStore, and the search routines behind grep.
+ *
+ * File reads use a generated FAT12 volume, held in memory and in a
+ * temporary image file, unless an image and a file in it are given.
+ *
+ * Times are of the host CPU, so only compare them with each other, or
+ * with those of another build of the same code.
+ */
+
+#include "shell.hh"
+#include "bench.hh"
+#include "queue.hh"
+#include "fatfile.hh"
+#include "fileops.hh"
+#include "filereader.hh"
+#include "grep.hh"
+#include "memorystore.hh"
+#include "imagestore.hh"
+#include "hostcon.hh"
+
+#include <mustore/fatfs.hh>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace MuStore;
+
+static uint64_t now() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/// How long each benchmark runs, in nanoseconds.
+static const uint64_t runTime = 200000000;
+
+/// Call `f` repeatedly for about runTime, return the nanoseconds per call.
+template<typename F>
+static double timeCalls(F f) {
+    uint64_t calls = 0;
+    uint64_t start = now();
+    uint64_t elapsed;
+    do {
+        for (int i = 0; i < 64; i++)
+            f();
+        calls  += 64;
+        elapsed = now() - start;
+    } while (elapsed < runTime);
+
+    return (double)elapsed / (double)calls;
+}
+
+static void printResult(const char *name, double value, const char *unit) {
+    printf("  %-36s %10.1f %s\n", name, value, unit);
+}
+
+/// Discards output, counting it.
+class NullConsole : public Console {
+public:
+    uint64_t bytes = 0;
+
+    void putch(char) { bytes++; }
+    int  getch(bool) { return -1; }
+};
+
+static void benchPrintf() {
+    NullConsole con;
+
+    printf("printf\n");
+
+    struct {
+        const char *name;
+        void (*run)(Console &con);
+    } cases[] = {
+        { "%s",                [](Console &c) { c.printf("%s", "hello, world"); } },
+        { "%u",                [](Console &c) { c.printf("%u", 4000000000u); } },
+        { "%d (negative)",     [](Console &c) { c.printf("%d", -1234567); } },
+        { "%'u",               [](Console &c) { c.printf("%'u", 4000000000u); } },
+        { "%02x",              [](Console &c) { c.printf("%02x", 0xabu); } },
+        { "%08x",              [](Console &c) { c.printf("%08x", 0xdeadbeefu); } },
+        { "%12s",              [](Console &c) { c.printf("%12s", "README.TXT"); } },
+        { "%-12s",             [](Console &c) { c.printf("%-12s", "README.TXT"); } },
+        { "literal text",      [](Console &c) { c.printf("No such command\n"); } },
+        { "puts",              [](Console &c) { c.puts("No such command\n"); } },
+        { "dir line",          [](Console &c) { c.printf("%12s %'10u %s\n", "README.TXT", 123456u, "2016-01-01"); } },
+        { "time report line",  [](Console &c) { c.printf("store   %'u bytes read, %'u bytes written, %'u us waiting\n",
+                                                         1048576u, 0u, 52345u); } },
+    };
+
+    for (auto &c : cases) {
+        double ns = timeCalls([&] { c.run(con); });
+        printResult(c.name, ns, "ns/call");
+    }
+}
+
+static void benchQueue() {
+    // The UART receive buffer.
+    Queue<uint8_t, 256> queue;
+    volatile uint8_t    sink;
+
+    printf("queue\n");
+
+    double ns = timeCalls([&] {
+        queue += 'a';
+        sink = --queue;
+    });
+    printResult("push + pop, empty queue", ns, "ns/byte");
+
+    ns = timeCalls([&] {
+        for (int i = 0; i < 256; i++)
+            queue += (uint8_t)i;
+        while (queue.getLength())
+            sink = --queue;
+    });
+    printResult("fill + drain 256", ns / 256, "ns/byte");
+
+    ns = timeCalls([&] {
+        for (int i = 0; i < 300; i++)
+            queue += (uint8_t)i;
+        while (queue.getLength())
+            sink = --queue;
+    });
+    printResult("overfill by 44 + drain 256", ns / 300, "ns/push");
+
+    (void)sink;
+}
+
+/**
+ * \brief Types the same command line into the shell over and over.
+ *
+ * Once it has been typed `repeats` times, the time per command is
+ * printed and the process exits: the shell does not return.
+ */
+class ScriptConsole : public Console {
+
+    const char *name;
+    const char *line;
+    const char *next;
+    uint32_t    repeats;
+    uint32_t    typed = 0;
+    uint64_t    start = 0;
+    uint64_t    bytes = 0;
+
+public:
+    void putch(char) { bytes++; }
+
+    int getch(bool) {
+        if (!start)
+            start = now();
+
+        if (!*next) {
+            if (++typed == repeats) {
+                double ns = (double)(now() - start) / repeats;
+                printResult(name, ns, "ns/command");
+                printf("  %-36s %10.1f bytes/command\n", "", (double)bytes / repeats);
+                fflush(stdout);
+                _exit(0);
+            }
+            next = line;
+        }
+        return *next++;
+    }
+
+    ScriptConsole(const char *name_, const char *line_, uint32_t repeats_)
+        : name(name_), line(line_), next(line_), repeats(repeats_) { }
+};
+
+static void benchDispatch(MemoryStore &store) {
+    printf("command dispatch (line splitting, lookup, histfile check, prompt)\n");
+    fflush(stdout);
+
+    struct {
+        const char *name;
+        const char *line;
+    } cases[] = {
+        { "echo",                "echo hello\n" },
+        { "echo, 8 arguments",   "echo a b c d e f g h\n" },
+        { "unknown command",     "xyzzy\n" },
+        { "empty line",          "\n" },
+        { "pwd",                 "pwd\n" },
+        { "help",                "help\n" },
+    };
+
+    for (auto &c : cases) {
+        // runShell() never returns, run it in a process of its own.
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            exit(1);
+        }
+        if (!pid) {
+            FatFs     fs(&store);
+            FatVolume volume(&store);
+            MountTable mounts;
+            mounts.add("/", fs, volume);
+
+            ScriptConsole con(c.name, c.line, 20000);
+            Console *consoles[] = { &con };
+            runShell(consoles, 1, mounts);
+            _exit(1);
+        }
+        int status;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status))
+            printf("  %-36s %10s\n", c.name, "failed");
+    }
+}
+
+static void printRate(const char *name, uint32_t bytes, double ns) {
+    printResult(name, bytes / ns * 1000, "MB/s");
+}
+
+static void benchFatFile(FatVolume &volume, const char *path) {
+    static uint8_t buffer[64 * 1024];
+
+    const size_t chunks[] = { 100, 512, 4096, sizeof(buffer) };
+
+    for (size_t chunk : chunks) {
+        FatFile  file;
+        uint32_t size = 0;
+        bool     ok   = true;
+
+        double ns = timeCalls([&] {
+            if (file.open(volume, path)) {
+                ok = false;
+                return;
+            }
+            size = file.getSize();
+            size_t n;
+            do {
+                if (file.read(buffer, chunk, n)) {
+                    ok = false;
+                    return;
+                }
+            } while (n);
+        });
+
+        char name[64];
+        snprintf(name, sizeof(name), "%s, FatFile, %zu B reads", path, chunk);
+        if (ok)
+            printRate(name, size, ns);
+        else
+            printf("  %-36s %10s\n", name, "failed");
+    }
+}
+
+static void benchFsNode(Fs &fs, const char *path) {
+    static uint8_t buffer[4096];
+
+    uint32_t size = 0;
+    bool     ok   = true;
+
+    double ns = timeCalls([&] {
+        FsError err;
+        FsNode  node = fs.get(path, err);
+        if (err) {
+            ok = false;
+            return;
+        }
+        size = (uint32_t)node.getSize();
+        while (true) {
+            node.read(buffer, sizeof(buffer), err);
+            if (err == FS_EOF)
+                break;
+            if (err) {
+                ok = false;
+                return;
+            }
+        }
+    });
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s, MuStore, 4096 B reads", path);
+    if (ok)
+        printRate(name, size, ns);
+    else
+        printf("  %-36s %10s\n", name, "failed");
+}
+
+static void benchFiles(const char *title, BlockStore &store, const char *const *paths, size_t count) {
+    printf("file reads from %s\n", title);
+
+    FatVolume volume(&store);
+    FatFs     fs(&store);
+
+    for (size_t i = 0; i < count; i++) {
+        benchFatFile(volume, paths[i]);
+        benchFsNode(fs, paths[i]);
+    }
+}
+
+/// The contents of /GREP.TXT: 256 KiB of log lines, one in 1000 an error.
+/**
+ * Runs the shell's bench store and bench fs on a store.
+ *
+ * Timings come from the host cycle counter, scaled to the target clock,
+ * so these show the cost of the code above the store rather than of a card.
+ */
+static void benchCommands(const char *title, BlockStore &store, uint32_t kib) {
+    printf("bench store and bench fs on %s\n", title);
+    fflush(stdout);
+
+    FdConsole con(STDOUT_FILENO);
+    FatVolume volume(&store);
+    FatFs     fs(&store);
+
+    benchStore(con, volume, kib);
+    benchFs(con, fs, volume, kib);
+}
+
+static std::vector<char> makeText() {
+    std::vector<char> text;
+    char line[80];
+    for (unsigned i = 0; text.size() < 256 * 1024; i++) {
+        int length = snprintf(line, sizeof(line),
+                              i % 1000 == 999 ? "%06u sensor %u: ERROR reading out of range\n"
+                                              : "%06u sensor %u: reading %u ok\n",
+                              i, i % 16, i * 7 % 4096);
+        text.insert(text.end(), line, line + length);
+    }
+    text.resize(256 * 1024);
+    text.back() = '\n';
+    return text;
+}
+
+/// Hide a value from the optimizer, so that pure calls on it are not hoisted out of a loop.
+template<typename T>
+static T opaque(T value) {
+    asm volatile("" : "+r"(value));
+    return value;
+}
+
+static void benchGrep(FatVolume &volume, const std::vector<char> &text) {
+    const char    *data   = text.data();
+    const uint32_t length = (uint32_t)text.size();
+    const void *volatile sink;
+
+    printf("grep\n");
+
+    printRate("findChar, absent byte",
+              length, timeCalls([&] { sink = findChar(opaque(data), length, '#'); }));
+    printRate("memchr (libc), absent byte",
+              length, timeCalls([&] { sink = memchr(opaque(data), '#', length); }));
+    printRate("countChar, newlines",
+              length, timeCalls([&] { sink = (void*)countChar(opaque(data), length, '\n'); }));
+
+    Bmh shortPattern("zq");
+    Bmh longPattern("temperature out of range");
+    printRate("Bmh, absent 2-byte pattern",
+              length, timeCalls([&] { sink = shortPattern.find(opaque(data), length); }));
+    printRate("Bmh, absent 24-byte pattern",
+              length, timeCalls([&] { sink = longPattern.find(opaque(data), length); }));
+
+    static Lz4Reader lz4;
+
+    NullConsole con;
+    Bmh         pattern("ERROR");
+    GrepOptions options;
+    options.lineNumbers = true;
+
+    for (int countOnly = 0; countOnly < 2; countOnly++) {
+        options.countOnly = countOnly;
+        bool ok = true;
+
+        double ns = timeCalls([&] {
+            FileReader file(lz4);
+            FatError   err = file.open(volume, "/GREP.TXT");
+            if (!err)
+                grep(con, file, pattern, options, err);
+            if (err)
+                ok = false;
+        });
+
+        const char *name = countOnly ? "grep -c, /GREP.TXT" : "grep -n, /GREP.TXT";
+        if (ok)
+            printRate(name, length, ns);
+        else
+            printf("  %-36s %10s\n", name, "failed");
+    }
+
+    (void)sink;
+}
+
+/// Write the contents of a file created with createFile().
+static bool writeFile(FatVolume &volume, const FatVolume::DirEntry &entry, const void *data, uint32_t length) {
+    BlockStore       &store  = volume.getStore();
+    const uint8_t    *p      = (const uint8_t*)data;
+    uint32_t          blocks = length / FatVolume::sectorSize;
+    FatVolume::Cursor cursor { entry.cluster, 0 };
+
+    while (blocks) {
+        uint32_t lba;
+        uint32_t count;
+        if (volume.nextRun(cursor, blocks, lba, count) || !count)
+            return false;
+        if (store.seek(lba) || store.writeBlocks(p, count))
+            return false;
+        p      += count * FatVolume::sectorSize;
+        blocks -= count;
+    }
+    return true;
+}
+
+/**
+ * \brief Create the files read by the benchmarks on a fresh volume.
+ *
+ * /FRAG.DAT is spread over more fragments than FatFile keeps extents for.
+ */
+static bool makeVolume(MemoryStore &store, const std::vector<char> &text) {
+    FatVolume::DirEntry entry;
+
+    if (FatVolume::format(store, "BENCH"))
+        return false;
+
+    FatVolume volume(&store);
+    if (createFile(volume, "/BENCH.DAT", 4 * 1024 * 1024, entry))
+        return false;
+
+    // Leave single-cluster holes for the fragmented file to fill.
+    char path[16];
+    for (int i = 0; i < 48; i++) {
+        snprintf(path, sizeof(path), "/F%02d.DAT", i);
+        if (createFile(volume, path, volume.getClusterSize(), entry))
+            return false;
+    }
+    for (int i = 0; i < 48; i += 2) {
+        snprintf(path, sizeof(path), "/F%02d.DAT", i);
+        if (removeFile(volume, path))
+            return false;
+    }
+    if (createFile(volume, "/FRAG.DAT", 32 * volume.getClusterSize(), entry))
+        return false;
+
+    if (createFile(volume, "/GREP.TXT", (uint32_t)text.size(), entry)
+        || !writeFile(volume, entry, text.data(), (uint32_t)text.size()))
+        return false;
+
+    return !volume.flush();
+}
+
+static void usage() {
+    fprintf(stderr,
+            "usage: hostbench [IMAGE PATH]\n"
+            "\n"
+            "  IMAGE PATH  read the file at PATH in IMAGE instead of generated files\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    if (argc != 1 && argc != 3)
+        usage();
+
+    enableCycleCounter();
+
+    // An 8 MiB volume, for command dispatch and file reads.
+    std::vector<uint8_t> volumeData(8 * 1024 * 1024);
+    MemoryStore volumeStore(volumeData.data(), volumeData.size());
+    std::vector<char> text = makeText();
+    if (!makeVolume(volumeStore, text)) {
+        fprintf(stderr, "hostbench: could not create the test volume\n");
+        return 1;
+    }
+
+    benchPrintf();
+    benchQueue();
+    benchDispatch(volumeStore);
+
+    FatVolume grepVolume(&volumeStore);
+    benchGrep(grepVolume, text);
+
+    {
+        // A copy, so the scratch files do not move the files read below.
+        std::vector<uint8_t> copy(volumeData);
+        MemoryStore store(copy.data(), copy.size());
+        benchCommands("memory", store, 1024);
+    }
+
+    if (argc == 3) {
+        const char *paths[] = { argv[2] };
+
+        ImageStore image;
+        if (!image.open(argv[1], true))
+            return 1;
+        benchFiles(argv[1], image, paths, 1);
+
+        std::vector<uint8_t> data((size_t)image.getBlockCount() * image.getBlockSize());
+        if (image.seek(0) || image.readBlocks(data.data(), image.getBlockCount())) {
+            fprintf(stderr, "%s: read error\n", argv[1]);
+            return 1;
+        }
+        MemoryStore memory((const void*)data.data(), data.size());
+        benchFiles("memory", memory, paths, 1);
+
+    } else {
+        const char *paths[] = { "/BENCH.DAT", "/FRAG.DAT" };
+
+        benchFiles("memory", volumeStore, paths, 2);
+
+        // The same volume in a file, read through the page cache.
+        FILE *f = tmpfile();
+        if (!f || fwrite(volumeData.data(), 1, volumeData.size(), f) != volumeData.size() || fflush(f)) {
+            perror("tmpfile");
+            return 1;
+        }
+        ImageStore image(dup(fileno(f)), volumeData.size() / FatVolume::sectorSize, false);
+        fclose(f);
+        benchFiles("an image file", image, paths, 2);
+    }
+
+    return 0;
+}
@@ -0,0 +1,190 @@
+/**
+ * \file
+ * \brief     Consoles on terminals and pseudo-terminals, for host tools.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "console.hh"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+/// A millisecond clock, like the target's GetTickCount().
+inline uint32_t getTicks() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+/**
+ * \brief A console on a file descriptor.
+ *
+ * Output is buffered until input is requested. Bytes can be dropped or
+ * damaged on purpose, in both directions, to simulate a bad link.
+ */
+class FdConsole : public Console {
+
+    int inFd;
+    int outFd;
+
+    uint8_t out[4096];
+    size_t  outLength = 0;
+    uint8_t in[4096];
+    size_t  inPos    = 0;
+    size_t  inLength = 0;
+
+    /// \return false if the byte is to be dropped
+    bool damage(uint8_t &byte) {
+        if (!errorRate || (uint32_t)rand() % 1000000 >= errorRate)
+            return true;
+        errors++;
+        if (rand() % 2)
+            return false;
+        byte ^= (uint8_t)(1 << rand() % 8);
+        return true;
+    }
+
+public:
+    uint32_t errorRate = 0; ///< Damaged bytes per million.
+    uint32_t errors    = 0;
+    uint64_t bytesOut  = 0;
+    bool     eof       = false; ///< Set when the input is closed.
+
+    void flush() {
+        size_t done = 0;
+        while (done < outLength) {
+            ssize_t n = write(outFd, out + done, outLength - done);
+            if (n < 0) {
+                perror("write");
+                exit(1);
+            }
+            done += (size_t)n;
+        }
+        outLength = 0;
+    }
+
+    void putch(char ch) {
+        uint8_t byte = (uint8_t)ch;
+        bytesOut++;
+        if (!damage(byte))
+            return;
+        if (outLength == sizeof(out))
+            flush();
+        out[outLength++] = byte;
+    }
+
+    int getch(bool block = true) {
+        flush();
+
+        while (true) {
+            if (inPos == inLength) {
+                // Waiting a little instead of spinning is close enough
+                // to non-blocking here.
+                pollfd p { inFd, POLLIN, 0 };
+                if (poll(&p, 1, block ? -1 : 1) <= 0)
+                    return -1;
+
+                ssize_t n = read(inFd, in, sizeof(in));
+                if (n <= 0) {
+                    eof = true;
+                    return -1;
+                }
+                inPos    = 0;
+                inLength = (size_t)n;
+            }
+
+            uint8_t byte = in[inPos++];
+            if (damage(byte))
+                return byte;
+        }
+    }
+
+    FdConsole(int fd_) : inFd(fd_), outFd(fd_) { }
+    FdConsole(int inFd_, int outFd_) : inFd(inFd_), outFd(outFd_) { }
+    ~FdConsole() { flush(); }
+};
+
+/// Convert a baud rate to its termios constant.
+inline speed_t baudToSpeed(unsigned long baud) {
+    switch (baud) {
+    case 9600:   return B9600;
+    case 19200:  return B19200;
+    case 38400:  return B38400;
+    case 57600:  return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 921600: return B921600;
+    }
+    fprintf(stderr, "unsupported baud rate %lu\n", baud);
+    exit(1);
+}
+
+/// Put a terminal in raw mode, and set its speed unless it is 0.
+inline void makeRaw(int fd, speed_t speed) {
+    termios tio;
+    if (tcgetattr(fd, &tio)) {
+        perror("tcgetattr");
+        exit(1);
+    }
+    cfmakeraw(&tio);
+    if (speed) {
+        cfsetispeed(&tio, speed);
+        cfsetospeed(&tio, speed);
+    }
+    if (tcsetattr(fd, TCSANOW, &tio)) {
+        perror("tcsetattr");
+        exit(1);
+    }
+}
+
+/// Open a serial device in raw mode.
+inline int openTty(const char *path, speed_t speed) {
+    int fd = open(path, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        perror(path);
+        exit(1);
+    }
+    makeRaw(fd, speed);
+    return fd;
+}
+
+/// Open a pseudo-terminal pair, with the slave end in raw mode.
+inline void openPty(int &master, int &slave) {
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) || unlockpt(master)) {
+        perror("posix_openpt");
+        exit(1);
+    }
+    slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+    if (slave < 0) {
+        perror("ptsname");
+        exit(1);
+    }
+    // The line discipline would translate CR and LF and echo input.
+    makeRaw(slave, 0);
+}
@@ -0,0 +1,85 @@
+/**
+ * \file
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "sam.hh"
+#include "adcsource.hh"
+#include "memusage.hh"
+
+#include <cstdlib>
+#include <cstring>
+#include <time.h>
+
+static Pio            pioB;
+static DWT_Type       dwt;
+static CoreDebug_Type coreDebug;
+
+Pio            *const PIOB      = &pioB;
+DWT_Type       *const DWT       = &dwt;
+CoreDebug_Type *const CoreDebug = &coreDebug;
+
+uint32_t SystemCoreClock = 84000000;
+
+static uint64_t nanoseconds() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+HostCycleCounter::operator uint32_t() const {
+    return (uint32_t)(nanoseconds() * (SystemCoreClock / 1000000) / 1000) - offset;
+}
+
+HostCycleCounter &HostCycleCounter::operator=(uint32_t value) {
+    offset = 0;
+    offset = *this - value;
+    return *this;
+}
+
+uint32_t GetTickCount() {
+    return (uint32_t)(nanoseconds() / 1000000);
+}
+
+void Sleep(uint32_t ms) {
+    timespec ts { (time_t)(ms / 1000), (long)(ms % 1000) * 1000000 };
+    nanosleep(&ts, nullptr);
+}
+
+void hang() {
+    abort();
+}
+
+// Drivers without a host equivalent.
+
+AdcSource *AdcSource::instance = nullptr;
+
+bool AdcSource::start(Recorder &recorder_, uint32_t rate) {
+    (void)recorder_;
+    (void)rate;
+    return false;
+}
+
+void AdcSource::stop() { }
+
+MemoryUsage getMemoryUsage() {
+    // There is no memory map to report on.
+    MemoryUsage usage;
+    memset(&usage, 0, sizeof(usage));
+    return usage;
+}
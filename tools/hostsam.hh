@@ -0,0 +1,105 @@
+/**
+ * \file
+ * \brief     Host stand-ins for the parts of libsam and CMSIS used by portable code.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstdint>
+
+/**
+ * \name Registers
+ *
+ * Peripheral registers that code outside the drivers touches are plain
+ * memory here: writes are kept, nothing happens.
+ */
+///@{
+struct Pio {
+    volatile uint32_t PIO_SODR;
+    volatile uint32_t PIO_CODR;
+};
+
+extern Pio *const PIOB;
+
+static const uint32_t PIO_PB27 = 1u << 27;
+
+/**
+ * \brief Reads like the DWT cycle counter.
+ *
+ * Counts at SystemCoreClock, derived from the host's monotonic clock, so
+ * cycle counts convert to time the same way as on the target. It wraps
+ * after the same ~51 seconds too.
+ */
+class HostCycleCounter {
+    uint32_t offset = 0;
+
+public:
+    operator uint32_t() const;
+    HostCycleCounter &operator=(uint32_t value);
+};
+
+struct DWT_Type {
+    uint32_t         CTRL;
+    HostCycleCounter CYCCNT;
+};
+
+struct CoreDebug_Type {
+    uint32_t DEMCR;
+};
+
+extern DWT_Type       *const DWT;
+extern CoreDebug_Type *const CoreDebug;
+
+static const uint32_t DWT_CTRL_CYCCNTENA_Msk    = 1u;
+static const uint32_t CoreDebug_DEMCR_TRCENA_Msk = 1u << 24;
+///@}
+
+/**
+ * \name Interrupts
+ *
+ * There are none on the host, so there is nothing to enable or mask, and
+ * exclusive accesses always succeed.
+ */
+///@{
+typedef int IRQn_Type;
+
+static const IRQn_Type SysTick_IRQn   = -1;
+static const int       __NVIC_PRIO_BITS = 4;
+
+inline void NVIC_SetPriority(IRQn_Type, uint32_t) { }
+
+inline uint32_t __LDREXW(volatile uint32_t *address) {
+    return *address;
+}
+
+inline uint32_t __STREXW(uint32_t value, volatile uint32_t *address) {
+    *address = value;
+    return 0;
+}
+///@}
+
+extern "C" {
+    /// The target's clock frequency, which the cycle counter runs at.
+    extern uint32_t SystemCoreClock;
+
+    /// Milliseconds since startup.
+    uint32_t GetTickCount();
+
+    void Sleep(uint32_t ms);
+}
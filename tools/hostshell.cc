@@ -0,0 +1,207 @@
+/**
+ * \file
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Runs the shell on the host, on a disk image instead of an SD card, so
+ * that it can be debugged and profiled with host tools (gdb, perf,
+ * valgrind).
+ *
+ * By default the shell is on the terminal. With -p it is on a
+ * pseudo-terminal instead, which the other host tools (xfer, blkclient)
+ * can talk to as if it were the board's serial port.
+ */
+
+#include "shell.hh"
+#include "metacache.hh"
+#include "memorystore.hh"
+#include "hostcon.hh"
+#include "imagestore.hh"
+
+#include <mustore/fatfs.hh>
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace MuStore;
+
+/**
+ * \brief The shell's console on a terminal.
+ *
+ * Does what the UART driver and the terminal emulator do on the target:
+ * line endings are converted, and input is echoed. Ctrl-C, Ctrl-D or the
+ * end of the input quits.
+ */
+class TermConsole : public FdConsole {
+
+    bool echo;
+    char lastChar = '\0';
+
+public:
+    void putch(char ch) {
+        // Convert LF -> CRLF.
+        if (lastChar != '\r' && ch == '\n') {
+            FdConsole::putch('\r');
+            ioStats.consoleBytes++;
+        }
+
+        FdConsole::putch(ch);
+        lastChar = ch;
+        ioStats.consoleBytes++;
+    }
+
+    int getch(bool block = true) {
+        int c = FdConsole::getch(block);
+        if ((c < 0 && eof) || (echo && (c == 0x03 || c == 0x04))) {
+            flush();
+            exit(0);
+        }
+        if (c < 0 || !echo)
+            return c;
+
+        if (c == 0x7f)
+            c = '\b';
+        putch(c == '\r' ? '\n' : (char)c);
+        return c;
+    }
+
+    void clear() {
+        puts("\x1b[2J\x1b[1;1H");
+    }
+
+    TermConsole(int inFd_, int outFd_, bool echo_)
+        : FdConsole(inFd_, outFd_), echo(echo_) { }
+};
+
+static termios savedTermios;
+
+static void restoreTerminal() {
+    tcsetattr(STDIN_FILENO, TCSANOW, &savedTermios);
+}
+
+/// Read a whole file into memory.
+static bool readFile(const char *path, std::vector<uint8_t> &data) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    uint8_t buffer[4096];
+    size_t  n;
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+        data.insert(data.end(), buffer, buffer + n);
+    fclose(f);
+    return true;
+}
+
+static void usage() {
+    fprintf(stderr,
+            "usage: picus-host [-p] [-r] [-f FLASH_IMAGE] IMAGE\n"
+            "\n"
+            "  -p              run on a pseudo-terminal instead of the terminal\n"
+            "  -r              open IMAGE read-only\n"
+            "  -f FLASH_IMAGE  mount a read-only image (from mkfatimg) at /flash\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    bool        pty        = false;
+    bool        readOnly   = false;
+    const char *flashImage = nullptr;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "prf:")) != -1) {
+        switch (opt) {
+        case 'p': pty        = true;   break;
+        case 'r': readOnly   = true;   break;
+        case 'f': flashImage = optarg; break;
+        default:  usage();
+        }
+    }
+    if (optind != argc - 1)
+        usage();
+
+    enableCycleCounter();
+
+    ImageStore image;
+    if (!image.open(argv[optind], readOnly))
+        return 1;
+
+    MetaCache cache(&image);
+    FatFs     fs(&cache);
+    FatVolume volume(&cache);
+
+    // Keep the FAT and root directory in RAM, like on the target.
+    cache.pin(volume);
+
+    if (fs.getFsSubType() == FatFs::SubType::NONE) {
+        fprintf(stderr, "%s: no FAT filesystem found\n", argv[optind]);
+        return 1;
+    }
+
+    MountTable mounts;
+    mounts.add("/", fs, volume);
+
+    // The same RAM disk as on the target.
+    static uint8_t ramDisk[16 * 1024];
+    MemoryStore ramStore(ramDisk, sizeof(ramDisk));
+    FatVolume::format(ramStore, "RAMDISK");
+    FatFs     ramFs(&ramStore);
+    FatVolume ramVolume(&ramStore);
+    if (ramFs.getFsSubType() != FatFs::SubType::NONE)
+        mounts.add("/ram", ramFs, ramVolume);
+
+    std::vector<uint8_t> flashData;
+    if (flashImage && !readFile(flashImage, flashData))
+        return 1;
+    MemoryStore flashStore((const void*)flashData.data(), flashData.size());
+    FatFs       flashFs(&flashStore);
+    FatVolume   flashVolume(&flashStore);
+    if (flashImage && flashFs.getFsSubType() != FatFs::SubType::NONE)
+        mounts.add("/flash", flashFs, flashVolume);
+
+    int inFd  = STDIN_FILENO;
+    int outFd = STDOUT_FILENO;
+    if (pty) {
+        // The slave end stays open, so that clients can come and go.
+        int slave;
+        openPty(inFd, slave);
+        outFd = inFd;
+        fprintf(stderr, "picus-host: shell on %s\n", ptsname(inFd));
+    } else if (isatty(STDIN_FILENO)) {
+        tcgetattr(STDIN_FILENO, &savedTermios);
+        atexit(restoreTerminal);
+        makeRaw(STDIN_FILENO, 0);
+    }
+
+    TermConsole con(inFd, outFd, !pty && isatty(STDIN_FILENO));
+    Console    *consoles[] = { &con };
+
+    con.printf("Found FAT%d filesystem `%s' in %s\n\n",
+               (fs.getFsSubType() == FatFs::SubType::FAT12 ? 12 :
+                fs.getFsSubType() == FatFs::SubType::FAT16 ? 16 : 32),
+               fs.getVolumeLabel(),
+               argv[optind]);
+
+    runShell(consoles, 1, mounts);
+
+    return 1;
+}
@@ -0,0 +1,140 @@
+/**
+ * \file
+ * \brief     A block store on a disk image file, for host tools.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "blockstore.hh"
+#include "cpustats.hh"
+#include "iostats.hh"
+
+#include <cstdio>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * \brief A block store on a disk image file, such as a copy of an SD card.
+ *
+ * Transfers are counted in ioStats like the SD card driver's, with the
+ * time spent in system calls counted as waiting for the store.
+ */
+class ImageStore : public BlockStore {
+
+    int  fd       = -1;
+    bool writable = false;
+
+    MuStore::StoreError transfer(void *buffer, size_t count, bool writing) {
+        if (pos + count > blockCount)
+            return MuStore::STORE_ERR_OUT_OF_BOUNDS;
+        if (writing && !writable)
+            return MuStore::STORE_ERR_IO;
+
+        CycleTimer timer;
+        uint8_t   *p      = (uint8_t*)buffer;
+        size_t     length = count * blockSize;
+        off_t      offset = (off_t)(pos * blockSize);
+        while (length) {
+            ssize_t n = writing ? pwrite(fd, p, length, offset)
+                              : pread (fd, p, length, offset);
+            if (n <= 0)
+                return MuStore::STORE_ERR_IO;
+            p      += n;
+            offset += n;
+            length -= (size_t)n;
+        }
+        ioStats.storeWaitCycles += timer.elapsed();
+
+        if (writing)
+            ioStats.storeBytesWritten += (uint32_t)(count * blockSize);
+        else
+            ioStats.storeBytesRead    += (uint32_t)(count * blockSize);
+        pos += count;
+
+        return MuStore::STORE_ERR_OK;
+    }
+
+public:
+    MuStore::StoreError seek(size_t lba) {
+        if (lba >= blockCount)
+            return MuStore::STORE_ERR_OUT_OF_BOUNDS;
+        pos = lba;
+        return MuStore::STORE_ERR_OK;
+    }
+
+    MuStore::StoreError read(void *buffer) {
+        return transfer(buffer, 1, false);
+    }
+
+    MuStore::StoreError write(const void *buffer) {
+        return transfer((void*)buffer, 1, true);
+    }
+
+    MuStore::StoreError readBlocks(void *buffer, size_t count) {
+        return transfer(buffer, count, false);
+    }
+
+    MuStore::StoreError writeBlocks(const void *buffer, size_t count) {
+        return transfer((void*)buffer, count, true);
+    }
+
+    using Store::read;
+    using Store::write;
+
+    /**
+     * \brief Open an image. A trailing partial block is ignored.
+     *
+     * \return false if the file cannot be opened
+     */
+    bool open(const char *path, bool readOnly = false) {
+        fd = ::open(path, readOnly ? O_RDONLY : O_RDWR);
+        if (fd < 0) {
+            perror(path);
+            return false;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st)) {
+            perror(path);
+            return false;
+        }
+
+        writable   = !readOnly;
+        blockSize  = 512;
+        blockCount = (size_t)st.st_size / blockSize;
+        pos        = 0;
+
+        return true;
+    }
+
+    /// Use an open file descriptor, e.g. of a temporary file. It is closed with the store.
+    ImageStore(int fd_, size_t blocks, bool writable_ = true)
+        : fd(fd_), writable(writable_) {
+        blockSize  = 512;
+        blockCount = blocks;
+    }
+
+    ImageStore() = default;
+    ~ImageStore() {
+        if (fd >= 0)
+            close(fd);
+    }
+};
@@ -0,0 +1,606 @@
+/**
+ * \file
+ * \brief     Build a FAT image for the flash mount from a directory tree.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Every file and directory gets a single contiguous cluster run. Hot files
+ * given with -H are placed first, in the given order, followed by the
+ * directory tables and then all other files in directory order.
+ *
+ * The reserved sectors after the boot sector hold an extent manifest:
+ *
+ *   "PCXT", uint32 count
+ *   count times: uint32 first cluster, uint32 sector count | flags
+ *
+ * sorted by first cluster, with every field little-endian. The firmware
+ * uses it to map files without walking their cluster chains.
+ *
+ * With -z, other files of at least 1 KiB are stored as LZ4 frames when that
+ * saves an eighth of their size or more. They keep their names; the top
+ * bit of their manifest sector count marks them as compressed, and the
+ * shell decompresses them on the fly. Other systems see the frames as
+ * stored. Matches are kept within the last 4 KiB, the firmware's
+ * decompression window.
+ */
+
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const uint32_t sectorSize    = 512;
+static const uint32_t dirEntrySize  = 32;
+static const uint32_t fatCount      = 2;
+static const uint32_t manifestEntry = 8;
+static const uint32_t manifestLz4   = 0x80000000; ///< FatVolume::extentLz4.
+
+static const uint32_t lz4Window     = 4096; ///< Lz4Reader::windowSize.
+static const uint32_t lz4BlockSize  = 64 * 1024;
+static const uint32_t lz4MinSize    = 1024;
+
+struct Node {
+    std::string       path;      ///< Relative to the source directory.
+    char              name[11];
+    bool              directory;
+    uint32_t          size;      ///< Bytes for files, table size for directories.
+    std::vector<uint8_t> data;   ///< File contents as stored.
+    bool              compressed;
+    uint32_t          cluster;
+    uint32_t          clusters;
+    int               parent;    ///< Index of the parent directory, -1 for the root.
+    std::vector<int>  children;
+};
+
+static std::vector<Node> nodes;
+
+static void die(const char *fmt, const char *arg = "") {
+    fprintf(stderr, "mkfatimg: ");
+    fprintf(stderr, fmt, arg);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+static void put16(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v);
+    p[1] = (uint8_t)(v >> 8);
+}
+static void put32(uint8_t *p, uint32_t v) {
+    put16(p,     v);
+    put16(p + 2, v >> 16);
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint32_t rotl(uint32_t v, int n) {
+    return v << n | v >> (32 - n);
+}
+
+/// XXH32 of a short buffer (< 16 bytes), for the LZ4 header checksum.
+static uint32_t xxh32Short(const uint8_t *p, size_t length) {
+    const uint32_t prime1 = 2654435761u, prime2 = 2246822519u, prime3 = 3266489917u;
+    const uint32_t prime4 = 668265263u,  prime5 = 374761393u;
+
+    uint32_t h = prime5 + (uint32_t)length;
+    size_t   i = 0;
+    for (; i + 4 <= length; i += 4)
+        h = rotl(h + get32(p + i) * prime3, 17) * prime4;
+    for (; i < length; i++)
+        h = rotl(h + p[i] * prime5, 11) * prime1;
+
+    h ^= h >> 15; h *= prime2;
+    h ^= h >> 13; h *= prime3;
+    h ^= h >> 16;
+
+    return h;
+}
+
+static void lz4Length(std::vector<uint8_t> &out, size_t length) {
+    for (; length >= 255; length -= 255)
+        out.push_back(255);
+    out.push_back((uint8_t)length);
+}
+
+static void lz4Sequence(std::vector<uint8_t> &out, const uint8_t *literals, size_t literalCount,
+                        uint32_t offset, size_t matchLength) {
+    size_t matchCode = matchLength ? matchLength - 4 : 0;
+
+    out.push_back((uint8_t)((literalCount < 15 ? literalCount : 15) << 4
+                            | (matchCode < 15 ? matchCode : 15)));
+    if (literalCount >= 15)
+        lz4Length(out, literalCount - 15);
+    out.insert(out.end(), literals, literals + literalCount);
+
+    if (matchLength) {
+        out.push_back((uint8_t)offset);
+        out.push_back((uint8_t)(offset >> 8));
+        if (matchCode >= 15)
+            lz4Length(out, matchCode - 15);
+    }
+}
+
+/// Greedy LZ4 block compression with a single-entry hash table.
+static std::vector<uint8_t> lz4Block(const uint8_t *src, size_t length) {
+    // Format rules: the last 5 bytes are literals, and the last match
+    // starts at least 12 bytes before the end of the block.
+    const size_t lastLiterals = 5;
+    const size_t matchLimit   = 12;
+    const int    hashBits     = 12;
+
+    std::vector<uint8_t> out;
+    std::vector<int32_t> table((size_t)1 << hashBits, -1);
+
+    size_t anchor = 0;
+    size_t i      = 0;
+
+    while (i + matchLimit <= length) {
+        uint32_t sequence  = get32(src + i);
+        uint32_t hash      = (sequence * 2654435761u) >> (32 - hashBits);
+        int32_t  candidate = table[hash];
+        table[hash] = (int32_t)i;
+
+        if (candidate < 0 || i - candidate > lz4Window || get32(src + candidate) != sequence) {
+            i++;
+            continue;
+        }
+
+        size_t matchLength = 4;
+        while (i + matchLength < length - lastLiterals
+               && src[candidate + matchLength] == src[i + matchLength])
+            matchLength++;
+
+        lz4Sequence(out, src + anchor, i - anchor, (uint32_t)(i - candidate), matchLength);
+        i     += matchLength;
+        anchor = i;
+    }
+    lz4Sequence(out, src + anchor, length - anchor, 0, 0);
+
+    return out;
+}
+
+/// Compress into an LZ4 frame with independent blocks and the content size.
+static std::vector<uint8_t> lz4Frame(const std::vector<uint8_t> &in) {
+    std::vector<uint8_t> out(4 + 10 + 1);
+
+    put32(&out[0], 0x184d2204);
+    out[4] = 0x68; // Version 01, independent blocks, content size present.
+    out[5] = 0x40; // 64 KiB maximum block size.
+    put32(&out[6],  (uint32_t)in.size());
+    put32(&out[10], 0);
+    out[14] = (uint8_t)(xxh32Short(&out[4], 10) >> 8);
+
+    for (size_t start = 0; start < in.size(); start += lz4BlockSize) {
+        size_t length = std::min((size_t)lz4BlockSize, in.size() - start);
+        std::vector<uint8_t> block = lz4Block(&in[start], length);
+
+        uint8_t header[4];
+        if (block.size() < length) {
+            put32(header, (uint32_t)block.size());
+            out.insert(out.end(), header, header + 4);
+            out.insert(out.end(), block.begin(), block.end());
+        } else {
+            put32(header, (uint32_t)length | 0x80000000);
+            out.insert(out.end(), header, header + 4);
+            out.insert(out.end(), in.begin() + start, in.begin() + start + length);
+        }
+    }
+
+    uint8_t endMark[4] = { };
+    out.insert(out.end(), endMark, endMark + 4);
+
+    return out;
+}
+
+/// Convert a file name to its space-padded 8.3 form.
+static bool toShortName(const char *name, char shortName[11]) {
+    memset(shortName, ' ', 11);
+
+    size_t i     = 0;
+    size_t limit = 8;
+    bool   inExt = false;
+
+    for (const char *p = name; *p; p++) {
+        char c = *p;
+        if (c == '.') {
+            if (inExt || !i)
+                return false;
+            inExt = true;
+            i     = 8;
+            limit = 11;
+            continue;
+        }
+        if (i >= limit)
+            return false;
+        if ((uint8_t)c < 0x20 || (uint8_t)c > 0x7e || strchr(" \"*+,/:;<=>?[\\]|", c))
+            return false;
+        if (c >= 'a' && c <= 'z')
+            c = (char)(c - 'a' + 'A');
+
+        shortName[i++] = c;
+    }
+
+    return i > 0;
+}
+
+static void scan(const std::string &root, int dir) {
+    std::string path = root + (nodes[dir].path.empty() ? "" : "/" + nodes[dir].path);
+
+    DIR *d = opendir(path.c_str());
+    if (!d)
+        die("cannot open directory %s", path.c_str());
+
+    std::vector<std::string> names;
+    while (dirent *e = readdir(d)) {
+        if (e->d_name[0] != '.')
+            names.push_back(e->d_name);
+    }
+    closedir(d);
+
+    std::sort(names.begin(), names.end());
+
+    for (auto &name : names) {
+        Node node;
+        node.path       = nodes[dir].path.empty() ? name : nodes[dir].path + "/" + name;
+        node.parent     = dir;
+        node.cluster    = 0;
+        node.clusters   = 0;
+        node.compressed = false;
+
+        if (!toShortName(name.c_str(), node.name)) {
+            fprintf(stderr, "mkfatimg: skipping %s, not a valid 8.3 name\n", node.path.c_str());
+            continue;
+        }
+        for (int sibling : nodes[dir].children) {
+            if (!memcmp(nodes[sibling].name, node.name, 11))
+                die("duplicate name %s", node.path.c_str());
+        }
+
+        struct stat st;
+        if (stat((root + "/" + node.path).c_str(), &st))
+            die("cannot stat %s", node.path.c_str());
+
+        node.directory = S_ISDIR(st.st_mode);
+        node.size      = node.directory ? 0 : (uint32_t)st.st_size;
+
+        nodes.push_back(node);
+        int index = (int)nodes.size() - 1;
+        nodes[dir].children.push_back(index);
+
+        if (node.directory)
+            scan(root, index);
+    }
+}
+
+static void usage() {
+    fprintf(stderr,
+            "usage: mkfatimg [-l LABEL] [-s KIB] [-H HOTFILE]... [-m MANIFEST] [-z] DIR IMAGE\n"
+            "\n"
+            "  -l LABEL     volume label\n"
+            "  -s KIB       minimum image size\n"
+            "  -H HOTFILE   place this file (relative to DIR) first, may be repeated\n"
+            "  -m MANIFEST  write a readable list of file extents\n"
+            "  -z           store compressible files (except hot files) as LZ4 frames\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    const char *label        = "PICUS";
+    const char *manifestPath = nullptr;
+    uint32_t    minKib       = 0;
+    bool        compress     = false;
+    std::vector<std::string> hot;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "l:s:H:m:z")) != -1) {
+        switch (opt) {
+        case 'l': label        = optarg;                        break;
+        case 's': minKib       = (uint32_t)strtoul(optarg, nullptr, 0); break;
+        case 'H': hot.push_back(optarg);                        break;
+        case 'm': manifestPath = optarg;                        break;
+        case 'z': compress     = true;                          break;
+        default:  usage();
+        }
+    }
+    if (argc - optind != 2)
+        usage();
+
+    std::string source = argv[optind];
+    const char *output = argv[optind + 1];
+
+    Node root;
+    root.directory  = true;
+    root.parent     = -1;
+    root.size       = 0;
+    root.cluster    = 0;
+    root.clusters   = 0;
+    root.compressed = false;
+    memset(root.name, ' ', 11);
+    nodes.push_back(root);
+
+    scan(source, 0);
+
+    // Directory tables: '.' and '..' plus one entry per child.
+    for (auto &node : nodes) {
+        if (node.directory && node.parent >= 0)
+            node.size = (uint32_t)(2 + node.children.size()) * dirEntrySize;
+    }
+
+    // Decide the allocation order.
+    std::vector<int> order;
+    std::vector<bool> placed(nodes.size(), false);
+
+    for (auto &path : hot) {
+        auto it = std::find_if(nodes.begin(), nodes.end(),
+                               [&](const Node &n) { return n.path == path && !n.directory; });
+        if (it == nodes.end()) {
+            fprintf(stderr, "mkfatimg: hot file %s not found, ignored\n", path.c_str());
+            continue;
+        }
+        int i = (int)(it - nodes.begin());
+        if (!placed[i]) {
+            order.push_back(i);
+            placed[i] = true;
+        }
+    }
+    for (size_t i = 1; i < nodes.size(); i++) {
+        if (nodes[i].directory) {
+            order.push_back((int)i);
+            placed[i] = true;
+        }
+    }
+    for (size_t i = 1; i < nodes.size(); i++) {
+        if (!placed[i])
+            order.push_back((int)i);
+    }
+
+    // Load file contents, compressing where worthwhile.
+    uint32_t originalBytes   = 0;
+    uint32_t compressedBytes = 0;
+    uint32_t compressedFiles = 0;
+
+    for (size_t i = 1; i < nodes.size(); i++) {
+        Node &node = nodes[i];
+        if (node.directory)
+            continue;
+
+        node.data.resize(node.size);
+        FILE *f = fopen((source + "/" + node.path).c_str(), "rb");
+        if (!f || fread(node.data.data(), 1, node.size, f) != node.size)
+            die("cannot read %s", node.path.c_str());
+        fclose(f);
+
+        bool isHot = std::find(hot.begin(), hot.end(), node.path) != hot.end();
+        if (!compress || isHot || node.size < lz4MinSize || !memcmp(node.name + 8, "LZ4", 3))
+            continue;
+
+        std::vector<uint8_t> frame = lz4Frame(node.data);
+        if (frame.size() > node.size - node.size / 8)
+            continue;
+
+        originalBytes   += node.size;
+        compressedBytes += (uint32_t)frame.size();
+        compressedFiles++;
+
+        node.compressed = true;
+        node.data       = frame;
+        node.size = (uint32_t)frame.size();
+    }
+
+    // Work out the geometry, with one sector per cluster.
+    uint32_t dataClusters = 0;
+    uint32_t files        = 0;
+    for (int i : order) {
+        Node &node = nodes[i];
+        node.clusters = (node.size + sectorSize - 1) / sectorSize;
+        if (node.clusters) {
+            node.cluster  = 2 + dataClusters;
+            dataClusters += node.clusters;
+            if (!node.directory)
+                files++;
+        }
+    }
+
+    uint32_t rootEntries = (uint32_t)nodes[0].children.size() + 1; // Plus the label.
+    rootEntries = (rootEntries + 15) / 16 * 16;
+    if (rootEntries < 64)
+        rootEntries = 64;
+    uint32_t rootSectors = rootEntries * dirEntrySize / sectorSize;
+
+    uint32_t reserved = 1 + (8 + files * manifestEntry + sectorSize - 1) / sectorSize;
+
+    uint32_t minSectors = minKib * 1024 / sectorSize;
+    uint32_t clusters   = dataClusters;
+    uint32_t fatSectors = 0;
+    uint32_t total      = 0;
+    bool     fat16      = false;
+
+    // The FAT size depends on the cluster count, which (when padding to a
+    // minimum size) depends on the FAT size. Iterate until stable.
+    for (int pass = 0; pass < 8; pass++) {
+        fat16      = clusters >= 4085;
+        uint32_t fatBytes = fat16 ? (clusters + 2) * 2 : ((clusters + 2) * 3 + 1) / 2;
+        fatSectors = (fatBytes + sectorSize - 1) / sectorSize;
+        total      = reserved + fatCount * fatSectors + rootSectors + clusters;
+        if (total >= minSectors)
+            break;
+        clusters += minSectors - total;
+    }
+    if (clusters >= 65525)
+        die("image too large%s", "");
+
+    uint32_t fatLba  = reserved;
+    uint32_t rootLba = fatLba + fatCount * fatSectors;
+    uint32_t dataLba = rootLba + rootSectors;
+
+    std::vector<uint8_t> image((size_t)total * sectorSize, 0);
+    auto sectorAt = [&](uint32_t lba) { return &image[(size_t)lba * sectorSize]; };
+
+    // Boot sector.
+    uint8_t *boot = sectorAt(0);
+    memcpy(boot, "\xeb\x3c\x90PICUS   ", 11);
+    put16(boot + 11, sectorSize);
+    boot[13] = 1;
+    put16(boot + 14, reserved);
+    boot[16] = (uint8_t)fatCount;
+    put16(boot + 17, rootEntries);
+    if (total <= 0xffff)
+        put16(boot + 19, total);
+    else
+        put32(boot + 32, total);
+    boot[21] = 0xf8;
+    put16(boot + 22, fatSectors);
+    put16(boot + 24, 1);
+    put16(boot + 26, 1);
+    boot[36] = 0x80;
+    boot[38] = 0x29;
+    put32(boot + 39, 0x50494355);
+    char labelName[11];
+    memset(labelName, ' ', 11);
+    for (size_t i = 0; i < 11 && label[i]; i++)
+        labelName[i] = (char)toupper((unsigned char)label[i]);
+    memcpy(boot + 43, labelName, 11);
+    memcpy(boot + 54, fat16 ? "FAT16   " : "FAT12   ", 8);
+    put16(boot + 510, 0xaa55);
+
+    // FAT.
+    std::vector<uint32_t> fat(clusters + 2, 0);
+    uint32_t eoc = fat16 ? 0xffff : 0xfff;
+    fat[0] = fat16 ? 0xfff8 : 0xff8;
+    fat[1] = eoc;
+    for (auto &node : nodes) {
+        for (uint32_t i = 0; i < node.clusters; i++)
+            fat[node.cluster + i] = i + 1 == node.clusters ? eoc : node.cluster + i + 1;
+    }
+    for (uint32_t copy = 0; copy < fatCount; copy++) {
+        uint8_t *p = sectorAt(fatLba + copy * fatSectors);
+        for (uint32_t c = 0; c < fat.size(); c++) {
+            if (fat16) {
+                put16(p + c * 2, fat[c]);
+            } else {
+                uint32_t offset = c + c / 2;
+                if (c & 1) {
+                    p[offset]     = (uint8_t)((p[offset] & 0x0f) | (fat[c] << 4));
+                    p[offset + 1] = (uint8_t)(fat[c] >> 4);
+                } else {
+                    p[offset]     = (uint8_t)fat[c];
+                    p[offset + 1] = (uint8_t)((p[offset + 1] & 0xf0) | ((fat[c] >> 8) & 0x0f));
+                }
+            }
+        }
+    }
+
+    // Directory tables.
+    auto writeEntry = [&](uint8_t *p, const char name[11], uint8_t attributes,
+                          uint32_t cluster, uint32_t size) {
+        memcpy(p, name, 11);
+        p[11] = attributes;
+        put16(p + 26, cluster);
+        put32(p + 28, size);
+    };
+
+    for (size_t i = 0; i < nodes.size(); i++) {
+        Node &dir = nodes[i];
+        if (!dir.directory)
+            continue;
+
+        uint8_t *p = i ? sectorAt(dataLba + dir.cluster - 2) : sectorAt(rootLba);
+        if (!i) {
+            writeEntry(p, labelName, 0x08, 0, 0);
+        } else {
+            uint32_t parentCluster = dir.parent > 0 ? nodes[dir.parent].cluster : 0;
+            writeEntry(p,                ".          ", 0x10, dir.cluster,   0);
+            writeEntry(p + dirEntrySize, "..         ", 0x10, parentCluster, 0);
+        }
+        p += (i ? 2 : 1) * dirEntrySize;
+
+        for (int c : dir.children) {
+            Node &child = nodes[c];
+            writeEntry(p, child.name, child.directory ? 0x10 : 0x20,
+                       child.cluster, child.directory ? 0 : child.size);
+            p += dirEntrySize;
+        }
+    }
+
+    // File contents.
+    for (auto &node : nodes) {
+        if (!node.directory && node.size)
+            memcpy(sectorAt(dataLba + node.cluster - 2), node.data.data(), node.size);
+    }
+
+    // Extent manifest, sorted by cluster as allocated.
+    std::vector<int> byCluster;
+    for (size_t i = 1; i < nodes.size(); i++) {
+        if (!nodes[i].directory && nodes[i].clusters)
+            byCluster.push_back((int)i);
+    }
+    std::sort(byCluster.begin(), byCluster.end(),
+              [](int a, int b) { return nodes[a].cluster < nodes[b].cluster; });
+
+    uint8_t *manifest = sectorAt(1);
+    memcpy(manifest, "PCXT", 4);
+    put32(manifest + 4, (uint32_t)byCluster.size());
+    for (size_t i = 0; i < byCluster.size(); i++) {
+        put32(manifest + 8 + i * manifestEntry,     nodes[byCluster[i]].cluster);
+        put32(manifest + 8 + i * manifestEntry + 4, nodes[byCluster[i]].clusters
+                                                    | (nodes[byCluster[i]].compressed ? manifestLz4 : 0));
+    }
+
+    FILE *out = fopen(output, "wb");
+    if (!out || fwrite(image.data(), 1, image.size(), out) != image.size())
+        die("cannot write %s", output);
+    fclose(out);
+
+    if (manifestPath) {
+        FILE *m = fopen(manifestPath, "w");
+        if (!m)
+            die("cannot write %s", manifestPath);
+        fprintf(m, "# path cluster lba sectors bytes [lz4]\n");
+        for (int i : order) {
+            const Node &node = nodes[i];
+            fprintf(m, "%s%s %u %u %u %u%s\n",
+                    node.path.c_str(), node.directory ? "/" : "",
+                    node.cluster,
+                    node.clusters ? dataLba + node.cluster - 2 : 0,
+                    node.clusters,
+                    node.size,
+                    node.compressed ? " lz4" : "");
+        }
+        fclose(m);
+    }
+
+    printf("mkfatimg: %s: FAT%d, %u KiB, %zu files and directories\n",
+           output, fat16 ? 16 : 12, total * sectorSize / 1024, nodes.size() - 1);
+    if (compressedFiles)
+        printf("mkfatimg: compressed %u files, %u -> %u bytes (%u%%)\n",
+               compressedFiles, originalBytes, compressedBytes,
+               (uint32_t)((uint64_t)compressedBytes * 100 / originalBytes));
+
+    return 0;
+}
@@ -0,0 +1,118 @@
+/**
+ * \file
+ * \brief     Symbol table generator for the profiler.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Reads the output of `nm -n -S -C --defined-only` for the firmware on
+ * standard input and writes a C++ source file defining profSymbols and
+ * profSymbolCount (see src/profiler.hh) on standard output.
+ *
+ * Only code symbols with a size are kept. Argument lists are stripped from
+ * the demangled names to keep the table small. Of symbols sharing an
+ * address, such as the weak aliases of the default interrupt handler, only
+ * the first is kept. Empty input gives an empty table, which is linked into
+ * the first build of the firmware.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+struct Symbol {
+    uint32_t    start;
+    uint32_t    size;
+    std::string name;
+};
+
+/// Cut a demangled name before its argument list, keeping "operator()".
+static std::string baseName(const char *name) {
+    std::string s(name);
+
+    size_t from = s.find("operator()");
+    from = from == std::string::npos ? 0 : from + strlen("operator()");
+
+    size_t paren = s.find('(', from);
+    if (paren != std::string::npos && paren > 0)
+        s.erase(paren);
+
+    return s;
+}
+
+static std::string escape(const std::string &s) {
+    std::string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        out += c;
+    }
+    return out;
+}
+
+int main(int argc, char **argv) {
+    (void)argv;
+    if (argc != 1) {
+        fprintf(stderr, "usage: nm -n -S -C --defined-only FIRMWARE | mksymtab > SOURCE\n");
+        return 1;
+    }
+
+    std::vector<Symbol> symbols;
+    char line[4096];
+
+    while (fgets(line, sizeof(line), stdin)) {
+        line[strcspn(line, "\n")] = '\0';
+
+        // "address size type name", symbols without a size lack the second field.
+        unsigned long start;
+        unsigned long size;
+        char type;
+        int  nameOffset;
+        if (sscanf(line, "%lx %lx %c %n", &start, &size, &type, &nameOffset) != 3)
+            continue;
+        if (!strchr("tTwW", type) || !size)
+            continue;
+
+        // Clear the Thumb bit.
+        symbols.push_back(Symbol { (uint32_t)start & ~1u, (uint32_t)size, baseName(line + nameOffset) });
+    }
+
+    std::stable_sort(symbols.begin(), symbols.end(),
+                     [](const Symbol &a, const Symbol &b) { return a.start < b.start; });
+    symbols.erase(std::unique(symbols.begin(), symbols.end(),
+                              [](const Symbol &a, const Symbol &b) { return a.start == b.start; }),
+                  symbols.end());
+
+    printf("// Generated by mksymtab, do not edit.\n");
+    printf("#include \"profiler.hh\"\n\n");
+    printf("const ProfSymbol profSymbols[] = {\n");
+    for (const Symbol &symbol : symbols)
+        printf("    { 0x%08xu, %uu, \"%s\" },\n", symbol.start, symbol.size, escape(symbol.name).c_str());
+    // Zero-length arrays are not allowed.
+    if (symbols.empty())
+        printf("    { 0, 0, \"\" },\n");
+    printf("};\n\n");
+    printf("const size_t profSymbolCount = %zu;\n", symbols.size());
+
+    return 0;
+}
@@ -0,0 +1,188 @@
+/**
+ * \file
+ * \brief     Exercise the recorder against a store in memory.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Records the synthetic counter source into a MemoryStore behind a
+ * wrapper that can stall writes, like a card busy with internal
+ * housekeeping. Each recording is checked: samples must count up within
+ * a buffer, and the gaps between buffers must add up to the dropped
+ * buffers the recorder reported.
+ *
+ * Scenarios: a store that keeps up easily, stalls the buffers can absorb,
+ * stalls they cannot, a store too slow for the rate, and stopping early.
+ */
+
+#include "recorder.hh"
+#include "memorystore.hh"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <time.h>
+#include <unistd.h>
+
+using namespace MuStore;
+
+static uint32_t getTicks() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+/// Delays writes: every write by `delay` ms, every `stallEvery`th by `stall` ms.
+class SlowStore : public BlockStore {
+
+    MemoryStore &store;
+    uint32_t     writes = 0;
+
+public:
+    uint32_t delay      = 0;
+    uint32_t stall      = 0;
+    uint32_t stallEvery = 0;
+
+    StoreError seek(size_t lba) { return store.seek(lba); }
+
+    StoreError read (void *buffer)       { return store.read(buffer); }
+    StoreError write(const void *buffer) { return writeBlocks(buffer, 1); }
+
+    StoreError readBlocks(void *buffer, size_t count) { return store.readBlocks(buffer, count); }
+
+    StoreError writeBlocks(const void *buffer, size_t count) {
+        uint32_t ms = delay;
+        if (stallEvery && ++writes % stallEvery == 0)
+            ms += stall;
+        if (ms)
+            usleep(ms * 1000);
+        return store.writeBlocks(buffer, count);
+    }
+
+    SlowStore(MemoryStore &store_) : store(store_) {
+        blockSize  = store.getBlockSize();
+        blockCount = store.getBlockCount();
+    }
+};
+
+/// Check a recording against the number of dropped buffers.
+static bool verify(const uint16_t *samples, uint32_t count, uint32_t dropped) {
+    uint32_t missing = 0;
+
+    for (uint32_t i = 1; i < count; i++) {
+        uint16_t gap = (uint16_t)(samples[i] - samples[i - 1] - 1);
+        if (!gap)
+            continue;
+        if (i % Recorder::bufferSamples || gap % Recorder::bufferSamples) {
+            printf("recsim: unexpected gap of %u samples at sample %u\n", gap, i);
+            return false;
+        }
+        missing += (uint32_t)(gap / Recorder::bufferSamples);
+    }
+    if (count && samples[0]) {
+        printf("recsim: the recording does not start at 0\n");
+        return false;
+    }
+    if (missing != dropped) {
+        printf("recsim: %u buffers missing, %u reported dropped\n", missing, dropped);
+        return false;
+    }
+    return true;
+}
+
+static uint32_t stopAfter = 0;
+static uint32_t stopStart = 0;
+
+static bool stopTimer() {
+    return stopAfter && getTicks() - stopStart >= stopAfter;
+}
+
+/**
+ * \brief Record and check one scenario.
+ *
+ * \param expectDrops whether buffers should be dropped
+ */
+static bool scenario(const char *name,
+                     uint32_t    rate,
+                     uint32_t    blocks,
+                     uint32_t    delay,
+                     uint32_t    stall,
+                     uint32_t    stallEvery,
+                     bool        expectDrops,
+                     uint32_t    stopMs = 0) {
+
+    std::vector<uint8_t> memory(blocks * Recorder::blockSize + 16 * Recorder::blockSize);
+    MemoryStore          backing(memory.data(), memory.size());
+    SlowStore            store(backing);
+    Recorder             recorder(getTicks);
+    SyntheticSource      source(getTicks);
+
+    store.delay      = delay;
+    store.stall      = stall;
+    store.stallEvery = stallEvery;
+
+    stopAfter = stopMs;
+    stopStart = getTicks();
+
+    // Start past block 0, like a file would.
+    const uint32_t lba = 16;
+    StoreError err = recorder.record(source, rate, store, lba, blocks, stopTimer);
+
+    uint32_t written = recorder.getBlocksWritten();
+    uint32_t ms      = recorder.getElapsed() ? recorder.getElapsed() : 1;
+
+    printf("recsim: %-12s %7u samples/s: %7u samples in %5u ms (%7u samples/s), %u buffers dropped\n",
+           name, rate, recorder.getSamplesWritten(), ms,
+           (uint32_t)((uint64_t)recorder.getSamplesWritten() * 1000 / ms),
+           recorder.getDropped());
+
+    if (err) {
+        printf("recsim: write error\n");
+        return false;
+    }
+    if (stopMs ? written >= blocks : written != blocks) {
+        printf("recsim: %u of %u blocks written\n", written, blocks);
+        return false;
+    }
+    if (expectDrops != !!recorder.getDropped()) {
+        printf("recsim: %s drops\n", expectDrops ? "expected" : "unexpected");
+        return false;
+    }
+
+    const uint16_t *samples = (const uint16_t*)(memory.data() + lba * Recorder::blockSize);
+    return verify(samples, recorder.getSamplesWritten(), recorder.getDropped());
+}
+
+int main() {
+    const uint32_t bufferBlocks = Recorder::bufferBlocks;
+
+    // One buffer holds 1024 samples: 20 ms at 50000 samples/s.
+    bool ok = scenario("fast store", 200000, 64 * bufferBlocks, 0, 0, 0, false)
+           && scenario("odd length", 100000, 10 * bufferBlocks + 3, 0, 0, 0, false)
+           && scenario("short stalls", 50000, 40 * bufferBlocks, 0, 8, 8, false)
+           && scenario("long stalls", 50000, 40 * bufferBlocks, 0, 120, 8, true)
+           && scenario("slow store", 1000000, 40 * bufferBlocks, 4, 0, 0, true)
+           && scenario("stopped", 10000, 40 * bufferBlocks, 0, 0, 0, false, 500);
+
+    printf("recsim: %s\n", ok ? "passed" : "FAILED");
+    return ok ? 0 : 1;
+}
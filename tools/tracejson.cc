@@ -0,0 +1,244 @@
+/**
+ * \file
+ * \brief     Converts a trace dump to Chrome trace JSON.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Reads a console capture containing the output of `trace dump` (see
+ * src/trace.hh for the format) and writes the events as Chrome trace JSON,
+ * which chrome://tracing and Perfetto can display:
+ *
+ *   tracejson [CAPTURE] > trace.json
+ *
+ * Shell commands and SD card commands become spans, from the command to
+ * its end or response. Transmit stalls become spans ending at their record.
+ * Received characters are instant events.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+// Keep in sync with TraceEvent in src/trace.hh.
+enum TraceEvent : uint8_t {
+    TRACE_NONE = 0,
+    TRACE_CMD_START,
+    TRACE_CMD_END,
+    TRACE_SD_CMD,
+    TRACE_SD_RESP,
+    TRACE_UART_RX,
+    TRACE_UART_TX_STALL,
+};
+
+static const size_t recordSize = 12;
+
+// Timeline rows.
+static const int tidShell = 1;
+static const int tidSd    = 2;
+static const int tidUart  = 3;
+
+static void die(const char *msg) {
+    fprintf(stderr, "tracejson: %s\n", msg);
+    exit(1);
+}
+
+static int hexDigit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/// Collect the bytes between the last "trace: begin" and "trace: end" lines.
+static std::vector<uint8_t> readDump(FILE *f) {
+    std::vector<uint8_t> data;
+    bool found  = false;
+    bool inDump = false;
+    char line[1024];
+
+    while (fgets(line, sizeof(line), f)) {
+        // Terminals and capture tools may leave carriage returns or escapes before the text.
+        if (strstr(line, "trace: begin")) {
+            data.clear();
+            inDump = true;
+            continue;
+        }
+        if (strstr(line, "trace: end")) {
+            if (inDump)
+                found = true;
+            inDump = false;
+            continue;
+        }
+        if (!inDump)
+            continue;
+
+        int high = -1;
+        for (const char *p = line; *p; p++) {
+            int digit = hexDigit(*p);
+            if (digit < 0)
+                continue;
+            if (high < 0) {
+                high = digit;
+            } else {
+                data.push_back((uint8_t)(high << 4 | digit));
+                high = -1;
+            }
+        }
+    }
+
+    if (!found)
+        die("no complete trace dump found");
+
+    return data;
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static std::string jsonString(const std::string &s) {
+    std::string out = "\"";
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += (char)c;
+        } else if (c < 0x20 || c >= 0x7f) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += (char)c;
+        }
+    }
+    return out + "\"";
+}
+
+int main(int argc, char **argv) {
+    if (argc > 2) {
+        fprintf(stderr, "usage: tracejson [CAPTURE] > JSON\n");
+        return 1;
+    }
+
+    FILE *f = argc > 1 ? fopen(argv[1], "r") : stdin;
+    if (!f)
+        die("cannot open capture");
+
+    std::vector<uint8_t> data = readDump(f);
+    if (f != stdin)
+        fclose(f);
+
+    if (data.size() < 16 || memcmp(data.data(), "PTRC", 4))
+        die("not a trace dump");
+
+    uint32_t clock       = get32(&data[4]);
+    uint32_t count       = get32(&data[8]);
+    uint32_t stringCount = get32(&data[12]);
+    if (!clock || data.size() < 16 + (uint64_t)count * recordSize)
+        die("trace dump truncated");
+
+    // Command names, by address.
+    std::map<uint32_t, std::string> strings;
+    size_t offset = 16 + (size_t)count * recordSize;
+    for (uint32_t i = 0; i < stringCount; i++) {
+        if (offset + 5 > data.size() || offset + 5 + data[offset + 4] > data.size())
+            die("trace dump truncated");
+        uint8_t length = data[offset + 4];
+        strings[get32(&data[offset])] = std::string((const char*)&data[offset + 5], length);
+        offset += 5 + length;
+    }
+
+    printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    printf("{\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":\"shell\"}},\n", tidShell);
+    printf("{\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":\"sd\"}},\n",    tidSd);
+    printf("{\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":\"uart\"}}",      tidUart);
+
+    // Timestamps are unwrapped by assuming consecutive records are less
+    // than half a counter period apart.
+    uint64_t time = 0;
+    uint32_t last = 0;
+    double   cyclesPerUs = clock / 1e6;
+
+    // Open spans per row. The ring may start in the middle of a span,
+    // ends without a beginning are dropped.
+    int depth[4] = { };
+
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t *r = &data[16 + (size_t)i * recordSize];
+        uint32_t cycles = get32(r);
+        uint8_t  event  = r[4];
+        uint8_t  a      = r[5];
+        uint16_t b      = (uint16_t)(r[6] | r[7] << 8);
+        uint32_t arg    = get32(r + 8);
+
+        if (i)
+            time += (uint64_t)(int64_t)(int32_t)(cycles - last);
+        last = cycles;
+
+        double ts = (double)(int64_t)time / cyclesPerUs;
+
+        switch (event) {
+        case TRACE_CMD_START:
+        case TRACE_CMD_END: {
+            if (event == TRACE_CMD_END && !depth[tidShell])
+                break;
+            depth[tidShell] += event == TRACE_CMD_START ? 1 : -1;
+
+            auto name = strings.find(arg);
+            printf(",\n{\"ph\":\"%s\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"name\":%s}",
+                   event == TRACE_CMD_START ? "B" : "E", tidShell, ts,
+                   jsonString(name != strings.end() ? name->second : "command").c_str());
+            break;
+        }
+        case TRACE_SD_CMD:
+            depth[tidSd]++;
+            printf(",\n{\"ph\":\"B\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"name\":\"CMD%u\",\"args\":{\"arg\":%u}}",
+                   tidSd, ts, a, arg);
+            break;
+        case TRACE_SD_RESP:
+            if (!depth[tidSd])
+                break;
+            depth[tidSd]--;
+            printf(",\n{\"ph\":\"E\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"args\":{\"r1\":%u%s}}",
+                   tidSd, ts, b, b == 0xff ? ",\"timeout\":true" : "");
+            break;
+        case TRACE_UART_RX:
+            printf(",\n{\"ph\":\"i\",\"s\":\"t\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"name\":\"%s\","
+                   "\"args\":{\"port\":%u,\"char\":%u}}",
+                   tidUart, ts, arg ? "rx dropped" : "rx", a, b);
+            break;
+        case TRACE_UART_TX_STALL:
+            printf(",\n{\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"name\":\"tx stall\","
+                   "\"args\":{\"port\":%u}}",
+                   tidUart, ts - arg / cyclesPerUs, arg / cyclesPerUs, a);
+            break;
+        default:
+            fprintf(stderr, "tracejson: skipping unknown event %u\n", event);
+            break;
+        }
+    }
+
+    printf("\n]}\n");
+
+    return 0;
+}
@@ -0,0 +1,311 @@
+/**
+ * \file
+ * \brief     Host side of the rz and sz shell commands.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2016, Chris Smeele
+ *
+ * \page License
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The put and get commands type the matching rz or sz command into the
+ * shell themselves, so the device only needs to be showing a prompt.
+ *
+ * The selftest command runs both ends of a transfer on the host, connected
+ * through a pseudo-terminal, with the device end in a child process. A
+ * file is sent and echoed back, once over a clean link and once over a
+ * link that drops and damages bytes.
+ */
+
+#include "xfer.hh"
+#include "hostcon.hh"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/// A file held in memory.
+class MemoryFile : public XferFile {
+public:
+    std::vector<uint8_t> data;
+
+    XferError read(uint32_t offset, void *buffer, size_t length) {
+        if (offset > data.size() || length > data.size() - offset)
+            return XFER_ERR_IO;
+        memcpy(buffer, data.data() + offset, length);
+        return XFER_ERR_OK;
+    }
+
+    XferError write(const void *buffer, size_t length) {
+        data.insert(data.end(), (const uint8_t*)buffer, (const uint8_t*)buffer + length);
+        return XFER_ERR_OK;
+    }
+};
+
+static const char *errorString(XferError err) {
+    switch (err) {
+    case XFER_ERR_OK:        return "ok";
+    case XFER_ERR_IO:        return "I/O error";
+    case XFER_ERR_TIMEOUT:   return "timed out";
+    case XFER_ERR_CANCELLED: return "cancelled by peer";
+    case XFER_ERR_PROTOCOL:  return "protocol error";
+    }
+    return "unknown error";
+}
+
+static void printRate(const char *what, size_t bytes, uint32_t ms) {
+    if (!ms)
+        ms = 1;
+    printf("xfer: %s %zu bytes in %u ms (%llu bytes/s)\n",
+           what, bytes, ms, (unsigned long long)bytes * 1000 / ms);
+}
+
+static int put(int fd, const char *local, const char *remote) {
+    MemoryFile file;
+
+    FILE *f = fopen(local, "rb");
+    if (!f) {
+        perror(local);
+        return 1;
+    }
+    uint8_t buffer[4096];
+    size_t  n;
+    while ((n = fread(buffer, 1, sizeof(buffer), f)))
+        file.write(buffer, n);
+    fclose(f);
+
+    if (!remote) {
+        remote = strrchr(local, '/');
+        remote = remote ? remote + 1 : local;
+    }
+
+    FdConsole con(fd);
+    con.puts("\rrz ");
+    con.puts(remote);
+    con.putch('\r');
+
+    Xfer xfer(getTicks);
+    xfer.attach(con);
+
+    uint32_t  start = getTicks();
+    XferError err   = xfer.send(file, (uint32_t)file.data.size(), remote);
+    if (err) {
+        fprintf(stderr, "xfer: put: %s\n", errorString(err));
+        return 1;
+    }
+    printRate("sent", file.data.size(), getTicks() - start);
+
+    return 0;
+}
+
+static int get(int fd, const char *remote, const char *local) {
+    FdConsole con(fd);
+    con.puts("\rsz ");
+    con.puts(remote);
+    con.putch('\r');
+
+    Xfer xfer(getTicks);
+    xfer.attach(con);
+
+    char      name[Xfer::maxNameLength + 1];
+    uint32_t  size;
+    XferError err = xfer.receiveHeader(name, sizeof(name), size);
+    if (err) {
+        fprintf(stderr, "xfer: get: %s\n", errorString(err));
+        return 1;
+    }
+
+    MemoryFile file;
+    uint32_t   start = getTicks();
+    if ((err = xfer.receiveData(file, size))) {
+        fprintf(stderr, "xfer: get: %s\n", errorString(err));
+        return 1;
+    }
+    uint32_t ms = getTicks() - start;
+
+    std::string path = local ? local : name;
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f || fwrite(file.data.data(), 1, file.data.size(), f) != file.data.size()) {
+        perror(path.c_str());
+        return 1;
+    }
+    fclose(f);
+    printRate("received", file.data.size(), ms);
+    xfer.linger(size);
+
+    return 0;
+}
+
+/// The device end of the self test: receive a file and send it back.
+static int echoPeer(int fd) {
+    FdConsole  con(fd);
+    Xfer       xfer(getTicks);
+    MemoryFile file;
+    char       name[Xfer::maxNameLength + 1];
+    uint32_t   size;
+
+    xfer.attach(con);
+
+    XferError err = xfer.receiveHeader(name, sizeof(name), size);
+    if (!err)
+        err = xfer.receiveData(file, size);
+    if (!err) {
+        xfer.linger(size);
+        err = xfer.send(file, size, name);
+    }
+    if (err)
+        fprintf(stderr, "xfer: peer: %s\n", errorString(err));
+
+    return err ? 1 : 0;
+}
+
+static bool selftestPass(uint32_t kib, uint32_t errorRate) {
+    int master;
+    int slave;
+    openPty(master, slave);
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("xfer: fork");
+        exit(1);
+    }
+    if (!pid) {
+        close(master);
+        exit(echoPeer(slave));
+    }
+    close(slave);
+
+    printf("xfer: selftest, %u KiB, %u damaged bytes per million\n", kib, errorRate);
+
+    MemoryFile sent;
+    sent.data.resize(kib * 1024);
+    for (auto &byte : sent.data)
+        byte = (uint8_t)rand();
+    // Make sure the bytes that need escaping are well represented.
+    for (size_t i = 0; i < sent.data.size(); i += 97)
+        sent.data[i] = (uint8_t)"\xc0\xdb\r\n"[i % 4];
+
+    MemoryFile received;
+    char       name[Xfer::maxNameLength + 1];
+    uint32_t   size = 0;
+    uint32_t   ms   = 0;
+    uint32_t   start;
+    bool       ok   = true;
+
+    {
+        FdConsole con(master);
+        con.errorRate = errorRate;
+
+        Xfer xfer(getTicks);
+        xfer.attach(con);
+
+        start = getTicks();
+        XferError err = xfer.send(sent, (uint32_t)sent.data.size(), "TEST.BIN");
+        if (!err) {
+            printRate("sent", sent.data.size(), getTicks() - start);
+            err = xfer.receiveHeader(name, sizeof(name), size);
+        }
+        if (!err) {
+            start = getTicks();
+            err   = xfer.receiveData(received, size);
+            ms    = getTicks() - start;
+        }
+        if (err) {
+            printf("xfer: selftest: %s\n", errorString(err));
+            ok = false;
+        } else {
+            printRate("received", received.data.size(), ms);
+            xfer.linger(size);
+        }
+        printf("xfer: %u bytes damaged, %llu bytes written for %zu bytes of data\n",
+               con.errors, (unsigned long long)con.bytesOut, sent.data.size());
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    close(master);
+
+    if (ok && (strcmp(name, "TEST.BIN") || received.data != sent.data)) {
+        printf("xfer: selftest: data mismatch\n");
+        ok = false;
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status))
+        ok = false;
+
+    return ok;
+}
+
+static void usage() {
+    fprintf(stderr,
+            "usage: xfer [-b BAUD] put DEVICE FILE [REMOTE]\n"
+            "       xfer [-b BAUD] get DEVICE REMOTE [FILE]\n"
+            "       xfer [-s KIB] [-e RATE] [-r SEED] selftest\n"
+            "\n"
+            "  -b BAUD  baud rate of the serial device (default 115200)\n"
+            "  -s KIB   size of the test file (default 256)\n"
+            "  -e RATE  damaged bytes per million in the lossy test (default 100)\n"
+            "  -r SEED  random seed\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    unsigned long baud      = 115200;
+    uint32_t      kib       = 256;
+    uint32_t      errorRate = 100;
+    unsigned      seed      = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "b:s:e:r:")) != -1) {
+        switch (opt) {
+        case 'b': baud      = strtoul(optarg, nullptr, 0); break;
+        case 's': kib       = (uint32_t)strtoul(optarg, nullptr, 0); break;
+        case 'e': errorRate = (uint32_t)strtoul(optarg, nullptr, 0); break;
+        case 'r': seed      = (unsigned)strtoul(optarg, nullptr, 0); break;
+        default:  usage();
+        }
+    }
+    srand(seed);
+
+    if (optind >= argc)
+        usage();
+
+    std::string command = argv[optind++];
+    int         args    = argc - optind;
+
+    if (command == "selftest" && !args) {
+        bool ok = selftestPass(kib, 0) && selftestPass(kib, errorRate);
+        printf("xfer: selftest %s\n", ok ? "passed" : "FAILED");
+        return ok ? 0 : 1;
+
+    } else if ((command == "put" || command == "get") && args >= 2 && args <= 3) {
+        int fd = openTty(argv[optind], baudToSpeed(baud));
+        const char *file  = argv[optind + 1];
+        const char *other = args == 3 ? argv[optind + 2] : nullptr;
+        int ret = command == "put" ? put(fd, file, other) : get(fd, file, other);
+        close(fd);
+        return ret;
+    }
+
+    usage();
+}